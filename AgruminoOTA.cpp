@@ -4,14 +4,37 @@
 // OTA libraries
 #include <ESP8266WiFi.h>
 #include <ESP8266httpUpdate.h>
+#include <UpdateRollback.h>
+#include <Updater.h>
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h> 
 #include <ArduinoOTA.h>
+#include <MulticastOTA.h>
 #include <ESP8266WebServer.h>
 #include <ESP8266HTTPUpdateServer.h>
+#include <stddef.h>
+
+extern "C" {
+#include "user_interface.h"
+}
 
 #define DELAY_TIME 100
 
+// Update check scheduler
+#define UPDATE_INTERVAL_SEC (6 * 3600UL) // Between two checks that reached the server
+#define UPDATE_RETRY_SEC 60 // First retry after a failed check, doubled at every failure
+#define UPDATE_JITTER_PERCENT 10 // Spread of the checks, in percent of the delay
+#define UPDATE_SCHEDULE_MAGIC 0x45535353
+
+// Peer distribution
+#define PEER_SERVICE "agrumino-ota" // mDNS service _agrumino-ota._tcp, TXT version= and md5= of the shared sketch
+#define PEER_PATH "/firmware.bin"
+
+#ifndef AGRUMINO_OTA_SCHEDULE_RTC_OFFSET
+// RTC user memory block of the schedule, after the rollback record
+#define AGRUMINO_OTA_SCHEDULE_RTC_OFFSET (UPDATE_ROLLBACK_RTC_OFFSET + (sizeof(UpdateRollbackRecord) + 3) / 4)
+#endif
+
 /*
 AgruminoOTA library, please check readme.md file for more documentation(markdown formatted file).
 Updates require enough free space (can be checked with ESP.getFreeSketchSpace()) and a board reset after.
@@ -23,10 +46,162 @@ OTA methods are static so they can be called in two equivalent ways:
 	AgruminoOTA agruminoOTA;
 	agruminoOTA.isConnected(); //Using class instance
 	AgruminoOTA::isConnected(); //Using class name
+
+ideUpdate() and webServer() block until the user button is pressed, the same OTA types can be run from the sketch loop() with an instance:
+	agruminoOTA.beginWebServer(agrumino, host, ota_port);
+	while(agruminoOTA.loop()) { ... }
 */
 
+const uint8_t* AgruminoOTA::_publicKey = NULL;
+unsigned long AgruminoOTA::_updateInterval = UPDATE_INTERVAL_SEC;
+unsigned long AgruminoOTA::_maxBackoff = UPDATE_INTERVAL_SEC;
+
+// Schedule of the update checks kept in RTC user memory, its clock counts the RTC timer that runs during deep sleep
+typedef struct {
+	uint32_t magic;
+	uint32_t rtcTicks; // system_get_rtc_time() when the clock was last advanced
+	uint32_t clockSec; // Seconds since the schedule was created
+	uint32_t clockUs; // Fraction of the current second
+	uint32_t nextCheck; // clockSec of the next check
+	uint32_t failures; // Failed checks in a row
+	uint32_t check; // CRC32 of the fields above
+} UpdateSchedule;
+
+static UpdateSchedule schedule;
+
+// Per chip offset in [0, window), the same at every wake so the fleet stays spread out
+static uint32_t chipJitter(uint32_t window)
+{
+	return window ? (ESP.getChipId() * 2654435761UL) % window : 0;
+}
+
+static void saveSchedule()
+{
+	schedule.magic = UPDATE_SCHEDULE_MAGIC;
+	schedule.check = crc32Update(&schedule, offsetof(UpdateSchedule, check));
+	ESP.rtcUserMemoryWrite(AGRUMINO_OTA_SCHEDULE_RTC_OFFSET, (uint32_t*) &schedule, sizeof(schedule));
+}
+
+// Loads the schedule and advances its clock, a new one has its first check within the jitter window
+static void loadSchedule(uint32_t firstWindow)
+{
+	uint32_t ticks = system_get_rtc_time();
+	if(!ESP.rtcUserMemoryRead(AGRUMINO_OTA_SCHEDULE_RTC_OFFSET, (uint32_t*) &schedule, sizeof(schedule)) ||
+	   schedule.magic != UPDATE_SCHEDULE_MAGIC ||
+	   schedule.check != crc32Update(&schedule, offsetof(UpdateSchedule, check)))
+	{
+		memset(&schedule, 0, sizeof(schedule));
+		schedule.rtcTicks = ticks;
+		schedule.nextCheck = chipJitter(firstWindow);
+		saveSchedule();
+		return;
+	}
+
+	// The counter only survives deep sleep, after other resets it starts again from 0
+	uint32_t elapsed = ticks - schedule.rtcTicks;
+	if(ticks < schedule.rtcTicks && ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE)
+	{
+		elapsed = ticks;
+	}
+	uint64_t us = ((uint64_t) elapsed * system_rtc_clock_cali_proc()) >> 12; // Calibration is in us per tick, Q12
+	us += schedule.clockUs;
+	schedule.clockSec += us / 1000000;
+	schedule.clockUs = us % 1000000;
+	schedule.rtcTicks = ticks;
+}
+
+// Running sketch read from flash, served by ESP8266WebServer::streamFile()
+class SketchStream : public Stream {
+  public:
+	SketchStream() : _size(ESP.getSketchSize()), _pos(0), _block(0xffffffff) {}
+	size_t size() { return _size; }
+	String name() { return PEER_PATH; }
+	void seek(uint32_t pos) { _pos = std::min(pos, _size); }
+	int available() override { return _size - _pos; }
+	int read() override { int c = peek(); if(c >= 0) _pos++; return c; }
+	int peek() override { return (_pos < _size && load()) ? ((uint8_t*) _buf)[_pos % sizeof(_buf)] : -1; }
+	size_t readBytes(char* buffer, size_t length) override
+	{
+		size_t done = 0;
+		while(done < length && _pos < _size && load())
+		{
+			size_t n = std::min(std::min(length - done, (size_t) (_size - _pos)), sizeof(_buf) - _pos % sizeof(_buf));
+			memcpy(buffer + done, (uint8_t*) _buf + _pos % sizeof(_buf), n);
+			done += n;
+			_pos += n;
+		}
+		return done;
+	}
+	size_t write(uint8_t) override { return 0; }
+	void flush() override {}
+
+  private:
+	// Flash is read in aligned blocks, the socket asks for any length
+	boolean load()
+	{
+		uint32_t block = _pos - _pos % sizeof(_buf);
+		if(block != _block)
+		{
+			if(!ESP.flashRead(block, _buf, sizeof(_buf)))
+			{
+				return false;
+			}
+			_block = block;
+		}
+		return true;
+	}
+
+	uint32_t _buf[64];
+	uint32_t _size;
+	uint32_t _pos;
+	uint32_t _block;
+};
+
+// Compares dotted versions field by field, numbers as numbers: "1.10" is newer than "1.9"
+static int compareVersions(const char* a, const char* b)
+{
+	while(*a || *b)
+	{
+		if(isdigit(*a) && isdigit(*b))
+		{
+			char* end;
+			unsigned long x = strtoul(a, &end, 10);
+			a = end;
+			unsigned long y = strtoul(b, &end, 10);
+			b = end;
+			if(x != y)
+			{
+				return (x < y) ? -1 : 1;
+			}
+		}
+		else if(*a != *b)
+		{
+			return (unsigned char) *a - (unsigned char) *b;
+		}
+		else
+		{
+			a++;
+			b++;
+		}
+	}
+	return 0;
+}
+
 // Constructors
-AgruminoOTA::AgruminoOTA() {
+AgruminoOTA::AgruminoOTA()
+: _agrumino(NULL)
+, _mode(SERVICE_NONE)
+, _state(STATE_IDLE)
+, _waitRelease(false)
+, _rebootOnSuccess(true)
+, _idleSleep(DELAY_TIME)
+, _httpServer(NULL)
+, _httpUpdater(NULL)
+{
+}
+
+AgruminoOTA::~AgruminoOTA() {
+	end();
 }
 
 //////////////////////////
@@ -86,13 +261,23 @@ boolean AgruminoOTA::wifiConnect(const char* ssid,const char* password, int max_
  *  
  *  \param [in] agrumino Agrumino instance
  *  
- *  \details Handles safety of connected equipment
+ *  \details Handles safety of connected equipment. The board is turned on only if it is not ready yet,
+ *  so sensor setup and soil calibration done by the sketch are kept.
  */
-void AgruminoOTA::OTAModeStart(Agrumino agrumino)
+void AgruminoOTA::OTAModeStart(Agrumino& agrumino)
 {
 	// Secure safety of equipment
 	agrumino.turnWateringOff();
 	
+	if(!agrumino.isBoardReady())
+	{
+		agrumino.turnBoardOn();
+	}
+	if(!agrumino.isGpioExpanderReady())
+	{
+		return; // The led can't be driven
+	}
+	
 	// Signals start of OTA mode by blinking thrice
 	agrumino.turnLedOff();
 	for(int i=0; i<=3;i++)
@@ -104,6 +289,199 @@ void AgruminoOTA::OTAModeStart(Agrumino agrumino)
 	
 }
 
+/**
+ *  \brief Starts the trial of a new sketch, to be called first in setup()
+ *  
+ *  \param [in] timeout_ms Time given to the sketch to call confirmUpdate()
+ *  \return Returns true while the running sketch is on trial
+ *  
+ *  \details On the first boots after an update the previous sketch is copied back if confirmUpdate() is not called within timeout_ms,
+ *  or if the board resets more than 3 times or wakes from deep sleep more than 10 times before. timeout_ms counts the time the sketch
+ *  runs, summed over the wakes of the trial. Returns false for a sketch that is not on trial, so it can always be called.
+ */
+boolean AgruminoOTA::beginTrial(unsigned long timeout_ms)
+{
+	if(UpdateRollback.state() == ROLLBACK_REVERTED)
+	{
+		Serial.println("The last update was rolled back: " + UpdateRollback.rejectedMD5());
+	}
+	return UpdateRollback.begin(timeout_ms);
+}
+
+/**
+ *  \brief Confirms the new sketch works, the previous one will not be restored
+ */
+void AgruminoOTA::confirmUpdate()
+{
+	UpdateRollback.confirm();
+}
+
+/**
+ *  \brief Checks if the last update was rolled back
+ *  
+ *  \return Returns true if the previous sketch was restored because the new one did not confirm
+ */
+boolean AgruminoOTA::rolledBack()
+{
+	return UpdateRollback.state() == ROLLBACK_REVERTED;
+}
+
+/**
+ *  \brief Decides whether this wake checks for updates
+ *  
+ *  \return Returns true if httpUpdate should run now, false to skip the check on this wake
+ *  
+ *  \details Reads the schedule from RTC memory, takes a few tens of microseconds and does not use the radio.
+ *  httpUpdate() and updateCheckFailed() set the next check. The first check of a board that lost power is spread
+ *  over the first 10% of the interval by chip ID, so a fleet powered on together does not check in together.
+ */
+boolean AgruminoOTA::updateDue()
+{
+	loadSchedule(_updateInterval * UPDATE_JITTER_PERCENT / 100);
+	saveSchedule(); // Keeps the RTC ticks recent, they wrap after a few hours
+	return schedule.clockSec >= schedule.nextCheck;
+}
+
+/**
+ *  \brief Sets how often updateDue() returns true
+ *  
+ *  \param [in] interval_sec Seconds between two checks that reached the server, a per chip jitter of up to 10% is added
+ *  \param [in] max_backoff_sec Longest delay after failed checks, which start at 60 s and double at every failure
+ */
+void AgruminoOTA::setUpdateInterval(unsigned long interval_sec, unsigned long max_backoff_sec)
+{
+	_updateInterval = interval_sec;
+	_maxBackoff = max_backoff_sec;
+}
+
+/**
+ *  \brief Counts a check that did not reach the update server, the next one backs off
+ */
+void AgruminoOTA::updateCheckFailed()
+{
+	scheduleNextCheck(false, 0);
+}
+
+/**
+ *  \brief Time left before updateDue() returns true
+ *  
+ *  \return Returns the seconds to the next check, 0 if it is due
+ */
+unsigned long AgruminoOTA::nextUpdateCheck()
+{
+	loadSchedule(_updateInterval * UPDATE_JITTER_PERCENT / 100);
+	return (schedule.nextCheck > schedule.clockSec) ? schedule.nextCheck - schedule.clockSec : 0;
+}
+
+/**
+ *  \brief Sets the next check after one has been done
+ *  
+ *  \param [in] reached True if the server answered, the interval starts again, otherwise the retries back off with random jitter
+ *  \param [in] retry_after Seconds from the server Retry-After header, 0 if none. It replaces the delay, plus up to 10% of jitter
+ */
+void AgruminoOTA::scheduleNextCheck(boolean reached, unsigned long retry_after)
+{
+	uint32_t delay;
+	loadSchedule(0);
+	if(reached)
+	{
+		schedule.failures = 0;
+		delay = _updateInterval + chipJitter(_updateInterval * UPDATE_JITTER_PERCENT / 100);
+	}
+	else
+	{
+		schedule.failures++;
+		uint32_t backoff = (uint32_t) UPDATE_RETRY_SEC << std::min(schedule.failures - 1, (uint32_t) 16);
+		backoff = std::min(backoff, (uint32_t) _maxBackoff);
+		delay = backoff / 2 + RANDOM_REG32 % (backoff / 2 + 1); // Devices failing together retry apart
+	}
+	if(retry_after > 0)
+	{
+		delay = retry_after + RANDOM_REG32 % (retry_after * UPDATE_JITTER_PERCENT / 100 + 1);
+	}
+	schedule.nextCheck = schedule.clockSec + delay;
+	saveSchedule();
+	Serial.printf("Next update check in %u s (failures: %u)\n", delay, schedule.failures);
+}
+
+/**
+ *  \brief Sets the key sketches have to be signed with, for every OTA type
+ *  
+ *  \param [in] key ED25519_KEY_SIZE bytes printed by tools/ota_sign.py keygen, has to outlive the OTA services. NULL accepts unsigned sketches
+ *  
+ *  \details The image is hashed while it is written and the signature checked before the reset, an unsigned or tampered sketch is never copied
+ */
+void AgruminoOTA::setPublicKey(const uint8_t* key)
+{
+	_publicKey = key;
+	ESPhttpUpdate.setPublicKey(key);
+	ArduinoOTA.setPublicKey(key);
+	MulticastOTA.setPublicKey(key);
+}
+
+/**
+ *  \brief Reads the staged sketch back and saves the running one, called after a successful update before the reset
+ *  
+ *  \return Returns false if the staged sketch is damaged and the update has been cancelled
+ *  
+ *  \details Without space for a copy of the running sketch the update goes on without a rollback
+ */
+boolean AgruminoOTA::prepareRollback()
+{
+	return prepareRollback(Update.md5String());
+}
+
+/**
+ *  \brief Reads the staged sketch back and saves the running one, for OTA types that do not write through Update
+ *  
+ *  \param [in] md5 MD5 of the staged sketch
+ *  \return Returns false if the staged sketch is damaged and the update has been cancelled
+ */
+boolean AgruminoOTA::prepareRollback(const String& md5)
+{
+	if(UpdateRollback.prepare(md5))
+	{
+		Serial.println("Running sketch saved, the new one has to call confirmUpdate()");
+		return true;
+	}
+	Serial.println("Rollback: " + UpdateRollback.getLastErrorString());
+	return UpdateRollback.getLastError() != UPDATE_ROLLBACK_ERROR_VERIFY;
+}
+
+/**
+ *  \brief Prints the per-stage timing of the last transfer as a single JSON line
+ *  
+ *  \param [in] mode OTA type ("http", "ide", "web")
+ *  \param [in] bytes Bytes written to flash
+ *  \param [in] total Total transfer time in microseconds
+ *  \param [in] receive Time spent receiving from the socket in microseconds
+ *  \param [in] write Time spent in Update (MD5, flash erase and write) in microseconds
+ *  \param [in] callback Time spent in acks and progress callbacks in microseconds
+ *  \param [in] sectors Flash sectors erased and programmed, 0 when not measured
+ *  \param [in] stall Time spent in the writes that erased and programmed a sector in microseconds
+ *  \param [in] stall_max Longest of those writes in microseconds
+ *  
+ *  \details Lines start with {"ota": so they can be grepped out of the serial log and compared between releases
+ */
+void AgruminoOTA::printStats(const char* mode, uint32_t bytes, uint32_t total, uint32_t receive, uint32_t write, uint32_t callback, uint32_t sectors, uint32_t stall, uint32_t stall_max)
+{
+	uint32_t rate = total ? (uint32_t)((uint64_t)bytes * 1000000 / total) : 0;
+	Serial.printf("{\"ota\":\"%s\",\"bytes\":%u,\"total_us\":%u,\"receive_us\":%u,\"write_us\":%u,\"callback_us\":%u,\"sectors\":%u,\"stall_us\":%u,\"stall_max_us\":%u,\"bytes_per_s\":%u}\n",
+		mode, bytes, total, receive, write, callback, sectors, stall, stall_max, rate);
+}
+
+/**
+ *  \brief Prints the counters of the last multicast transfer as a single JSON line
+ *  
+ *  \details Recovered blocks were rebuilt from parity, the others lost were sent again after a NACK
+ */
+void AgruminoOTA::printMulticastStats()
+{
+	const mota_stats_t& stats = MulticastOTA.getStats();
+	Serial.printf("{\"ota\":\"multicast\",\"bytes\":%u,\"total_us\":%u,\"erase_us\":%u,\"blocks\":%u,\"recovered\":%u,\"duplicates\":%u,\"nacks\":%u,\"rounds\":%u}\n",
+		stats.bytes, stats.total, stats.erase, stats.blocks, stats.recovered, stats.duplicates, stats.nacks, stats.rounds);
+}
+
 //////////////////////////
 // OTA types methods    //
 /////////////////////////
@@ -119,11 +497,31 @@ void AgruminoOTA::OTAModeStart(Agrumino agrumino)
  *  
  *  \details Requires the board to be connected the a wi-fi network beforehand
  */
-void AgruminoOTA::httpUpdate(Agrumino agrumino, const char* ota_server,int ota_port,const char* ota_path,const char* ota_version_string)
+void AgruminoOTA::httpUpdate(Agrumino& agrumino, const char* ota_server,int ota_port,const char* ota_path,const char* ota_version_string)
 {
-	OTAModeStart(agrumino); // Handles safety of connected equipment
-	Serial.println("Ready to download (a board reset is required after a successful update)."); 
+	httpUpdate(agrumino, ota_server, ota_port, ota_path, ota_version_string, true);
+}
+
+/**
+ *  \brief httpUpdate(), setting the next scheduled check only if setNextCheck is true
+ *  
+ *  \details peerUpdate() does not schedule: when the download from a peer fails the sketch falls back to the WAN server,
+ *  which sets the next check, and the wake counts once.
+ */
+void AgruminoOTA::httpUpdate(Agrumino& agrumino, const char* ota_server, int ota_port, const char* ota_path, const char* ota_version_string, boolean setNextCheck)
+{
+	// Scheduled checks mostly end with a 304, OTA mode starts only when an image is sent
+	ESPhttpUpdate.onStart([&agrumino]() {
+		OTAModeStart(agrumino); // Handles safety of connected equipment
+		Serial.println("Ready to download (a board reset is required after a successful update).");
+	});
+	ESPhttpUpdate.acceptDelta(true); // The server may answer with a patch against the running sketch
+	ESPhttpUpdate.useHTTP10(false); // Chunked responses from proxies and CDNs are decoded while written
+	ESPhttpUpdate.lightCheck(true); // Sketch MD5 cached in RTC memory, If-None-Match with the ETag of the installed image
+	ESPhttpUpdate.resumeDownloads(true); // An interrupted download continues from the last flash sector on the next call
+	ESPhttpUpdate.rebootOnUpdate(false); // The board is reset below, after the running sketch has been saved for a rollback
 	t_httpUpdate_return ret = ESPhttpUpdate.update(ota_server,ota_port,ota_path,ota_version_string); // Requests update and gets result
+	ESPhttpUpdate.onStart(nullptr);
 	
 	// Server side script can respond as follows: - response code 200, and send the firmware image, - or response code 304 to notify ESP that no update is required
 	
@@ -145,6 +543,25 @@ void AgruminoOTA::httpUpdate(Agrumino agrumino, const char* ota_server,int ota_p
             Serial.print("Undefined HTTP_UPDATE Code: ");Serial.println(ret);
 
     }
+	
+	const HTTPUpdateStats& stats = ESPhttpUpdate.getStats();
+	if(stats.bytes > 0)
+	{
+		printStats("http", stats.bytes, stats.total, stats.receive, stats.write, 0);
+	}
+	
+	// Connection errors, unexpected answers like 503 and broken downloads retry with backoff, refused images wait for the next interval
+	int error = ESPhttpUpdate.getLastError();
+	boolean reached = (ret != HTTP_UPDATE_FAILED) || (error <= HTTP_UE_TOO_LESS_SPACE && error != HTTP_UE_SERVER_WRONG_HTTP_CODE);
+	if(setNextCheck)
+	{
+		scheduleNextCheck(reached, ESPhttpUpdate.getRetryAfter());
+	}
+	
+	if(ret == HTTP_UPDATE_OK && prepareRollback())
+	{
+		ESP.restart();
+	}
 }
 
 /**
@@ -157,9 +574,9 @@ void AgruminoOTA::httpUpdate(Agrumino agrumino, const char* ota_server,int ota_p
  *  
  *  \details Requires the board to be connected the a wi-fi network beforehand
  */
-void AgruminoOTA::httpUpdate(Agrumino agrumino, const char* ota_server,int ota_port,const char* ota_path) // Without optional version string
+void AgruminoOTA::httpUpdate(Agrumino& agrumino, const char* ota_server,int ota_port,const char* ota_path) // Without optional version string
 {
-	AgruminoOTA::httpUpdate(agrumino, ota_server, ota_port, "");
+	AgruminoOTA::httpUpdate(agrumino, ota_server, ota_port, ota_path, "");
 }
 
 /**
@@ -169,8 +586,160 @@ void AgruminoOTA::httpUpdate(Agrumino agrumino, const char* ota_server,int ota_p
  *  
  *  \details Requires the board to be connected the a wi-fi network beforehand
  */
-void AgruminoOTA::ideUpdate(Agrumino agrumino)
+void AgruminoOTA::ideUpdate(Agrumino& agrumino)
+{
+	AgruminoOTA service;
+	service.beginIdeUpdate(agrumino);
+	while(service.loop()) // If the user button is pressed again stops OTA mode
+	{
+	}
+}
+
+/**
+ *  \brief Handles upload of sketch using Arduino IDE or console using a password
+ *  
+ *  \param [in] agrumino Agrumino instance
+ *  \param [in] password 
+ *  
+ *  \details Requires the board to be connected the a wi-fi network beforehand.  
+ */
+void AgruminoOTA::ideUpdate(Agrumino& agrumino, const char* password) // With password
+{
+	ArduinoOTA.setPassword(password); //It is possible to reveal password entered previously in Arduino IDE, if IDE has not been closed since last upload.
+	
+	// Password can be set with it's md5 value as well
+	// ArduinoOTA.setPasswordHash(MD5(password));
+	
+	AgruminoOTA::ideUpdate(agrumino);
+	
+}
+
+/**
+ *  \brief The board will host a web server where the upload of a binary file is possible
+ *  
+ *  \param [in] agrumino Agrumino instance
+ *  \param [in] host Decides the url
+ *  \param [in] ota_port
+ *  
+ *  \details Requires the board to be connected the a wi-fi network beforehand. 
+ */
+void AgruminoOTA::webServer(Agrumino& agrumino, const char* host, int ota_port) 
+{
+	AgruminoOTA service;
+	service.beginWebServer(agrumino, host, ota_port);
+	while(service.loop()) // If the user button is pressed again stops OTA mode
+	{
+	}
+}
+
+/**
+ *  \brief Receives a sketch multicast to every board on the LAN at once
+ *  
+ *  \param [in] agrumino Agrumino instance
+ *  
+ *  \details Requires the board to be connected the a wi-fi network beforehand. Blocks until the user button is pressed
+ */
+void AgruminoOTA::multicastUpdate(Agrumino& agrumino)
+{
+	AgruminoOTA service;
+	service.beginMulticast(agrumino);
+	while(service.loop()) // If the user button is pressed again stops OTA mode
+	{
+	}
+}
+
+/**
+ *  \brief Downloads the sketch from a board on the same LAN that runs a newer version
+ *  
+ *  \param [in] agrumino Agrumino instance
+ *  \param [in] ota_version_string Version of the running sketch, compared with the one announced by the peers
+ *  \return Returns false if no peer has a newer sketch or the download failed, the board is reset after a successful update
+ *  
+ *  \details Boards sharing their sketch with peerServer() are found with mDNS, which takes one second. Any device can announce
+ *  the service, so it requires setPublicKey(): the peer sends the signature its sketch was installed with. The sketch is checked
+ *  like in httpUpdate() (MD5, signature, rollback), a sketch that was rolled back is not downloaded again. The next scheduled
+ *  check is not set, when it returns false the sketch falls back to httpUpdate() with the WAN server, or calls
+ *  updateCheckFailed() if it has none.
+ */
+boolean AgruminoOTA::peerUpdate(Agrumino& agrumino, const char* ota_version_string)
+{
+	if(!_publicKey) // Any device on the LAN can announce the service
+	{
+		Serial.println("Peer updates need a public key, see setPublicKey()");
+		return false;
+	}
+	
+	char tmp[16];
+	sprintf(tmp,"Agrumino-%06x", ESP.getChipId());
+	MDNS.begin(tmp);
+	
+	String sketchMD5 = ESP.getSketchMD5();
+	String rejected = UpdateRollback.rejectedMD5();
+	String newest = ota_version_string;
+	int peer = -1;
+	int peers = MDNS.queryService(PEER_SERVICE, "tcp");
+	for(int i = 0; i < peers; i++)
+	{
+		String version = MDNS.txt(i, "version");
+		String md5 = MDNS.txt(i, "md5");
+		if(version.length() == 0 || md5.length() != 32 || md5.equalsIgnoreCase(sketchMD5) || md5.equalsIgnoreCase(rejected))
+		{
+			continue;
+		}
+		if(compareVersions(version.c_str(), newest.c_str()) > 0) // Peers running older versions are never followed
+		{
+			newest = version;
+			peer = i;
+		}
+	}
+	if(peer < 0)
+	{
+		Serial.printf("No peer runs a newer sketch (%d found)\n", peers);
+		return false;
+	}
+	
+	Serial.println("Downloading version " + newest + " from " + MDNS.hostname(peer) + " (" + MDNS.IP(peer).toString() + ")");
+	httpUpdate(agrumino, MDNS.IP(peer).toString().c_str(), MDNS.port(peer), PEER_PATH, ota_version_string, false); // The WAN check schedules
+	return false; // Reached only if the update did not succeed
+}
+
+/**
+ *  \brief The board shares its sketch with the other boards on the LAN until the user button is pressed
+ *  
+ *  \param [in] agrumino Agrumino instance
+ *  \param [in] host mDNS host name
+ *  \param [in] ota_port
+ *  \param [in] ota_version_string Version of the running sketch, announced to the peers
+ *  
+ *  \details Requires the board to be connected the a wi-fi network beforehand
+ */
+void AgruminoOTA::peerServer(Agrumino& agrumino, const char* host, int ota_port, const char* ota_version_string)
 {
+	AgruminoOTA service;
+	if(!service.beginPeerServer(agrumino, host, ota_port, ota_version_string))
+	{
+		return;
+	}
+	while(service.loop()) // If the user button is pressed again stops sharing
+	{
+	}
+}
+
+//////////////////////////
+// OTA service methods  //
+/////////////////////////
+
+/**
+ *  \brief Starts the Arduino IDE OTA service without blocking, loop() has to be called afterwards
+ *  
+ *  \param [in] agrumino Agrumino instance, borrowed until end()
+ *  
+ *  \details Requires the board to be connected the a wi-fi network beforehand
+ */
+void AgruminoOTA::beginIdeUpdate(Agrumino& agrumino)
+{
+	end();
+	_agrumino = &agrumino;
 	OTAModeStart(agrumino); // Handles safety of connected equipment
 	
 	// Port defaults to 8266
@@ -183,7 +752,10 @@ void AgruminoOTA::ideUpdate(Agrumino agrumino)
 
 	// In Arduino IDE (you may need to restart the IDE first) the board will appear  as Agrumino-[ChipID] in Tools -> Port -> Network ports
 	
-	ArduinoOTA.onStart([]() {
+	ArduinoOTA.setRebootOnSuccess(_rebootOnSuccess);
+	
+	ArduinoOTA.onStart([this]() {
+		_state = STATE_RECEIVING;
 		String type;
 		if (ArduinoOTA.getCommand() == U_FLASH)
 		type = "sketch";
@@ -194,92 +766,395 @@ void AgruminoOTA::ideUpdate(Agrumino agrumino)
 		Serial.println("Start updating " + type);
 	});
 	
-	ArduinoOTA.onEnd([]() {
+	ArduinoOTA.onEnd([this]() {
+		_state = (ArduinoOTA.getCommand() != U_FLASH || prepareRollback()) ? STATE_DONE : STATE_FAILED;
 		Serial.println("\nEnd (Board reset required)");
+		const ota_stats_t& stats = ArduinoOTA.getStats();
+		printStats("ide", stats.bytes, stats.total, stats.receive, stats.write, stats.callback, stats.sectors, stats.stall, stats.stall_max);
 	});
 	
-	ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+	ArduinoOTA.onProgress([this](unsigned int progress, unsigned int total) {
+		if (progress >= total) _state = STATE_VERIFYING; // MD5 is checked by Update.end()
 		Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
 	});
 	
-	ArduinoOTA.onError([](ota_error_t error) {
+	ArduinoOTA.onError([this](ota_error_t error) {
+		_state = STATE_FAILED;
 		Serial.printf("Error[%u]: ", error);
 		if (error == OTA_AUTH_ERROR) Serial.println("Auth Failed");
 		else if (error == OTA_BEGIN_ERROR) Serial.println("Begin Failed");
 		else if (error == OTA_CONNECT_ERROR) Serial.println("Connect Failed");
 		else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
 		else if (error == OTA_END_ERROR) Serial.println("End Failed");
+		else if (error == OTA_SIGNATURE_ERROR) Serial.println("Signature Failed");
+		const ota_stats_t& stats = ArduinoOTA.getStats();
+		if (stats.bytes > 0) printStats("ide", stats.bytes, stats.total, stats.receive, stats.write, stats.callback, stats.sectors, stats.stall, stats.stall_max);
 	});
 	
 	ArduinoOTA.begin();
+	arm(SERVICE_IDE);
 	Serial.println("Ready, release the user button to proceed, press it again to stop OTA functionality (a board reset is required  after a successful update)");
 	Serial.print("IP address: ");
 	Serial.println(WiFi.localIP());
-	while(agrumino.isButtonPressed()) // Waits release of user button to start
-	{
-		delay(DELAY_TIME);
-	}
-	while(!agrumino.isButtonPressed()) // If the user button is pressed again stops OTA mode
-	{
-		ArduinoOTA.handle();
-		delay(DELAY_TIME);
-	}
 }
 
 /**
- *  \brief Handles upload of sketch using Arduino IDE or console using a password
+ *  \brief Starts the Arduino IDE OTA service using a password without blocking, loop() has to be called afterwards
  *  
  *  \param [in] agrumino Agrumino instance
  *  \param [in] password 
  *  
- *  \details Requires the board to be connected the a wi-fi network beforehand.  
+ *  \details Requires the board to be connected the a wi-fi network beforehand
  */
-void AgruminoOTA::ideUpdate(Agrumino agrumino, const char* password) // With password
+void AgruminoOTA::beginIdeUpdate(Agrumino& agrumino, const char* password)
 {
-	ArduinoOTA.setPassword(password); //It is possible to reveal password entered previously in Arduino IDE, if IDE has not been closed since last upload.
-	
-	// Password can be set with it's md5 value as well
-	// ArduinoOTA.setPasswordHash(MD5(password));
-	
-	AgruminoOTA::ideUpdate(agrumino);
-	
+	ArduinoOTA.setPassword(password);
+	beginIdeUpdate(agrumino);
 }
 
 /**
- *  \brief The board will host a web server where the upload of a binary file is possible
+ *  \brief Starts the web browser OTA service without blocking, loop() has to be called afterwards
  *  
- *  \param [in] agrumino Agrumino instance
+ *  \param [in] agrumino Agrumino instance, borrowed until end()
  *  \param [in] host Decides the url
  *  \param [in] ota_port
  *  
- *  \details Requires the board to be connected the a wi-fi network beforehand. 
+ *  \details Requires the board to be connected the a wi-fi network beforehand
  */
-void AgruminoOTA::webServer(Agrumino agrumino, const char* host, int ota_port) 
+void AgruminoOTA::beginWebServer(Agrumino& agrumino, const char* host, int ota_port)
 {
+	end();
+	_agrumino = &agrumino;
 	OTAModeStart(agrumino); // Handles safety of connected equipment
 	
-	ESP8266WebServer httpServer(ota_port);
-	ESP8266HTTPUpdateServer httpUpdater;
+	_httpServer = new ESP8266WebServer(ota_port);
+	_httpUpdater = new ESP8266HTTPUpdateServer(true); // Serial output also prints the per-stage timing of the upload
 	
 	MDNS.begin(host);
 	
-	httpUpdater.setup(&httpServer);
-	httpServer.begin();
+	_httpUpdater->setRebootOnSuccess(_rebootOnSuccess);
+	_httpUpdater->setPublicKey(_publicKey);
+	_httpUpdater->onStart([this]() { _state = STATE_RECEIVING; });
+	_httpUpdater->onEnd([this]() { _state = prepareRollback() ? STATE_DONE : STATE_FAILED; });
+	_httpUpdater->onError([this](const String& error) {
+		_state = STATE_FAILED;
+		Serial.println("Update failed: " + error);
+	});
+	_httpUpdater->setup(_httpServer);
+	_httpServer->begin();
 	MDNS.addService("http", "tcp", ota_port);
+	arm(SERVICE_WEB);
 	Serial.printf("HTTPUpdateServer ready! Open http://%s.local/update in your browser\n", host);
 	Serial.println("Alternatively you can use http://" + WiFi.localIP().toString() + ":" + String(ota_port) +  "/update");
 	// If the url does not work, try replacing it with module’s IP address. 
 	Serial.println("Ready, release the user button to proceed, press it again to stop OTA functionality (a board reset is required after a successful update)");
-	while(agrumino.isButtonPressed()) // Waits release of user button to start
+}
+
+/**
+ *  \brief Starts the multicast OTA service without blocking, loop() has to be called afterwards
+ *  
+ *  \param [in] agrumino Agrumino instance, borrowed until end()
+ *  
+ *  \details Joins the group of tools/ota_multicast.py. Lost blocks are rebuilt from the parity blocks or sent again
+ *  after a NACK, then the sketch is checked (MD5, signature) and saved for a rollback like in the other types.
+ *  Requires the board to be connected the a wi-fi network beforehand
+ */
+void AgruminoOTA::beginMulticast(Agrumino& agrumino)
+{
+	end();
+	_agrumino = &agrumino;
+	OTAModeStart(agrumino); // Handles safety of connected equipment
+	
+	WiFi.setSleepMode(WIFI_NONE_SLEEP); // A sleeping station misses part of the multicast frames
+	MulticastOTA.setRebootOnSuccess(_rebootOnSuccess);
+	MulticastOTA.setPublicKey(_publicKey);
+	
+	MulticastOTA.onStart([this]() {
+		_state = STATE_RECEIVING;
+		Serial.println("Receiving sketch " + MulticastOTA.getMD5());
+	});
+	
+	MulticastOTA.onProgress([this](unsigned int progress, unsigned int total) {
+		if (progress >= total) _state = STATE_VERIFYING;
+		Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+	});
+	
+	MulticastOTA.onEnd([this]() {
+		_state = prepareRollback(MulticastOTA.getMD5()) ? STATE_DONE : STATE_FAILED;
+		Serial.println("\nEnd (Board reset required)");
+		printMulticastStats();
+	});
+	
+	MulticastOTA.onError([this](mota_error_t error) {
+		_state = STATE_FAILED;
+		Serial.printf("Error[%u]: ", error);
+		if (error == MOTA_BEGIN_ERROR) Serial.println("Begin Failed");
+		else if (error == MOTA_RECEIVE_ERROR) Serial.println("Receive Failed");
+		else if (error == MOTA_VERIFY_ERROR) Serial.println("Verify Failed");
+		else if (error == MOTA_FLASH_ERROR) Serial.println("Flash Failed");
+		else if (error == MOTA_SIGNATURE_ERROR) Serial.println("Signature Failed");
+		else if (error == MOTA_IMAGE_ERROR) Serial.println("Image Rejected");
+		printMulticastStats();
+	});
+	
+	if(!MulticastOTA.begin())
 	{
-		delay(DELAY_TIME);
+		Serial.println("Multicast group could not be joined");
 	}
-	while(!agrumino.isButtonPressed()) // If the user button is pressed again stops OTA mode
+	arm(SERVICE_MULTICAST);
+	Serial.println("Ready, release the user button to proceed, press it again to stop OTA functionality (a board reset is required after a successful update)");
+	Serial.print("IP address: ");
+	Serial.println(WiFi.localIP());
+}
+
+/**
+ *  \brief Shares the running sketch with the boards on the LAN without blocking, loop() has to be called afterwards
+ *  
+ *  \param [in] agrumino Agrumino instance, borrowed until end()
+ *  \param [in] host mDNS host name
+ *  \param [in] ota_port
+ *  \param [in] ota_version_string Version of the running sketch, announced to the peers
+ *  \return Returns false if the running sketch is still on trial, it is shared once confirmUpdate() has been called
+ *  
+ *  \details The sketch is announced with mDNS (version and MD5) and sent from flash to peerUpdate() on GET /firmware.bin,
+ *  resumed downloads included, with the signature it was installed with. The session stays in STATE_ARMED. Requires the board to be connected the a wi-fi network beforehand
+ */
+boolean AgruminoOTA::beginPeerServer(Agrumino& agrumino, const char* host, int ota_port, const char* ota_version_string)
+{
+	end();
+	if(UpdateRollback.state() == ROLLBACK_TRIAL)
 	{
-		httpServer.handleClient();
-		delay(DELAY_TIME);
+		Serial.println("The running sketch is on trial, it can't be shared yet");
+		return false;
 	}
+	_agrumino = &agrumino;
+	
+	const char* headers[] = { "If-None-Match", "Range", "x-ESP8266-sketch-md5" };
+	_httpServer = new ESP8266WebServer(ota_port);
+	_httpServer->collectHeaders(headers, sizeof(headers) / sizeof(headers[0]));
+	_httpServer->on(PEER_PATH, HTTP_GET, [this]() { sendSketch(); });
+	_httpServer->begin();
+	
+	MDNS.begin(host);
+	MDNS.addService(PEER_SERVICE, "tcp", ota_port); // mDNS services can't be removed, a second begin updates the port and TXT records
+	MDNS.addServiceTxt(PEER_SERVICE, "tcp", "version", ota_version_string);
+	MDNS.addServiceTxt(PEER_SERVICE, "tcp", "md5", ESP.getSketchMD5());
+	arm(SERVICE_PEER);
+	Serial.printf("Sharing version %s on http://%s:%d%s\n", ota_version_string, WiFi.localIP().toString().c_str(), ota_port, PEER_PATH);
+	return true;
 }
 
+/**
+ *  \brief Runs the OTA service once without sleeping
+ *  
+ *  \return Returns the session state, STATE_IDLE if the service is not running or has been stopped by the user button
+ *  
+ *  \details Returns in a few microseconds when nothing is pending, so it can share the sketch loop() with sensor sampling.
+ *  The user button stops the service once it has been released after begin.
+ */
+AgruminoOTA::State AgruminoOTA::poll()
+{
+	if(_mode == SERVICE_NONE)
+	{
+		return STATE_IDLE;
+	}
+	
+	if(_waitRelease) // Waits release of user button before accepting a stop request
+	{
+		_waitRelease = _agrumino->isButtonPressed();
+	}
+	else if(_agrumino->isButtonPressed()) // If the user button is pressed again stops OTA mode
+	{
+		end();
+		return STATE_IDLE;
+	}
+	
+	service();
+	return _state;
+}
+
+/**
+ *  \brief Runs the OTA service, to be called repeatedly from the sketch loop()
+ *  
+ *  \return Returns false when the service is not running or has been stopped by the user button
+ *  
+ *  \details Requests are handled as soon as they arrive, the method sleeps for at most the idle sleep time (100 ms by default)
+ *  and only while no socket has pending data.
+ */
+boolean AgruminoOTA::loop()
+{
+	if(poll() == STATE_IDLE)
+	{
+		return false;
+	}
+	
+	unsigned long start = millis();
+	while(!isPending() && millis() - start < _idleSleep)
+	{
+		delay(1);
+	}
+	return true;
+}
+
+/**
+ *  \brief Stops the OTA service started by beginIdeUpdate or beginWebServer
+ */
+void AgruminoOTA::end()
+{
+	if(_mode == SERVICE_IDE)
+	{
+		ArduinoOTA.end();
+		ArduinoOTA.onStart(NULL);
+		ArduinoOTA.onEnd(NULL);
+		ArduinoOTA.onProgress(NULL);
+		ArduinoOTA.onError(NULL);
+	}
+	if(_mode == SERVICE_MULTICAST)
+	{
+		MulticastOTA.end();
+		MulticastOTA.onStart(NULL);
+		MulticastOTA.onEnd(NULL);
+		MulticastOTA.onProgress(NULL);
+		MulticastOTA.onError(NULL);
+	}
+	if(_httpServer)
+	{
+		_httpServer->stop();
+		delete _httpServer;
+		_httpServer = NULL;
+	}
+	if(_httpUpdater)
+	{
+		delete _httpUpdater;
+		_httpUpdater = NULL;
+	}
+	_mode = SERVICE_NONE;
+	_state = STATE_IDLE;
+	_agrumino = NULL;
+}
+
+/**
+ *  \brief Returns the session state without running the service
+ */
+AgruminoOTA::State AgruminoOTA::getState()
+{
+	return _state;
+}
+
+/**
+ *  \brief Sets the maximum time loop() sleeps when no socket has pending data
+ *  
+ *  \param [in] ms Sleep time in milliseconds, 0 never sleeps (the sketch handles its own timing)
+ */
+void AgruminoOTA::setIdleSleep(unsigned long ms)
+{
+	_idleSleep = ms;
+}
 
+/**
+ *  \brief Sets if the board resets itself after a successful update
+ *  
+ *  \param [in] reboot Default true, if false the session stays in STATE_DONE until the sketch resets the board
+ *  
+ *  \details Applies to the next beginIdeUpdate or beginWebServer call
+ */
+void AgruminoOTA::setRebootOnSuccess(boolean reboot)
+{
+	_rebootOnSuccess = reboot;
+}
 
+/**
+ *  \brief Marks the session as waiting for an update
+ *  
+ *  \param [in] mode Running OTA type
+ */
+void AgruminoOTA::arm(ServiceMode mode)
+{
+	_mode = mode;
+	_state = STATE_ARMED;
+	_waitRelease = true;
+}
+
+/**
+ *  \brief Handles pending requests of the running OTA type
+ */
+void AgruminoOTA::service()
+{
+	if(_mode == SERVICE_IDE)
+	{
+		ArduinoOTA.handle();
+	}
+	else if(_mode == SERVICE_MULTICAST)
+	{
+		MulticastOTA.handle();
+	}
+	else if(_mode == SERVICE_WEB || _mode == SERVICE_PEER)
+	{
+		_httpServer->handleClient();
+	}
+}
+
+/**
+ *  \brief Checks if the running OTA type has data waiting to be handled
+ *  
+ *  \return Returns true if service() has work to do
+ */
+boolean AgruminoOTA::isPending()
+{
+	if(_mode == SERVICE_IDE)
+	{
+		return ArduinoOTA.isUpdatePending();
+	}
+	if(_mode == SERVICE_MULTICAST)
+	{
+		return MulticastOTA.isUpdatePending();
+	}
+	if(_mode == SERVICE_WEB || _mode == SERVICE_PEER)
+	{
+		return _httpServer->hasPendingClient();
+	}
+	return false;
+}
+
+/**
+ *  \brief Answers a peer asking for the running sketch, with the headers httpUpdate() expects from a server
+ */
+void AgruminoOTA::sendSketch()
+{
+	String md5 = ESP.getSketchMD5(); // Computed once, then cached by the core
+	String etag = "\"" + md5 + "\"";
+	_httpServer->sendHeader("ETag", etag);
+	if(_httpServer->header("If-None-Match") == etag || _httpServer->header("x-ESP8266-sketch-md5").equalsIgnoreCase(md5))
+	{
+		_httpServer->send(304);
+		return;
+	}
+	
+	SketchStream sketch;
+	uint32_t start = 0;
+	_httpServer->sendHeader("x-MD5", md5);
+	String signature = UpdateRollback.installedSignature(); // Saved when the sketch was installed, a serial upload has none
+	if(signature.length() > 0)
+	{
+		_httpServer->sendHeader("x-Signature", signature);
+	}
+	if(sscanf(_httpServer->header("Range").c_str(), "bytes=%u-", &start) == 1 && start > 0) // Resumed download
+	{
+		if(start >= sketch.size())
+		{
+			_httpServer->sendHeader("Content-Range", "bytes */" + String(sketch.size()));
+			_httpServer->send(416);
+			return;
+		}
+		sketch.seek(start);
+		_httpServer->sendHeader("Content-Range", "bytes " + String(start) + "-" + String(sketch.size() - 1) + "/" + String(sketch.size()));
+		_httpServer->setContentLength(sketch.size() - start);
+		_httpServer->send(206, "application/octet-stream", "");
+		_httpServer->client().write(sketch);
+	}
+	else
+	{
+		_httpServer->streamFile(sketch, "application/octet-stream");
+	}
+	Serial.println("Sketch sent to " + _httpServer->client().remoteIP().toString() + " from byte " + String(start));
+}
@@ -4,25 +4,95 @@
 #include "Arduino.h"
 #include "Agrumino.h"
 
+class ESP8266WebServer;
+class ESP8266HTTPUpdateServer;
+
 class AgruminoOTA {
-	
+
   public:
+	// OTA session states
+	enum State {
+		STATE_IDLE,      // No OTA type running
+		STATE_ARMED,     // Waiting for an update
+		STATE_RECEIVING, // Receiving the new sketch
+		STATE_VERIFYING, // All bytes received, checking the image
+		STATE_DONE,      // Update successful, a board reset is required
+		STATE_FAILED     // Last update failed, still waiting for a new one
+	};
+
 	// Constructors
     AgruminoOTA();
-	
+    ~AgruminoOTA();
+
 	// OTA types, requires wifi connection
-	static void httpUpdate(Agrumino agrumino, const char* ota_server,int ota_port,const char* ota_path,const char* ota_version_string);
-	static void httpUpdate(Agrumino agrumino, const char* ota_server,int ota_port,const char* ota_path);
-	static void ideUpdate(Agrumino agrumino);
-	static void ideUpdate(Agrumino agrumino, const char* password);
-	static void webServer(Agrumino agrumino,const char* host, int ota_port);
-	
+	static void httpUpdate(Agrumino& agrumino, const char* ota_server,int ota_port,const char* ota_path,const char* ota_version_string);
+	static void httpUpdate(Agrumino& agrumino, const char* ota_server,int ota_port,const char* ota_path);
+	static void ideUpdate(Agrumino& agrumino);
+	static void ideUpdate(Agrumino& agrumino, const char* password);
+	static void webServer(Agrumino& agrumino,const char* host, int ota_port);
+	static boolean peerUpdate(Agrumino& agrumino, const char* ota_version_string); // Downloads a newer sketch from a board on the LAN, false if none has it or no key is set
+	static void peerServer(Agrumino& agrumino, const char* host, int ota_port, const char* ota_version_string);
+	static void multicastUpdate(Agrumino& agrumino); // Receives the sketch multicast by tools/ota_multicast.py
+
+	// OTA service, non-blocking versions of ideUpdate and webServer to be run from the sketch loop()
+	void beginIdeUpdate(Agrumino& agrumino);
+	void beginIdeUpdate(Agrumino& agrumino, const char* password);
+	void beginWebServer(Agrumino& agrumino, const char* host, int ota_port);
+	void beginMulticast(Agrumino& agrumino);
+	boolean beginPeerServer(Agrumino& agrumino, const char* host, int ota_port, const char* ota_version_string); // Shares the running sketch with the boards on the LAN
+	State poll(); // Runs the service once without sleeping
+	boolean loop(); // Returns false once the service has been stopped by the user button
+	void end();
+	State getState();
+	void setIdleSleep(unsigned long ms); // Max sleep inside loop() when no socket has pending data, 0 to never sleep
+	void setRebootOnSuccess(boolean reboot); // Default true, if false the sketch decides when to reset after STATE_DONE
+
 	// Support methods
 	static boolean wifiConnect(const char* ssid,const char* password);
 	static boolean wifiConnect(const char* ssid,const char* password, int max_tries);
 	static boolean isConnected();
-	static void OTAModeStart(Agrumino agrumino); // Handles safety in OTA mode
-	
+	static void OTAModeStart(Agrumino& agrumino); // Handles safety in OTA mode
+
+	// Rollback of a new sketch that does not confirm it works
+	static boolean beginTrial(unsigned long timeout_ms); // Call first in setup(), returns true while the new sketch is on trial
+	static void confirmUpdate(); // The new sketch works, ends the trial
+	static boolean rolledBack(); // Returns true if the last update was rolled back
+
+	// Update check scheduler, kept in RTC memory across deep sleep
+	static boolean updateDue(); // Returns true if httpUpdate should run on this wake, false to skip it without turning the radio on
+	static void setUpdateInterval(unsigned long interval_sec, unsigned long max_backoff_sec); // Default 6 hours, retries back off up to max_backoff_sec
+	static void updateCheckFailed(); // Counts a check that did not reach the server, e.g. no wi-fi
+	static unsigned long nextUpdateCheck(); // Seconds to the next check, 0 if due
+
+	// Signed sketches
+	static void setPublicKey(const uint8_t* key); // Only sketches signed with this Ed25519 key are installed, NULL accepts unsigned ones
+
+  private:
+	enum ServiceMode { SERVICE_NONE, SERVICE_IDE, SERVICE_WEB, SERVICE_PEER, SERVICE_MULTICAST };
+
+	void arm(ServiceMode mode);
+	void service();
+	boolean isPending();
+	void sendSketch();
+	static void httpUpdate(Agrumino& agrumino, const char* ota_server, int ota_port, const char* ota_path, const char* ota_version_string, boolean setNextCheck);
+	static boolean prepareRollback();
+	static boolean prepareRollback(const String& md5);
+	static void scheduleNextCheck(boolean reached, unsigned long retry_after);
+	static void printMulticastStats();
+	static void printStats(const char* mode, uint32_t bytes, uint32_t total, uint32_t receive, uint32_t write, uint32_t callback, uint32_t sectors = 0, uint32_t stall = 0, uint32_t stall_max = 0);
+
+	Agrumino* _agrumino; // Borrowed from the sketch, must outlive the session
+	ServiceMode _mode;
+	volatile State _state;
+	boolean _waitRelease;
+	boolean _rebootOnSuccess;
+	unsigned long _idleSleep;
+	ESP8266WebServer* _httpServer;
+	ESP8266HTTPUpdateServer* _httpUpdater;
+	static const uint8_t* _publicKey;
+	static unsigned long _updateInterval;
+	static unsigned long _maxBackoff;
+
 };
 
 #endif
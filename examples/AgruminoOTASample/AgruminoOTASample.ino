@@ -4,7 +4,7 @@
 #define SLEEP_TIME_SEC 2
 #define PIN_BTN_S1       4
 #define WI_FI_FAILED_TRIES_MAX 4
-#define OTA_TYPE 1 //1 HTTP update, 2 web browser, 3 IDE update, 4 IDE update with password
+#define OTA_TYPE 1 //1 HTTP update, 2 web browser, 3 IDE update, 4 IDE update with password, 5 share the sketch with the boards on the LAN, 6 multicast update
 
 Agrumino agrumino;
 
@@ -38,6 +38,8 @@ boolean lastIsPressed = false;
 void setup(void) 
 {
   Serial.begin(115200);
+  AgruminoOTA::beginTrial(60000); // After an update the previous sketch is restored if this one does not confirm within 60 s
+  AgruminoOTA::setUpdateInterval(6 * 3600UL, 3600UL); // Checks the HTTP server every 6 hours, failed checks retry within the hour
   agrumino.setup();
 }
 
@@ -90,6 +92,24 @@ void loop(void)
   Serial.println("batteryLevel :     " + String(batteryLevel) + "%");
   Serial.println("");
 
+  AgruminoOTA::confirmUpdate(); // Sensors read, the new sketch works
+
+  // Scheduled check on the HTTP server, most wakes skip it without turning the radio on
+  if(OTA_TYPE == 1 && !pressionFlag && AgruminoOTA::updateDue())
+  {
+    if(AgruminoOTA::wifiConnect(ssid,network_password,WI_FI_FAILED_TRIES_MAX))
+    {
+      if(!AgruminoOTA::peerUpdate(agrumino,ota_version_string)) // A board on the LAN may already have the new sketch
+      {
+        AgruminoOTA::httpUpdate(agrumino,ota_server,ota_port,ota_path,ota_version_string); // Sets the next check, honouring the server Retry-After, peerUpdate() does not
+      }
+    }
+    else
+    {
+      AgruminoOTA::updateCheckFailed(); // Retries back off
+    }
+  }
+
   if (isButtonPressed) 
   {
     agrumino.turnWateringOn();
@@ -171,6 +191,14 @@ void updateSketch()
         Serial.println("OTA type: IDE update with password"); // ArduinoIDE update using password
         AgruminoOTA::ideUpdate(agrumino,ide_password);
         break;
+      case 5:
+        Serial.println("OTA type: LAN peers"); // The other boards on the LAN download this sketch from the board instead of the HTTP server
+        AgruminoOTA::peerServer(agrumino,host,ota_port,ota_version_string);
+        break;
+      case 6:
+        Serial.println("OTA type: Multicast update"); // Every board in this mode receives the sketch sent once by tools/ota_multicast.py
+        AgruminoOTA::multicastUpdate(agrumino);
+        break;
       default:
         Serial.println("Unidentified OTA type");
     }
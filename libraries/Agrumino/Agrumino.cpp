@@ -45,6 +45,12 @@
 #define BATTERY_VOLT_DIVIDER_Z1      1800 // Value of the Z1(R25) resistor in the Voltage divider used for read the batt voltage.
 #define BATTERY_VOLT_DIVIDER_Z2       424 // 470 (Original) // Value of the Z2(R26) resistor. Adjusted considering the ADC internal resistance.
 #define BATTERY_VOLT_SAMPLES           20 // Number of reading needed to calculate the battery voltage
+// Initialized ICs flags
+#define INIT_GPIO_EXPANDER          0x01
+#define INIT_TEMP_SENSOR            0x02
+#define INIT_SOIL_SENSOR            0x04
+#define INIT_LUX_SENSOR             0x08
+#define INIT_ALL                    0x0F
 
 ///////////////
 // Variables //
@@ -53,14 +59,16 @@
 MCP9800 mcpTempSensor;
 PCA9536 pcaGpioExpander;
 MCP3221 mcpSoilSensor(I2C_ADDR_SOIL);
-unsigned int _soilRawAir;
-unsigned int _soilRawWater;
 
 /////////////////
 // Constructor //
 /////////////////
 
 Agrumino::Agrumino() {
+  // Calibration is kept across turnBoardOff()/turnBoardOn()
+  _soilRawAir = DEFAULT_SOIL_RAW_AIR;
+  _soilRawWater = DEFAULT_SOIL_RAW_WATER;
+  _initializedICs = 0;
 }
 
 void Agrumino::setup() {
@@ -108,10 +116,35 @@ void Agrumino::turnBoardOn() {
     delay(5); // Ensure that the ICs are booted up properly
     initBoard();
     checkBattery();
+  } else if (_initializedICs == 0) {
+    // Board turned on by another Agrumino instance or before setup(), ICs not initialized yet
+    initBoard();
   }
 }
+
 void Agrumino::turnBoardOff() {
   digitalWrite(PIN_MOSFET, LOW);
+  _initializedICs = 0;
+}
+
+boolean Agrumino::isBoardReady() {
+  return isBoardOn() && _initializedICs == INIT_ALL;
+}
+
+boolean Agrumino::isGpioExpanderReady() {
+  return isBoardOn() && (_initializedICs & INIT_GPIO_EXPANDER);
+}
+
+boolean Agrumino::isTempSensorReady() {
+  return isBoardOn() && (_initializedICs & INIT_TEMP_SENSOR);
+}
+
+boolean Agrumino::isSoilSensorReady() {
+  return isBoardOn() && (_initializedICs & INIT_SOIL_SENSOR);
+}
+
+boolean Agrumino::isLuxSensorReady() {
+  return isBoardOn() && (_initializedICs & INIT_LUX_SENSOR);
 }
 
 void Agrumino::turnWateringOn() {
@@ -221,8 +254,10 @@ void Agrumino::initGpioExpander() {
     pcaGpioExpander.reset();
     pcaGpioExpander.setMode(IO_PCA9536_LED, IO_OUTPUT); // Back green LED
     pcaGpioExpander.setState(IO_PCA9536_LED, IO_LOW);
+    _initializedICs |= INIT_GPIO_EXPANDER;
     Serial.println("OK");
   } else {
+    _initializedICs &= ~INIT_GPIO_EXPANDER;
     Serial.println("FAIL!");
   }
 }
@@ -233,8 +268,10 @@ void Agrumino::initTempSensor() {
   if (success) {
     mcpTempSensor.setResolution(MCP_ADC_RES_11); // 11bit (0.125c)
     mcpTempSensor.setOneShot(true);
+    _initializedICs |= INIT_TEMP_SENSOR;
     Serial.println("OK");
   } else {
+    _initializedICs &= ~INIT_TEMP_SENSOR;
     Serial.println("FAIL!");
   }
 }
@@ -246,10 +283,10 @@ void Agrumino::initSoilSensor() {
     mcpSoilSensor.reset();
     mcpSoilSensor.setSmoothing(EMAVG);
     // mcpSoilSensor.setVref(3300); This will make the reading of the MCP3221 voltage accurate. Currently is not needed because we need just a range
-    _soilRawAir = DEFAULT_SOIL_RAW_AIR;
-    _soilRawWater = DEFAULT_SOIL_RAW_WATER;
+    _initializedICs |= INIT_SOIL_SENSOR;
     Serial.println("OK");
   } else {
+    _initializedICs &= ~INIT_SOIL_SENSOR;
     Serial.println("FAIL!");
   }
 }
@@ -268,8 +305,10 @@ void Agrumino::initLuxSensor() {
     Wire.write(0x01); // Select "Command-II" register
     Wire.write(0x03); // Set range = 64000 lux, ADC 16 bit
     Wire.endTransmission();
+    _initializedICs |= INIT_LUX_SENSOR;
     Serial.println("OK");
   } else {
+    _initializedICs &= ~INIT_LUX_SENSOR;
     Serial.println("FAIL!");
   }
 }
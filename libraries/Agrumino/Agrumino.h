@@ -32,6 +32,11 @@ class Agrumino {
     boolean isBoardOn();
     void turnBoardOn(); // Also call initBoard()
     void turnBoardOff(); 
+    boolean isBoardReady(); // Board on and all the ICs initialized
+    boolean isGpioExpanderReady();
+    boolean isTempSensorReady();
+    boolean isSoilSensorReady();
+    boolean isLuxSensorReady();
     float readBatteryVoltage(); 
     unsigned int readBatteryLevel();
     
@@ -66,6 +71,7 @@ class Agrumino {
     // Private variables
     unsigned int _soilRawAir;
     unsigned int _soilRawWater;
+    byte _initializedICs; // INIT_* flags of the ICs initialized since the board has been turned on
 };
 
 #endif
@@ -33,7 +33,7 @@
  *==============================================================================================================*/
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #include "MCP3221.h"
@@ -52,11 +52,11 @@ MCP3221::MCP3221(
      smoothing_t     smoothingMethod,
      byte            numSamples) :
      _devAddr(devAddr),
-     _vRef(vRef),
-     _alpha(alpha),
      _voltageInput(voltageInput),
      _smoothing(smoothingMethod),
-     _numSamples(numSamples)
+     _numSamples(numSamples),
+     _vRef(vRef),
+     _alpha(alpha)
      {
         _samples[MAX_NUM_SAMPLES] = { 0 };
         if (((res1 != 0) && (res2 != 0)) && (_voltageInput == VOLTAGE_INPUT_12V)) {
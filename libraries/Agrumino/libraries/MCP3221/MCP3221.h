@@ -123,14 +123,14 @@
  *==============================================================================================================*/
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #ifndef MCP3221_h
 #define MCP3221_h
 
 #if !defined(ARDUINO_ARCH_AVR)
-#warning “The MCP3221 library only supports AVR processors.”
+#warning "The MCP3221 library only supports AVR processors."
 #endif
 
 #include <Arduino.h>
@@ -33,7 +33,7 @@
  *==============================================================================================================*/
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #ifndef MCP3221InfoStr_h
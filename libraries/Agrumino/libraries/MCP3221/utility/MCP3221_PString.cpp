@@ -4,7 +4,7 @@ Original Code by: Mikal Hart (http://arduiniana.org/libraries/PString/)
 */
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #include "MCP3221_PString.h"
@@ -4,7 +4,7 @@ Original Code by: Mikal Hart (http://arduiniana.org/libraries/PString/)
 */
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #ifndef MCP3221PString_h
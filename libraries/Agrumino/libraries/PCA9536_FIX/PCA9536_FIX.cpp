@@ -33,7 +33,7 @@
  *==============================================================================================================*/
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #include "PCA9536_FIX.h"
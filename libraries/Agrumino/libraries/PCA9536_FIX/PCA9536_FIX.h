@@ -116,14 +116,14 @@
 *==============================================================================================================*/
 
 #if 1
-__asm volatile ("nop");
+__asm ("nop");
 #endif
 
 #ifndef PCA9536_h
 #define PCA9536_h
 
 #if !defined(ARDUINO_ARCH_AVR)
-#warning “The PCA9536 library only supports AVR processors.”
+#warning "The PCA9536 library only supports AVR processors."
 #endif
 
 #include <Arduino.h>
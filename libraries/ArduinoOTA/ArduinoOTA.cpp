@@ -6,6 +6,10 @@
 #include "ArduinoOTA.h"
 #include "MD5Builder.h"
 #include "StreamString.h"
+#include <LzssDecoder.h>
+#include <UpdateSignature.h>
+#include <ESP8266httpUpdate.h>
+#include "eboot_command.h"
 
 extern "C" {
   #include "osapi.h"
@@ -28,20 +32,98 @@ extern "C" {
 #endif
 #endif
 
+// Receive buffers between the socket and Update, see setRxBuffers()
+class OTARxRing
+{
+public:
+  OTARxRing(size_t size) : _buf(size ? (uint8_t*) malloc(size) : NULL), _size(_buf ? size : 0), _head(0), _len(0) {}
+  ~OTARxRing() { free(_buf); }
+
+  bool valid() const { return _buf != NULL; }
+  size_t size() const { return _size; }
+  size_t length() const { return _len; }
+
+  // Moves what the socket has received into the free space, which also reopens the TCP window
+  void fill(WiFiClient& client) {
+    size_t avail;
+    while (_len < _size && (avail = client.peekAvailable()) > 0) {
+      size_t tail = (_head + _len) % _size;
+      size_t len = std::min(avail, std::min(_size - _len, _size - tail));
+      memcpy(_buf + tail, client.peekBuffer(), len);
+      client.peekConsume(len);
+      _len += len;
+    }
+  }
+
+  // Contiguous data at the head, fill() does not move it
+  uint8_t* data(size_t& len) {
+    len = std::min(_len, _size - _head);
+    return _buf + _head;
+  }
+
+  void consume(size_t len) {
+    _head = (_head + len) % _size;
+    _len -= len;
+  }
+
+private:
+  uint8_t* _buf;
+  size_t _size;
+  size_t _head;
+  size_t _len;
+};
+
+// v2 transfer frames sent back to the uploader: type, then a little endian u32
+#define OTA_FRAME_ACK   'A' // input bytes consumed so far
+#define OTA_FRAME_OK    'O' // update done, input bytes consumed
+#define OTA_FRAME_ERROR 'E' // update failed, Update error code, followed by the error text
+
+// error codes above the Update ones, sent in OTA_FRAME_ERROR
+#define OTA_ERROR_SIGNATURE 0x100
+#define OTA_ERROR_CANCELLED 0x200 // onEnd dropped the staged sketch
+
+// Update.end() leaves the eboot command that installs the sketch at the next boot,
+// onEnd clears it to cancel the update, e.g. when the sketch does not read back
+static bool sketchStaged() {
+  struct eboot_command cmd;
+  return eboot_command_read(&cmd) == 0 && cmd.action == ACTION_COPY_RAW;
+}
+
+// Bytes to give Update after done of size so that the write erases at most one sector.
+// Update writes a full sector out with the first byte of the next one, and the last one
+// when the image is complete, so the first byte of the last sector goes alone
+static size_t sectorSlice(uint32_t done, uint32_t size) {
+  if (done && done % FLASH_SECTOR_SIZE == 0 && size - done <= FLASH_SECTOR_SIZE) {
+    return 1;
+  }
+  return FLASH_SECTOR_SIZE - done % FLASH_SECTOR_SIZE;
+}
+
+static void sendFrame(WiFiClient& client, uint8_t type, uint32_t value) {
+  uint8_t frame[5] = { type, (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24) };
+  client.write((const uint8_t*) frame, sizeof(frame));
+}
+
 ArduinoOTAClass::ArduinoOTAClass()
 : _port(0)
 , _udp_ota(0)
 , _initialized(false)
 , _rebootOnSuccess(true)
+, _rx_buffers(OTA_RX_BUFFERS)
+, _version(1)
+, _ack_interval(OTA_ACK_INTERVAL)
+, _receive_timeout(OTA_RECEIVE_TIMEOUT)
 , _state(OTA_IDLE)
 , _size(0)
 , _cmd(0)
 , _ota_port(0)
+, _update_signature(NULL)
 , _start_callback(NULL)
 , _end_callback(NULL)
 , _error_callback(NULL)
 , _progress_callback(NULL)
 {
+  memset(&_stats, 0, sizeof(_stats));
 }
 
 ArduinoOTAClass::~ArduinoOTAClass(){
@@ -49,6 +131,18 @@ ArduinoOTAClass::~ArduinoOTAClass(){
     _udp_ota->unref();
     _udp_ota = 0;
   }
+  delete _update_signature;
+}
+
+void ArduinoOTAClass::setPublicKey(const uint8_t * publicKey) {
+  if (!publicKey) {
+    delete _update_signature;
+    _update_signature = NULL;
+  } else if (!_update_signature) {
+    _update_signature = new UpdateSignature(publicKey);
+  } else {
+    _update_signature->setPublicKey(publicKey);
+  }
 }
 
 void ArduinoOTAClass::onStart(THandlerFunction fn) {
@@ -103,6 +197,18 @@ void ArduinoOTAClass::setRebootOnSuccess(bool reboot){
   _rebootOnSuccess = reboot;
 }
 
+void ArduinoOTAClass::setRxBuffers(uint8_t count){
+  _rx_buffers = count;
+}
+
+void ArduinoOTAClass::setReceiveTimeout(uint32_t ms){
+  _receive_timeout = ms;
+}
+
+void ArduinoOTAClass::setAckInterval(uint32_t bytes){
+  _ack_interval = bytes ? bytes : OTA_ACK_INTERVAL;
+}
+
 void ArduinoOTAClass::begin() {
   if (_initialized)
     return;
@@ -141,6 +247,21 @@ void ArduinoOTAClass::begin() {
 #endif
 }
 
+void ArduinoOTAClass::end() {
+  if (!_initialized)
+    return;
+
+  if(_udp_ota){
+    _udp_ota->unref();
+    _udp_ota = 0;
+  }
+  _initialized = false;
+  _state = OTA_IDLE;
+#ifdef OTA_DEBUG
+  OTA_DEBUG.printf("OTA server stopped\n");
+#endif
+}
+
 int ArduinoOTAClass::parseInt(){
   char data[16];
   uint8_t index;
@@ -186,6 +307,17 @@ void ArduinoOTAClass::_onRx(){
     _udp_ota->read();
     _md5 = readStringUntil('\n');
     _md5.trim();
+    // "<md5> 2" asks for the v2 transfer, older devices ignore the invitation and the uploader falls back.
+    // "<md5> <version> <signature>" carries the signature of a signed sketch
+    _version = 1;
+    _signature = String();
+    if(_md5.length() > 33 && _md5.charAt(32) == ' '){
+      _version = _md5.substring(33).toInt() >= 2 ? 2 : 1;
+      int space = _md5.indexOf(' ', 33);
+      if(space > 0)
+        _signature = _md5.substring(space + 1);
+      _md5.remove(32);
+    }
     if(_md5.length() != 32)
       return;
 
@@ -246,6 +378,28 @@ void ArduinoOTAClass::_runUpdate() {
   ip_addr_t ota_ip;
   ota_ip.addr = (uint32_t)_ota_ip;
 
+  // checked once the image is written, so it has to come before anything is erased
+  Sha256* hash = NULL;
+  if (_cmd == U_FLASH && _update_signature) {
+    if (!_update_signature->begin(_signature)) {
+#ifdef OTA_DEBUG
+      OTA_DEBUG.println("Signature Missing");
+#endif
+      if (_error_callback) {
+        _error_callback(OTA_SIGNATURE_ERROR);
+      }
+      String error = _update_signature->getLastErrorString();
+      _udp_ota->append("ERR: ", 5);
+      _udp_ota->append(error.c_str(), error.length());
+      _udp_ota->send(&ota_ip, _ota_udp_port);
+      delay(100);
+      _udp_ota->listen(*IP_ADDR_ANY, _port);
+      _state = OTA_IDLE;
+      return;
+    }
+    hash = _update_signature->hash();
+  }
+
   if (!Update.begin(_size, _cmd)) {
 #ifdef OTA_DEBUG
     OTA_DEBUG.println("Update Begin Error");
@@ -264,7 +418,17 @@ void ArduinoOTAClass::_runUpdate() {
     _state = OTA_IDLE;
     return;
   }
-  _udp_ota->append("OK", 2);
+  OTARxRing ring(_rx_buffers * TCP_MSS);
+
+  if (_version >= 2) {
+    // "OK 2 <ack interval> <window>", the window is what can be buffered here before the next ack
+    uint32_t window = std::max((uint32_t) (TCP_WND + ring.size()), 2 * _ack_interval);
+    char ok[32];
+    int len = sprintf(ok, "OK 2 %u %u", _ack_interval, window);
+    _udp_ota->append(ok, len);
+  } else {
+    _udp_ota->append("OK", 2);
+  }
   _udp_ota->send(&ota_ip, _ota_udp_port);
   delay(100);
 
@@ -279,6 +443,10 @@ void ArduinoOTAClass::_runUpdate() {
     _progress_callback(0, _size);
   }
 
+  memset(&_stats, 0, sizeof(_stats));
+  uint32_t start = micros();
+  uint32_t stage;
+
   WiFiClient client;
   if (!client.connect(_ota_ip, _ota_port)) {
 #ifdef OTA_DEBUG
@@ -288,47 +456,160 @@ void ArduinoOTAClass::_runUpdate() {
     if (_error_callback) {
       _error_callback(OTA_CONNECT_ERROR);
     }
+    Update.end();
     _state = OTA_IDLE;
+    return;
+  }
+
+  // compressed images are sent with the size and MD5 of the decoded image in the invitation
+  LzssDecoder lzss;
+  uint8_t magic[LZSS_MAGIC_SIZE];
+  bool compressed = LzssDecoder::isCompressed(magic, client.peekBytes(magic, sizeof(magic)));
+
+  if (_version >= 2) {
+    client.setNoDelay(true);
   }
 
   uint32_t written, total = 0;
+  uint32_t received = 0, acked = 0;
   while (!Update.isFinished() && client.connected()) {
-    int waited = 1000;
-    while (!client.available() && waited--)
-      delay(1);
-    if (!waited){
+    stage = micros();
+    // woken up by the receive callback, not polled
+    bool ready = client.waitAvailable(_receive_timeout) > 0;
+    _stats.receive += micros() - stage;
+    if (!ready){
 #ifdef OTA_DEBUG
       OTA_DEBUG.printf("Receive Failed\n");
 #endif
+      _stats.bytes = total;
+      _stats.total = micros() - start;
       _udp_ota->listen(*IP_ADDR_ANY, _port);
       if (_error_callback) {
         _error_callback(OTA_RECEIVE_ERROR);
       }
+      Update.end();
       _state = OTA_IDLE;
+      return;
+    }
+    stage = micros();
+    written = 0;
+    if (ring.valid()) {
+      ring.fill(client);
+      while (ring.length()) {
+        size_t len;
+        uint8_t* data = ring.data(len);
+        if (!compressed) {
+          len = std::min(len, sectorSlice(total + written, _size));
+        }
+        ring.fill(client);
+        uint32_t before = written;
+        size_t used = _write(data, len, compressed ? &lzss : NULL, hash, written);
+        ring.consume(used);
+        received += used;
+        if ((!used && written == before) || lzss.hasError() || Update.hasError()) {
+          break;
+        }
+      }
+    } else {
+      // the received pbufs are consumed in place, Update copies them once into its sector buffer
+      size_t len;
+      while ((len = client.peekAvailable()) > 0) {
+        if (!compressed) {
+          len = std::min(len, sectorSlice(total + written, _size));
+        }
+        uint32_t before = written;
+        size_t used = _write((uint8_t*) client.peekBuffer(), len, compressed ? &lzss : NULL, hash, written);
+        client.peekConsume(used);
+        received += used;
+        if ((!used && written == before) || lzss.hasError() || Update.hasError()) {
+          break;
+        }
+      }
+    }
+    if (Update.hasError()) {
+      break;
+    }
+    if (compressed && (lzss.hasError() || (lzss.hasHeader() && lzss.size() != (uint32_t) _size))) {
+#ifdef OTA_DEBUG
+      OTA_DEBUG.printf("Compressed Image Corrupt\n");
+#endif
+      break;
+    }
+    _stats.write += micros() - stage;
+    stage = micros();
+    if (_version >= 2 && received - acked >= _ack_interval) {
+      // cumulative, the uploader only needs the latest one
+      sendFrame(client, OTA_FRAME_ACK, received);
+      acked = received;
     }
-    written = Update.write(client);
     if (written > 0) {
-      client.print(written, DEC);
+      if (_version < 2) {
+        client.print(written, DEC);
+      }
       total += written;
       if(_progress_callback) {
         _progress_callback(total, _size);
       }
     }
+    _stats.callback += micros() - stage;
   }
+  _stats.bytes = total;
+  _stats.total = micros() - start;
 
-  if (Update.end()) {
-    client.print("OK");
-    client.stop();
-    delay(10);
+  bool updated = Update.end();
+  if (updated && hash && !_update_signature->verify()) {
+    // the staged image has been dropped, the running sketch stays
 #ifdef OTA_DEBUG
-    OTA_DEBUG.printf("Update Success\n");
+    OTA_DEBUG.println(_update_signature->getLastErrorString());
 #endif
+    _udp_ota->listen(*IP_ADDR_ANY, _port);
+    if (_error_callback) {
+      _error_callback(OTA_SIGNATURE_ERROR);
+    }
+    if (_version >= 2) {
+      sendFrame(client, OTA_FRAME_ERROR, OTA_ERROR_SIGNATURE + _update_signature->getLastError());
+    }
+    client.print(_update_signature->getLastErrorString());
+    _state = OTA_IDLE;
+    return;
+  }
+
+  if (updated) {
+    // runs before the uploader is told, it may still cancel the update
     if (_end_callback) {
       _end_callback();
     }
+    if (_cmd == U_FLASH && !sketchStaged()) {
+#ifdef OTA_DEBUG
+      OTA_DEBUG.println("Update cancelled by onEnd");
+#endif
+      _udp_ota->listen(*IP_ADDR_ANY, _port);
+      if (_error_callback) {
+        _error_callback(OTA_END_ERROR);
+      }
+      if (_version >= 2) {
+        sendFrame(client, OTA_FRAME_ERROR, OTA_ERROR_CANCELLED);
+      }
+      client.print("Update cancelled, the staged sketch was dropped");
+      _state = OTA_IDLE;
+      return;
+    }
+    if (_cmd == U_FLASH) {
+      ESP8266HTTPUpdate::forgetSketchMD5(); // the MD5 cached for httpUpdate is the running sketch's
+    }
+    if (_version >= 2) {
+      sendFrame(client, OTA_FRAME_OK, received);
+    } else {
+      client.print("OK");
+    }
+    client.stop();
+    delay(10);
+#ifdef OTA_DEBUG
+    OTA_DEBUG.printf("Update Success\n");
+#endif
     if(_rebootOnSuccess){
 #ifdef OTA_DEBUG
-    OTA_DEBUG.printf("Rebooting...\n");
+      OTA_DEBUG.printf("Rebooting...\n");
 #endif
       //let serial/network finish tasks that might be given in _end_callback
       delay(100);
@@ -339,6 +620,9 @@ void ArduinoOTAClass::_runUpdate() {
     if (_error_callback) {
       _error_callback(OTA_END_ERROR);
     }
+    if (_version >= 2) {
+      sendFrame(client, OTA_FRAME_ERROR, Update.getError());
+    }
     Update.printError(client);
 #ifdef OTA_DEBUG
     Update.printError(OTA_DEBUG);
@@ -347,6 +631,39 @@ void ArduinoOTAClass::_runUpdate() {
   }
 }
 
+// Feeds data to Update, or to the decoder for compressed images, and records the writes
+// that erased and programmed a sector. The decoder stops like the slices of the loop so a call
+// erases at most one, whatever the input decodes to. hash gets the bytes written.
+// Returns the bytes consumed from data, the decoder may leave some for the next call
+size_t ArduinoOTAClass::_write(uint8_t* data, size_t len, LzssDecoder* lzss, Sha256* hash, uint32_t& written) {
+  size_t progress = Update.progress();
+  uint32_t start = micros();
+  size_t used;
+
+  if (lzss) {
+    const uint8_t* in = data;
+    size_t left = len;
+    written += lzss->writeTo(Update, in, left, sectorSlice(lzss->progress(), _size), hash);
+    used = len - left;
+  } else {
+    used = Update.write(data, std::min(len, (size_t) Update.remaining()));
+    written += used;
+  }
+
+  if (Update.progress() != progress) {
+    uint32_t stall = micros() - start;
+    _stats.sectors++;
+    _stats.stall += stall;
+    if (stall > _stats.stall_max) {
+      _stats.stall_max = stall;
+    }
+  }
+  if (hash && !lzss) {
+    hash->add(data, used);
+  }
+  return used;
+}
+
 void ArduinoOTAClass::handle() {
   if (_state == OTA_RUNUPDATE) {
     _runUpdate();
@@ -354,10 +671,18 @@ void ArduinoOTAClass::handle() {
   }
 }
 
+bool ArduinoOTAClass::isUpdatePending() {
+  return _state == OTA_RUNUPDATE;
+}
+
 int ArduinoOTAClass::getCommand() {
   return _cmd;
 }
 
+const ota_stats_t& ArduinoOTAClass::getStats() {
+  return _stats;
+}
+
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ARDUINOOTA)
 ArduinoOTAClass ArduinoOTA;
 #endif
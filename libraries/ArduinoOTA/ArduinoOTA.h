@@ -6,6 +6,23 @@
 #include <functional>
 
 class UdpContext;
+class LzssDecoder;
+class Sha256;
+class UpdateSignature;
+
+// The copy into the buffers costs less than the sender waits without them, the window
+// stays closed during the erases (./ota_host_test bench: 1 MB at 70.3 KiB/s, 69.2 with 0)
+#ifndef OTA_RX_BUFFERS
+#define OTA_RX_BUFFERS 4
+#endif
+
+#ifndef OTA_RECEIVE_TIMEOUT
+#define OTA_RECEIVE_TIMEOUT 1000
+#endif
+
+#ifndef OTA_ACK_INTERVAL
+#define OTA_ACK_INTERVAL 4096
+#endif
 
 typedef enum {
   OTA_IDLE,
@@ -18,9 +35,22 @@ typedef enum {
   OTA_BEGIN_ERROR,
   OTA_CONNECT_ERROR,
   OTA_RECEIVE_ERROR,
-  OTA_END_ERROR
+  OTA_END_ERROR,
+  OTA_SIGNATURE_ERROR
 } ota_error_t;
 
+// Time spent in each stage of the last transfer, in microseconds
+typedef struct {
+  uint32_t bytes;     // bytes written to flash
+  uint32_t total;     // from the TCP connection to the last byte written
+  uint32_t receive;   // waiting for data on the socket
+  uint32_t write;     // Update.write(): MD5 update, flash sector erase and write
+  uint32_t callback;  // acks sent back to espota and onProgress callback
+  uint32_t sectors;   // flash sectors erased and programmed
+  uint32_t stall;     // time inside the writes that erased and programmed a sector
+  uint32_t stall_max; // longest of those writes
+} ota_stats_t;
+
 class ArduinoOTAClass
 {
   public:
@@ -47,6 +77,22 @@ class ArduinoOTAClass
     //Sets if the device should be rebooted after successful update. Default true
     void setRebootOnSuccess(bool reboot);
 
+    //Sets the number of TCP segments buffered between the socket and the flash writes. Default OTA_RX_BUFFERS
+    //The socket is drained into these buffers before every sector erase, so the sender can go on during it.
+    //0 writes straight from the received pbufs
+    void setRxBuffers(uint8_t count);
+
+    //Sets how long the transfer waits for data before failing with OTA_RECEIVE_ERROR. Default OTA_RECEIVE_TIMEOUT ms
+    void setReceiveTimeout(uint32_t ms);
+
+    //Sets the bytes received between two acks in the v2 transfer (tools/espota2.py). Default OTA_ACK_INTERVAL
+    //The ArduinoIDE uploader uses the v1 transfer, acked after every write
+    void setAckInterval(uint32_t bytes);
+
+    //Only accepts sketches signed with this Ed25519 key (ED25519_KEY_SIZE bytes, RAM or PROGMEM). Default NULL, unsigned
+    //The signature is sent by tools/espota2.py after the version in the invitation, see UpdateSignature.h
+    void setPublicKey(const uint8_t *publicKey);
+
     //This callback will be called when OTA connection has begun
     void onStart(THandlerFunction fn);
 
@@ -62,12 +108,21 @@ class ArduinoOTAClass
     //Starts the ArduinoOTA service
     void begin();
 
+    //Stops the ArduinoOTA service, begin() can be called again afterwards
+    void end();
+
     //Call this in loop() to run the service
     void handle();
 
+    //Returns true if an update has been accepted and the next handle() will run it
+    bool isUpdatePending();
+
     //Gets update command type after OTA has started. Either U_FLASH or U_SPIFFS
     int getCommand();
 
+    //Gets per-stage timing of the last transfer, valid from onEnd/onError
+    const ota_stats_t& getStats();
+
   private:
     int _port;
     String _password;
@@ -76,6 +131,10 @@ class ArduinoOTAClass
     UdpContext *_udp_ota;
     bool _initialized;
     bool _rebootOnSuccess;
+    uint8_t _rx_buffers;
+    uint8_t _version;
+    uint32_t _ack_interval;
+    uint32_t _receive_timeout;
     ota_state_t _state;
     int _size;
     int _cmd;
@@ -83,6 +142,9 @@ class ArduinoOTAClass
     uint16_t _ota_udp_port;
     IPAddress _ota_ip;
     String _md5;
+    String _signature;
+    UpdateSignature *_update_signature;
+    ota_stats_t _stats;
 
     THandlerFunction _start_callback;
     THandlerFunction _end_callback;
@@ -90,6 +152,7 @@ class ArduinoOTAClass
     THandlerFunction_Progress _progress_callback;
 
     void _runUpdate(void);
+    size_t _write(uint8_t* data, size_t len, LzssDecoder* lzss, Sha256* hash, uint32_t& written);
     void _onRx(void);
     int parseInt(void);
     String readStringUntil(char end);
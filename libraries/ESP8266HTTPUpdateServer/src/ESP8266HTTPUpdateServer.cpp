@@ -4,6 +4,10 @@
 #include <ESP8266WebServer.h>
 #include <WiFiUdp.h>
 #include "StreamString.h"
+#include <LzssDecoder.h>
+#include <UpdateSignature.h>
+#include <ESP8266httpUpdate.h>
+#include "eboot_command.h"
 #include "ESP8266HTTPUpdateServer.h"
 
 
@@ -23,6 +27,32 @@ ESP8266HTTPUpdateServer::ESP8266HTTPUpdateServer(bool serial_debug)
   _username = NULL;
   _password = NULL;
   _authenticated = false;
+  memset(&_stats, 0, sizeof(_stats));
+  _lastUploadCall = 0;
+  _rebootOnSuccess = true;
+  _start_callback = NULL;
+  _end_callback = NULL;
+  _error_callback = NULL;
+  _decoder = NULL;
+  _signature = NULL;
+}
+
+ESP8266HTTPUpdateServer::~ESP8266HTTPUpdateServer()
+{
+  delete _decoder;
+  delete _signature;
+}
+
+void ESP8266HTTPUpdateServer::setPublicKey(const uint8_t * publicKey)
+{
+  if (!publicKey) {
+    delete _signature;
+    _signature = NULL;
+  } else if (!_signature) {
+    _signature = new UpdateSignature(publicKey);
+  } else {
+    _signature->setPublicKey(publicKey);
+  }
 }
 
 void ESP8266HTTPUpdateServer::setup(ESP8266WebServer *server, const char * path, const char * username, const char * password)
@@ -42,10 +72,15 @@ void ESP8266HTTPUpdateServer::setup(ESP8266WebServer *server, const char * path,
     _server->on(path, HTTP_POST, [&](){
       if(!_authenticated)
         return _server->requestAuthentication();
-      if (Update.hasError()) {
+      if (Update.hasError() || _updaterError.length()) {
         _server->send(200, F("text/html"), String(F("Update error: ")) + _updaterError);
       } else {
         _server->client().setNoDelay(true);
+        if (!_rebootOnSuccess) {
+          _server->send(200, F("text/html"), F("Update Success! A board reset is required to run the new sketch.\n"));
+          return;
+        }
+        if (_serial_output) Serial.printf("Rebooting...\n");
         _server->send_P(200, PSTR("text/html"), successResponse);
         delay(100);
         _server->client().stop();
@@ -55,9 +90,14 @@ void ESP8266HTTPUpdateServer::setup(ESP8266WebServer *server, const char * path,
       // handler for the file upload, get's the sketch bytes, and writes
       // them through the Update object
       HTTPUpload& upload = _server->upload();
+      uint32_t now = micros();
 
       if(upload.status == UPLOAD_FILE_START){
+        memset(&_stats, 0, sizeof(_stats));
+        _stats.total = now;
         _updaterError = String();
+        delete _decoder;
+        _decoder = NULL;
         if (_serial_output)
           Serial.setDebugOutput(true);
 
@@ -72,25 +112,77 @@ void ESP8266HTTPUpdateServer::setup(ESP8266WebServer *server, const char * path,
         if (_serial_output)
           Serial.printf("Update: %s\n", upload.filename.c_str());
         uint32_t maxSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
-        if(!Update.begin(maxSketchSpace)){//start with max available size
+        if(_signature && !_signature->begin(_server->arg("signature"))){
+          _setSignatureError(); // before anything is erased
+        } else if(!Update.begin(maxSketchSpace)){//start with max available size
           _setUpdaterError();
+        } else if (_start_callback) {
+          _start_callback();
         }
       } else if(_authenticated && upload.status == UPLOAD_FILE_WRITE && !_updaterError.length()){
         if (_serial_output) Serial.printf(".");
-        if(Update.write(upload.buf, upload.currentSize) != upload.currentSize){
-          _setUpdaterError();
+        _stats.receive += now - _lastUploadCall;
+        if(upload.totalSize == 0 && LzssDecoder::isCompressed(upload.buf, upload.currentSize)){
+          _decoder = new LzssDecoder();
         }
-      } else if(_authenticated && upload.status == UPLOAD_FILE_END && !_updaterError.length()){
-        if(Update.end(true)){ //true to set the size to the current progress
-          if (_serial_output) Serial.printf("Update Success: %u\nRebooting...\n", upload.totalSize);
+        if(_decoder){
+          _stats.bytes += _decoder->writeTo(Update, upload.buf, upload.currentSize, _signature ? _signature->hash() : NULL);
+          if(_decoder->hasError()){
+            _setDecoderError();
+          } else if(Update.hasError()){
+            _setUpdaterError();
+          }
         } else {
+          size_t written = Update.write(upload.buf, upload.currentSize);
+          _stats.bytes += written;
+          if(_signature){
+            _signature->add(upload.buf, written);
+          }
+          if(written != upload.currentSize){
+            _setUpdaterError();
+          }
+        }
+        _stats.write += micros() - now;
+      } else if(_authenticated && upload.status == UPLOAD_FILE_END && !_updaterError.length()){
+        _stats.receive += now - _lastUploadCall;
+        _stats.total = now - _stats.total;
+        if(_decoder && !_decoder->isFinished()){
+          _setDecoderError();
+        } else if(!Update.end(true)){ //true to set the size to the current progress
           _setUpdaterError();
+        } else if(_signature && !_signature->verify()){ //drops the staged sketch if it fails
+          _stats.verify = _signature->verifyTime();
+          _setSignatureError();
+        } else {
+          if(_signature) _stats.verify = _signature->verifyTime();
+          if (_serial_output) {
+            Serial.printf("Update Success: %u\n", (unsigned) upload.totalSize);
+            uint32_t rate = _stats.total ? (uint32_t)((uint64_t)_stats.bytes * 1000000 / _stats.total) : 0;
+            Serial.printf("{\"ota\":\"web\",\"bytes\":%u,\"total_us\":%u,\"receive_us\":%u,\"write_us\":%u,\"callback_us\":0,\"verify_us\":%u,\"bytes_per_s\":%u}\n",
+                          _stats.bytes, _stats.total, _stats.receive, _stats.write, _stats.verify, rate);
+          }
+          if (_end_callback) _end_callback();
+          // onEnd may cancel the update by clearing the eboot command, e.g. when the sketch does not read back
+          struct eboot_command cmd;
+          if (eboot_command_read(&cmd) != 0 || cmd.action != ACTION_COPY_RAW) {
+            _updaterError = F("Update cancelled, the staged sketch was dropped");
+            if (_serial_output) Serial.println(_updaterError);
+            if (_error_callback) _error_callback(_updaterError);
+          } else {
+            ESP8266HTTPUpdate::forgetSketchMD5(); // the MD5 cached for httpUpdate is the running sketch's
+          }
         }
         if (_serial_output) Serial.setDebugOutput(false);
+        delete _decoder;
+        _decoder = NULL;
       } else if(_authenticated && upload.status == UPLOAD_FILE_ABORTED){
         Update.end();
+        delete _decoder;
+        _decoder = NULL;
         if (_serial_output) Serial.println("Update was aborted");
+        if (_error_callback) _error_callback(F("Update was aborted"));
       }
+      _lastUploadCall = micros();
       delay(0);
     });
 }
@@ -101,4 +193,22 @@ void ESP8266HTTPUpdateServer::_setUpdaterError()
   StreamString str;
   Update.printError(str);
   _updaterError = str.c_str();
+  if (_error_callback) _error_callback(_updaterError);
+}
+
+void ESP8266HTTPUpdateServer::_setSignatureError()
+{
+  _updaterError = _signature->getLastErrorString();
+  if (_serial_output) Serial.println(_updaterError);
+  if (_error_callback) _error_callback(_updaterError);
+}
+
+void ESP8266HTTPUpdateServer::_setDecoderError()
+{
+  Update.end(); // drop the partial image
+  _updaterError = F("Compressed image corrupt");
+  if (_serial_output) Serial.println(_updaterError);
+  if (_error_callback) _error_callback(_updaterError);
+  delete _decoder;
+  _decoder = NULL;
 }
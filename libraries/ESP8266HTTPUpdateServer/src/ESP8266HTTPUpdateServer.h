@@ -1,12 +1,29 @@
 #ifndef __HTTP_UPDATE_SERVER_H
 #define __HTTP_UPDATE_SERVER_H
 
+#include <functional>
+
 class ESP8266WebServer;
+class LzssDecoder;
+class UpdateSignature;
+
+// Time spent in each stage of the last upload, in microseconds
+typedef struct {
+  uint32_t bytes;     // bytes written to flash
+  uint32_t total;     // from UPLOAD_FILE_START to UPLOAD_FILE_END
+  uint32_t receive;   // between upload callbacks: socket receive and multipart parsing
+  uint32_t write;     // Update.write(): MD5 update, flash sector erase and write, SHA-256 of signed sketches
+  uint32_t verify;    // Ed25519 check of signed sketches, after the last byte
+} HTTPUpdateServerStats;
 
 class ESP8266HTTPUpdateServer
 {
   public:
+    typedef std::function<void(void)> THandlerFunction;
+    typedef std::function<void(const String&)> THandlerFunction_Error;
+
     ESP8266HTTPUpdateServer(bool serial_debug=false);
+    ~ESP8266HTTPUpdateServer();
 
     void setup(ESP8266WebServer *server)
     {
@@ -25,8 +42,31 @@ class ESP8266HTTPUpdateServer
 
     void setup(ESP8266WebServer *server, const char * path, const char * username, const char * password);
 
+    const HTTPUpdateServerStats& getStats()
+    {
+      return _stats;
+    }
+
+    //This callback will be called when an authenticated upload has begun
+    void onStart(THandlerFunction fn) { _start_callback = fn; }
+
+    //This callback will be called when the uploaded image has been written and verified
+    void onEnd(THandlerFunction fn) { _end_callback = fn; }
+
+    //This callback will be called with the Update error when an upload fails or is aborted
+    void onError(THandlerFunction_Error fn) { _error_callback = fn; }
+
+    //Sets if the device should be rebooted after successful update. Default true
+    void setRebootOnSuccess(bool reboot) { _rebootOnSuccess = reboot; }
+
+    //Only accepts sketches signed with this Ed25519 key (ED25519_KEY_SIZE bytes, RAM or PROGMEM). Default NULL, unsigned
+    //The signature is sent in the "signature" query argument of the POST, see UpdateSignature.h
+    void setPublicKey(const uint8_t * publicKey);
+
   protected:
     void _setUpdaterError();
+    void _setDecoderError();
+    void _setSignatureError();
 
   private:
     bool _serial_output;
@@ -35,6 +75,15 @@ class ESP8266HTTPUpdateServer
     char * _password;
     bool _authenticated;
     String _updaterError;
+    HTTPUpdateServerStats _stats;
+    uint32_t _lastUploadCall;
+    bool _rebootOnSuccess;
+    LzssDecoder* _decoder; // only while a compressed image is uploaded
+    UpdateSignature* _signature; // only with a public key
+
+    THandlerFunction _start_callback;
+    THandlerFunction _end_callback;
+    THandlerFunction_Error _error_callback;
 };
 
 
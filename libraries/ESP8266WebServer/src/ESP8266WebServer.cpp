@@ -39,7 +39,6 @@
 static const char AUTHORIZATION_HEADER[] PROGMEM = "Authorization";
 static const char qop_auth[] PROGMEM = "qop=auth";
 static const char WWW_Authenticate[] PROGMEM = "WWW-Authenticate";
-static const char Content_Length[] PROGMEM = "Content-Length";
 
 
 ESP8266WebServer::ESP8266WebServer(IPAddress addr, int port)
@@ -48,6 +47,12 @@ ESP8266WebServer::ESP8266WebServer(IPAddress addr, int port)
 , _currentVersion(0)
 , _currentStatus(HC_NONE)
 , _statusChange(0)
+, _currentRequests(0)
+, _requestKeepAlive(false)
+, _currentKeepAlive(false)
+, _keepAlive(false)
+, _keepAliveMax(HTTP_KEEPALIVE_MAX)
+, _keepAliveTimeout(HTTP_KEEPALIVE_TIMEOUT)
 , _currentHandler(nullptr)
 , _firstHandler(nullptr)
 , _lastHandler(nullptr)
@@ -66,6 +71,12 @@ ESP8266WebServer::ESP8266WebServer(int port)
 , _currentVersion(0)
 , _currentStatus(HC_NONE)
 , _statusChange(0)
+, _currentRequests(0)
+, _requestKeepAlive(false)
+, _currentKeepAlive(false)
+, _keepAlive(false)
+, _keepAliveMax(HTTP_KEEPALIVE_MAX)
+, _keepAliveTimeout(HTTP_KEEPALIVE_TIMEOUT)
 , _currentHandler(nullptr)
 , _firstHandler(nullptr)
 , _lastHandler(nullptr)
@@ -254,6 +265,9 @@ void ESP8266WebServer::addHandler(RequestHandler* handler) {
 }
 
 void ESP8266WebServer::_addRequestHandler(RequestHandler* handler) {
+    const char* path = "";
+    RequestRoute route = handler->route(path);
+    _routes.add(handler, route, path);
     if (!_lastHandler) {
       _firstHandler = handler;
       _lastHandler = handler;
@@ -282,6 +296,8 @@ void ESP8266WebServer::handleClient() {
     _currentClient = client;
     _currentStatus = HC_WAIT_READ;
     _statusChange = millis();
+    _currentRequests = 0;
+    _request.begin(_requestBuf, sizeof(_requestBuf));
   }
 
   bool keepCurrentClient = false;
@@ -293,21 +309,27 @@ void ESP8266WebServer::handleClient() {
       // No-op to avoid C++ compiler warning
       break;
     case HC_WAIT_READ:
-      // Wait for data from client to become available
-      if (_currentClient.available()) {
+      // Wait for data from client to become available, a pipelined request may already be in _request
+      if (_request.available() || _currentClient.available()) {
         if (_parseRequest(_currentClient)) {
           _currentClient.setTimeout(HTTP_MAX_SEND_WAIT);
           _contentLength = CONTENT_LENGTH_NOT_SET;
           _handleRequest();
 
           if (_currentClient.connected()) {
-            _currentStatus = HC_WAIT_CLOSE;
+            if (_currentKeepAlive) {
+              _nextRequest();
+            } else {
+              _currentStatus = HC_WAIT_CLOSE;
+            }
             _statusChange = millis();
             keepCurrentClient = true;
           }
         }
       } else { // !_currentClient.available()
-        if (millis() - _statusChange <= HTTP_MAX_DATA_WAIT) {
+        // a kept connection waits for its next request, unless another client is waiting for the server
+        if (_currentRequests ? millis() - _statusChange <= _keepAliveTimeout && !_server.hasClient()
+                             : millis() - _statusChange <= HTTP_MAX_DATA_WAIT) {
           keepCurrentClient = true;
         }
         callYield = true;
@@ -333,6 +355,26 @@ void ESP8266WebServer::handleClient() {
   }
 }
 
+bool ESP8266WebServer::hasPendingClient() {
+  // a kept connection is pending again once its next request arrives
+  if (_currentStatus == HC_WAIT_READ && (!_currentRequests || _request.available() || client().available()))
+    return true;
+  return _server.hasClient();
+}
+
+void ESP8266WebServer::setKeepAlive(bool enable, uint16_t maxRequests, unsigned long timeout) {
+  _keepAlive = enable;
+  _keepAliveMax = maxRequests;
+  _keepAliveTimeout = timeout;
+}
+
+void ESP8266WebServer::_nextRequest() {
+  _currentRequests++;
+  _request.next();
+  _currentUpload.reset();
+  _currentStatus = HC_WAIT_READ;
+}
+
 void ESP8266WebServer::close() {
   _server.close();
   _currentStatus = HC_NONE;
@@ -345,16 +387,19 @@ void ESP8266WebServer::stop() {
 }
 
 void ESP8266WebServer::sendHeader(const String& name, const String& value, bool first) {
-  String headerLine = name;
-  headerLine += F(": ");
-  headerLine += value;
-  headerLine += "\r\n";
-
   if (first) {
+    String headerLine = name;
+    headerLine += F(": ");
+    headerLine += value;
+    headerLine += "\r\n";
     _responseHeaders = headerLine + _responseHeaders;
   }
   else {
-    _responseHeaders += headerLine;
+    // appended in place, the buffer of _responseHeaders is kept from one response to the next
+    _responseHeaders += name;
+    _responseHeaders += F(": ");
+    _responseHeaders += value;
+    _responseHeaders += F("\r\n");
   }
 }
 
@@ -362,44 +407,66 @@ void ESP8266WebServer::setContentLength(const size_t contentLength) {
     _contentLength = contentLength;
 }
 
-void ESP8266WebServer::_prepareHeader(String& response, int code, const char* content_type, size_t contentLength) {
-    response = String(F("HTTP/1.")) + String(_currentVersion) + ' ';
-    response += String(code);
-    response += ' ';
-    response += _responseCodeToString(code);
-    response += "\r\n";
-
-    using namespace mime;
-    if (!content_type)
-        content_type = mimeTable[html].mimeType;
+static char* appendP(char* p, PGM_P text) {
+    strcpy_P(p, text);
+    return p + strlen(p);
+}
 
-    sendHeader(String(F("Content-Type")), String(FPSTR(content_type)), true);
+size_t ESP8266WebServer::_prepareHeader(char* head, size_t& split, int code, const char* content_type, size_t contentLength) {
+    char* p = head + sprintf(head, "HTTP/1.%u %d ", _currentVersion, code);
+    p = appendP(p, _responseCodeText(code));
+    p = appendP(p, PSTR("\r\nContent-Type: "));
+    p = appendP(p, content_type);
+    p = appendP(p, PSTR("\r\n"));
+    // the headers of sendHeader() go here, between the content type and the length
+    split = p - head;
     if (_contentLength == CONTENT_LENGTH_NOT_SET) {
-        sendHeader(String(FPSTR(Content_Length)), String(contentLength));
+        p += sprintf(p, "Content-Length: %u\r\n", (unsigned) contentLength);
     } else if (_contentLength != CONTENT_LENGTH_UNKNOWN) {
-        sendHeader(String(FPSTR(Content_Length)), String(_contentLength));
+        p += sprintf(p, "Content-Length: %u\r\n", (unsigned) _contentLength);
     } else if(_contentLength == CONTENT_LENGTH_UNKNOWN && _currentVersion){ //HTTP/1.1 or above client
       //let's do chunked
       _chunked = true;
-      sendHeader(String(F("Accept-Ranges")),String(F("none")));
-      sendHeader(String(F("Transfer-Encoding")),String(F("chunked")));
+      p = appendP(p, PSTR("Accept-Ranges: none\r\nTransfer-Encoding: chunked\r\n"));
     }
-    sendHeader(String(F("Connection")), String(F("close")));
+    // without a length or chunks the end of the connection ends the content
+    _currentKeepAlive = _requestKeepAlive && (_contentLength != CONTENT_LENGTH_UNKNOWN || _chunked);
+    p = appendP(p, _currentKeepAlive ? PSTR("Connection: keep-alive\r\n\r\n") : PSTR("Connection: close\r\n\r\n"));
+    return p - head;
+}
 
-    response += _responseHeaders;
-    response += "\r\n";
+void ESP8266WebServer::_sendResponse(int code, const char* content_type, size_t contentLength, const char* content, size_t length) {
+    using namespace mime;
+    if (!content_type)
+        content_type = mimeTable[html].mimeType;
+
+    // status line and content type on the stack, the headers of sendHeader(), the rest of the
+    // head and the content: written at once so a small response fits in one segment
+    char head[HTTP_HEAD_LEN + strlen_P(content_type)];
+    char chunkSize[11];
+    WriteBuffer parts[6];
+    size_t count = 0;
+    size_t split;
+    size_t headLength = _prepareHeader(head, split, code, content_type, contentLength);
+    parts[count++] = { head, split };
+    parts[count++] = { _responseHeaders.c_str(), _responseHeaders.length() };
+    parts[count++] = { head + split, headLength - split };
+    if (length) {
+      if (_chunked)
+        parts[count++] = { chunkSize, (size_t) sprintf(chunkSize, "%x\r\n", (unsigned) length) };
+      parts[count++] = { content, length };
+      if (_chunked)
+        parts[count++] = { "\r\n", 2 };
+    }
+    _currentClientWritev(parts, count);
     _responseHeaders = "";
 }
 
 void ESP8266WebServer::send(int code, const char* content_type, const String& content) {
-    String header;
     // Can we asume the following?
     //if(code == 200 && content.length() == 0 && _contentLength == CONTENT_LENGTH_NOT_SET)
     //  _contentLength = CONTENT_LENGTH_UNKNOWN;
-    _prepareHeader(header, code, content_type, content.length());
-    _currentClientWrite(header.c_str(), header.length());
-    if(content.length())
-      sendContent(content);
+    _sendResponse(code, content_type, content.length(), content.c_str(), content.length());
 }
 
 void ESP8266WebServer::send_P(int code, PGM_P content_type, PGM_P content) {
@@ -409,20 +476,16 @@ void ESP8266WebServer::send_P(int code, PGM_P content_type, PGM_P content) {
         contentLength = strlen_P(content);
     }
 
-    String header;
     char type[64];
     memccpy_P((void*)type, (PGM_VOID_P)content_type, 0, sizeof(type));
-    _prepareHeader(header, code, (const char* )type, contentLength);
-    _currentClientWrite(header.c_str(), header.length());
+    _sendResponse(code, (const char* )type, contentLength);
     sendContent_P(content);
 }
 
 void ESP8266WebServer::send_P(int code, PGM_P content_type, PGM_P content, size_t contentLength) {
-    String header;
     char type[64];
     memccpy_P((void*)type, (PGM_VOID_P)content_type, 0, sizeof(type));
-    _prepareHeader(header, code, (const char* )type, contentLength);
-    sendContent(header);
+    _sendResponse(code, (const char* )type, contentLength);
     sendContent_P(content, contentLength);
 }
 
@@ -435,22 +498,21 @@ void ESP8266WebServer::send(int code, const String& content_type, const String&
 }
 
 void ESP8266WebServer::sendContent(const String& content) {
-  const char * footer = "\r\n";
   size_t len = content.length();
   if(_chunked) {
-    char * chunkSize = (char *)malloc(11);
-    if(chunkSize){
-      sprintf(chunkSize, "%x%s", len, footer);
-      _currentClientWrite(chunkSize, strlen(chunkSize));
-      free(chunkSize);
-    }
-  }
-  _currentClientWrite(content.c_str(), len);
-  if(_chunked){
-    _currentClient.write(footer, 2);
+    // chunk size, data and CRLF in one write
+    char chunkSize[11];
+    WriteBuffer parts[3] = {
+      { chunkSize, (size_t) sprintf(chunkSize, "%x\r\n", (unsigned) len) },
+      { content.c_str(), len },
+      { "\r\n", 2 }
+    };
+    _currentClientWritev(parts, 3);
     if (len == 0) {
       _chunked = false;
     }
+  } else {
+    _currentClientWrite(content.c_str(), len);
   }
 }
 
@@ -461,16 +523,12 @@ void ESP8266WebServer::sendContent_P(PGM_P content) {
 void ESP8266WebServer::sendContent_P(PGM_P content, size_t size) {
   const char * footer = "\r\n";
   if(_chunked) {
-    char * chunkSize = (char *)malloc(11);
-    if(chunkSize){
-      sprintf(chunkSize, "%x%s", size, footer);
-      _currentClientWrite(chunkSize, strlen(chunkSize));
-      free(chunkSize);
-    }
+    char chunkSize[11];
+    _currentClientWrite(chunkSize, sprintf(chunkSize, "%x%s", (unsigned) size, footer));
   }
   _currentClientWrite_P(content, size);
   if(_chunked){
-    _currentClient.write(footer, 2);
+    _currentClientWrite(footer, 2);
     if (size == 0) {
       _chunked = false;
     }
@@ -617,47 +675,51 @@ void ESP8266WebServer::_finalizeResponse() {
 }
 
 String ESP8266WebServer::_responseCodeToString(int code) {
+  return String(FPSTR(_responseCodeText(code)));
+}
+
+PGM_P ESP8266WebServer::_responseCodeText(int code) {
   switch (code) {
-    case 100: return F("Continue");
-    case 101: return F("Switching Protocols");
-    case 200: return F("OK");
-    case 201: return F("Created");
-    case 202: return F("Accepted");
-    case 203: return F("Non-Authoritative Information");
-    case 204: return F("No Content");
-    case 205: return F("Reset Content");
-    case 206: return F("Partial Content");
-    case 300: return F("Multiple Choices");
-    case 301: return F("Moved Permanently");
-    case 302: return F("Found");
-    case 303: return F("See Other");
-    case 304: return F("Not Modified");
-    case 305: return F("Use Proxy");
-    case 307: return F("Temporary Redirect");
-    case 400: return F("Bad Request");
-    case 401: return F("Unauthorized");
-    case 402: return F("Payment Required");
-    case 403: return F("Forbidden");
-    case 404: return F("Not Found");
-    case 405: return F("Method Not Allowed");
-    case 406: return F("Not Acceptable");
-    case 407: return F("Proxy Authentication Required");
-    case 408: return F("Request Time-out");
-    case 409: return F("Conflict");
-    case 410: return F("Gone");
-    case 411: return F("Length Required");
-    case 412: return F("Precondition Failed");
-    case 413: return F("Request Entity Too Large");
-    case 414: return F("Request-URI Too Large");
-    case 415: return F("Unsupported Media Type");
-    case 416: return F("Requested range not satisfiable");
-    case 417: return F("Expectation Failed");
-    case 500: return F("Internal Server Error");
-    case 501: return F("Not Implemented");
-    case 502: return F("Bad Gateway");
-    case 503: return F("Service Unavailable");
-    case 504: return F("Gateway Time-out");
-    case 505: return F("HTTP Version not supported");
-    default:  return F("");
+    case 100: return PSTR("Continue");
+    case 101: return PSTR("Switching Protocols");
+    case 200: return PSTR("OK");
+    case 201: return PSTR("Created");
+    case 202: return PSTR("Accepted");
+    case 203: return PSTR("Non-Authoritative Information");
+    case 204: return PSTR("No Content");
+    case 205: return PSTR("Reset Content");
+    case 206: return PSTR("Partial Content");
+    case 300: return PSTR("Multiple Choices");
+    case 301: return PSTR("Moved Permanently");
+    case 302: return PSTR("Found");
+    case 303: return PSTR("See Other");
+    case 304: return PSTR("Not Modified");
+    case 305: return PSTR("Use Proxy");
+    case 307: return PSTR("Temporary Redirect");
+    case 400: return PSTR("Bad Request");
+    case 401: return PSTR("Unauthorized");
+    case 402: return PSTR("Payment Required");
+    case 403: return PSTR("Forbidden");
+    case 404: return PSTR("Not Found");
+    case 405: return PSTR("Method Not Allowed");
+    case 406: return PSTR("Not Acceptable");
+    case 407: return PSTR("Proxy Authentication Required");
+    case 408: return PSTR("Request Time-out");
+    case 409: return PSTR("Conflict");
+    case 410: return PSTR("Gone");
+    case 411: return PSTR("Length Required");
+    case 412: return PSTR("Precondition Failed");
+    case 413: return PSTR("Request Entity Too Large");
+    case 414: return PSTR("Request-URI Too Large");
+    case 415: return PSTR("Unsupported Media Type");
+    case 416: return PSTR("Requested range not satisfiable");
+    case 417: return PSTR("Expectation Failed");
+    case 500: return PSTR("Internal Server Error");
+    case 501: return PSTR("Not Implemented");
+    case 502: return PSTR("Bad Gateway");
+    case 503: return PSTR("Service Unavailable");
+    case 504: return PSTR("Gateway Time-out");
+    case 505: return PSTR("HTTP Version not supported");
+    default:  return PSTR("");
   }
 }
@@ -40,15 +40,31 @@ enum HTTPAuthMethod { BASIC_AUTH, DIGEST_AUTH };
 #define HTTP_UPLOAD_BUFLEN 2048
 #endif
 
+// The request line and the longest header line have to fit in it
+#ifndef HTTP_REQUEST_BUFLEN
+#define HTTP_REQUEST_BUFLEN 1024
+#endif
+
 #define HTTP_MAX_DATA_WAIT 5000 //ms to wait for the client to send the request
 #define HTTP_MAX_POST_WAIT 5000 //ms to wait for POST data to arrive
 #define HTTP_MAX_SEND_WAIT 5000 //ms to wait for data chunk to be ACKed
 #define HTTP_MAX_CLOSE_WAIT 2000 //ms to wait for the client to close the connection
 
+#ifndef HTTP_KEEPALIVE_TIMEOUT
+#define HTTP_KEEPALIVE_TIMEOUT 2000 //ms a kept connection may stay idle between two requests
+#endif
+#ifndef HTTP_KEEPALIVE_MAX
+#define HTTP_KEEPALIVE_MAX 100 //requests served on a kept connection before it is closed
+#endif
+
+// Room on the stack for the status line and the headers set by send(), besides the content type
+#define HTTP_HEAD_LEN 160
+
 #define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
 #define CONTENT_LENGTH_NOT_SET ((size_t) -2)
 
 class ESP8266WebServer;
+class RequestBody;
 
 typedef struct {
   HTTPUploadStatus status;
@@ -60,7 +76,9 @@ typedef struct {
   uint8_t buf[HTTP_UPLOAD_BUFLEN];
 } HTTPUpload;
 
+#include "detail/RouteTable.h"
 #include "detail/RequestHandler.h"
+#include "detail/RequestParser.h"
 
 namespace fs {
 class FS;
@@ -80,6 +98,12 @@ public:
   virtual void close();
   void stop();
 
+  bool hasPendingClient(); // a client is connected and its request has not been handled yet
+
+  // Keeps the connection open after a response for the next requests of the client (off by default),
+  // until it stays idle for timeout ms or maxRequests were served on it
+  void setKeepAlive(bool enable, uint16_t maxRequests = HTTP_KEEPALIVE_MAX, unsigned long timeout = HTTP_KEEPALIVE_TIMEOUT);
+
   bool authenticate(const char * username, const char * password);
   void requestAuthentication(HTTPAuthMethod mode = BASIC_AUTH, const char* realm = NULL, const String& authFailMsg = String("") );
 
@@ -138,17 +162,19 @@ public:
 protected:
   virtual size_t _currentClientWrite(const char* b, size_t l) { return _currentClient.write( b, l ); }
   virtual size_t _currentClientWrite_P(PGM_P b, size_t l) { return _currentClient.write_P( b, l ); }
+  virtual size_t _currentClientWritev(const WriteBuffer* b, size_t c) { return _currentClient.writev( b, c ); }
   void _addRequestHandler(RequestHandler* handler);
   void _handleRequest();
   void _finalizeResponse();
+  void _nextRequest();
   bool _parseRequest(WiFiClient& client);
   void _parseArguments(String data);
   static String _responseCodeToString(int code);
-  bool _parseForm(WiFiClient& client, String boundary, uint32_t len);
+  static PGM_P _responseCodeText(int code);
+  bool _parseForm(RequestBody& client, const String& boundary, uint32_t len);
   bool _parseFormUploadAborted();
-  void _uploadWriteByte(uint8_t b);
-  uint8_t _uploadReadByte(WiFiClient& client);
-  void _prepareHeader(String& response, int code, const char* content_type, size_t contentLength);
+  size_t _prepareHeader(char* head, size_t& split, int code, const char* content_type, size_t contentLength);
+  void _sendResponse(int code, const char* content_type, size_t contentLength, const char* content = nullptr, size_t length = 0);
   bool _collectHeader(const char* headerName, const char* headerValue);
  
   void _streamFileCore(const size_t fileSize, const String & fileName, const String & contentType);
@@ -170,13 +196,24 @@ protected:
   uint8_t     _currentVersion;
   HTTPClientStatus _currentStatus;
   unsigned long _statusChange;
+  uint16_t      _currentRequests;   // served on the current connection
+  bool          _requestKeepAlive;  // the client of the request accepts to keep the connection
+  bool          _currentKeepAlive;  // the response keeps the connection
+
+  bool          _keepAlive;
+  uint16_t      _keepAliveMax;
+  unsigned long _keepAliveTimeout;
 
   RequestHandler*  _currentHandler;
   RequestHandler*  _firstHandler;
   RequestHandler*  _lastHandler;
+  RouteTable<RequestHandler> _routes;
   THandlerFunction _notFoundHandler;
   THandlerFunction _fileUploadHandler;
 
+  RequestParser    _request;
+  char             _requestBuf[HTTP_REQUEST_BUFLEN];
+
   int              _currentArgCount;
   RequestArgument* _currentArgs;
   std::unique_ptr<HTTPUpload> _currentUpload;
@@ -88,6 +88,8 @@ void ESP8266WebServerSecure::handleClient() {
     _currentClientSecure = client;
     _currentStatus = HC_WAIT_READ;
     _statusChange = millis();
+    _currentRequests = 0;
+    _request.begin(_requestBuf, sizeof(_requestBuf));
   }
 
   bool keepCurrentClient = false;
@@ -99,21 +101,27 @@ void ESP8266WebServerSecure::handleClient() {
       // No-op to avoid C++ compiler warning
       break;
     case HC_WAIT_READ:
-      // Wait for data from client to become available
-      if (_currentClientSecure.available()) {
+      // Wait for data from client to become available, a pipelined request may already be in _request
+      if (_request.available() || _currentClientSecure.available()) {
         if (_parseRequest(_currentClientSecure)) {
           _currentClientSecure.setTimeout(HTTP_MAX_SEND_WAIT);
           _contentLength = CONTENT_LENGTH_NOT_SET;
           _handleRequest();
 
           if (_currentClientSecure.connected()) {
-            _currentStatus = HC_WAIT_CLOSE;
+            if (_currentKeepAlive) {
+              _nextRequest();
+            } else {
+              _currentStatus = HC_WAIT_CLOSE;
+            }
             _statusChange = millis();
             keepCurrentClient = true;
           }
         }
       } else { // !_currentClient.available()
-        if (millis() - _statusChange <= HTTP_MAX_DATA_WAIT) {
+        // a kept connection waits for its next request, unless another client is waiting for the server
+        if (_currentRequests ? millis() - _statusChange <= _keepAliveTimeout && !_serverSecure.hasClient()
+                             : millis() - _statusChange <= HTTP_MAX_DATA_WAIT) {
           keepCurrentClient = true;
         }
         callYield = true;
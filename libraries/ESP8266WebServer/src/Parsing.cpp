@@ -24,6 +24,7 @@
 #include "WiFiClient.h"
 #include "ESP8266WebServer.h"
 #include "detail/mimetable.h"
+#include "detail/MultipartReader.h"
 
 //#define DEBUG_ESP_HTTP_SERVER
 #ifdef DEBUG_ESP_PORT
@@ -35,7 +36,41 @@
 static const char Content_Type[] PROGMEM = "Content-Type";
 static const char filename[] PROGMEM = "filename";
 
-static char* readBytesWithTimeout(WiFiClient& client, size_t maxLength, size_t& dataLength, int timeout_ms)
+// The client, with the bytes the request parser received past the headers in front
+class RequestBody {
+public:
+  RequestBody(WiFiClient& client, RequestParser& request) : _client(client), _request(request), _left(SIZE_MAX) {}
+
+  // Ends the body after length more bytes, as if the client closed the connection there
+  void limit(size_t length) { _left = length; }
+
+  size_t available() {
+    size_t n = _request.available() + _client.available();
+    return n < _left ? n : _left;
+  }
+
+  bool connected() { return _left && (_request.available() || _client.connected()); }
+
+  size_t read(uint8_t* buf, size_t size) {
+    if (size > _left)
+      size = _left;
+    size_t n = _request.read(buf, size);
+    if (n < size) {
+      int res = _client.read(buf + n, size - n);
+      if (res > 0)
+        n += res;
+    }
+    _left -= n;
+    return n;
+  }
+
+private:
+  WiFiClient& _client;
+  RequestParser& _request;
+  size_t _left;
+};
+
+static char* readBytesWithTimeout(RequestBody& client, size_t maxLength, size_t& dataLength, int timeout_ms)
 {
   char *buf = nullptr;
   dataLength = 0;
@@ -46,6 +81,10 @@ static char* readBytesWithTimeout(WiFiClient& client, size_t maxLength, size_t&
     if (!newLength) {
       break;
     }
+    // not past the body, a pipelined request may follow it
+    if (newLength > maxLength - dataLength) {
+      newLength = maxLength - dataLength;
+    }
     if (!buf) {
       buf = (char *) malloc(newLength + 1);
       if (!buf) {
@@ -60,130 +99,120 @@ static char* readBytesWithTimeout(WiFiClient& client, size_t maxLength, size_t&
       }
       buf = newBuf;
     }
-    client.readBytes(buf + dataLength, newLength);
-    dataLength += newLength;
+    dataLength += client.read((uint8_t*) buf + dataLength, newLength);
     buf[dataLength] = '\0';
   }
   return buf;
 }
 
 bool ESP8266WebServer::_parseRequest(WiFiClient& client) {
-  // Read the first line of HTTP request
-  String req = client.readStringUntil('\r');
-  client.readStringUntil('\n');
   //reset header value
   for (int i = 0; i < _headerKeysCount; ++i) {
-    _currentHeaders[i].value =String();
-   }
-
-  // First line of HTTP request looks like "GET /path HTTP/1.1"
-  // Retrieve the "/path" part by finding the spaces
-  int addr_start = req.indexOf(' ');
-  int addr_end = req.indexOf(' ', addr_start + 1);
-  if (addr_start == -1 || addr_end == -1) {
+    if (_currentHeaders[i].value.length())
+      _currentHeaders[i].value.remove(0);
+  }
+  _hostHeader.remove(0);
+  _currentKeepAlive = false;
+
+  String boundaryStr;
+  bool isForm = false;
+  bool isEncoded = false;
+  uint32_t contentLength = 0;
+  bool hasContentLength = false;
+  bool connectionClose = false;
+  bool connectionKeepAlive = false;
+  bool chunkedBody = false;
+  //the request line and the headers are parsed in place in _requestBuf, only collected headers are copied
+  auto onHeader = [&](const char* headerName, const char* headerValue){
 #ifdef DEBUG_ESP_HTTP_SERVER
-    DEBUG_OUTPUT.print("Invalid request: ");
-    DEBUG_OUTPUT.println(req);
+    DEBUG_OUTPUT.print("headerName: ");
+    DEBUG_OUTPUT.println(headerName);
+    DEBUG_OUTPUT.print("headerValue: ");
+    DEBUG_OUTPUT.println(headerValue);
+#endif
+    if (strcasecmp_P(headerName, Content_Type) == 0){
+      isForm = false;
+      isEncoded = false;
+      if (strncmp_P(headerValue, PSTR("application/x-www-form-urlencoded"), 33) == 0){
+        isEncoded = true;
+      } else if (strncmp_P(headerValue, PSTR("multipart/"), 10) == 0){
+        const char* boundary = strchr(headerValue, '=');
+        boundaryStr = boundary ? boundary + 1 : "";
+        boundaryStr.replace("\"","");
+        isForm = true;
+      }
+    } else if (strcasecmp_P(headerName, PSTR("Content-Length")) == 0){
+      contentLength = strtoul(headerValue, NULL, 10);
+      hasContentLength = true;
+    } else if (strcasecmp_P(headerName, PSTR("Host")) == 0){
+      _hostHeader = headerValue;
+    } else if (strcasecmp_P(headerName, PSTR("Connection")) == 0){
+      connectionClose = strncasecmp_P(headerValue, PSTR("close"), 5) == 0;
+      connectionKeepAlive = strncasecmp_P(headerValue, PSTR("keep-alive"), 10) == 0;
+    } else if (strcasecmp_P(headerName, PSTR("Transfer-Encoding")) == 0){
+      chunkedBody = true;
+    }
+    _collectHeader(headerName, headerValue);
+  };
+
+  //_request is started by handleClient() for a new connection, then by _nextRequest() over what is left of the previous request
+  unsigned long start = millis();
+  RequestParser::Result result;
+  while ((result = _request.parse(onHeader)) == RequestParser::NEED_MORE) {
+    size_t avail;
+    while (!(avail = client.available())) {
+      if (!client.connected() || millis() - start > HTTP_MAX_DATA_WAIT)
+        return false;
+      delay(1);
+    }
+    if (avail > _request.room())
+      avail = _request.room();
+    int res = client.read((uint8_t*) _request.space(), avail);
+    if (res > 0)
+      _request.received(res);
+  }
+  if (result != RequestParser::DONE) {
+#ifdef DEBUG_ESP_HTTP_SERVER
+    DEBUG_OUTPUT.println(result == RequestParser::TOO_LARGE ? "Request line or header too long" : "Invalid request");
 #endif
     return false;
   }
 
-  String methodStr = req.substring(0, addr_start);
-  String url = req.substring(addr_start + 1, addr_end);
-  String versionEnd = req.substring(addr_end + 8);
-  _currentVersion = atoi(versionEnd.c_str());
-  String searchStr = "";
-  int hasSearch = url.indexOf('?');
-  if (hasSearch != -1){
-    searchStr = url.substring(hasSearch + 1);
-    url = url.substring(0, hasSearch);
-  }
-  _currentUri = url;
+  HTTPMethod method = _request.method();
+  _currentMethod = method;
+  _currentUri = _request.uri();
+  _currentVersion = _request.version();
   _chunked = false;
+  String searchStr = _request.query();
 
-  HTTPMethod method = HTTP_GET;
-  if (methodStr == F("POST")) {
-    method = HTTP_POST;
-  } else if (methodStr == F("DELETE")) {
-    method = HTTP_DELETE;
-  } else if (methodStr == F("OPTIONS")) {
-    method = HTTP_OPTIONS;
-  } else if (methodStr == F("PUT")) {
-    method = HTTP_PUT;
-  } else if (methodStr == F("PATCH")) {
-    method = HTTP_PATCH;
-  }
-  _currentMethod = method;
+  // HTTP/1.1 keeps the connection unless the client asks to close it, HTTP/1.0 only if it asks to keep it.
+  // The next request can only be found after a body of known length that is read to its end.
+  // HEAD is answered like GET, with a body the client does not read, so it closes the connection
+  bool hasBody = method == HTTP_POST || method == HTTP_PUT || method == HTTP_PATCH || method == HTTP_DELETE;
+  _requestKeepAlive = _keepAlive && _currentRequests + 1 < _keepAliveMax && _request.knownMethod()
+                      && (_currentVersion ? !connectionClose : connectionKeepAlive)
+                      && !chunkedBody && !(hasBody ? isForm : contentLength);
 
 #ifdef DEBUG_ESP_HTTP_SERVER
   DEBUG_OUTPUT.print("method: ");
-  DEBUG_OUTPUT.print(methodStr);
+  DEBUG_OUTPUT.print(method);
   DEBUG_OUTPUT.print(" url: ");
-  DEBUG_OUTPUT.print(url);
+  DEBUG_OUTPUT.print(_currentUri);
   DEBUG_OUTPUT.print(" search: ");
   DEBUG_OUTPUT.println(searchStr);
 #endif
 
-  //attach handler
-  RequestHandler* handler;
-  for (handler = _firstHandler; handler; handler = handler->next()) {
-    if (handler->canHandle(_currentMethod, _currentUri))
-      break;
-  }
-  _currentHandler = handler;
+  //attach handler, only the handlers routed to this URI are asked
+  _currentHandler = _routes.find(_currentUri.c_str(), [&](RequestHandler* handler){
+    return handler->canHandle(_currentMethod, _currentUri);
+  });
 
-  String formData;
+  RequestBody body(client, _request);
   // below is needed only when POST type request
-  if (method == HTTP_POST || method == HTTP_PUT || method == HTTP_PATCH || method == HTTP_DELETE){
-    String boundaryStr;
-    String headerName;
-    String headerValue;
-    bool isForm = false;
-    bool isEncoded = false;
-    uint32_t contentLength = 0;
-    //parse headers
-    while(1){
-      req = client.readStringUntil('\r');
-      client.readStringUntil('\n');
-      if (req == "") break;//no moar headers
-      int headerDiv = req.indexOf(':');
-      if (headerDiv == -1){
-        break;
-      }
-      headerName = req.substring(0, headerDiv);
-      headerValue = req.substring(headerDiv + 1);
-      headerValue.trim();
-       _collectHeader(headerName.c_str(),headerValue.c_str());
-
-      #ifdef DEBUG_ESP_HTTP_SERVER
-      DEBUG_OUTPUT.print("headerName: ");
-      DEBUG_OUTPUT.println(headerName);
-      DEBUG_OUTPUT.print("headerValue: ");
-      DEBUG_OUTPUT.println(headerValue);
-      #endif
-
-      if (headerName.equalsIgnoreCase(FPSTR(Content_Type))){
-        using namespace mime;
-        if (headerValue.startsWith(FPSTR(mimeTable[txt].mimeType))){
-          isForm = false;
-        } else if (headerValue.startsWith(F("application/x-www-form-urlencoded"))){
-          isForm = false;
-          isEncoded = true;
-        } else if (headerValue.startsWith(F("multipart/"))){
-          boundaryStr = headerValue.substring(headerValue.indexOf('=') + 1);
-          boundaryStr.replace("\"","");
-          isForm = true;
-        }
-      } else if (headerName.equalsIgnoreCase(F("Content-Length"))){
-        contentLength = headerValue.toInt();
-      } else if (headerName.equalsIgnoreCase(F("Host"))){
-        _hostHeader = headerValue;
-      }
-    }
-
+  if (hasBody){
     if (!isForm){
       size_t plainLength;
-      char* plainBuf = readBytesWithTimeout(client, contentLength, plainLength, HTTP_MAX_POST_WAIT);
+      char* plainBuf = readBytesWithTimeout(body, contentLength, plainLength, HTTP_MAX_POST_WAIT);
       if (plainLength < contentLength) {
       	free(plainBuf);
       	return false;
@@ -211,48 +240,21 @@ bool ESP8266WebServer::_parseRequest(WiFiClient& client) {
         // No content - but we can still have arguments in the URL.
         _parseArguments(searchStr);
       }
-    }
-
-    if (isForm){
+    } else {
       _parseArguments(searchStr);
-      if (!_parseForm(client, boundaryStr, contentLength)) {
+      // a form without Content-Length is read until the client closes the connection
+      if (!_parseForm(body, boundaryStr, hasContentLength ? contentLength : UINT32_MAX)) {
         return false;
       }
     }
   } else {
-    String headerName;
-    String headerValue;
-    //parse headers
-    while(1){
-      req = client.readStringUntil('\r');
-      client.readStringUntil('\n');
-      if (req == "") break;//no moar headers
-      int headerDiv = req.indexOf(':');
-      if (headerDiv == -1){
-        break;
-      }
-      headerName = req.substring(0, headerDiv);
-      headerValue = req.substring(headerDiv + 2);
-      _collectHeader(headerName.c_str(),headerValue.c_str());
-
-	  #ifdef DEBUG_ESP_HTTP_SERVER
-	  DEBUG_OUTPUT.print("headerName: ");
-	  DEBUG_OUTPUT.println(headerName);
-	  DEBUG_OUTPUT.print("headerValue: ");
-	  DEBUG_OUTPUT.println(headerValue);
-	  #endif
-
-	  if (headerName.equalsIgnoreCase("Host")){
-        _hostHeader = headerValue;
-      }
-    }
     _parseArguments(searchStr);
   }
   client.flush();
 
 #ifdef DEBUG_ESP_HTTP_SERVER
   DEBUG_OUTPUT.print("Request: ");
-  DEBUG_OUTPUT.println(url);
+  DEBUG_OUTPUT.println(_currentUri);
   DEBUG_OUTPUT.print(" Arguments: ");
   DEBUG_OUTPUT.println(searchStr);
 #endif
@@ -262,7 +264,7 @@ bool ESP8266WebServer::_parseRequest(WiFiClient& client) {
 
 bool ESP8266WebServer::_collectHeader(const char* headerName, const char* headerValue) {
   for (int i = 0; i < _headerKeysCount; i++) {
-    if (_currentHeaders[i].key.equalsIgnoreCase(headerName)) {
+    if (strcasecmp(_currentHeaders[i].key.c_str(), headerName) == 0) {
             _currentHeaders[i].value=headerValue;
             return true;
         }
@@ -345,59 +347,54 @@ void ESP8266WebServer::_parseArguments(String data) {
 
 }
 
-void ESP8266WebServer::_uploadWriteByte(uint8_t b){
-  if (_currentUpload->currentSize == HTTP_UPLOAD_BUFLEN){
-    if(_currentHandler && _currentHandler->canUpload(_currentUri))
-      _currentHandler->upload(*this, _currentUri, *_currentUpload);
-    _currentUpload->totalSize += _currentUpload->currentSize;
-    _currentUpload->currentSize = 0;
-  }
-  _currentUpload->buf[_currentUpload->currentSize++] = b;
-}
-
-uint8_t ESP8266WebServer::_uploadReadByte(WiFiClient& client){
-  int res = client.read();
-  if(res == -1){
-    while(!client.available() && client.connected())
-      yield();
-    res = client.read();
-  }
-  return (uint8_t)res;
-}
-
-bool ESP8266WebServer::_parseForm(WiFiClient& client, String boundary, uint32_t len){
-  (void) len;
+bool ESP8266WebServer::_parseForm(RequestBody& client, const String& boundary, uint32_t len){
 #ifdef DEBUG_ESP_HTTP_SERVER
   DEBUG_OUTPUT.print("Parse Form: Boundary: ");
   DEBUG_OUTPUT.print(boundary);
   DEBUG_OUTPUT.print(" Length: ");
   DEBUG_OUTPUT.println(len);
 #endif
-  String line;
-  int retry = 0;
-  do {
-    line = client.readStringUntil('\r');
-    ++retry;
-  } while (line.length() == 0 && retry < 3);
-
-  client.readStringUntil('\n');
-  //start reading the form
-  if (line == ("--"+boundary)){
-    RequestArgument* postArgs = new RequestArgument[32];
-    int postArgsLen = 0;
+  // the body is read in blocks into the upload buffer, file data is handed to the upload handler from there.
+  // Nothing is read past len: a form that is not closed by then fails instead of waiting for more data
+  if (len != UINT32_MAX)
+    client.limit(len);
+  _currentUpload.reset(new HTTPUpload());
+  _currentUpload->totalSize = 0;
+  _currentUpload->currentSize = 0;
+  MultipartReader<RequestBody> reader(client, _currentUpload->buf, HTTP_UPLOAD_BUFLEN, boundary.c_str(), HTTP_MAX_POST_WAIT);
+  const char* line;
+  size_t lineLen;
+  //start reading the form, "--" after the boundary closes it
+  bool done;
+  if (!reader.valid() || !reader.begin() || !reader.readDelimiterEnd(done)){
+#ifdef DEBUG_ESP_HTTP_SERVER
+    DEBUG_OUTPUT.println("Error: no boundary");
+#endif
+    return false;
+  }
+  bool failed = false;
+  RequestArgument* postArgs = new RequestArgument[32];
+  int postArgsLen = 0;
+  while(!done){
+    String argName;
+    String argType;
+    String argFilename;
+    bool argIsFile = false;
+    using namespace mime;
+    argType = FPSTR(mimeTable[txt].mimeType);
+
+    //part headers, up to the empty line
     while(1){
-      String argName;
-      String argValue;
-      String argType;
-      String argFilename;
-      bool argIsFile = false;
-
-      line = client.readStringUntil('\r');
-      client.readStringUntil('\n');
-      if (line.length() > 19 && line.substring(0, 19).equalsIgnoreCase(F("Content-Disposition"))){
-        int nameStart = line.indexOf('=');
+      if (!reader.readLine(line, lineLen)){
+        failed = true;
+        break;
+      }
+      if (lineLen == 0) break;
+      if (lineLen > 19 && strncasecmp_P(line, PSTR("Content-Disposition"), 19) == 0){
+        argName = line;
+        int nameStart = argName.indexOf('=');
         if (nameStart != -1){
-          argName = line.substring(nameStart+2);
+          argName = argName.substring(nameStart+2);
           nameStart = argName.indexOf('=');
           if (nameStart == -1){
             argName = argName.substring(0, argName.length() - 1);
@@ -413,168 +410,126 @@ bool ESP8266WebServer::_parseForm(WiFiClient& client, String boundary, uint32_t
             if (argFilename == F("blob") && hasArg(FPSTR(filename))) 
               argFilename = arg(FPSTR(filename));
           }
+        }
 #ifdef DEBUG_ESP_HTTP_SERVER
-          DEBUG_OUTPUT.print("PostArg Name: ");
-          DEBUG_OUTPUT.println(argName);
-#endif
-          using namespace mime;
-          argType = FPSTR(mimeTable[txt].mimeType);
-          line = client.readStringUntil('\r');
-          client.readStringUntil('\n');
-          if (line.length() > 12 && line.substring(0, 12).equalsIgnoreCase(FPSTR(Content_Type))){
-            argType = line.substring(line.indexOf(':')+2);
-            //skip next line
-            client.readStringUntil('\r');
-            client.readStringUntil('\n');
-          }
-#ifdef DEBUG_ESP_HTTP_SERVER
-          DEBUG_OUTPUT.print("PostArg Type: ");
-          DEBUG_OUTPUT.println(argType);
+        DEBUG_OUTPUT.print("PostArg Name: ");
+        DEBUG_OUTPUT.println(argName);
 #endif
-          if (!argIsFile){
-            while(1){
-              line = client.readStringUntil('\r');
-              client.readStringUntil('\n');
-              if (line.startsWith("--"+boundary)) break;
-              if (argValue.length() > 0) argValue += "\n";
-              argValue += line;
-            }
+      } else if (lineLen > 12 && strncasecmp_P(line, Content_Type, 12) == 0){
+        const char* value = strchr(line, ':');
+        if (value){
+          while (*++value == ' ');
+          argType = value;
+        }
 #ifdef DEBUG_ESP_HTTP_SERVER
-            DEBUG_OUTPUT.print("PostArg Value: ");
-            DEBUG_OUTPUT.println(argValue);
-            DEBUG_OUTPUT.println();
+        DEBUG_OUTPUT.print("PostArg Type: ");
+        DEBUG_OUTPUT.println(argType);
 #endif
+      }
+    }
+    if (failed) break;
 
-            RequestArgument& arg = postArgs[postArgsLen++];
-            arg.key = argName;
-            arg.value = argValue;
-
-            if (line == ("--"+boundary+"--")){
-#ifdef DEBUG_ESP_HTTP_SERVER
-              DEBUG_OUTPUT.println("Done Parsing POST");
-#endif
-              break;
-            }
-          } else {
-            _currentUpload.reset(new HTTPUpload());
-            _currentUpload->status = UPLOAD_FILE_START;
-            _currentUpload->name = argName;
-            _currentUpload->filename = argFilename;
-            _currentUpload->type = argType;
-            _currentUpload->totalSize = 0;
-            _currentUpload->currentSize = 0;
+    if (!argIsFile){
+      String argValue;
+      bool received = reader.readPart([&](const uint8_t* data, size_t length){
+        argValue.reserve(argValue.length() + length);
+        for (size_t i = 0; i < length; i++)
+          argValue += (char)data[i];
+      });
+      if (!received){
+        failed = true;
+        break;
+      }
+      //lines used to be joined with LF
+      argValue.replace("\r\n", "\n");
 #ifdef DEBUG_ESP_HTTP_SERVER
-            DEBUG_OUTPUT.print("Start File: ");
-            DEBUG_OUTPUT.print(_currentUpload->filename);
-            DEBUG_OUTPUT.print(" Type: ");
-            DEBUG_OUTPUT.println(_currentUpload->type);
+      DEBUG_OUTPUT.print("PostArg Value: ");
+      DEBUG_OUTPUT.println(argValue);
+      DEBUG_OUTPUT.println();
 #endif
-            if(_currentHandler && _currentHandler->canUpload(_currentUri))
-              _currentHandler->upload(*this, _currentUri, *_currentUpload);
-            _currentUpload->status = UPLOAD_FILE_WRITE;
-            uint8_t argByte = _uploadReadByte(client);
-readfile:
-            while(argByte != 0x0D){
-              if (!client.connected()) return _parseFormUploadAborted();
-              _uploadWriteByte(argByte);
-              argByte = _uploadReadByte(client);
-            }
-
-            argByte = _uploadReadByte(client);
-            if (!client.connected()) return _parseFormUploadAborted();
-            if (argByte == 0x0A){
-              argByte = _uploadReadByte(client);
-              if (!client.connected()) return _parseFormUploadAborted();
-              if ((char)argByte != '-'){
-                //continue reading the file
-                _uploadWriteByte(0x0D);
-                _uploadWriteByte(0x0A);
-                goto readfile;
-              } else {
-                argByte = _uploadReadByte(client);
-                if (!client.connected()) return _parseFormUploadAborted();
-                if ((char)argByte != '-'){
-                  //continue reading the file
-                  _uploadWriteByte(0x0D);
-                  _uploadWriteByte(0x0A);
-                  _uploadWriteByte((uint8_t)('-'));
-                  goto readfile;
-                }
-              }
-
-              uint8_t endBuf[boundary.length()];
-              client.readBytes(endBuf, boundary.length());
-
-              if (strstr((const char*)endBuf, boundary.c_str()) != NULL){
-                if(_currentHandler && _currentHandler->canUpload(_currentUri))
-                  _currentHandler->upload(*this, _currentUri, *_currentUpload);
-                _currentUpload->totalSize += _currentUpload->currentSize;
-                _currentUpload->status = UPLOAD_FILE_END;
-                if(_currentHandler && _currentHandler->canUpload(_currentUri))
-                  _currentHandler->upload(*this, _currentUri, *_currentUpload);
+      if (postArgsLen < 32){
+        RequestArgument& arg = postArgs[postArgsLen++];
+        arg.key = argName;
+        arg.value = argValue;
+      }
+    } else {
+      bool canUpload = _currentHandler && _currentHandler->canUpload(_currentUri);
+      _currentUpload->status = UPLOAD_FILE_START;
+      _currentUpload->name = argName;
+      _currentUpload->filename = argFilename;
+      _currentUpload->type = argType;
+      _currentUpload->totalSize = 0;
+      _currentUpload->currentSize = 0;
 #ifdef DEBUG_ESP_HTTP_SERVER
-                DEBUG_OUTPUT.print("End File: ");
-                DEBUG_OUTPUT.print(_currentUpload->filename);
-                DEBUG_OUTPUT.print(" Type: ");
-                DEBUG_OUTPUT.print(_currentUpload->type);
-                DEBUG_OUTPUT.print(" Size: ");
-                DEBUG_OUTPUT.println(_currentUpload->totalSize);
+      DEBUG_OUTPUT.print("Start File: ");
+      DEBUG_OUTPUT.print(_currentUpload->filename);
+      DEBUG_OUTPUT.print(" Type: ");
+      DEBUG_OUTPUT.println(_currentUpload->type);
 #endif
-                line = client.readStringUntil(0x0D);
-                client.readStringUntil(0x0A);
-                if (line == "--"){
+      if(canUpload)
+        _currentHandler->upload(*this, _currentUri, *_currentUpload);
+      _currentUpload->status = UPLOAD_FILE_WRITE;
+      //every slice is already at the start of upload.buf
+      bool received = reader.readPart([&](const uint8_t* data, size_t length){
+        (void) data;
+        _currentUpload->currentSize = length;
+        if(canUpload)
+          _currentHandler->upload(*this, _currentUri, *_currentUpload);
+        _currentUpload->totalSize += length;
+      });
+      if (!received){
+        delete[] postArgs;
+        return _parseFormUploadAborted();
+      }
+      _currentUpload->currentSize = 0;
+      _currentUpload->status = UPLOAD_FILE_END;
+      if(canUpload)
+        _currentHandler->upload(*this, _currentUri, *_currentUpload);
 #ifdef DEBUG_ESP_HTTP_SERVER
-                  DEBUG_OUTPUT.println("Done Parsing POST");
+      DEBUG_OUTPUT.print("End File: ");
+      DEBUG_OUTPUT.print(_currentUpload->filename);
+      DEBUG_OUTPUT.print(" Type: ");
+      DEBUG_OUTPUT.print(_currentUpload->type);
+      DEBUG_OUTPUT.print(" Size: ");
+      DEBUG_OUTPUT.println(_currentUpload->totalSize);
 #endif
-                  break;
-                }
-                continue;
-              } else {
-                _uploadWriteByte(0x0D);
-                _uploadWriteByte(0x0A);
-                _uploadWriteByte((uint8_t)('-'));
-                _uploadWriteByte((uint8_t)('-'));
-                uint32_t i = 0;
-                while(i < boundary.length()){
-                  _uploadWriteByte(endBuf[i++]);
-                }
-                argByte = _uploadReadByte(client);
-                goto readfile;
-              }
-            } else {
-              _uploadWriteByte(0x0D);
-              goto readfile;
-            }
-            break;
-          }
-        }
-      }
     }
 
-    int iarg;
-    int totalArgs = ((32 - postArgsLen) < _currentArgCount)?(32 - postArgsLen):_currentArgCount;
-    for (iarg = 0; iarg < totalArgs; iarg++){
-      RequestArgument& arg = postArgs[postArgsLen++];
-      arg.key = _currentArgs[iarg].key;
-      arg.value = _currentArgs[iarg].value;
-    }
-    if (_currentArgs) delete[] _currentArgs;
-    _currentArgs = new RequestArgument[postArgsLen];
-    for (iarg = 0; iarg < postArgsLen; iarg++){
-      RequestArgument& arg = _currentArgs[iarg];
-      arg.key = postArgs[iarg].key;
-      arg.value = postArgs[iarg].value;
+    //rest of the boundary line, the body may end right after the closing "--"
+    if (!reader.readDelimiterEnd(done)){
+      failed = true;
+      break;
     }
-    _currentArgCount = iarg;
-    if (postArgs) 
-      delete[] postArgs;
-    return true;
   }
+
+  if (failed){
 #ifdef DEBUG_ESP_HTTP_SERVER
-  DEBUG_OUTPUT.print("Error: line: ");
-  DEBUG_OUTPUT.println(line);
+    DEBUG_OUTPUT.println("Error: form truncated");
 #endif
-  return false;
+    delete[] postArgs;
+    return false;
+  }
+#ifdef DEBUG_ESP_HTTP_SERVER
+  DEBUG_OUTPUT.println("Done Parsing POST");
+#endif
+
+  int iarg;
+  int totalArgs = ((32 - postArgsLen) < _currentArgCount)?(32 - postArgsLen):_currentArgCount;
+  for (iarg = 0; iarg < totalArgs; iarg++){
+    RequestArgument& arg = postArgs[postArgsLen++];
+    arg.key = _currentArgs[iarg].key;
+    arg.value = _currentArgs[iarg].value;
+  }
+  if (_currentArgs) delete[] _currentArgs;
+  _currentArgs = new RequestArgument[postArgsLen];
+  for (iarg = 0; iarg < postArgsLen; iarg++){
+    RequestArgument& arg = _currentArgs[iarg];
+    arg.key = postArgs[iarg].key;
+    arg.value = postArgs[iarg].value;
+  }
+  _currentArgCount = iarg;
+  delete[] postArgs;
+  return true;
 }
 
 String ESP8266WebServer::urlDecode(const String& text)
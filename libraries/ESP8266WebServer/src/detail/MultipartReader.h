@@ -0,0 +1,196 @@
+#ifndef MULTIPARTREADER_H
+#define MULTIPARTREADER_H
+
+#include <string.h>
+
+// Longest boundary accepted, RFC 2046 allows 70 characters
+#define MULTIPART_BOUNDARY_MAX 70
+
+// Reads a multipart/form-data body in blocks, as many bytes as the client has
+// received at once, into a buffer owned by the caller (the upload buffer).
+// Part data is returned as slices at the start of that buffer, the delimiter
+// ("\r\n--" boundary) is found with a Boyer-Moore-Horspool search.
+// Needs millis() and yield(), the client needs available(), connected() and
+// read(uint8_t*, size_t).
+template<typename Client>
+class MultipartReader {
+public:
+  MultipartReader(Client& client, uint8_t* buf, size_t size, const char* boundary, unsigned long timeout)
+  : _client(client)
+  , _buf(buf)
+  , _size(size)
+  , _len(0)
+  , _pos(0)
+  , _timeout(timeout)
+  {
+    size_t boundaryLen = strlen(boundary);
+    if (boundaryLen > MULTIPART_BOUNDARY_MAX)
+      boundaryLen = 0; // valid() fails
+    memcpy(_delim, "\r\n--", 4);
+    memcpy(_delim + 4, boundary, boundaryLen);
+    _delimLen = boundaryLen ? boundaryLen + 4 : 0;
+    for (size_t i = 0; i < 256; i++)
+      _skip[i] = _delimLen;
+    for (size_t i = 0; _delimLen && i < _delimLen - 1; i++)
+      _skip[_delim[i]] = _delimLen - 1 - i;
+  }
+
+  bool valid() const {
+    return _delimLen && _size > 2 * _delimLen;
+  }
+
+  // Reads the next line, it is returned NUL terminated without its CRLF and
+  // stays valid until the next call. Fails on timeout or on a line that
+  // does not fit in the buffer.
+  bool readLine(const char*& line, size_t& length) {
+    size_t from = _pos;
+    while (true) {
+      uint8_t* nl = (uint8_t*) memchr(_buf + from, '\n', _len - from);
+      if (nl) {
+        uint8_t* start = _buf + _pos;
+        length = nl - start;
+        if (length && start[length - 1] == '\r')
+          length--;
+        start[length] = 0;
+        _pos = nl + 1 - _buf;
+        line = (const char*) start;
+        return true;
+      }
+      from = _len;
+      if (_pos == 0 && _len == _size)
+        return false;
+      size_t moved = _pos;
+      if (!_fill())
+        return false;
+      from -= moved;
+    }
+  }
+
+  // Makes _buf[0, length) the next slice of part data, the slice is valid
+  // until the next call. last is set when the slice ends the part, the
+  // delimiter has then been consumed and the rest of its line follows.
+  bool readData(size_t& length, bool& last) {
+    _compact();
+    size_t from = 0;
+    while (true) {
+      int found = _find(from);
+      if (found >= 0) {
+        length = found;
+        _pos = found + _delimLen;
+        last = true;
+        return true;
+      }
+      if (_len == _size) {
+        // keep what can still be the start of the delimiter
+        length = _len - (_delimLen - 1);
+        _pos = length;
+        last = false;
+        return true;
+      }
+      from = _len >= _delimLen ? _len - (_delimLen - 1) : 0;
+      if (!_fill())
+        return false;
+    }
+  }
+
+  // Reads the data of the part up to the delimiter, the body starts with a
+  // delimiter that has no CRLF in front of it, so this is used for that too
+  template<typename Fn>
+  bool readPart(Fn fn) {
+    bool last = false;
+    size_t length;
+    while (!last) {
+      if (!readData(length, last))
+        return false;
+      if (length)
+        fn(_buf, length);
+    }
+    return true;
+  }
+
+  // Reads what follows a delimiter. close is set for the close delimiter,
+  // "--" after the boundary, which may end the body without a CRLF, the
+  // rest of any other delimiter line is skipped.
+  bool readDelimiterEnd(bool& close) {
+    while (_len - _pos < 2) {
+      if (!_fill())
+        return false;
+    }
+    close = _buf[_pos] == '-' && _buf[_pos + 1] == '-';
+    if (close) {
+      _pos += 2;
+      return true;
+    }
+    const char* line;
+    size_t length;
+    return readLine(line, length);
+  }
+
+  // Finds the first delimiter, skipping the preamble
+  bool begin() {
+    // "--boundary" at the very start has no CRLF, give it one
+    while (_len < 2) {
+      if (!_fill())
+        return false;
+    }
+    if (_buf[0] == '-' && _buf[1] == '-') {
+      if (_len + 2 > _size)
+        return false;
+      memmove(_buf + 2, _buf, _len);
+      _buf[0] = '\r';
+      _buf[1] = '\n';
+      _len += 2;
+    }
+    return readPart([](const uint8_t*, size_t) {});
+  }
+
+private:
+  void _compact() {
+    if (_pos) {
+      memmove(_buf, _buf + _pos, _len - _pos);
+      _len -= _pos;
+      _pos = 0;
+    }
+  }
+
+  bool _fill() {
+    _compact();
+    if (_len == _size)
+      return true;
+    unsigned long start = millis();
+    size_t avail;
+    while (!(avail = _client.available())) {
+      if (!_client.connected() || millis() - start > _timeout)
+        return false;
+      yield();
+    }
+    if (avail > _size - _len)
+      avail = _size - _len;
+    _len += _client.read(_buf + _len, avail);
+    return true;
+  }
+
+  int _find(size_t from) const {
+    if (_len < _delimLen)
+      return -1;
+    const size_t last = _delimLen - 1;
+    const uint8_t lastByte = _delim[last];
+    for (size_t i = from; i + last < _len; i += _skip[_buf[i + last]]) {
+      if (_buf[i + last] == lastByte && memcmp(_buf + i, _delim, last) == 0)
+        return (int) i;
+    }
+    return -1;
+  }
+
+  Client&  _client;
+  uint8_t* _buf;
+  size_t   _size;
+  size_t   _len;   // bytes in _buf
+  size_t   _pos;   // bytes of _buf already consumed
+  unsigned long _timeout;
+  uint8_t  _delim[MULTIPART_BOUNDARY_MAX + 4];
+  size_t   _delimLen;
+  uint8_t  _skip[256];
+};
+
+#endif //MULTIPARTREADER_H
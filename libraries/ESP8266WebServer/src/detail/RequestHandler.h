@@ -9,6 +9,11 @@ public:
     virtual bool handle(ESP8266WebServer& server, HTTPMethod requestMethod, String requestUri) { (void) server; (void) requestMethod; (void) requestUri; return false; }
     virtual void upload(ESP8266WebServer& server, String requestUri, HTTPUpload& upload) { (void) server; (void) requestUri; (void) upload; }
 
+    // Path the handler is put under in the route table of the server, canHandle() is then only
+    // called for URIs equal to it (ROUTE_EXACT) or starting with it (ROUTE_PREFIX).
+    // The path must stay valid as long as the handler.
+    virtual RequestRoute route(const char*& path) { (void) path; return ROUTE_NONE; }
+
     RequestHandler* next() { return _next; }
     void next(RequestHandler* r) { _next = r; }
 
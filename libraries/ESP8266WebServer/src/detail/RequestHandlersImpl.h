@@ -14,19 +14,30 @@ public:
     , _ufn(ufn)
     , _uri(uri)
     , _method(method)
+    , _prefix(false)
     {
+        // "/path/*" handles every URI starting with "/path/"
+        if (_uri.endsWith("*")) {
+            _uri.remove(_uri.length() - 1);
+            _prefix = true;
+        }
     }
 
     bool canHandle(HTTPMethod requestMethod, String requestUri) override  {
         if (_method != HTTP_ANY && _method != requestMethod)
             return false;
 
-        if (requestUri != _uri)
+        if (_prefix ? !requestUri.startsWith(_uri) : requestUri != _uri)
             return false;
 
         return true;
     }
 
+    RequestRoute route(const char*& path) override {
+        path = _uri.c_str();
+        return _prefix ? ROUTE_PREFIX : ROUTE_EXACT;
+    }
+
     bool canUpload(String requestUri) override  {
         if (!_ufn || !canHandle(HTTP_POST, requestUri))
             return false;
@@ -55,6 +66,7 @@ protected:
     ESP8266WebServer::THandlerFunction _ufn;
     String _uri;
     HTTPMethod _method;
+    bool _prefix;
 };
 
 class StaticRequestHandler : public RequestHandler {
@@ -80,6 +92,11 @@ public:
         return true;
     }
 
+    RequestRoute route(const char*& path) override {
+        path = _uri.c_str();
+        return _isFile ? ROUTE_EXACT : ROUTE_PREFIX;
+    }
+
     bool handle(ESP8266WebServer& server, HTTPMethod requestMethod, String requestUri) override {
         if (!canHandle(requestMethod, requestUri))
             return false;
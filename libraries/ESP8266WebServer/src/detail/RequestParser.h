@@ -0,0 +1,178 @@
+#ifndef REQUESTPARSER_H
+#define REQUESTPARSER_H
+
+#include <string.h>
+
+// Incremental parser of the request line and headers of an HTTP request,
+// over a buffer owned by the caller. Nothing is allocated or copied: the
+// method is matched in place, and the URI, the query and the header names
+// and values are NUL terminated views into the buffer. Bytes received past
+// the end of the headers are kept and handed out by read().
+class RequestParser {
+public:
+  enum Result { NEED_MORE, DONE, BAD_REQUEST, TOO_LARGE };
+
+  RequestParser()
+  : _buf(nullptr)
+  , _size(0)
+  {
+    begin(nullptr, 0);
+  }
+
+  // The request line and the longest header line have to fit in size bytes
+  void begin(char* buf, size_t size) {
+    _buf = buf;
+    _size = size;
+    _len = 0;
+    _pos = 0;
+    _scan = 0;
+    _keep = 0;
+    _method = HTTP_GET;
+    _known = true;
+    _uri = _query = "";
+    _version = 0;
+  }
+
+  // Starts the next request of the connection over the bytes received past
+  // the previous one, a pipelined request may already be there
+  void next() {
+    size_t left = _len - _pos;
+    memmove(_buf, _buf + _pos, left);
+    begin(_buf, _size);
+    _len = left;
+  }
+
+  // Received bytes are written at space(), room() of them at most, then passed to received()
+  char* space() { return _buf + _len; }
+  size_t room() const { return _size - _len; }
+  void received(size_t count) { _len += count; }
+
+  // Parses the lines received so far, onHeader(const char* name, const char* value)
+  // is called for every header, the views are valid during the call only
+  template<typename Fn>
+  Result parse(Fn onHeader) {
+    while (true) {
+      char* start = _buf + _pos;
+      char* nl = (char*) memchr(_buf + _scan, '\n', _len - _scan);
+      if (!nl) {
+        _scan = _len;
+        if (_len < _size)
+          return NEED_MORE;
+        if (_pos == _keep)
+          return TOO_LARGE;
+        // drop the header lines already handled, the request line stays
+        memmove(_buf + _keep, start, _len - _pos);
+        _len -= _pos - _keep;
+        _pos = _scan = _keep;
+        return NEED_MORE;
+      }
+      size_t length = nl - start;
+      _pos = _scan = nl + 1 - _buf;
+      if (length && start[length - 1] == '\r')
+        length--;
+      start[length] = 0;
+
+      if (!_keep) {
+        if (!length)
+          continue; // empty lines before the request line are ignored
+        if (!_requestLine(start, length))
+          return BAD_REQUEST;
+        _keep = _pos;
+        continue;
+      }
+      if (!length)
+        return DONE;
+
+      char* value = (char*) memchr(start, ':', length);
+      if (!value)
+        continue;
+      char* end = start + length;
+      *value++ = 0;
+      while (*value == ' ' || *value == '\t')
+        value++;
+      while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        *--end = 0;
+      onHeader((const char*) start, (const char*) value);
+    }
+  }
+
+  HTTPMethod method() const { return _method; }
+  bool knownMethod() const { return _known; } // false for HEAD and the other methods handled as GET
+  const char* uri() const { return _uri; }     // path of the request line, without the query
+  const char* query() const { return _query; } // after the '?', empty if none
+  uint8_t version() const { return _version; } // 1 for HTTP/1.1, 0 for HTTP/1.0
+
+  // Bytes received past the headers once parse() returned DONE, past the previous request after next()
+  size_t available() const { return _len - _pos; }
+
+  size_t read(uint8_t* buf, size_t size) {
+    size_t n = _len - _pos;
+    if (n > size)
+      n = size;
+    memcpy(buf, _buf + _pos, n);
+    _pos += n;
+    return n;
+  }
+
+private:
+  // "GET /path?query HTTP/1.1"
+  bool _requestLine(char* line, size_t length) {
+    char* end = line + length;
+    char* uri = (char*) memchr(line, ' ', length);
+    if (!uri)
+      return false;
+    char* version = (char*) memchr(uri + 1, ' ', end - uri - 1);
+    if (!version)
+      return false;
+    _method = _methodOf(line, uri - line);
+    _known = _method != HTTP_GET || (uri - line == 3 && memcmp(line, "GET", 3) == 0);
+    *uri++ = 0;
+    *version++ = 0;
+    _version = (end - version >= 8 && version[7] >= '0' && version[7] <= '9') ? version[7] - '0' : 0;
+    _uri = uri;
+    char* query = strchr(uri, '?');
+    if (query) {
+      *query++ = 0;
+      _query = query;
+    } else {
+      _query = version - 1; // the NUL after the URI
+    }
+    return true;
+  }
+
+  // Unknown methods are handled as GET, like HEAD
+  static HTTPMethod _methodOf(const char* name, size_t length) {
+    switch (length) {
+      case 3:
+        if (name[0] == 'P' && memcmp(name, "PUT", 3) == 0) return HTTP_PUT;
+        break;
+      case 4:
+        if (name[0] == 'P' && memcmp(name, "POST", 4) == 0) return HTTP_POST;
+        break;
+      case 5:
+        if (name[0] == 'P' && memcmp(name, "PATCH", 5) == 0) return HTTP_PATCH;
+        break;
+      case 6:
+        if (name[0] == 'D' && memcmp(name, "DELETE", 6) == 0) return HTTP_DELETE;
+        break;
+      case 7:
+        if (name[0] == 'O' && memcmp(name, "OPTIONS", 7) == 0) return HTTP_OPTIONS;
+        break;
+    }
+    return HTTP_GET;
+  }
+
+  char*       _buf;
+  size_t      _size;
+  size_t      _len;   // bytes in _buf
+  size_t      _pos;   // start of the next line, or of the bytes past the headers
+  size_t      _scan;  // bytes already searched for the end of the line
+  size_t      _keep;  // end of the request line, 0 until it is parsed
+  HTTPMethod  _method;
+  bool        _known;
+  const char* _uri;
+  const char* _query;
+  uint8_t     _version;
+};
+
+#endif //REQUESTPARSER_H
@@ -0,0 +1,186 @@
+#ifndef ROUTETABLE_H
+#define ROUTETABLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// How a request handler is found, see RequestHandler::route()
+enum RequestRoute {
+  ROUTE_NONE,   // asked for every request, like before the route table
+  ROUTE_EXACT,  // only for the URI equal to its path
+  ROUTE_PREFIX  // only for URIs starting with its path
+};
+
+// Radix tree of the paths of the request handlers. find() walks the tree
+// once along the URI (O(URI length)) and only offers the handlers
+// registered for that URI, for a prefix of it or with ROUTE_NONE, to the
+// accept function. Of those it accepts, the first registered one is
+// returned, as with a scan of all the handlers in order.
+// Paths are not copied, they must stay valid as long as the table.
+template<typename T>
+class RouteTable {
+public:
+  RouteTable()
+  : _any(nullptr)
+  , _count(0)
+  {
+    memset(&_root, 0, sizeof(_root));
+  }
+
+  ~RouteTable() {
+    _free(_root.child);
+    _free(_root.exact);
+    _free(_root.prefix);
+    _free(_any);
+  }
+
+  bool add(T* item, RequestRoute route, const char* path) {
+    Entry* entry = new Entry;
+    if (!entry)
+      return false;
+    entry->item = item;
+    entry->order = _count++;
+    entry->next = nullptr;
+    if (route == ROUTE_NONE) {
+      _append(&_any, entry);
+      return true;
+    }
+    Node* node = _insert(path, strlen(path));
+    if (!node) {
+      delete entry;
+      return false;
+    }
+    _append(route == ROUTE_EXACT ? &node->exact : &node->prefix, entry);
+    return true;
+  }
+
+  // accept(T*) is called on the candidates, the first registered candidate it accepts is returned
+  template<typename Fn>
+  T* find(const char* uri, Fn accept) const {
+    Entry* best = nullptr;
+    _consider(_any, best, accept);
+    const Node* node = &_root;
+    _consider(node->prefix, best, accept);
+    size_t length = strlen(uri);
+    while (length) {
+      const Node* child = node->child;
+      while (child && child->label[0] != *uri)
+        child = child->sibling;
+      if (!child || child->length > length || memcmp(child->label, uri, child->length) != 0)
+        break;
+      uri += child->length;
+      length -= child->length;
+      node = child;
+      _consider(node->prefix, best, accept);
+    }
+    if (!length)
+      _consider(node->exact, best, accept);
+    return best ? best->item : nullptr;
+  }
+
+private:
+  struct Entry {
+    T*       item;
+    uint16_t order;  // registration order
+    Entry*   next;
+  };
+
+  struct Node {
+    const char* label;   // into a registered path
+    uint16_t    length;
+    Node*       child;   // first child, children differ by the first character of their label
+    Node*       sibling;
+    Entry*      exact;
+    Entry*      prefix;
+  };
+
+  // The first entry of the list accepted, if it was registered before the best so far
+  template<typename Fn>
+  static void _consider(Entry* entry, Entry*& best, Fn& accept) {
+    for (; entry; entry = entry->next) {
+      if (best && entry->order > best->order)
+        return;
+      if (accept(entry->item)) {
+        best = entry;
+        return;
+      }
+    }
+  }
+
+  Node* _insert(const char* path, size_t length) {
+    Node* node = &_root;
+    while (length) {
+      Node** link = &node->child;
+      while (*link && (*link)->label[0] != *path)
+        link = &(*link)->sibling;
+      Node* child = *link;
+      if (!child) {
+        child = _node(path, length);
+        if (child)
+          *link = child;
+        return child;
+      }
+      size_t common = 0;
+      while (common < child->length && common < length && child->label[common] == path[common])
+        common++;
+      if (common < child->length) {
+        // split the edge where the paths differ
+        Node* split = _node(child->label, common);
+        if (!split)
+          return nullptr;
+        split->sibling = child->sibling;
+        split->child = child;
+        child->sibling = nullptr;
+        child->label += common;
+        child->length -= common;
+        *link = split;
+        child = split;
+      }
+      node = child;
+      path += common;
+      length -= common;
+    }
+    return node;
+  }
+
+  static Node* _node(const char* label, size_t length) {
+    Node* node = new Node;
+    if (node) {
+      memset(node, 0, sizeof(Node));
+      node->label = label;
+      node->length = length;
+    }
+    return node;
+  }
+
+  static void _append(Entry** list, Entry* entry) {
+    while (*list)
+      list = &(*list)->next;
+    *list = entry;
+  }
+
+  static void _free(Entry* entry) {
+    while (entry) {
+      Entry* next = entry->next;
+      delete entry;
+      entry = next;
+    }
+  }
+
+  static void _free(Node* node) {
+    while (node) {
+      Node* sibling = node->sibling;
+      _free(node->child);
+      _free(node->exact);
+      _free(node->prefix);
+      delete node;
+      node = sibling;
+    }
+  }
+
+  Node     _root;
+  Entry*   _any;
+  uint16_t _count;
+};
+
+#endif //ROUTETABLE_H
@@ -179,6 +179,16 @@ size_t WiFiClient::write(const uint8_t *buf, size_t size)
     return _client->write(buf, size);
 }
 
+size_t WiFiClient::writev(const WriteBuffer* buffers, size_t count)
+{
+    if (!_client || !count)
+    {
+        return 0;
+    }
+    _client->setTimeout(_timeout);
+    return _client->writev(buffers, count);
+}
+
 size_t WiFiClient::write(Stream& stream, size_t unused)
 {
     (void) unused;
@@ -261,6 +271,29 @@ size_t WiFiClient::peekBytes(uint8_t *buffer, size_t length) {
     return _client->peekBytes((char *)buffer, count);
 }
 
+const char* WiFiClient::peekBuffer()
+{
+    return _client? _client->peekBuffer(): nullptr;
+}
+
+size_t WiFiClient::peekAvailable()
+{
+    return _client? _client->peekAvailable(): 0;
+}
+
+void WiFiClient::peekConsume(size_t consume)
+{
+    if (_client)
+        _client->peekConsume(consume);
+}
+
+int WiFiClient::waitAvailable(uint32_t timeout_ms)
+{
+    if (!_client || !_client->wait_until_received(timeout_ms))
+        return 0;
+    return _client->getSize();
+}
+
 void WiFiClient::flush()
 {
     if (_client)
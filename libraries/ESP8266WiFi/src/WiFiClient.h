@@ -37,6 +37,12 @@
 class ClientContext;
 class WiFiServer;
 
+// One of the buffers of WiFiClient::writev()
+struct WriteBuffer {
+  const void* data;
+  size_t size;
+};
+
 class WiFiClient : public Client, public SList<WiFiClient> {
 protected:
   WiFiClient(ClientContext* client);
@@ -55,6 +61,8 @@ public:
   virtual size_t write(const uint8_t *buf, size_t size);
   virtual size_t write_P(PGM_P buf, size_t size);
   size_t write(Stream& stream);
+  // writes the buffers (in RAM) as if they were one, small ones leave in a single segment
+  virtual size_t writev(const WriteBuffer* buffers, size_t count);
 
   // This one is deprecated, use write(Stream& instead)
   size_t write(Stream& stream, size_t unitSize) __attribute__ ((deprecated));
@@ -67,6 +75,16 @@ public:
   size_t peekBytes(char *buffer, size_t length) {
     return peekBytes((uint8_t *) buffer, length);
   }
+
+  // direct access to the received data, without copying it:
+  // peekBuffer() points to peekAvailable() contiguous bytes (one pbuf),
+  // valid until peekConsume() or the next read
+  const char* peekBuffer();
+  size_t peekAvailable();
+  void peekConsume(size_t consume);
+  // waits in the receive callback instead of polling available(),
+  // returns available() once data arrives, 0 on timeout or when the connection closes
+  int waitAvailable(uint32_t timeout_ms);
   virtual void flush();
   virtual void stop();
   virtual uint8_t connected();
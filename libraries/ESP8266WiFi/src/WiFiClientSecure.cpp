@@ -564,6 +564,23 @@ size_t WiFiClientSecure::write_P(PGM_P buf, size_t size)
     return write(copy, size);
 }
 
+size_t WiFiClientSecure::writev(const WriteBuffer* buffers, size_t count)
+{
+    // every buffer goes through the TLS layer, it can't be handed to lwIP as is
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!buffers[i].size) {
+            continue;
+        }
+        size_t rc = write(reinterpret_cast<const uint8_t*>(buffers[i].data), buffers[i].size);
+        written += rc;
+        if (rc != buffers[i].size) {
+            break;
+        }
+    }
+    return written;
+}
+
 int WiFiClientSecure::read(uint8_t *buf, size_t size)
 {
     if (!_ssl) {
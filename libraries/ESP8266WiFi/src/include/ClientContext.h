@@ -283,6 +283,50 @@ public:
         return copy_size;
     }
 
+    const char* peekBuffer()
+    {
+        if(!_rx_buf) {
+            return nullptr;
+        }
+
+        return reinterpret_cast<const char*>(_rx_buf->payload) + _rx_buf_offset;
+    }
+
+    size_t peekAvailable()
+    {
+        if(!_rx_buf) {
+            return 0;
+        }
+
+        return _rx_buf->len - _rx_buf_offset;
+    }
+
+    void peekConsume(size_t consume)
+    {
+        if(!_rx_buf) {
+            return;
+        }
+
+        size_t max_size = _rx_buf->len - _rx_buf_offset;
+        _consume((consume < max_size) ? consume : max_size);
+    }
+
+    // Blocks until data is received, the connection is closed or timeout_ms elapse.
+    // This delay will be interrupted by esp_schedule in the receive callback
+    bool wait_until_received(uint32_t timeout_ms)
+    {
+        if(_rx_buf) {
+            return true;
+        }
+        if(!_pcb) {
+            return false;
+        }
+        _recv_waiting = 1;
+        delay(timeout_ms);
+        _recv_waiting = 0;
+        return _rx_buf != nullptr;
+    }
+
     void discard_received()
     {
         if(!_rx_buf) {
@@ -327,7 +371,19 @@ public:
         if (!_pcb) {
             return 0;
         }
-        return _write_from_source(new BufferDataSource(data, size));
+        BufferDataSource source(data, size);
+        return _write_from_source(&source);
+    }
+
+    // The buffers are queued one after the other before tcp_output() is called,
+    // so a response head and a small body leave in the same segment
+    size_t writev(const WriteBuffer* buffers, size_t count)
+    {
+        if (!_pcb) {
+            return 0;
+        }
+        GatherDataSource source(buffers, count);
+        return _write_from_source(&source);
     }
 
     size_t write(Stream& stream)
@@ -335,7 +391,8 @@ public:
         if (!_pcb) {
             return 0;
         }
-        return _write_from_source(new BufferedStreamDataSource<Stream>(stream, stream.available()));
+        BufferedStreamDataSource<Stream> source(stream, stream.available());
+        return _write_from_source(&source);
     }
 
     size_t write_P(PGM_P buf, size_t size)
@@ -344,7 +401,8 @@ public:
             return 0;
         }
         ProgmemStream stream(buf, size);
-        return _write_from_source(new BufferedStreamDataSource<ProgmemStream>(stream, size));
+        BufferedStreamDataSource<ProgmemStream> source(stream, size);
+        return _write_from_source(&source);
     }
 
     void keepAlive (uint16_t idle_sec = TCP_DEFAULT_KEEPALIVE_IDLE_SEC, uint16_t intv_sec = TCP_DEFAULT_KEEPALIVE_INTERVAL_SEC, uint8_t count = TCP_DEFAULT_KEEPALIVE_COUNT)
@@ -388,11 +446,12 @@ protected:
 
     void _notify_error()
     {
-        if (_connect_pending || _send_waiting) {
+        if (_connect_pending || _send_waiting || _recv_waiting) {
             esp_schedule();
         }
     }
 
+    // ds is owned by the caller, usually on its stack
     size_t _write_from_source(DataSource* ds)
     {
         assert(_datasource == nullptr);
@@ -409,7 +468,6 @@ protected:
                 if (_is_timeout()) {
                     DEBUGV(":wtmo\r\n");
                 }
-                delete _datasource;
                 _datasource = nullptr;
                 break;
             }
@@ -438,6 +496,10 @@ protected:
         while( will_send && _datasource) {
             size_t next_chunk =
                 will_send > _write_chunk_size ? _write_chunk_size : will_send;
+            size_t contiguous = _datasource->contiguous();
+            if (next_chunk > contiguous) {
+                next_chunk = contiguous;
+            }
             const uint8_t* buf = _datasource->get_buffer(next_chunk);
             if (state() == CLOSED) {
                 need_output = false;
@@ -525,6 +587,10 @@ protected:
             _rx_buf = pb;
             _rx_buf_offset = 0;
         }
+        if(_recv_waiting) {
+            _recv_waiting = 0;
+            esp_schedule();
+        }
         return ERR_OK;
     }
 
@@ -597,6 +663,7 @@ private:
     uint32_t _op_start_time = 0;
     uint8_t _send_waiting = 0;
     uint8_t _connect_pending = 0;
+    uint8_t _recv_waiting = 0;
 
     int8_t _refcnt;
     ClientContext* _next;
@@ -13,6 +13,8 @@ public:
     virtual size_t available() = 0;
     virtual const uint8_t* get_buffer(size_t size) = 0;
     virtual void release_buffer(const uint8_t* buffer, size_t size) = 0;
+    // bytes get_buffer() can return at once
+    virtual size_t contiguous() { return available(); }
 
 };
 
@@ -49,6 +51,60 @@ protected:
     size_t _pos = 0;
 };
 
+// The buffers of WiFiClient::writev() one after the other, without copying them
+class GatherDataSource : public DataSource {
+public:
+    GatherDataSource(const WriteBuffer* buffers, size_t count) :
+        _buffers(buffers),
+        _count(count)
+    {
+        for (size_t i = 0; i < count; i++) {
+            _left += buffers[i].size;
+        }
+        _skipEmpty();
+    }
+
+    size_t available() override
+    {
+        return _left;
+    }
+
+    size_t contiguous() override
+    {
+        return _left ? _buffers[_index].size - _pos : 0;
+    }
+
+    const uint8_t* get_buffer(size_t size) override
+    {
+        (void) size;
+        assert(size <= contiguous());
+        return reinterpret_cast<const uint8_t*>(_buffers[_index].data) + _pos;
+    }
+
+    void release_buffer(const uint8_t* buffer, size_t size) override
+    {
+        (void) buffer;
+        _pos += size;
+        _left -= size;
+        _skipEmpty();
+    }
+
+protected:
+    void _skipEmpty()
+    {
+        while (_index < _count && _pos == _buffers[_index].size) {
+            _index++;
+            _pos = 0;
+        }
+    }
+
+    const WriteBuffer* _buffers;
+    size_t _count;
+    size_t _index = 0;
+    size_t _pos = 0;
+    size_t _left = 0;
+};
+
 template<typename TStream>
 class BufferedStreamDataSource : public DataSource {
 public:
@@ -0,0 +1,133 @@
+/**
+ * HashBenchmark.ino
+ *
+ * Measures the cost of signed updates (UpdateSignature.h) on the board:
+ * MD5 and SHA-256 rates against the flash sector erase and write rate, which
+ * bounds the OTA throughput, and the time of one Ed25519 verification.
+ * The SHA-256 of a signed image runs next to the Updater MD5, so the update
+ * stays flash bound while md5 + sha256 together are faster than flash.
+ * A signature of RFC 8032 test 1 with S + L in place of S, which passes
+ * the curve equation, must be rejected (malleable_rejected).
+ *
+ * Erases and writes the sectors right after the sketch, do not run it with
+ * an update staged there.
+ */
+
+#include <Arduino.h>
+#include <MD5Builder.h>
+#include <Sha256.h>
+#include <Ed25519.h>
+
+#define USE_SERIAL Serial
+
+#define BENCH_SIZE      (64 * 1024)
+#define BENCH_SECTORS   8
+
+// RFC 8032 test 2
+static const uint8_t testKey[ED25519_KEY_SIZE] PROGMEM = {
+    0x3d, 0x40, 0x17, 0xc3, 0xe8, 0x43, 0x89, 0x5a, 0x92, 0xb7, 0x0a, 0xa7, 0x4d, 0x1b, 0x7e, 0xbc,
+    0x9c, 0x98, 0x2c, 0xcf, 0x2e, 0xc4, 0x96, 0x8c, 0xc0, 0xcd, 0x55, 0xf1, 0x2a, 0xf4, 0x66, 0x0c
+};
+static const uint8_t testSignature[ED25519_SIGNATURE_SIZE] PROGMEM = {
+    0x92, 0xa0, 0x09, 0xa9, 0xf0, 0xd4, 0xca, 0xb8, 0x72, 0x0e, 0x82, 0x0b, 0x5f, 0x64, 0x25, 0x40,
+    0xa2, 0xb2, 0x7b, 0x54, 0x16, 0x50, 0x3f, 0x8f, 0xb3, 0x76, 0x22, 0x23, 0xeb, 0xdb, 0x69, 0xda,
+    0x08, 0x5a, 0xc1, 0xe4, 0x3e, 0x15, 0x99, 0x6e, 0x45, 0x8f, 0x36, 0x13, 0xd0, 0xf1, 0x1d, 0x8c,
+    0x38, 0x7b, 0x2e, 0xae, 0xb4, 0x30, 0x2a, 0xee, 0xb0, 0x0d, 0x29, 0x16, 0x12, 0xbb, 0x0c, 0x00
+};
+
+// RFC 8032 test 1 (empty message), S replaced by S + L
+static const uint8_t malleableKey[ED25519_KEY_SIZE] PROGMEM = {
+    0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+    0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a
+};
+static const uint8_t malleableSignature[ED25519_SIGNATURE_SIZE] PROGMEM = {
+    0xe5, 0x56, 0x43, 0x00, 0xc3, 0x60, 0xac, 0x72, 0x90, 0x86, 0xe2, 0xcc, 0x80, 0x6e, 0x82, 0x8a,
+    0x84, 0x87, 0x7f, 0x1e, 0xb8, 0xe5, 0xd9, 0x74, 0xd8, 0x73, 0xe0, 0x65, 0x22, 0x49, 0x01, 0x55,
+    0x4c, 0x8c, 0x78, 0x72, 0xaa, 0x06, 0x4e, 0x04, 0x9d, 0xbb, 0x30, 0x13, 0xfb, 0xf2, 0x93, 0x80,
+    0xd2, 0x5b, 0xf5, 0xf0, 0x59, 0x5b, 0xbe, 0x24, 0x65, 0x51, 0x41, 0x43, 0x8e, 0x7a, 0x10, 0x1b
+};
+
+uint32_t buf[1024]; // 4 KB, the Updater buffer size
+
+uint32_t rate(uint32_t bytes, uint32_t us) {
+    return us ? (uint32_t) ((uint64_t) bytes * 1000000 / us) : 0;
+}
+
+// the image arrives in the Updater buffer, so the data is read once and hashed from RAM
+uint32_t benchMD5() {
+    MD5Builder md5;
+    uint32_t time = 0;
+    md5.begin();
+    for(uint32_t offset = 0; offset < BENCH_SIZE; offset += sizeof(buf)) {
+        ESP.flashRead(offset, buf, sizeof(buf));
+        uint32_t start = micros();
+        md5.add((uint8_t*) buf, sizeof(buf));
+        time += micros() - start;
+        yield();
+    }
+    md5.calculate();
+    return time;
+}
+
+uint32_t benchSha256() {
+    Sha256 sha;
+    uint8_t digest[SHA256_SIZE];
+    uint32_t time = 0;
+    for(uint32_t offset = 0; offset < BENCH_SIZE; offset += sizeof(buf)) {
+        ESP.flashRead(offset, buf, sizeof(buf));
+        uint32_t start = micros();
+        sha.add((uint8_t*) buf, sizeof(buf));
+        time += micros() - start;
+        yield();
+    }
+    sha.calculate(digest);
+    return time;
+}
+
+uint32_t benchFlash() {
+    uint32_t address = (ESP.getSketchSize() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t start = micros();
+    for(uint32_t i = 0; i < BENCH_SECTORS; i++) {
+        uint32_t sector = address / FLASH_SECTOR_SIZE + i;
+        if(!ESP.flashEraseSector(sector) || !ESP.flashWrite(sector * FLASH_SECTOR_SIZE, buf, sizeof(buf))) {
+            return 0;
+        }
+        yield();
+    }
+    return micros() - start;
+}
+
+void setup() {
+    USE_SERIAL.begin(115200);
+    USE_SERIAL.println();
+
+    uint32_t md5Time = benchMD5();
+    uint32_t shaTime = benchSha256();
+    uint32_t flashTime = benchFlash();
+
+    uint8_t key[ED25519_KEY_SIZE];
+    uint8_t signature[ED25519_SIGNATURE_SIZE];
+    uint8_t message = 0x72;
+    memcpy_P(key, testKey, sizeof(key));
+    memcpy_P(signature, testSignature, sizeof(signature));
+    uint32_t start = micros();
+    bool valid = ed25519Verify(signature, &message, 1, key);
+    uint32_t verifyTime = micros() - start;
+
+    memcpy_P(key, malleableKey, sizeof(key));
+    memcpy_P(signature, malleableSignature, sizeof(signature));
+    bool rejected = !ed25519Verify(signature, &message, 0, key);
+
+    uint32_t md5Rate = rate(BENCH_SIZE, md5Time);
+    uint32_t shaRate = rate(BENCH_SIZE, shaTime);
+    uint32_t flashRate = rate(BENCH_SECTORS * FLASH_SECTOR_SIZE, flashTime);
+    uint32_t updateRate = rate(BENCH_SIZE, md5Time + shaTime);
+
+    USE_SERIAL.printf("{\"ota\":\"hash\",\"cpu_mhz\":%u,\"md5_bytes_per_s\":%u,\"sha256_bytes_per_s\":%u,\"flash_bytes_per_s\":%u,\"verify_us\":%u,\"verify_ok\":%s,\"malleable_rejected\":%s}\n",
+                      ESP.getCpuFreqMHz(), md5Rate, shaRate, flashRate, verifyTime, valid ? "true" : "false", rejected ? "true" : "false");
+    USE_SERIAL.printf("MD5 + SHA-256: %u bytes/s, flash: %u bytes/s, signed updates are %s bound\n",
+                      updateRate, flashRate, updateRate > flashRate ? "flash" : "CPU");
+}
+
+void loop() {
+}
@@ -0,0 +1,163 @@
+/**
+ *
+ * @file ChunkedStream.cpp
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include "ChunkedStream.h"
+
+ChunkedStream::ChunkedStream(Stream& in)
+    : _in(in)
+    , _chunkLeft(0)
+    , _started(false)
+    , _finished(false)
+    , _error(false)
+    , _peekLen(0)
+{
+    setTimeout(_in.getTimeout());
+}
+
+/**
+ * reads one line up to LF, the CR and the LF are dropped
+ * @return false on timeout or if the line does not fit
+ */
+bool ChunkedStream::_readLine(char* line, size_t size)
+{
+    size_t len = 0;
+    char c;
+
+    while(_in.readBytes(&c, 1) == 1) {
+        if(c == '\n') {
+            if(len && line[len - 1] == '\r') {
+                len--;
+            }
+            line[len] = 0;
+            return true;
+        }
+        if(len + 1 < size) {
+            line[len++] = c;
+        }
+    }
+    return false;
+}
+
+/**
+ * reads the next chunk header, and the trailer after the last chunk
+ * @return true if chunk data follows
+ */
+bool ChunkedStream::_nextChunk()
+{
+    char line[32];
+
+    if(_finished || _error) {
+        return false;
+    }
+
+    // CRLF closing the data of the previous chunk
+    if(_started && (!_readLine(line, sizeof(line)) || line[0])) {
+        _error = true;
+        return false;
+    }
+    _started = true;
+
+    // <hex size>[;extensions]
+    if(!_readLine(line, sizeof(line)) || !isxdigit(line[0])) {
+        _error = true;
+        return false;
+    }
+    char* end;
+    _chunkLeft = strtoul(line, &end, 16);
+    if(*end && *end != ';' && *end != ' ') {
+        _error = true;
+        return false;
+    }
+
+    if(_chunkLeft == 0) {
+        // trailer headers up to an empty line
+        do {
+            if(!_readLine(line, sizeof(line))) {
+                _error = true;
+                return false;
+            }
+        } while(line[0]);
+        _finished = true;
+        return false;
+    }
+    return true;
+}
+
+size_t ChunkedStream::_readData(uint8_t* buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length) {
+        if(!_chunkLeft && !_nextChunk()) {
+            break;
+        }
+        size_t len = std::min((size_t) _chunkLeft, length - count);
+        size_t got = _in.readBytes((char*) buffer + count, len);
+        _chunkLeft -= got;
+        count += got;
+        if(got < len) {
+            break; // timeout
+        }
+    }
+    return count;
+}
+
+size_t ChunkedStream::peekBytes(uint8_t* buffer, size_t length)
+{
+    length = std::min(length, sizeof(_peek));
+    if(_peekLen < length) {
+        _peekLen += _readData(_peek + _peekLen, length - _peekLen);
+    }
+    length = std::min(length, _peekLen);
+    memcpy(buffer, _peek, length);
+    return length;
+}
+
+int ChunkedStream::available()
+{
+    if(!_chunkLeft && !_finished && _in.available()) {
+        _nextChunk();
+    }
+    return _peekLen + std::min((size_t) _chunkLeft, (size_t) _in.available());
+}
+
+int ChunkedStream::read()
+{
+    uint8_t c;
+    if(readBytes((char*) &c, 1) != 1) {
+        return -1;
+    }
+    return c;
+}
+
+int ChunkedStream::peek()
+{
+    uint8_t c;
+    if(peekBytes(&c, 1) != 1) {
+        return -1;
+    }
+    return c;
+}
+
+int ChunkedStream::read(uint8_t* buffer, size_t size)
+{
+    return readBytes((char*) buffer, size);
+}
+
+size_t ChunkedStream::readBytes(char* buffer, size_t length)
+{
+    size_t count = std::min(length, _peekLen);
+    if(count) {
+        memcpy(buffer, _peek, count);
+        memmove(_peek, _peek + count, _peekLen - count);
+        _peekLen -= count;
+    }
+    return count + _readData((uint8_t*) buffer + count, length - count);
+}
@@ -0,0 +1,69 @@
+/**
+ *
+ * @file ChunkedStream.h
+ *
+ * Removes the chunked transfer encoding framing of a HTTP/1.1 response body
+ * while it is read, only the chunk headers are parsed, the data is not buffered.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef CHUNKEDSTREAM_H_
+#define CHUNKEDSTREAM_H_
+
+#include <Arduino.h>
+
+#define CHUNKED_PEEK_SIZE   8
+
+class ChunkedStream : public Stream
+{
+public:
+    ChunkedStream(Stream& in);
+
+    /// true once the last (zero size) chunk has been read
+    bool isFinished() const
+    {
+        return _finished && !_peekLen;
+    }
+
+    /// true if a chunk header was malformed or did not arrive in time
+    bool hasError() const
+    {
+        return _error;
+    }
+
+    /// peeks up to CHUNKED_PEEK_SIZE bytes of data
+    size_t peekBytes(uint8_t* buffer, size_t length);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    int read(uint8_t* buffer, size_t size);
+    size_t readBytes(char* buffer, size_t length);
+    void flush() override
+    {
+    }
+    size_t write(uint8_t) override
+    {
+        return 0;
+    }
+
+protected:
+    bool _nextChunk();
+    bool _readLine(char* line, size_t size);
+    size_t _readData(uint8_t* buffer, size_t length);
+
+    Stream& _in;
+    uint32_t _chunkLeft;
+    bool _started;
+    bool _finished;
+    bool _error;
+    uint8_t _peek[CHUNKED_PEEK_SIZE];
+    size_t _peekLen;
+};
+
+#endif /* CHUNKEDSTREAM_H_ */
@@ -0,0 +1,203 @@
+/**
+ *
+ * @file DeltaStream.cpp
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include "DeltaStream.h"
+
+#define DELTA_OP_END    0x00
+#define DELTA_OP_COPY   0x01
+#define DELTA_OP_DATA   0x02
+
+static const uint8_t deltaMagic[DELTA_MAGIC_SIZE] = { 'E', 'S', 'P', 'D' };
+
+DeltaStream::DeltaStream(Stream& patch)
+    : _patch(patch)
+    , _size(0)
+    , _produced(0)
+    , _sketchSize(0)
+    , _op(DELTA_OP_END)
+    , _opOffset(0)
+    , _opLeft(0)
+    , _error(false)
+    , _bufPos(0)
+    , _bufLen(0)
+{
+    setTimeout(_patch.getTimeout());
+}
+
+bool DeltaStream::isDelta(const uint8_t* buf, size_t len)
+{
+    return len >= DELTA_MAGIC_SIZE && memcmp(buf, deltaMagic, DELTA_MAGIC_SIZE) == 0;
+}
+
+bool DeltaStream::begin()
+{
+    uint8_t magic[DELTA_MAGIC_SIZE];
+    if(!_readPatch(magic, sizeof(magic)) || !isDelta(magic, sizeof(magic))) {
+        _error = true;
+        return false;
+    }
+    if(!_readU32(_size) || !_readPatch(_baseMD5, sizeof(_baseMD5))) {
+        _error = true;
+        return false;
+    }
+    _sketchSize = ESP.getSketchSize();
+    return true;
+}
+
+String DeltaStream::baseMD5() const
+{
+    static const char hex[] = "0123456789abcdef";
+    String md5;
+    md5.reserve(32);
+    for(size_t i = 0; i < sizeof(_baseMD5); i++) {
+        md5 += hex[_baseMD5[i] >> 4];
+        md5 += hex[_baseMD5[i] & 0x0f];
+    }
+    return md5;
+}
+
+bool DeltaStream::_readPatch(void* dst, size_t len)
+{
+    return _patch.readBytes((char*) dst, len) == len;
+}
+
+bool DeltaStream::_readU32(uint32_t& value)
+{
+    uint8_t b[4];
+    if(!_readPatch(b, sizeof(b))) {
+        return false;
+    }
+    value = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+    return true;
+}
+
+/**
+ * makes sure the output buffer holds at least one byte of the image
+ * @return false at the end of the image or on a patch error
+ */
+bool DeltaStream::_fill()
+{
+    if(_bufPos < _bufLen) {
+        return true;
+    }
+    _bufPos = 0;
+    _bufLen = 0;
+
+    if(_error || _produced >= _size) {
+        return false;
+    }
+
+    while(_opLeft == 0) {
+        if(!_readPatch(&_op, 1)) {
+            _error = true;
+            return false;
+        }
+        switch(_op) {
+        case DELTA_OP_COPY:
+            if(!_readU32(_opOffset) || !_readU32(_opLeft) ||
+               _opOffset > _sketchSize || _opLeft > _sketchSize - _opOffset) {
+                _error = true;
+                return false;
+            }
+            break;
+        case DELTA_OP_DATA:
+            if(!_readU32(_opLeft)) {
+                _error = true;
+                return false;
+            }
+            break;
+        default:
+            // END before the whole image was produced, or unknown op
+            _error = true;
+            return false;
+        }
+        if(_opLeft > _size - _produced) {
+            _error = true;
+            return false;
+        }
+    }
+
+    size_t len = std::min((size_t) _opLeft, (size_t) DELTA_BUFFER_SIZE);
+    uint8_t* buf = (uint8_t*) _buf;
+
+    if(_op == DELTA_OP_COPY) {
+        uint32_t aligned = _opOffset & ~3;
+        size_t skew = _opOffset - aligned;
+        if(!ESP.flashRead(aligned, _buf, (skew + len + 3) & ~3)) {
+            _error = true;
+            return false;
+        }
+        _bufPos = skew;
+        _bufLen = skew + len;
+        _opOffset += len;
+    } else {
+        if(!_readPatch(buf, len)) {
+            _error = true;
+            return false;
+        }
+        _bufLen = len;
+    }
+    _opLeft -= len;
+    return true;
+}
+
+size_t DeltaStream::peekBytes(uint8_t* buffer, size_t length)
+{
+    if(!_fill()) {
+        return 0;
+    }
+    size_t len = std::min(length, _bufLen - _bufPos);
+    memcpy(buffer, (uint8_t*) _buf + _bufPos, len);
+    return len;
+}
+
+int DeltaStream::available()
+{
+    if(_error) {
+        return 0;
+    }
+    return _size - _produced;
+}
+
+int DeltaStream::read()
+{
+    if(!_fill()) {
+        return -1;
+    }
+    _produced++;
+    return ((uint8_t*) _buf)[_bufPos++];
+}
+
+int DeltaStream::peek()
+{
+    if(!_fill()) {
+        return -1;
+    }
+    return ((uint8_t*) _buf)[_bufPos];
+}
+
+int DeltaStream::read(uint8_t* buffer, size_t size)
+{
+    return readBytes((char*) buffer, size);
+}
+
+size_t DeltaStream::readBytes(char* buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length && _fill()) {
+        size_t len = std::min(length - count, _bufLen - _bufPos);
+        memcpy(buffer + count, (uint8_t*) _buf + _bufPos, len);
+        _bufPos += len;
+        _produced += len;
+        count += len;
+    }
+    return count;
+}
@@ -0,0 +1,97 @@
+/**
+ *
+ * @file DeltaStream.h
+ *
+ * Rebuilds a firmware image from a delta patch against the running sketch,
+ * while the patch is read from the network.
+ *
+ * Patch format (little endian):
+ *   header  "ESPD" | uint32 target size | 16 byte MD5 of the base sketch
+ *   0x01    COPY   | uint32 offset | uint32 length   copy from the running sketch
+ *   0x02    DATA   | uint32 length | length bytes    literal bytes
+ *   0x00    END
+ *
+ * Patches are generated by tools/ota_delta.py
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef DELTASTREAM_H_
+#define DELTASTREAM_H_
+
+#include <Arduino.h>
+
+#define DELTA_MAGIC_SIZE    4
+#define DELTA_HEADER_SIZE   (DELTA_MAGIC_SIZE + 4 + 16)
+
+#ifndef DELTA_BUFFER_SIZE
+#define DELTA_BUFFER_SIZE   512
+#endif
+
+class DeltaStream : public Stream
+{
+public:
+    DeltaStream(Stream& patch);
+
+    /// true if buf starts with the delta patch magic
+    static bool isDelta(const uint8_t* buf, size_t len);
+
+    /// reads and checks the patch header
+    bool begin();
+
+    /// size of the rebuilt image, valid after begin()
+    uint32_t size() const
+    {
+        return _size;
+    }
+
+    /// MD5 of the sketch the patch applies to, as lowercase hex
+    String baseMD5() const;
+
+    /// true if the patch is truncated or refers outside the running sketch
+    bool hasError() const
+    {
+        return _error;
+    }
+
+    size_t peekBytes(uint8_t* buffer, size_t length);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    int read(uint8_t* buffer, size_t size);
+    size_t readBytes(char* buffer, size_t length);
+    void flush() override
+    {
+    }
+    size_t write(uint8_t) override
+    {
+        return 0;
+    }
+
+protected:
+    bool _fill();
+    bool _readPatch(void* dst, size_t len);
+    bool _readU32(uint32_t& value);
+
+    Stream& _patch;
+    uint32_t _size;
+    uint32_t _produced;
+    uint32_t _sketchSize;
+    uint8_t _baseMD5[16];
+    uint8_t _op;
+    uint32_t _opOffset;
+    uint32_t _opLeft;
+    bool _error;
+
+    // flash reads need 4 byte aligned address, length and buffer
+    uint32_t _buf[(DELTA_BUFFER_SIZE + 8) / 4];
+    size_t _bufPos;
+    size_t _bufLen;
+};
+
+#endif /* DELTASTREAM_H_ */
@@ -24,13 +24,107 @@
  */
 
 #include "ESP8266httpUpdate.h"
+#include "ChunkedStream.h"
+#include "DeltaStream.h"
+#include "LzssDecoder.h"
+#include "UpdateRollback.h"
 #include <StreamString.h>
+#include <stddef.h>
+
+extern "C" {
+#include "user_interface.h"
+}
 
 extern "C" uint32_t _SPIFFS_start;
 extern "C" uint32_t _SPIFFS_end;
 
+#define HTTP_UPDATE_RESUME_MAGIC 0x45535052
+#define HTTP_UPDATE_CACHE_MAGIC  0x45535043
+#define HTTP_UPDATE_CACHE_OFFSET (HTTP_UPDATE_RTC_OFFSET + sizeof(HTTPUpdateResume) / 4)
+
+uint32_t crc32Update(const void* data, size_t length, uint32_t crc)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    const uint8_t* p = (const uint8_t*) data;
+    while(length--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return crc;
+}
+
+/**
+ * Stream wrapper used to split the time spent in Update.writeStream()
+ * between the socket and the Updater (MD5 + flash).
+ * With a signature the bytes read are hashed too, outside of the receive time
+ */
+class TimedStream : public Stream
+{
+public:
+    TimedStream(Stream& in, uint32_t& receiveTime, UpdateSignature* signature = NULL)
+        : _in(in), _receiveTime(receiveTime), _signature(signature)
+    {
+        setTimeout(8000);
+    }
+
+    int available() override
+    {
+        return _in.available();
+    }
+
+    int read() override
+    {
+        uint32_t start = micros();
+        int c = _in.read();
+        _receiveTime += micros() - start;
+        if(_signature && c >= 0) {
+            uint8_t b = c;
+            _signature->add(&b, 1);
+        }
+        return c;
+    }
+
+    size_t readBytes(char* buffer, size_t length)
+    {
+        uint32_t start = micros();
+        size_t len = _in.readBytes(buffer, length);
+        _receiveTime += micros() - start;
+        if(_signature) {
+            _signature->add((const uint8_t*) buffer, len);
+        }
+        return len;
+    }
+
+    int peek() override
+    {
+        return _in.peek();
+    }
+
+    void flush() override
+    {
+        _in.flush();
+    }
+
+    size_t write(uint8_t c) override
+    {
+        return _in.write(c);
+    }
+
+protected:
+    Stream& _in;
+    uint32_t& _receiveTime;
+    UpdateSignature* _signature;
+};
+
 ESP8266HTTPUpdate::ESP8266HTTPUpdate(void)
 {
+    memset(&_stats, 0, sizeof(_stats));
+    memset(&_resume, 0, sizeof(_resume));
+    memset(&_cache, 0, sizeof(_cache));
 }
 
 ESP8266HTTPUpdate::~ESP8266HTTPUpdate(void)
@@ -44,6 +138,11 @@ HTTPUpdateResult ESP8266HTTPUpdate::update(const String& url, const String& curr
     return update(url, currentVersion, httpsFingerprint);
 }
 
+HTTPUpdateResult ESP8266HTTPUpdate::update(HTTPClient& http, const String& currentVersion)
+{
+    return handleUpdate(http, currentVersion, false);
+}
+
 HTTPUpdateResult ESP8266HTTPUpdate::update(const String& url, const String& currentVersion)
 {
     HTTPClient http;
@@ -110,6 +209,15 @@ int ESP8266HTTPUpdate::getLastError(void)
     return _lastError;
 }
 
+/**
+ * return per-stage timing of the last update
+ * @return HTTPUpdateStats
+ */
+const HTTPUpdateStats& ESP8266HTTPUpdate::getStats(void)
+{
+    return _stats;
+}
+
 /**
  * return error code as String
  * @return String error
@@ -151,6 +259,20 @@ String ESP8266HTTPUpdate::getLastErrorString(void)
         return F("Verify Bin Header Failed");
     case HTTP_UE_BIN_FOR_WRONG_FLASH:
         return F("New Binary Does Not Fit Flash Size");
+    case HTTP_UE_DELTA_BASE_MISMATCH:
+        return F("Delta Patch For Another Sketch");
+    case HTTP_UE_DELTA_CORRUPT:
+        return F("Delta Patch Corrupt");
+    case HTTP_UE_COMPRESSED_CORRUPT:
+        return F("Compressed Image Corrupt");
+    case HTTP_UE_RESUME_MISMATCH:
+        return F("Resumed Download Does Not Match");
+    case HTTP_UE_ROLLED_BACK:
+        return F("Image Was Rolled Back");
+    case HTTP_UE_SIGNATURE_MISSING:
+        return F("Image Signature Missing");
+    case HTTP_UE_SIGNATURE_INVALID:
+        return F("Image Signature Invalid");
     }
 
     return String();
@@ -168,29 +290,62 @@ HTTPUpdateResult ESP8266HTTPUpdate::handleUpdate(HTTPClient& http, const String&
 
     HTTPUpdateResult ret = HTTP_UPDATE_FAILED;
 
-    // use HTTP/1.0 for update since the update handler not support any transfer Encoding
-    http.useHTTP10(true);
+    // HTTP/1.0 by default for old servers, chunked HTTP/1.1 responses are decoded by ChunkedStream
+    http.useHTTP10(_useHTTP10);
     http.setTimeout(8000);
     http.setUserAgent(F("ESP8266-http-Update"));
-    http.addHeader(F("x-ESP8266-STA-MAC"), WiFi.macAddress());
-    http.addHeader(F("x-ESP8266-AP-MAC"), WiFi.softAPmacAddress());
-    http.addHeader(F("x-ESP8266-free-space"), String(ESP.getFreeSketchSpace()));
-    http.addHeader(F("x-ESP8266-sketch-size"), String(ESP.getSketchSize()));
-    http.addHeader(F("x-ESP8266-sketch-md5"), String(ESP.getSketchMD5()));
-    http.addHeader(F("x-ESP8266-chip-size"), String(ESP.getFlashChipRealSize()));
+
+    // values formatted on the stack, not a String each
+    uint8_t mac[6];
+    char staMac[18];
+    char apMac[18];
+    char freeSpace[11];
+    char sketchSize[11];
+    char chipSize[11];
+
+    WiFi.macAddress(mac);
+    snprintf(staMac, sizeof(staMac), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    WiFi.softAPmacAddress(mac);
+    snprintf(apMac, sizeof(apMac), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    utoa(ESP.getFreeSketchSpace(), freeSpace, 10);
+    utoa(ESP.getSketchSize(), sketchSize, 10);
+    utoa(ESP.getFlashChipRealSize(), chipSize, 10);
+
+    http.addHeader(F("x-ESP8266-STA-MAC"), staMac);
+    http.addHeader(F("x-ESP8266-AP-MAC"), apMac);
+    http.addHeader(F("x-ESP8266-free-space"), freeSpace);
+    http.addHeader(F("x-ESP8266-sketch-size"), sketchSize);
+    http.addHeader(F("x-ESP8266-sketch-md5"), sketchMD5());
+    http.addHeader(F("x-ESP8266-chip-size"), chipSize);
     http.addHeader(F("x-ESP8266-sdk-version"), ESP.getSdkVersion());
+    http.addHeader(F("x-ESP8266-compression"), F("espz"));
 
     if(spiffs) {
         http.addHeader(F("x-ESP8266-mode"), F("spiffs"));
     } else {
         http.addHeader(F("x-ESP8266-mode"), F("sketch"));
+        if(_acceptDelta) {
+            http.addHeader(F("x-ESP8266-delta"), F("1"));
+        }
     }
 
     if(currentVersion && currentVersion[0] != 0x00) {
         http.addHeader(F("x-ESP8266-version"), currentVersion);
     }
 
-    const char * headerkeys[] = { "x-MD5" };
+    // sketchMD5() above has dropped an ETag that does not belong to the running sketch
+    if(_lightCheck && !spiffs && _cache.etag[0]) {
+        http.addHeader(F("If-None-Match"), _cache.etag);
+    }
+
+    _resuming = _resumeDownloads && loadResume(spiffs ? U_SPIFFS : U_FLASH);
+    if(_resuming && _resume.committed) {
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%u-", _resume.committed);
+        http.addHeader(F("Range"), range);
+    }
+
+    const char * headerkeys[] = { "x-MD5", "Content-Range", "Transfer-Encoding", "ETag", "x-Signature", "Retry-After" };
     size_t headerkeyssize = sizeof(headerkeys) / sizeof(char*);
 
     // track these headers
@@ -200,6 +355,9 @@ HTTPUpdateResult ESP8266HTTPUpdate::handleUpdate(HTTPClient& http, const String&
     int code = http.GET();
     int len = http.getSize();
 
+    // a busy server (503) or a staged rollout (304) tells when to come back, an HTTP-date reads as 0
+    _retryAfter = (code > 0) ? strtoul(http.header("Retry-After").c_str(), NULL, 10) : 0;
+
     if(code <= 0) {
         DEBUG_HTTP_UPDATE("[httpUpdate] HTTP error: %s\n", http.errorToString(code).c_str());
         _lastError = code;
@@ -225,9 +383,40 @@ HTTPUpdateResult ESP8266HTTPUpdate::handleUpdate(HTTPClient& http, const String&
         DEBUG_HTTP_UPDATE("[httpUpdate]  - current version: %s\n", currentVersion.c_str() );
     }
 
+    bool resumed = (code == HTTP_CODE_PARTIAL_CONTENT);
+    bool chunked = http.header("Transfer-Encoding").equalsIgnoreCase("chunked");
+
     switch(code) {
+    case HTTP_CODE_PARTIAL_CONTENT:  ///< Partial Content (Resume Update)
+        if(!_resuming || !checkResume(http, len)) {
+            DEBUG_HTTP_UPDATE("[httpUpdate] Content-Range does not match the saved download\n");
+            clearResume();
+            _lastError = HTTP_UE_RESUME_MISMATCH;
+            ret = HTTP_UPDATE_FAILED;
+            break;
+        }
+        DEBUG_HTTP_UPDATE("[httpUpdate] resume at %u of %u\n", _resume.committed, _resume.size);
+        // fall through
     case HTTP_CODE_OK:  ///< OK (Start Update)
-        if(len > 0) {
+        if(len > 0 || chunked) {
+            // the image this board has just rolled back from is not installed again
+            UpdateRollbackClass rollback;
+            String rejected = spiffs ? String() : rollback.rejectedMD5();
+            if(rejected.length() && rejected.equalsIgnoreCase(http.header("x-MD5"))) {
+                DEBUG_HTTP_UPDATE("[httpUpdate] image %s was rolled back\n", rejected.c_str());
+                _lastError = HTTP_UE_ROLLED_BACK;
+                ret = HTTP_UPDATE_FAILED;
+                break;
+            }
+
+            // the signature is checked once the image is written, it has to be there before anything is erased
+            if(!spiffs && _signature.enabled() && !_signature.begin(http.header("x-Signature"))) {
+                DEBUG_HTTP_UPDATE("[httpUpdate] x-Signature missing or malformed\n");
+                _lastError = HTTP_UE_SIGNATURE_MISSING;
+                ret = HTTP_UPDATE_FAILED;
+                break;
+            }
+
             bool startUpdate = true;
             if(spiffs) {
                 size_t spiffsSize = ((size_t) &_SPIFFS_end - (size_t) &_SPIFFS_start);
@@ -247,7 +436,21 @@ HTTPUpdateResult ESP8266HTTPUpdate::handleUpdate(HTTPClient& http, const String&
                 ret = HTTP_UPDATE_FAILED;
             } else {
 
+                if(_onStart) {
+                    _onStart();
+                }
+
                 WiFiClient * tcp = http.getStreamPtr();
+                if(!tcp) {
+                    // dropped right after the headers, a resumed download keeps its saved progress
+                    DEBUG_HTTP_UPDATE("[httpUpdate] connection lost before the body\n");
+                    _lastError = HTTPC_ERROR_CONNECTION_LOST;
+                    http.end();
+                    return HTTP_UPDATE_FAILED;
+                }
+
+                // the body may not be read to the end, never reuse this connection
+                http.setReuse(false);
 
                 WiFiUDP::stopAll();
                 WiFiClient::stopAllExcept(tcp);
@@ -264,38 +467,79 @@ HTTPUpdateResult ESP8266HTTPUpdate::handleUpdate(HTTPClient& http, const String&
                     DEBUG_HTTP_UPDATE("[httpUpdate] runUpdate flash...\n");
                 }
 
-                if(!spiffs) {
+                ChunkedStream chunks(*tcp);
+                Stream* body = chunked ? (Stream*) &chunks : tcp;
+                LzssStream lzss(*body);
+                Stream* in = body;
+                // 0: plain chunked image, written up to the last chunk
+                uint32_t size = resumed ? _resume.size : (chunked ? 0 : len);
+                bool delta = false;
+
+                if(!resumed) {
                     uint8_t buf[4];
-                    if(tcp->peekBytes(&buf[0], 4) != 4) {
-                        DEBUG_HTTP_UPDATE("[httpUpdate] peekBytes magic header failed\n");
-                        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
-                        http.end();
-                        return HTTP_UPDATE_FAILED;
+                    size_t peeked = chunked ? chunks.peekBytes(&buf[0], 4) : tcp->peekBytes(&buf[0], 4);
+
+                    // compressed images are detected by their magic, the checks below run on the decoded data
+                    if(LzssDecoder::isCompressed(buf, peeked)) {
+                        if(!lzss.begin()) {
+                            DEBUG_HTTP_UPDATE("[httpUpdate] compressed header read failed\n");
+                            _lastError = HTTP_UE_COMPRESSED_CORRUPT;
+                            http.end();
+                            return HTTP_UPDATE_FAILED;
+                        }
+                        DEBUG_HTTP_UPDATE("[httpUpdate]  - compressed size: %d image size: %u\n", len, lzss.size());
+                        in = &lzss;
+                        size = lzss.size();
+                        peeked = lzss.peekBytes(&buf[0], 4);
+                        size_t space = spiffs ? ((size_t) &_SPIFFS_end - (size_t) &_SPIFFS_start) : ESP.getFreeSketchSpace();
+                        if(size > space) {
+                            DEBUG_HTTP_UPDATE("[httpUpdate] space to low (%d) needed: %d\n", space, size);
+                            _lastError = HTTP_UE_TOO_LESS_SPACE;
+                            http.end();
+                            return HTTP_UPDATE_FAILED;
+                        }
                     }
 
-                    // check for valid first magic byte
-                    if(buf[0] != 0xE9) {
-                        DEBUG_HTTP_UPDATE("[httpUpdate] Magic header does not start with 0xE9\n");
-                        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
-                        http.end();
-                        return HTTP_UPDATE_FAILED;
-
+                    if(!spiffs) {
+                        delta = _acceptDelta && DeltaStream::isDelta(buf, peeked);
+                        if(!delta && !verifyHeader(buf, peeked)) {
+                            http.end();
+                            return HTTP_UPDATE_FAILED;
+                        }
                     }
 
-                    uint32_t bin_flash_size = ESP.magicFlashChipSize((buf[3] & 0xf0) >> 4);
+                    // Range offsets only match flash offsets for plain images
+                    startResume((in == body && !delta && size) ? http.header("x-MD5") : String(), size, command);
+                }
 
-                    // check if new bin fits to SPI flash
-                    if(bin_flash_size > ESP.getFlashChipRealSize()) {
-                        DEBUG_HTTP_UPDATE("[httpUpdate] New binary does not fit SPI Flash size\n");
-                        _lastError = HTTP_UE_BIN_FOR_WRONG_FLASH;
-                        http.end();
-                        return HTTP_UPDATE_FAILED;
-                    }
+                bool updated;
+                if(delta) {
+                    DEBUG_HTTP_UPDATE("[httpUpdate] runDelta flash...\n");
+                    updated = runDelta(*in, http.header("x-MD5"));
+                } else {
+                    updated = runUpdate(*in, size, http.header("x-MD5"), command, chunked ? &chunks : NULL);
                 }
 
-                if(runUpdate(*tcp, len, http.header("x-MD5"), command)) {
+                if(!updated && lzss.hasError()) {
+                    _lastError = HTTP_UE_COMPRESSED_CORRUPT;
+                }
+
+                if(updated) {
                     ret = HTTP_UPDATE_OK;
                     DEBUG_HTTP_UPDATE("[httpUpdate] Update ok\n");
+
+                    if(_lightCheck && !spiffs) {
+                        // the ETag is sent again once the new sketch runs and its MD5 matches
+                        String etag = http.header("ETag");
+                        if(etag.length() < sizeof(_cache.etag)) {
+                            strcpy(_cache.etag, etag.c_str());
+                            strncpy(_cache.imageMD5, Update.md5String().c_str(), sizeof(_cache.imageMD5) - 1);
+                        }
+                        // a new build may keep the size and the last sector, its first boot hashes it again
+                        _cache.sketchSize = 0;
+                        _cache.sketchCrc = 0;
+                        saveCache();
+                    }
                     http.end();
 
                     if(_rebootOnUpdate && !spiffs) {
@@ -337,17 +581,116 @@ HTTPUpdateResult ESP8266HTTPUpdate::handleUpdate(HTTPClient& http, const String&
     return ret;
 }
 
+/**
+ * checks the first bytes of a sketch image
+ * @param buf const uint8_t *
+ * @param len size_t bytes available in buf
+ * @return true if the image can be flashed on this chip
+ */
+bool ESP8266HTTPUpdate::verifyHeader(const uint8_t* buf, size_t len)
+{
+    if(len != 4) {
+        DEBUG_HTTP_UPDATE("[httpUpdate] peekBytes magic header failed\n");
+        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+        return false;
+    }
+
+    // check for valid first magic byte
+    if(buf[0] != 0xE9) {
+        DEBUG_HTTP_UPDATE("[httpUpdate] Magic header does not start with 0xE9\n");
+        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+        return false;
+    }
+
+    uint32_t bin_flash_size = ESP.magicFlashChipSize((buf[3] & 0xf0) >> 4);
+
+    // check if new bin fits to SPI flash
+    if(bin_flash_size > ESP.getFlashChipRealSize()) {
+        DEBUG_HTTP_UPDATE("[httpUpdate] New binary does not fit SPI Flash size\n");
+        _lastError = HTTP_UE_BIN_FOR_WRONG_FLASH;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * rebuild the new sketch from a delta patch and the running sketch
+ * @param in Stream& the patch
+ * @param md5 String MD5 of the rebuilt sketch
+ * @return true if Update ok
+ */
+bool ESP8266HTTPUpdate::runDelta(Stream& in, String md5)
+{
+    DeltaStream delta(in);
+
+    if(!delta.begin()) {
+        DEBUG_HTTP_UPDATE("[httpUpdate] delta header read failed\n");
+        _lastError = HTTP_UE_DELTA_CORRUPT;
+        return false;
+    }
+
+    DEBUG_HTTP_UPDATE("[httpUpdate]  - delta size: %u base: %s\n", delta.size(), delta.baseMD5().c_str());
+
+    // hashed from flash, not taken from the lightCheck() cache: a stale MD5 would patch the wrong base
+    if(delta.baseMD5() != ESP.getSketchMD5()) {
+        DEBUG_HTTP_UPDATE("[httpUpdate] delta base does not match the running sketch\n");
+        _lastError = HTTP_UE_DELTA_BASE_MISMATCH;
+        return false;
+    }
+
+    if(delta.size() > ESP.getFreeSketchSpace()) {
+        DEBUG_HTTP_UPDATE("[httpUpdate] FreeSketchSpace to low (%d) needed: %d\n", ESP.getFreeSketchSpace(), delta.size());
+        _lastError = HTTP_UE_TOO_LESS_SPACE;
+        return false;
+    }
+
+    uint8_t buf[4];
+    if(!verifyHeader(buf, delta.peekBytes(buf, 4))) {
+        if(delta.hasError()) {
+            _lastError = HTTP_UE_DELTA_CORRUPT;
+        }
+        return false;
+    }
+
+    if(!runUpdate(delta, delta.size(), md5, U_FLASH)) {
+        if(delta.hasError()) {
+            _lastError = HTTP_UE_DELTA_CORRUPT;
+        }
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * write Update to flash
  * @param in Stream&
- * @param size uint32_t
+ * @param size uint32_t 0 if unknown, then the image ends with the last chunk
  * @param md5 String
+ * @param chunked ChunkedStream * the stream under in for a chunked response
  * @return true if Update ok
  */
-bool ESP8266HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int command)
+bool ESP8266HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int command, ChunkedStream* chunked)
 {
 
     StreamString error;
+    bool toEnd = (size == 0);
+
+    if(toEnd) {
+        if(!chunked) {
+            _lastError = HTTP_UE_SERVER_NOT_REPORT_SIZE;
+            return false;
+        }
+        if(command == U_SPIFFS) {
+            size = (size_t) &_SPIFFS_end - (size_t) &_SPIFFS_start;
+        } else {
+            size = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+        }
+    }
+
+    memset(&_stats, 0, sizeof(_stats));
+    uint32_t start = micros();
 
     if(!Update.begin(size, command)) {
         _lastError = Update.getError();
@@ -365,25 +708,300 @@ bool ESP8266HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int com
         }
     }
 
-    if(Update.writeStream(in) != size) {
-        _lastError = Update.getError();
+    UpdateSignature* signature = (command == U_FLASH && _signature.enabled()) ? &_signature : NULL;
+    TimedStream timed(in, _stats.receive, signature);
+    uint32_t offset = 0;
+
+    if(_resuming) {
+        if(_resume.committed && !replayResume(signature)) {
+            DEBUG_HTTP_UPDATE("[httpUpdate] saved download does not match flash\n");
+            Update.end();
+            clearResume();
+            _lastError = HTTP_UE_RESUME_MISMATCH;
+            return false;
+        }
+        offset = _resume.committed;
+        _stats.bytes = writeBody(timed, size - offset);
+    } else if(toEnd) {
+        _stats.bytes = writeBody(timed, size);
+    } else {
+        _stats.bytes = Update.writeStream(timed);
+    }
+    _stats.total = micros() - start;
+    _stats.write = _stats.total - _stats.receive;
+
+    DEBUG_HTTP_UPDATE("[httpUpdate] %u bytes in %u us (receive: %u us, write: %u us)\n",
+                      _stats.bytes, _stats.total, _stats.receive, _stats.write);
+
+    if(toEnd ? (!chunked->isFinished() || Update.hasError()) : (_stats.bytes != size - offset)) {
+        _lastError = Update.hasError() ? Update.getError() : HTTPC_ERROR_READ_TIMEOUT;
         Update.printError(error);
         error.trim(); // remove line ending
         DEBUG_HTTP_UPDATE("[httpUpdate] Update.writeStream failed! (%s)\n", error.c_str());
+        if(_resuming && Update.hasError()) {
+            clearResume(); // otherwise the saved progress is kept for the next attempt
+        }
+        Update.end(); // stop the Updater if the loop above left it running
         return false;
     }
 
-    if(!Update.end()) {
+    if(!Update.end(toEnd)) { // for chunked images the size is set to the bytes written
         _lastError = Update.getError();
         Update.printError(error);
         error.trim(); // remove line ending
         DEBUG_HTTP_UPDATE("[httpUpdate] Update.end failed! (%s)\n", error.c_str());
+        clearResume();
         return false;
     }
 
+    clearResume();
+
+    if(signature) {
+        bool valid = signature->verify(); // drops the staged image if it fails
+        _stats.verify = signature->verifyTime();
+        DEBUG_HTTP_UPDATE("[httpUpdate] signature %s in %u us\n", valid ? "ok" : "invalid", _stats.verify);
+        if(!valid) {
+            _lastError = HTTP_UE_SIGNATURE_INVALID;
+            return false;
+        }
+    }
     return true;
 }
 
+/**
+ * loads the saved download progress from RTC memory
+ * @param command int U_FLASH or U_SPIFFS
+ * @return true if a download of the same kind was interrupted
+ */
+bool ESP8266HTTPUpdate::loadResume(int command)
+{
+    if(!ESP.rtcUserMemoryRead(HTTP_UPDATE_RTC_OFFSET, (uint32_t*) &_resume, sizeof(_resume))) {
+        return false;
+    }
+    return _resume.magic == HTTP_UPDATE_RESUME_MAGIC &&
+           _resume.check == crc32Update(&_resume, offsetof(HTTPUpdateResume, check)) &&
+           _resume.command == (uint32_t) command;
+}
+
+/**
+ * starts saving the progress of a new download
+ * @param md5 const String& empty if the image can not be resumed
+ */
+void ESP8266HTTPUpdate::startResume(const String& md5, uint32_t size, int command)
+{
+    if(!_resumeDownloads) {
+        _resuming = false;
+        return;
+    }
+    if(md5.length() != 32) {
+        clearResume();
+        return;
+    }
+    _resume.id = crc32Update(md5.c_str(), md5.length());
+    _resume.size = size;
+    _resume.command = command;
+    _resume.committed = 0;
+    _resume.crc = 0xffffffff;
+    _resume.magic = 0; // saved below
+    _resuming = true;
+    saveResume();
+}
+
+/**
+ * checks that a 206 response continues the saved download
+ */
+bool ESP8266HTTPUpdate::checkResume(HTTPClient& http, int len)
+{
+    String md5 = http.header("x-MD5");
+    unsigned int first, last, size;
+
+    // Content-Range: bytes <first>-<last>/<size>
+    if(sscanf(http.header("Content-Range").c_str(), "bytes %u-%u/%u", &first, &last, &size) != 3) {
+        return false;
+    }
+    return md5.length() == 32 && crc32Update(md5.c_str(), md5.length()) == _resume.id &&
+           size == _resume.size && first == _resume.committed && last + 1 == size &&
+           (len < 0 || len == (int) (size - first));
+}
+
+/**
+ * checks the committed bytes still in flash and passes them to Update again,
+ * so the Updater MD5 and the signature hash cover the whole image
+ */
+bool ESP8266HTTPUpdate::replayResume(UpdateSignature* signature)
+{
+    uint32_t buf[64];
+    uint32_t address = resumeAddress();
+    uint32_t crc = 0xffffffff;
+    uint32_t offset;
+
+    for(offset = 0; offset < _resume.committed; offset += sizeof(buf)) {
+        if(!ESP.flashRead(address + offset, buf, sizeof(buf))) {
+            return false;
+        }
+        crc = crc32Update(buf, sizeof(buf), crc);
+    }
+    if(crc != _resume.crc) {
+        return false;
+    }
+
+    // the Updater erases a sector only after it has been read back here
+    for(offset = 0; offset < _resume.committed; offset += sizeof(buf)) {
+        if(!ESP.flashRead(address + offset, buf, sizeof(buf)) ||
+           Update.write((uint8_t*) buf, sizeof(buf)) != sizeof(buf)) {
+            return false;
+        }
+        if(signature) {
+            signature->add((const uint8_t*) buf, sizeof(buf));
+        }
+    }
+    return true;
+}
+
+/**
+ * writes up to len bytes or up to the end of the stream, saving the progress of resumable downloads.
+ * Used where Update.writeStream() does not fit: it checks the magic byte on the first byte
+ * it reads and treats the end of the stream as an error
+ * @return bytes written
+ */
+size_t ESP8266HTTPUpdate::writeBody(Stream& in, uint32_t len)
+{
+    uint8_t buf[256];
+    size_t written = 0;
+
+    while(written < len) {
+        size_t toRead = std::min((size_t) (len - written), sizeof(buf));
+        size_t got = in.readBytes((char*) buf, toRead);
+        if(got && Update.write(buf, got) != got) {
+            break;
+        }
+        written += got;
+        if(_resuming) {
+            saveResume();
+        }
+        if(got < toRead) {
+            break; // end of the stream or timeout
+        }
+    }
+    return written;
+}
+
+/**
+ * reads back the sectors written since the last call and saves the progress
+ */
+void ESP8266HTTPUpdate::saveResume()
+{
+    uint32_t committed = Update.progress() & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t buf[64];
+    uint32_t address = resumeAddress();
+
+    if(_resume.magic == HTTP_UPDATE_RESUME_MAGIC && committed <= _resume.committed) {
+        return;
+    }
+    for(uint32_t offset = _resume.committed; offset < committed; offset += sizeof(buf)) {
+        if(!ESP.flashRead(address + offset, buf, sizeof(buf))) {
+            return;
+        }
+        _resume.crc = crc32Update(buf, sizeof(buf), _resume.crc);
+    }
+    _resume.committed = committed;
+    _resume.magic = HTTP_UPDATE_RESUME_MAGIC;
+    _resume.check = crc32Update(&_resume, offsetof(HTTPUpdateResume, check));
+    ESP.rtcUserMemoryWrite(HTTP_UPDATE_RTC_OFFSET, (uint32_t*) &_resume, sizeof(_resume));
+}
+
+void ESP8266HTTPUpdate::clearResume()
+{
+    if(!_resumeDownloads) {
+        return;
+    }
+    memset(&_resume, 0, sizeof(_resume));
+    ESP.rtcUserMemoryWrite(HTTP_UPDATE_RTC_OFFSET, (uint32_t*) &_resume, sizeof(_resume));
+    _resuming = false;
+}
+
+/**
+ * flash address of the image, computed like Update.begin()
+ */
+uint32_t ESP8266HTTPUpdate::resumeAddress()
+{
+    uint32_t updateEndAddress = (uint32_t) (uintptr_t) &_SPIFFS_start - 0x40200000;
+    if(_resume.command == U_SPIFFS) {
+        return updateEndAddress;
+    }
+    uint32_t roundedSize = (_resume.size + FLASH_SECTOR_SIZE - 1) & (~(FLASH_SECTOR_SIZE - 1));
+    return (updateEndAddress > roundedSize) ? (updateEndAddress - roundedSize) : 0;
+}
+
+/**
+ * MD5 of the running sketch, with lightCheck() cached in RTC memory.
+ * The cache belongs to a sketch identified by its size and a CRC32 of its last sector.
+ * That sector holds the end of .rodata and the checksum byte, which does not cover
+ * .irom0: a build changing only flash code can match, so every install clears the key.
+ * httpUpdate does it here, ArduinoOTA, the web updater and MulticastOTA with
+ * forgetSketchMD5(). A serial upload ends with a reset from the EN pin, which keeps
+ * RTC memory: after a reset from the pin the sketch is hashed again
+ */
+String ESP8266HTTPUpdate::sketchMD5()
+{
+    if(!_lightCheck) {
+        return ESP.getSketchMD5();
+    }
+
+    uint32_t size = ESP.getSketchSize();
+    uint32_t crc = 0xffffffff;
+    uint32_t buf[64];
+    for(uint32_t offset = (size > FLASH_SECTOR_SIZE) ? ((size - FLASH_SECTOR_SIZE) & ~3) : 0; offset < size; offset += sizeof(buf)) {
+        size_t len = std::min((size_t) (size - offset + 3) & ~3, sizeof(buf));
+        if(!ESP.flashRead(offset, buf, len)) {
+            return ESP.getSketchMD5();
+        }
+        crc = crc32Update(buf, len, crc);
+    }
+
+    bool pinReset = (ESP.getResetInfoPtr()->reason == REASON_EXT_SYS_RST);
+    if(loadCache() && !pinReset && _cache.sketchSize == size && _cache.sketchCrc == crc) {
+        return _cache.sketchMD5;
+    }
+
+    String md5 = ESP.getSketchMD5();
+    if(strcmp(_cache.imageMD5, md5.c_str()) != 0) {
+        // the ETag is for another image, e.g. the sketch was uploaded over serial
+        _cache.etag[0] = 0;
+    }
+    _cache.imageMD5[0] = 0;
+    _cache.sketchSize = size;
+    _cache.sketchCrc = crc;
+    strncpy(_cache.sketchMD5, md5.c_str(), sizeof(_cache.sketchMD5) - 1);
+    saveCache();
+    return md5;
+}
+
+void ESP8266HTTPUpdate::forgetSketchMD5()
+{
+    HTTPUpdateCache cache;
+    memset(&cache, 0, sizeof(cache)); // no magic, the next loadCache() fails
+    ESP.rtcUserMemoryWrite(HTTP_UPDATE_CACHE_OFFSET, (uint32_t*) &cache, sizeof(cache));
+}
+
+bool ESP8266HTTPUpdate::loadCache()
+{
+    if(ESP.rtcUserMemoryRead(HTTP_UPDATE_CACHE_OFFSET, (uint32_t*) &_cache, sizeof(_cache)) &&
+       _cache.magic == HTTP_UPDATE_CACHE_MAGIC &&
+       _cache.check == crc32Update(&_cache, offsetof(HTTPUpdateCache, check))) {
+        return true;
+    }
+    memset(&_cache, 0, sizeof(_cache));
+    return false;
+}
+
+void ESP8266HTTPUpdate::saveCache()
+{
+    _cache.magic = HTTP_UPDATE_CACHE_MAGIC;
+    _cache.check = crc32Update(&_cache, offsetof(HTTPUpdateCache, check));
+    ESP.rtcUserMemoryWrite(HTTP_UPDATE_CACHE_OFFSET, (uint32_t*) &_cache, sizeof(_cache));
+}
+
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
 ESP8266HTTPUpdate ESPhttpUpdate;
 #endif
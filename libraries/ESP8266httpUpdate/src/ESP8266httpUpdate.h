@@ -26,11 +26,15 @@
 #ifndef ESP8266HTTPUPDATE_H_
 #define ESP8266HTTPUPDATE_H_
 
+#include <functional>
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
 #include <WiFiUdp.h>
 #include <ESP8266HTTPClient.h>
+#include "UpdateSignature.h"
+
+class ChunkedStream;
 
 #ifdef DEBUG_ESP_HTTP_UPDATE
 #ifdef DEBUG_ESP_PORT
@@ -51,6 +55,18 @@
 #define HTTP_UE_SERVER_FAULTY_MD5           (-105)
 #define HTTP_UE_BIN_VERIFY_HEADER_FAILED    (-106)
 #define HTTP_UE_BIN_FOR_WRONG_FLASH         (-107)
+#define HTTP_UE_DELTA_BASE_MISMATCH         (-108)
+#define HTTP_UE_DELTA_CORRUPT               (-109)
+#define HTTP_UE_COMPRESSED_CORRUPT          (-110)
+#define HTTP_UE_RESUME_MISMATCH             (-111)
+#define HTTP_UE_ROLLED_BACK                 (-112)
+#define HTTP_UE_SIGNATURE_MISSING           (-113)
+#define HTTP_UE_SIGNATURE_INVALID           (-114)
+
+#ifndef HTTP_UPDATE_RTC_OFFSET
+/// first RTC user memory block used to resume downloads, blocks 0-31 hold the eboot command
+#define HTTP_UPDATE_RTC_OFFSET              32
+#endif
 
 enum HTTPUpdateResult {
     HTTP_UPDATE_FAILED,
@@ -60,6 +76,44 @@ enum HTTPUpdateResult {
 
 typedef HTTPUpdateResult t_httpUpdate_return; // backward compatibility
 
+/// CRC32 protecting the records kept in RTC user memory
+uint32_t crc32Update(const void* data, size_t length, uint32_t crc = 0xffffffff);
+
+/// time spent in each stage of the last update, in microseconds
+typedef struct {
+    uint32_t bytes;     ///< bytes written to flash
+    uint32_t total;     ///< from Update.begin() to the last byte written
+    uint32_t receive;   ///< reading from the socket, including waits for data
+    uint32_t write;     ///< Update: MD5 update, flash sector erase and write, SHA-256 of signed images
+    uint32_t verify;    ///< Ed25519 check of signed images, after the last byte
+} HTTPUpdateStats;
+
+/// download progress kept in RTC user memory between attempts
+typedef struct {
+    uint32_t magic;
+    uint32_t id;        ///< CRC32 of the image MD5 (x-MD5 header)
+    uint32_t size;      ///< image size
+    uint32_t command;   ///< U_FLASH or U_SPIFFS
+    uint32_t committed; ///< bytes written to flash and read back, whole sectors
+    uint32_t crc;       ///< CRC32 of the committed bytes
+    uint32_t check;     ///< CRC32 of the fields above
+} HTTPUpdateResume;
+
+#ifndef HTTP_UPDATE_ETAG_SIZE
+#define HTTP_UPDATE_ETAG_SIZE               48
+#endif
+
+/// sketch MD5 and ETag of the installed image kept in RTC user memory, after HTTPUpdateResume
+typedef struct {
+    uint32_t magic;
+    uint32_t sketchSize;                ///< size of the sketch the MD5 belongs to
+    uint32_t sketchCrc;                 ///< CRC32 of the last sector of that sketch
+    char sketchMD5[33];                 ///< MD5 of the running sketch
+    char imageMD5[33];                  ///< MD5 of the image the ETag belongs to
+    char etag[HTTP_UPDATE_ETAG_SIZE];   ///< ETag of the installed image
+    uint32_t check;                     ///< CRC32 of the fields above
+} HTTPUpdateCache;
+
 class ESP8266HTTPUpdate
 {
 public:
@@ -71,6 +125,57 @@ public:
         _rebootOnUpdate = reboot;
     }
 
+    /**
+     * cheaper update checks: the sketch MD5 is cached in RTC memory instead of hashing the sketch
+     * every time, and the request carries If-None-Match with the ETag of the installed image
+     */
+    void lightCheck(bool enable)
+    {
+        _lightCheck = enable;
+    }
+
+    /// HTTP/1.0 by default, with HTTP/1.1 chunked responses are decoded while they are written
+    void useHTTP10(bool useHTTP10)
+    {
+        _useHTTP10 = useHTTP10;
+    }
+
+    /**
+     * keep the download progress in RTC memory and ask for the rest with a Range request on the next attempt,
+     * only for plain images sent with a x-MD5 header
+     */
+    void resumeDownloads(bool resume)
+    {
+        _resumeDownloads = resume;
+    }
+
+    /**
+     * drops the sketch MD5 and the ETag cached by lightCheck(), for the other update paths:
+     * call it once they have staged a sketch, the next check hashes the new sketch
+     */
+    static void forgetSketchMD5();
+
+    /// tell the server that a delta patch against the running sketch is accepted (see DeltaStream.h)
+    void acceptDelta(bool accept)
+    {
+        _acceptDelta = accept;
+    }
+
+    /// called when the server sends an image, right before the download, not on a 304 or a refused answer
+    void onStart(std::function<void(void)> callback)
+    {
+        _onStart = callback;
+    }
+
+    /**
+     * only install sketches signed with this key, sent in the x-Signature header (see UpdateSignature.h)
+     * @param publicKey const uint8_t * ED25519_KEY_SIZE bytes, NULL accepts unsigned sketches
+     */
+    void setPublicKey(const uint8_t* publicKey)
+    {
+        _signature.setPublicKey(publicKey);
+    }
+
     // This function is deprecated, use rebootOnUpdate and the next one instead
     t_httpUpdate_return update(const String& url, const String& currentVersion,
                                const String& httpsFingerprint, bool reboot) __attribute__((deprecated));
@@ -93,16 +198,52 @@ public:
     t_httpUpdate_return updateSpiffs(const String& url, const String& currentVersion = "");
     t_httpUpdate_return updateSpiffs(const String& url, const String& currentVersion, const String& httpsFingerprint);
 
+    /// uses a HTTPClient set up by the caller, with setReuse(true) the connection is kept open when no update is sent
+    t_httpUpdate_return update(HTTPClient& http, const String& currentVersion = "");
+
 
     int getLastError(void);
     String getLastErrorString(void);
+    const HTTPUpdateStats& getStats(void);
+
+    /// seconds from the Retry-After header of the last answer (delay form only), 0 if there was none
+    uint32_t getRetryAfter(void)
+    {
+        return _retryAfter;
+    }
 
 protected:
     t_httpUpdate_return handleUpdate(HTTPClient& http, const String& currentVersion, bool spiffs = false);
-    bool runUpdate(Stream& in, uint32_t size, String md5, int command = U_FLASH);
+    bool runUpdate(Stream& in, uint32_t size, String md5, int command = U_FLASH, ChunkedStream* chunked = NULL);
+    bool runDelta(Stream& in, String md5);
+    bool verifyHeader(const uint8_t* buf, size_t len);
+
+    bool loadResume(int command);
+    void startResume(const String& md5, uint32_t size, int command);
+    bool checkResume(HTTPClient& http, int len);
+    bool replayResume(UpdateSignature* signature);
+    size_t writeBody(Stream& in, uint32_t len);
+    void saveResume();
+    void clearResume();
+    uint32_t resumeAddress();
+
+    String sketchMD5();
+    bool loadCache();
+    void saveCache();
 
     int _lastError;
+    uint32_t _retryAfter = 0;
     bool _rebootOnUpdate = true;
+    bool _acceptDelta = false;
+    bool _useHTTP10 = true;
+    bool _lightCheck = false;
+    bool _resumeDownloads = false;
+    bool _resuming = false;
+    HTTPUpdateResume _resume;
+    HTTPUpdateCache _cache;
+    HTTPUpdateStats _stats;
+    UpdateSignature _signature;
+    std::function<void(void)> _onStart;
 };
 
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
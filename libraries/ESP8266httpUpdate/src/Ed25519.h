@@ -0,0 +1,33 @@
+/**
+ *
+ * @file Ed25519.h
+ *
+ * Ed25519 signature verification, derived from TweetNaCl (public domain).
+ * Only what is needed to check a firmware signature: no signing and no secret data.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef ED25519_H_
+#define ED25519_H_
+
+#include <Arduino.h>
+
+#define ED25519_KEY_SIZE        32
+#define ED25519_SIGNATURE_SIZE  64
+
+/**
+ * checks an Ed25519 signature. Takes seconds on the ESP8266 (see the HashBenchmark example) and yields meanwhile
+ * @param signature const uint8_t * ED25519_SIGNATURE_SIZE bytes
+ * @param message const uint8_t *
+ * @param len size_t message length
+ * @param publicKey const uint8_t * ED25519_KEY_SIZE bytes
+ * @return true if the signature is valid
+ */
+bool ed25519Verify(const uint8_t* signature, const uint8_t* message, size_t len, const uint8_t* publicKey);
+
+#endif /* ED25519_H_ */
@@ -0,0 +1,288 @@
+/**
+ *
+ * @file LzssDecoder.cpp
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include "LzssDecoder.h"
+
+static const uint8_t lzssMagic[LZSS_MAGIC_SIZE] = { 'E', 'S', 'P', 'Z' };
+
+LzssDecoder::LzssDecoder()
+    : _window(NULL)
+{
+    reset();
+}
+
+LzssDecoder::~LzssDecoder()
+{
+    reset();
+}
+
+void LzssDecoder::reset()
+{
+    if(_window) {
+        free(_window);
+        _window = NULL;
+    }
+    _state = STATE_HEADER;
+    _error = false;
+    _headerLen = 0;
+    _windowBits = 0;
+    _lookaheadBits = 0;
+    _head = 0;
+    _index = 0;
+    _count = 0;
+    _bits = 0;
+    _bitCount = 0;
+    _size = 0;
+    _produced = 0;
+}
+
+bool LzssDecoder::isCompressed(const uint8_t* buf, size_t len)
+{
+    return len >= LZSS_MAGIC_SIZE && memcmp(buf, lzssMagic, LZSS_MAGIC_SIZE) == 0;
+}
+
+bool LzssDecoder::_parseHeader()
+{
+    if(!isCompressed(_header, _headerLen)) {
+        return false;
+    }
+    _size = _header[4] | (_header[5] << 8) | (_header[6] << 16) | ((uint32_t) _header[7] << 24);
+    _windowBits = _header[8];
+    _lookaheadBits = _header[9];
+    if(_windowBits < LZSS_MIN_WINDOW_BITS || _windowBits > LZSS_MAX_WINDOW_BITS ||
+       _lookaheadBits < 3 || _lookaheadBits >= _windowBits) {
+        return false;
+    }
+    // the encoder starts with a window of zeros
+    _window = (uint8_t*) calloc(1, 1 << _windowBits);
+    return _window != NULL;
+}
+
+bool LzssDecoder::_getBits(uint8_t count, uint16_t& value, const uint8_t*& in, size_t& inLen)
+{
+    while(_bitCount < count) {
+        if(inLen == 0) {
+            return false;
+        }
+        _bits = (_bits << 8) | *in++;
+        inLen--;
+        _bitCount += 8;
+    }
+    _bitCount -= count;
+    value = (_bits >> _bitCount) & ((1 << count) - 1);
+    return true;
+}
+
+size_t LzssDecoder::decode(const uint8_t*& in, size_t& inLen, uint8_t* out, size_t outLen)
+{
+    size_t produced = 0;
+    uint16_t mask = (1 << _windowBits) - 1;
+    uint16_t value;
+
+    while(!_error) {
+        if(_state == STATE_HEADER) {
+            while(_headerLen < LZSS_HEADER_SIZE && inLen) {
+                _header[_headerLen++] = *in++;
+                inLen--;
+            }
+            if(_headerLen < LZSS_HEADER_SIZE) {
+                break;
+            }
+            if(!_parseHeader()) {
+                _error = true;
+                break;
+            }
+            mask = (1 << _windowBits) - 1;
+            _state = STATE_TAG;
+            continue;
+        }
+
+        if(produced == outLen || _produced == _size) {
+            break;
+        }
+
+        switch(_state) {
+        case STATE_TAG:
+            if(!_getBits(1, value, in, inLen)) {
+                return produced;
+            }
+            _state = value ? STATE_LITERAL : STATE_INDEX;
+            break;
+        case STATE_LITERAL:
+            if(!_getBits(8, value, in, inLen)) {
+                return produced;
+            }
+            out[produced++] = value;
+            _window[_head++ & mask] = value;
+            _produced++;
+            _state = STATE_TAG;
+            break;
+        case STATE_INDEX:
+            if(!_getBits(_windowBits, value, in, inLen)) {
+                return produced;
+            }
+            _index = value + 1;
+            _state = STATE_COUNT;
+            break;
+        case STATE_COUNT:
+            if(!_getBits(_lookaheadBits, value, in, inLen)) {
+                return produced;
+            }
+            _count = value + 1;
+            if(_count > _size - _produced) {
+                _error = true;
+                return produced;
+            }
+            _state = STATE_COPY;
+            break;
+        case STATE_COPY:
+            while(_count && produced < outLen) {
+                uint8_t c = _window[(_head - _index) & mask];
+                out[produced++] = c;
+                _window[_head++ & mask] = c;
+                _produced++;
+                _count--;
+            }
+            if(!_count) {
+                _state = STATE_TAG;
+            }
+            break;
+        default:
+            _error = true;
+            break;
+        }
+    }
+    return produced;
+}
+
+size_t LzssDecoder::writeTo(UpdaterClass& update, const uint8_t* data, size_t len, Sha256* hash)
+{
+    return writeTo(update, data, len, SIZE_MAX, hash);
+}
+
+size_t LzssDecoder::writeTo(UpdaterClass& update, const uint8_t*& data, size_t& len, size_t limit, Sha256* hash)
+{
+    uint8_t buf[LZSS_BUFFER_SIZE / 2];
+    size_t total = 0;
+
+    while(!_error && total < limit) {
+        size_t decoded = decode(data, len, buf, std::min(sizeof(buf), limit - total));
+        if(!decoded) {
+            break;
+        }
+        size_t written = update.write(buf, decoded);
+        if(hash) {
+            hash->add(buf, written);
+        }
+        total += written;
+        if(written != decoded) {
+            break;
+        }
+    }
+    return total;
+}
+
+LzssStream::LzssStream(Stream& in)
+    : _in(in)
+    , _inputPos(_input)
+    , _inputLen(0)
+    , _outputPos(0)
+    , _outputLen(0)
+{
+    setTimeout(_in.getTimeout());
+}
+
+bool LzssStream::_readInput()
+{
+    // wait for at least one byte but never for more than is already buffered
+    size_t len = _in.available();
+    len = std::min(std::max(len, (size_t) 1), sizeof(_input));
+    _inputLen = _in.readBytes((char*) _input, len);
+    _inputPos = _input;
+    return _inputLen > 0;
+}
+
+bool LzssStream::begin()
+{
+    while(!_decoder.hasHeader() && !_decoder.hasError()) {
+        if(!_inputLen && !_readInput()) {
+            return false;
+        }
+        _decoder.decode(_inputPos, _inputLen, _output, 0);
+    }
+    return !_decoder.hasError();
+}
+
+bool LzssStream::_fill()
+{
+    while(_outputPos == _outputLen) {
+        if(_decoder.hasError() || _decoder.isFinished()) {
+            return false;
+        }
+        if(!_inputLen && !_readInput()) {
+            return false;
+        }
+        _outputPos = 0;
+        _outputLen = _decoder.decode(_inputPos, _inputLen, _output, sizeof(_output));
+    }
+    return true;
+}
+
+size_t LzssStream::peekBytes(uint8_t* buffer, size_t length)
+{
+    if(!_fill()) {
+        return 0;
+    }
+    size_t len = std::min(length, _outputLen - _outputPos);
+    memcpy(buffer, _output + _outputPos, len);
+    return len;
+}
+
+int LzssStream::available()
+{
+    if(_decoder.hasError()) {
+        return 0;
+    }
+    return _decoder.size() - _decoder.progress() + (_outputLen - _outputPos);
+}
+
+int LzssStream::read()
+{
+    if(!_fill()) {
+        return -1;
+    }
+    return _output[_outputPos++];
+}
+
+int LzssStream::peek()
+{
+    if(!_fill()) {
+        return -1;
+    }
+    return _output[_outputPos];
+}
+
+int LzssStream::read(uint8_t* buffer, size_t size)
+{
+    return readBytes((char*) buffer, size);
+}
+
+size_t LzssStream::readBytes(char* buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length && _fill()) {
+        size_t len = std::min(length - count, _outputLen - _outputPos);
+        memcpy(buffer + count, _output + _outputPos, len);
+        _outputPos += len;
+        count += len;
+    }
+    return count;
+}
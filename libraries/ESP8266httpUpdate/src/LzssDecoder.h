@@ -0,0 +1,176 @@
+/**
+ *
+ * @file LzssDecoder.h
+ *
+ * Streaming decoder for compressed OTA images.
+ *
+ * Image format:
+ *   header  "ESPZ" | uint32 image size (little endian) | uint8 window bits | uint8 lookahead bits
+ *   body    heatshrink bit stream with the same window and lookahead bits
+ *
+ * The decoder keeps a window of 2^window bits bytes on the heap (at most 4 KB),
+ * images are compressed by tools/ota_compress.py
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef LZSSDECODER_H_
+#define LZSSDECODER_H_
+
+#include <Arduino.h>
+#include <Updater.h>
+#include "Sha256.h"
+
+#define LZSS_MAGIC_SIZE         4
+#define LZSS_HEADER_SIZE        (LZSS_MAGIC_SIZE + 4 + 2)
+#define LZSS_MIN_WINDOW_BITS    4
+#define LZSS_MAX_WINDOW_BITS    12
+
+#ifndef LZSS_BUFFER_SIZE
+#define LZSS_BUFFER_SIZE        256
+#endif
+
+class LzssDecoder
+{
+public:
+    LzssDecoder();
+    ~LzssDecoder();
+
+    /// true if buf starts with the compressed image magic
+    static bool isCompressed(const uint8_t* buf, size_t len);
+
+    /**
+     * decodes from in until out is full or the input is used up,
+     * the header is taken from the first bytes of the input
+     * @param in const uint8_t *& advanced past the consumed bytes
+     * @param inLen size_t& decreased by the consumed bytes
+     * @return bytes written to out
+     */
+    size_t decode(const uint8_t*& in, size_t& inLen, uint8_t* out, size_t outLen);
+
+    /// decodes data and writes the result to update, returns the decoded bytes written. hash gets the bytes written
+    size_t writeTo(UpdaterClass& update, const uint8_t* data, size_t len, Sha256* hash = NULL);
+
+    /**
+     * like writeTo() but stops once limit decoded bytes are written,
+     * the rest of the input is left for the next call
+     * @param data const uint8_t *& advanced past the consumed bytes
+     * @param len size_t& decreased by the consumed bytes
+     * @return decoded bytes written
+     */
+    size_t writeTo(UpdaterClass& update, const uint8_t*& data, size_t& len, size_t limit, Sha256* hash = NULL);
+
+    /// frees the window, the decoder can be used for another image
+    void reset();
+
+    bool hasHeader() const
+    {
+        return _state != STATE_HEADER;
+    }
+
+    /// size of the decoded image, valid once hasHeader()
+    uint32_t size() const
+    {
+        return _size;
+    }
+
+    /// decoded bytes so far
+    uint32_t progress() const
+    {
+        return _produced;
+    }
+
+    bool isFinished() const
+    {
+        return hasHeader() && _produced == _size;
+    }
+
+    bool hasError() const
+    {
+        return _error;
+    }
+
+protected:
+    enum State {
+        STATE_HEADER,
+        STATE_TAG,
+        STATE_LITERAL,
+        STATE_INDEX,
+        STATE_COUNT,
+        STATE_COPY
+    };
+
+    bool _getBits(uint8_t count, uint16_t& value, const uint8_t*& in, size_t& inLen);
+    bool _parseHeader();
+
+    State _state;
+    bool _error;
+    uint8_t _header[LZSS_HEADER_SIZE];
+    uint8_t _headerLen;
+    uint8_t _windowBits;
+    uint8_t _lookaheadBits;
+    uint8_t* _window;
+    uint16_t _head;
+    uint16_t _index;
+    uint16_t _count;
+    uint32_t _bits;
+    uint8_t _bitCount;
+    uint32_t _size;
+    uint32_t _produced;
+};
+
+/**
+ * Stream adapter decoding a compressed image read from another stream
+ */
+class LzssStream : public Stream
+{
+public:
+    LzssStream(Stream& in);
+
+    /// reads the header, false if the input is not a valid compressed image
+    bool begin();
+
+    uint32_t size() const
+    {
+        return _decoder.size();
+    }
+
+    bool hasError() const
+    {
+        return _decoder.hasError();
+    }
+
+    size_t peekBytes(uint8_t* buffer, size_t length);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    int read(uint8_t* buffer, size_t size);
+    size_t readBytes(char* buffer, size_t length);
+    void flush() override
+    {
+    }
+    size_t write(uint8_t) override
+    {
+        return 0;
+    }
+
+protected:
+    bool _fill();
+    bool _readInput();
+
+    Stream& _in;
+    LzssDecoder _decoder;
+    uint8_t _input[LZSS_BUFFER_SIZE / 2];
+    const uint8_t* _inputPos;
+    size_t _inputLen;
+    uint8_t _output[LZSS_BUFFER_SIZE];
+    size_t _outputPos;
+    size_t _outputLen;
+};
+
+#endif /* LZSSDECODER_H_ */
@@ -0,0 +1,132 @@
+/**
+ *
+ * @file Sha256.cpp
+ *
+ * FIPS 180-4 SHA-256
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include "Sha256.h"
+
+static const uint32_t sha256K[64] PROGMEM = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t ror(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256()
+{
+    begin();
+}
+
+void Sha256::begin()
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(_state, init, sizeof(_state));
+    _length = 0;
+}
+
+void Sha256::add(const uint8_t* data, size_t len)
+{
+    size_t used = _length % SHA256_BLOCK_SIZE;
+    _length += len;
+
+    if(used) {
+        size_t fill = std::min(len, (size_t) (SHA256_BLOCK_SIZE - used));
+        memcpy(_buffer + used, data, fill);
+        data += fill;
+        len -= fill;
+        if(used + fill < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        _block(_buffer);
+    }
+    // whole blocks straight from the caller buffer
+    while(len >= SHA256_BLOCK_SIZE) {
+        _block(data);
+        data += SHA256_BLOCK_SIZE;
+        len -= SHA256_BLOCK_SIZE;
+    }
+    memcpy(_buffer, data, len);
+}
+
+void Sha256::calculate(uint8_t* digest)
+{
+    uint64_t bits = (uint64_t) _length * 8;
+    size_t used = _length % SHA256_BLOCK_SIZE;
+
+    _buffer[used++] = 0x80;
+    if(used > SHA256_BLOCK_SIZE - 8) {
+        memset(_buffer + used, 0, SHA256_BLOCK_SIZE - used);
+        _block(_buffer);
+        used = 0;
+    }
+    memset(_buffer + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+    for(int i = 0; i < 8; i++) {
+        _buffer[SHA256_BLOCK_SIZE - 1 - i] = bits >> (8 * i);
+    }
+    _block(_buffer);
+
+    for(int i = 0; i < 8; i++) {
+        digest[4 * i] = _state[i] >> 24;
+        digest[4 * i + 1] = _state[i] >> 16;
+        digest[4 * i + 2] = _state[i] >> 8;
+        digest[4 * i + 3] = _state[i];
+    }
+}
+
+void Sha256::_block(const uint8_t* block)
+{
+    uint32_t w[16];
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+
+    for(int i = 0; i < 64; i++) {
+        // the message schedule is kept in a 16 word ring
+        if(i < 16) {
+            w[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16) |
+                   ((uint32_t) block[4 * i + 2] << 8) | block[4 * i + 3];
+        } else {
+            uint32_t w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            w[i & 15] += (ror(w15, 7) ^ ror(w15, 18) ^ (w15 >> 3)) + w[(i - 7) & 15] +
+                         (ror(w2, 17) ^ ror(w2, 19) ^ (w2 >> 10));
+        }
+        uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) +
+                      pgm_read_dword(&sha256K[i]) + w[i & 15];
+        uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+}
@@ -0,0 +1,47 @@
+/**
+ *
+ * @file Sha256.h
+ *
+ * Incremental SHA-256, fed with the image while it is written to flash.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <Arduino.h>
+
+#define SHA256_SIZE         32
+#define SHA256_BLOCK_SIZE   64
+
+class Sha256
+{
+public:
+    Sha256();
+
+    void begin();
+    void add(const uint8_t* data, size_t len);
+
+    /// writes the SHA256_SIZE byte digest, begin() has to be called again afterwards
+    void calculate(uint8_t* digest);
+
+    /// bytes added since begin()
+    uint32_t length() const
+    {
+        return _length;
+    }
+
+protected:
+    void _block(const uint8_t* block);
+
+    uint32_t _state[8];
+    uint8_t _buffer[SHA256_BLOCK_SIZE];
+    uint32_t _length;
+};
+
+#endif /* SHA256_H_ */
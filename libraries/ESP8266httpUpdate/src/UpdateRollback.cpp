@@ -0,0 +1,350 @@
+/**
+ *
+ * @file UpdateRollback.cpp
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include "UpdateRollback.h"
+#include <MD5Builder.h>
+#include <stddef.h>
+#include "eboot_command.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+extern "C" uint32_t _SPIFFS_start;
+
+#define UPDATE_ROLLBACK_MAGIC 0x4553524b
+#define UPDATE_SIGNATURE_MAGIC 0x45535347
+
+static uint32_t sectorRound(uint32_t size)
+{
+    return (size + FLASH_SECTOR_SIZE - 1) & (~(FLASH_SECTOR_SIZE - 1));
+}
+
+UpdateRollbackClass::UpdateRollbackClass()
+    : _timerArmed(false)
+    , _timeout(0)
+    , _tick(0)
+    , _lastError(0)
+{
+    memset(&_record, 0, sizeof(_record));
+}
+
+bool UpdateRollbackClass::prepare(const String& md5)
+{
+    struct eboot_command cmd;
+    _lastError = 0;
+
+    // Update.end() leaves the copy of the staged image for eboot
+    if(eboot_command_read(&cmd) != 0 || cmd.action != ACTION_COPY_RAW || cmd.args[1] != 0) {
+        _lastError = UPDATE_ROLLBACK_ERROR_NO_IMAGE;
+        return false;
+    }
+    uint32_t image = cmd.args[0];
+    uint32_t imageSize = cmd.args[2];
+
+    // a sector that was not written correctly would be copied over the sketch
+    if(md5.length() != 32 || !flashMD5(image, imageSize).equalsIgnoreCase(md5)) {
+        eboot_command_clear();
+        _lastError = UPDATE_ROLLBACK_ERROR_VERIFY;
+        return false;
+    }
+
+    uint32_t size = ESP.getSketchSize();
+    saveSignature(image, imageSize, size, md5); // peers can't check the sketch without it, the update goes on
+    uint32_t address = saveAddress(image, imageSize, size);
+    if(!address) {
+        _lastError = UPDATE_ROLLBACK_ERROR_SPACE;
+        return false;
+    }
+
+    String sketchMD5 = ESP.getSketchMD5();
+    if(flashMD5(address, size) != sketchMD5) { // not already saved by an earlier attempt
+        if(!flashCopy(0, address, size) || flashMD5(address, size) != sketchMD5) {
+            _lastError = UPDATE_ROLLBACK_ERROR_FLASH;
+            return false;
+        }
+    }
+
+    memset(&_record, 0, sizeof(_record));
+    _record.state = ROLLBACK_PENDING;
+    _record.address = address;
+    _record.size = size;
+    String imageMD5 = md5;
+    imageMD5.toLowerCase();
+    imageMD5.toCharArray(_record.imageMD5, sizeof(_record.imageMD5));
+    save();
+    return true;
+}
+
+bool UpdateRollbackClass::begin(uint32_t timeout, uint8_t boots, uint8_t wakes)
+{
+    if(!load()) {
+        return false;
+    }
+
+    if(_record.state == ROLLBACK_PENDING) {
+        // the staged image was not installed, e.g. a serial upload came first
+        if(ESP.getSketchMD5() != _record.imageMD5) {
+            memset(&_record, 0, sizeof(_record));
+            save();
+            return false;
+        }
+        _record.state = ROLLBACK_TRIAL;
+        _record.boots = 0;
+        _record.wakes = 0;
+        _record.used = 0;
+    }
+    if(_record.state != ROLLBACK_TRIAL) {
+        return false;
+    }
+
+    // a sketch that crashes or hangs before the timeout is counted by its resets,
+    // one that sleeps before it by its wake ups and the time it ran
+    bool over;
+    if(ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE) {
+        over = ++_record.wakes > wakes;
+    } else {
+        over = ++_record.boots > boots;
+    }
+    save();
+    if(over || _record.used >= timeout) {
+        rollback();
+        return true;
+    }
+
+    _timeout = timeout;
+    _tick = millis();
+    os_timer_disarm(&_timer);
+    os_timer_setfn(&_timer, &UpdateRollbackClass::onTick, this);
+    os_timer_arm(&_timer, std::min((uint32_t) UPDATE_ROLLBACK_TICK, timeout - _record.used), true);
+    _timerArmed = true;
+    return true;
+}
+
+void UpdateRollbackClass::confirm()
+{
+    if(_timerArmed) {
+        os_timer_disarm(&_timer);
+        _timerArmed = false;
+    }
+    if(load() && _record.state == ROLLBACK_TRIAL) {
+        memset(&_record, 0, sizeof(_record));
+        save();
+    }
+}
+
+void UpdateRollbackClass::rollback()
+{
+    if(revert()) {
+        ESP.restart();
+    }
+}
+
+UpdateRollbackState UpdateRollbackClass::state()
+{
+    return load() ? (UpdateRollbackState) _record.state : ROLLBACK_NONE;
+}
+
+String UpdateRollbackClass::rejectedMD5()
+{
+    if(state() != ROLLBACK_REVERTED) {
+        return String();
+    }
+    return String(_record.imageMD5);
+}
+
+int UpdateRollbackClass::getLastError()
+{
+    return _lastError;
+}
+
+String UpdateRollbackClass::getLastErrorString()
+{
+    switch(_lastError) {
+    case UPDATE_ROLLBACK_ERROR_NO_IMAGE:
+        return F("No Staged Sketch");
+    case UPDATE_ROLLBACK_ERROR_VERIFY:
+        return F("Staged Sketch Read Back Failed, Update Cancelled");
+    case UPDATE_ROLLBACK_ERROR_SPACE:
+        return F("No Space To Save The Running Sketch");
+    case UPDATE_ROLLBACK_ERROR_FLASH:
+        return F("Saving The Running Sketch Failed");
+    }
+    return String();
+}
+
+String UpdateRollbackClass::installedSignature()
+{
+    // Update stages an image right below SPIFFS, the sector under it is where prepare() saved the signature
+    uint32_t image = (uint32_t) (uintptr_t) &_SPIFFS_start - 0x40200000 - sectorRound(ESP.getSketchSize());
+    UpdateSignatureRecord record;
+    if(!ESP.flashRead(image - FLASH_SECTOR_SIZE, (uint32_t*) &record, sizeof(record)) ||
+       record.magic != UPDATE_SIGNATURE_MAGIC ||
+       record.check != crc32Update(&record, offsetof(UpdateSignatureRecord, check)) ||
+       ESP.getSketchMD5() != record.imageMD5) {
+        return String();
+    }
+
+    String hex;
+    hex.reserve(UPDATE_SIGNATURE_HEX_SIZE);
+    for(size_t i = 0; i < sizeof(record.signature); i++) {
+        hex += "0123456789abcdef"[record.signature[i] >> 4];
+        hex += "0123456789abcdef"[record.signature[i] & 0xf];
+    }
+    return hex;
+}
+
+uint32_t UpdateRollbackClass::saveAddress(uint32_t image, uint32_t imageSize, uint32_t sketchSize)
+{
+    // the copy stays clear of the running sketch, it would overwrite what is still to be read,
+    // and of the sectors eboot writes the new image to, they would overwrite the copy
+    uint32_t size = sectorRound(sketchSize);
+    if(image < size + FLASH_SECTOR_SIZE) {
+        return 0;
+    }
+    uint32_t address = image - FLASH_SECTOR_SIZE - size;
+    if(address < std::max(size, sectorRound(imageSize))) {
+        return 0;
+    }
+    return address;
+}
+
+/**
+ * writes the signature of the staged image in the sector below it, with the same clearances as the saved copy
+ * @return false if the image was not verified or there is no room
+ */
+bool UpdateRollbackClass::saveSignature(uint32_t image, uint32_t imageSize, uint32_t sketchSize, const String& md5)
+{
+    UpdateSignatureRecord record;
+    memset(&record, 0, sizeof(record));
+    if(!UpdateSignature::takeStaged(record.signature)) {
+        return false;
+    }
+    if(image < FLASH_SECTOR_SIZE + std::max(sectorRound(sketchSize), sectorRound(imageSize))) {
+        return false;
+    }
+
+    record.magic = UPDATE_SIGNATURE_MAGIC;
+    String imageMD5 = md5;
+    imageMD5.toLowerCase();
+    imageMD5.toCharArray(record.imageMD5, sizeof(record.imageMD5));
+    record.check = crc32Update(&record, offsetof(UpdateSignatureRecord, check));
+
+    uint32_t address = image - FLASH_SECTOR_SIZE;
+    return ESP.flashEraseSector(address / FLASH_SECTOR_SIZE) && ESP.flashWrite(address, (uint32_t*) &record, sizeof(record));
+}
+
+/**
+ * tells eboot to copy the saved sketch back, runs from the timer too
+ * @return true if the copy is set up
+ */
+bool UpdateRollbackClass::revert()
+{
+    if(!load() || _record.state != ROLLBACK_TRIAL) {
+        return false;
+    }
+
+    struct eboot_command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.action = ACTION_COPY_RAW;
+    cmd.args[0] = _record.address;
+    cmd.args[1] = 0x00000;
+    cmd.args[2] = _record.size;
+    eboot_command_write(&cmd);
+
+    _record.state = ROLLBACK_REVERTED;
+    save();
+    return true;
+}
+
+/**
+ * adds the time since the last tick to the trial, so a deep sleep keeps it for the next wake
+ */
+void UpdateRollbackClass::onTick(void* arg)
+{
+    UpdateRollbackClass* self = reinterpret_cast<UpdateRollbackClass*>(arg);
+    uint32_t now = millis();
+    if(!self->load() || self->_record.state != ROLLBACK_TRIAL) {
+        os_timer_disarm(&self->_timer);
+        self->_timerArmed = false;
+        return;
+    }
+    self->_record.used += now - self->_tick;
+    self->_tick = now;
+    if(self->_record.used < self->_timeout) {
+        self->save();
+        return;
+    }
+
+    os_timer_disarm(&self->_timer);
+    self->_timerArmed = false;
+    // system context: no ESP.restart(), it yields
+    if(self->revert()) {
+        system_restart();
+    }
+}
+
+bool UpdateRollbackClass::load()
+{
+    if(ESP.rtcUserMemoryRead(UPDATE_ROLLBACK_RTC_OFFSET, (uint32_t*) &_record, sizeof(_record)) &&
+       _record.magic == UPDATE_ROLLBACK_MAGIC &&
+       _record.check == crc32Update(&_record, offsetof(UpdateRollbackRecord, check))) {
+        return true;
+    }
+    memset(&_record, 0, sizeof(_record));
+    return false;
+}
+
+void UpdateRollbackClass::save()
+{
+    _record.magic = UPDATE_ROLLBACK_MAGIC;
+    _record.check = crc32Update(&_record, offsetof(UpdateRollbackRecord, check));
+    ESP.rtcUserMemoryWrite(UPDATE_ROLLBACK_RTC_OFFSET, (uint32_t*) &_record, sizeof(_record));
+}
+
+String UpdateRollbackClass::flashMD5(uint32_t address, uint32_t size)
+{
+    uint32_t buf[64];
+    MD5Builder md5;
+    md5.begin();
+    for(uint32_t offset = 0; offset < size; offset += sizeof(buf)) {
+        if(!ESP.flashRead(address + offset, buf, sizeof(buf))) {
+            return String();
+        }
+        md5.add((uint8_t*) buf, std::min((size_t) (size - offset), sizeof(buf)));
+        if((offset & (FLASH_SECTOR_SIZE - 1)) == 0) {
+            yield();
+        }
+    }
+    md5.calculate();
+    return md5.toString();
+}
+
+bool UpdateRollbackClass::flashCopy(uint32_t from, uint32_t to, uint32_t size)
+{
+    uint32_t buf[64];
+    for(uint32_t offset = 0; offset < size; offset += sizeof(buf)) {
+        if((offset & (FLASH_SECTOR_SIZE - 1)) == 0) {
+            yield();
+            if(!ESP.flashEraseSector((to + offset) / FLASH_SECTOR_SIZE)) {
+                return false;
+            }
+        }
+        if(!ESP.flashRead(from + offset, buf, sizeof(buf)) || !ESP.flashWrite(to + offset, buf, sizeof(buf))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
+UpdateRollbackClass UpdateRollback;
+#endif
@@ -0,0 +1,172 @@
+/**
+ *
+ * @file UpdateRollback.h
+ *
+ * Trial boot and rollback of a new sketch.
+ *
+ * The ESP8266 has a single sketch slot: Update stages the new image at the top of
+ * the free space and eboot copies it over the running sketch at the next boot.
+ * prepare() reads the staged image back and saves a copy of the running sketch
+ * just below it. The first boots of the new image are a trial: if the sketch does
+ * not call confirm() within the timeout, or it resets or wakes from deep sleep more
+ * than the allowed times, eboot is told to copy the saved sketch back. The timeout
+ * counts the time the sketch runs, summed over the wakes of the trial.
+ *
+ * Flash layout after prepare():
+ *   0x0 | running sketch | ... | saved sketch | signature | staged image | SPIFFS
+ *
+ * The signature sector keeps the signature of a signed image with its MD5, it stays
+ * valid after the install until a later update stages an image over it. The installed
+ * sketch finds it from its own size and serves it to peers, see installedSignature().
+ *
+ * The trial record is kept in RTC user memory, after the httpUpdate records,
+ * so it survives resets and deep sleep but not a power loss: a power cut during
+ * the trial ends it in favour of the new sketch.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef UPDATEROLLBACK_H_
+#define UPDATEROLLBACK_H_
+
+#include <Arduino.h>
+#include "ESP8266httpUpdate.h"
+#include "UpdateSignature.h"
+
+extern "C" {
+#include "osapi.h"
+}
+
+#ifndef UPDATE_ROLLBACK_RTC_OFFSET
+/// RTC user memory block of the trial record, after HTTPUpdateResume and HTTPUpdateCache
+#define UPDATE_ROLLBACK_RTC_OFFSET  (HTTP_UPDATE_RTC_OFFSET + (sizeof(HTTPUpdateResume) + sizeof(HTTPUpdateCache)) / 4)
+#endif
+
+#ifndef UPDATE_ROLLBACK_TIMEOUT
+#define UPDATE_ROLLBACK_TIMEOUT     60000
+#endif
+
+#ifndef UPDATE_ROLLBACK_BOOTS
+#define UPDATE_ROLLBACK_BOOTS       3
+#endif
+
+#ifndef UPDATE_ROLLBACK_WAKES
+#define UPDATE_ROLLBACK_WAKES       10
+#endif
+
+#ifndef UPDATE_ROLLBACK_TICK
+/// ms between two saves of the trial time, the time of a wake shorter than this is not counted
+#define UPDATE_ROLLBACK_TICK        1000
+#endif
+
+#define UPDATE_ROLLBACK_ERROR_NO_IMAGE  (1)
+#define UPDATE_ROLLBACK_ERROR_VERIFY    (2)
+#define UPDATE_ROLLBACK_ERROR_SPACE     (3)
+#define UPDATE_ROLLBACK_ERROR_FLASH     (4)
+
+enum UpdateRollbackState {
+    ROLLBACK_NONE,      ///< no update pending or on trial
+    ROLLBACK_PENDING,   ///< new image staged, the running sketch is saved
+    ROLLBACK_TRIAL,     ///< the new image is running and has not confirmed yet
+    ROLLBACK_REVERTED   ///< the new image did not confirm, the saved sketch is running again
+};
+
+/// trial record kept in RTC user memory
+typedef struct {
+    uint32_t magic;
+    uint32_t state;     ///< UpdateRollbackState
+    uint32_t address;   ///< flash address of the saved sketch
+    uint32_t size;      ///< size of the saved sketch
+    uint32_t boots;     ///< boots of the new image on trial
+    uint32_t wakes;     ///< deep sleep wake ups of the new image on trial
+    uint32_t used;      ///< ms of the timeout used by the wakes so far
+    char imageMD5[33];  ///< MD5 of the new image
+    uint32_t check;     ///< CRC32 of the fields above
+} UpdateRollbackRecord;
+
+/// signature sector, right below the staged image
+typedef struct {
+    uint32_t magic;
+    char imageMD5[33];  ///< MD5 of the signed image
+    uint8_t signature[ED25519_SIGNATURE_SIZE];
+    uint32_t check;     ///< CRC32 of the fields above
+} UpdateSignatureRecord;
+
+class UpdateRollbackClass
+{
+public:
+    UpdateRollbackClass();
+
+    /**
+     * call after a successful Update.end() of a sketch, before the reset.
+     * Reads the staged image back and saves the running sketch, and the signature of
+     * the image if UpdateSignature verified it.
+     * If the staged image does not match md5 the update is cancelled
+     * @param md5 const String& MD5 of the image, Update.md5String()
+     * @return true if the next boot starts a trial
+     */
+    bool prepare(const String& md5);
+
+    /**
+     * call first thing in setup(). On the first boots of a new image starts the trial:
+     * a timer rolls back if confirm() is not called within timeout ms of running time,
+     * the time used before a deep sleep is carried over to the next wake
+     * @return true while the running sketch is on trial
+     */
+    bool begin(uint32_t timeout = UPDATE_ROLLBACK_TIMEOUT, uint8_t boots = UPDATE_ROLLBACK_BOOTS,
+               uint8_t wakes = UPDATE_ROLLBACK_WAKES);
+
+    /// the new sketch works, ends the trial
+    void confirm();
+
+    /// copies the saved sketch back at the next boot and resets, only while on trial
+    void rollback();
+
+    UpdateRollbackState state();
+
+    /// MD5 of the image that was rolled back, empty otherwise
+    String rejectedMD5();
+
+    int getLastError();
+    String getLastErrorString();
+
+    /**
+     * the signature the running sketch was installed with, to send as x-Signature
+     * @return UPDATE_SIGNATURE_HEX_SIZE hex digits, empty if the sketch was not signed,
+     * was uploaded by serial or a later update has staged an image over the sector
+     */
+    static String installedSignature();
+
+    /**
+     * where prepare() saves the running sketch: right below the signature sector, clear of
+     * the running sketch it is copied from and of the sectors eboot copies the image to
+     * @return flash address, 0 if there is no room
+     */
+    static uint32_t saveAddress(uint32_t image, uint32_t imageSize, uint32_t sketchSize);
+
+protected:
+    bool load();
+    void save();
+    bool revert();
+    static bool saveSignature(uint32_t image, uint32_t imageSize, uint32_t sketchSize, const String& md5);
+    static String flashMD5(uint32_t address, uint32_t size);
+    static bool flashCopy(uint32_t from, uint32_t to, uint32_t size);
+    static void onTick(void* arg);
+
+    UpdateRollbackRecord _record;
+    os_timer_t _timer;
+    bool _timerArmed;
+    uint32_t _timeout;
+    uint32_t _tick;     ///< millis() of the last save of the trial time
+    int _lastError;
+};
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
+extern UpdateRollbackClass UpdateRollback;
+#endif
+
+#endif /* UPDATEROLLBACK_H_ */
@@ -0,0 +1,123 @@
+/**
+ *
+ * @file UpdateSignature.cpp
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include "UpdateSignature.h"
+#include "eboot_command.h"
+
+static int hexDigit(char c)
+{
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+uint8_t UpdateSignature::_stagedSignature[ED25519_SIGNATURE_SIZE];
+bool UpdateSignature::_staged = false;
+
+UpdateSignature::UpdateSignature(const uint8_t* publicKey)
+    : _hasSignature(false)
+    , _verifyTime(0)
+    , _lastError(0)
+{
+    setPublicKey(publicKey);
+}
+
+void UpdateSignature::setPublicKey(const uint8_t* publicKey)
+{
+    _hasKey = (publicKey != NULL);
+    if(_hasKey) {
+        memcpy_P(_publicKey, publicKey, sizeof(_publicKey));
+    }
+}
+
+bool UpdateSignature::begin(const String& signature)
+{
+    _hash.begin();
+    _hasSignature = false;
+    _staged = false;
+    _lastError = 0;
+
+    if(signature.length() != UPDATE_SIGNATURE_HEX_SIZE) {
+        _lastError = UPDATE_SIGNATURE_ERROR_MISSING;
+        return false;
+    }
+    for(size_t i = 0; i < sizeof(_signature); i++) {
+        int high = hexDigit(signature[2 * i]);
+        int low = hexDigit(signature[2 * i + 1]);
+        if(high < 0 || low < 0) {
+            _lastError = UPDATE_SIGNATURE_ERROR_MISSING;
+            return false;
+        }
+        _signature[i] = (high << 4) | low;
+    }
+    _hasSignature = true;
+    return true;
+}
+
+bool UpdateSignature::verify()
+{
+    uint8_t digest[SHA256_SIZE];
+    uint32_t start = micros();
+    bool valid = false;
+
+    if(!_hasSignature) {
+        _lastError = UPDATE_SIGNATURE_ERROR_MISSING;
+    } else {
+        _hash.calculate(digest);
+        valid = ed25519Verify(_signature, digest, sizeof(digest), _publicKey);
+        if(!valid) {
+            _lastError = UPDATE_SIGNATURE_ERROR_INVALID;
+        }
+    }
+    _verifyTime = micros() - start;
+    _hasSignature = false;
+
+    _staged = valid;
+    if(valid) {
+        memcpy(_stagedSignature, _signature, sizeof(_stagedSignature));
+    } else {
+        eboot_command_clear();
+    }
+    return valid;
+}
+
+int UpdateSignature::getLastError()
+{
+    return _lastError;
+}
+
+String UpdateSignature::getLastErrorString()
+{
+    switch(_lastError) {
+    case UPDATE_SIGNATURE_ERROR_MISSING:
+        return F("Signature Missing");
+    case UPDATE_SIGNATURE_ERROR_INVALID:
+        return F("Signature Invalid");
+    }
+    return String();
+}
+
+bool UpdateSignature::takeStaged(uint8_t* signature)
+{
+    if(!_staged) {
+        return false;
+    }
+    memcpy(signature, _stagedSignature, sizeof(_stagedSignature));
+    _staged = false;
+    return true;
+}
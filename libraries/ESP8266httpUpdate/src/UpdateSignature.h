@@ -0,0 +1,105 @@
+/**
+ *
+ * @file UpdateSignature.h
+ *
+ * Ed25519 signed sketches.
+ *
+ * The image is hashed with SHA-256 while it is written to flash, so the check
+ * after Update.end() only costs the Ed25519 verification and no pass over the
+ * image. The signature covers the 32 byte SHA-256 digest of the image as it is
+ * written to flash: the decoded image for compressed uploads and delta patches.
+ * Images are signed by tools/ota_sign.py, the public key is compiled into the sketch.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef UPDATESIGNATURE_H_
+#define UPDATESIGNATURE_H_
+
+#include <Arduino.h>
+#include "Sha256.h"
+#include "Ed25519.h"
+
+/// length of the signature in hex, as sent by the upload tools
+#define UPDATE_SIGNATURE_HEX_SIZE           (2 * ED25519_SIGNATURE_SIZE)
+
+#define UPDATE_SIGNATURE_ERROR_MISSING      (1)
+#define UPDATE_SIGNATURE_ERROR_INVALID      (2)
+
+class UpdateSignature
+{
+public:
+    UpdateSignature(const uint8_t* publicKey = NULL);
+
+    /**
+     * @param publicKey const uint8_t * ED25519_KEY_SIZE bytes in RAM or PROGMEM, NULL to accept unsigned images
+     */
+    void setPublicKey(const uint8_t* publicKey);
+
+    /// true if images have to be signed
+    bool enabled() const
+    {
+        return _hasKey;
+    }
+
+    /**
+     * starts hashing a new image
+     * @param signature const String& UPDATE_SIGNATURE_HEX_SIZE hex digits
+     * @return false if the signature is missing or malformed
+     */
+    bool begin(const String& signature);
+
+    /// hashes the next bytes of the image, in the order they are written to flash
+    void add(const uint8_t* data, size_t len)
+    {
+        _hash.add(data, len);
+    }
+
+    /// the hash fed by begin() and add(), for decoders that write to flash themselves
+    Sha256* hash()
+    {
+        return &_hash;
+    }
+
+    /**
+     * call after a successful Update.end(). Checks the signature of the bytes added since begin(),
+     * if it does not match the staged image is dropped: eboot will not copy it
+     * @return true if the image is signed with the public key
+     */
+    bool verify();
+
+    /// microseconds spent in the last verify()
+    uint32_t verifyTime() const
+    {
+        return _verifyTime;
+    }
+
+    int getLastError();
+    String getLastErrorString();
+
+    /**
+     * the signature of the last image that passed verify(), for UpdateRollback::prepare() to keep with the sketch.
+     * It is cleared by the next begin(), by a failed verify() and by this call
+     * @param signature uint8_t * ED25519_SIGNATURE_SIZE bytes
+     * @return false if the last image was not verified
+     */
+    static bool takeStaged(uint8_t* signature);
+
+protected:
+    Sha256 _hash;
+    uint8_t _publicKey[ED25519_KEY_SIZE];
+    uint8_t _signature[ED25519_SIGNATURE_SIZE];
+    bool _hasKey;
+    bool _hasSignature;
+    uint32_t _verifyTime;
+    int _lastError;
+
+    static uint8_t _stagedSignature[ED25519_SIGNATURE_SIZE];
+    static bool _staged;
+};
+
+#endif /* UPDATESIGNATURE_H_ */
@@ -110,6 +110,8 @@ struct MDNSAnswer {
   uint8_t ip[4];
   uint16_t port;
   char *hostname;
+  char *txt; // TXT rdata, length prefixed key=value strings
+  uint8_t txtLen;
 };
 
 struct MDNSQuery {
@@ -138,6 +140,7 @@ MDNSResponder::~MDNSResponder() {
   for (int n = numAnswers - 1; n >= 0; n--) {
     answer = _getAnswerFromIdx(n);
     os_free(answer->hostname);
+    if (answer->txt) os_free(answer->txt);
     os_free(answer);
     answer = 0;
   }
@@ -236,6 +239,18 @@ bool MDNSResponder::addServiceTxt(char *name, char *proto, char *key, char *valu
     //Checking Service names
     if(strcmp(servicePtr->_name, name) == 0 && strcmp(servicePtr->_proto, proto) == 0) {
       //found a service name match
+      size_t keyLen = os_strlen(key);
+      for (MDNSTxt *txtPtr = servicePtr->_txts; txtPtr; txtPtr = txtPtr->_next) {
+        if (txtPtr->_txt.length() > keyLen && txtPtr->_txt.charAt(keyLen) == '=' && strncmp(txtPtr->_txt.c_str(), key, keyLen) == 0) {
+          //the key is already in the record, its value is replaced
+          uint16_t oldLen = txtPtr->_txt.length() + 1;
+          if (servicePtr->_txtLen - oldLen + txtLen > 1300)
+            return false;
+          txtPtr->_txt = String(key) + "=" + String(value);
+          servicePtr->_txtLen = servicePtr->_txtLen - oldLen + txtLen;
+          return true;
+        }
+      }
       if (servicePtr->_txtLen + txtLen > 1300) 
         return false;  //max txt record size
       MDNSTxt *newtxt = new MDNSTxt;
@@ -262,8 +277,12 @@ bool MDNSResponder::addServiceTxt(char *name, char *proto, char *key, char *valu
 }
 
 void MDNSResponder::addService(char *name, char *proto, uint16_t port){
-  if(_getServicePort(name, proto) != 0) 
-    return;
+  for (MDNSService* servicePtr = _services; servicePtr; servicePtr = servicePtr->_next) {
+    if(strcmp(servicePtr->_name, name) == 0 && strcmp(servicePtr->_proto, proto) == 0) {
+      servicePtr->_port = port; //added before, services can't be removed but can move
+      return;
+    }
+  }
   if(os_strlen(name) > 32 || os_strlen(proto) != 3) 
     return; //bad arguments
   struct MDNSService *srv = (struct MDNSService*)(os_malloc(sizeof(struct MDNSService)));
@@ -399,6 +418,30 @@ uint16_t MDNSResponder::port(int idx) {
   return answer->port;
 }
 
+String MDNSResponder::txt(int idx, const char *key) {
+  MDNSAnswer *answer = _getAnswerFromIdx(idx);
+  if (answer == 0 || answer->txt == 0) {
+    return String();
+  }
+  size_t keyLen = os_strlen(key);
+  uint16_t i = 0;
+  while (i < answer->txtLen) {
+    uint8_t len = answer->txt[i++];
+    if (i + len > answer->txtLen) {
+      break;
+    }
+    const char *entry = answer->txt + i;
+    if (len > keyLen && entry[keyLen] == '=' && strncasecmp(entry, key, keyLen) == 0) {
+      char value[256];
+      memcpy(value, entry + keyLen + 1, len - keyLen - 1);
+      value[len - keyLen - 1] = '\0';
+      return String(value);
+    }
+    i += len;
+  }
+  return String();
+}
+
 MDNSAnswer* MDNSResponder::_getAnswerFromIdx(int idx) {
   MDNSAnswer *answer = _answers;
   while (answer != 0 && idx-- > 0) {
@@ -425,7 +468,7 @@ MDNSTxt * MDNSResponder::_getServiceTxt(char *name, char *proto){
   for (servicePtr = _services; servicePtr; servicePtr = servicePtr->_next) {
     if(servicePtr->_port > 0 && strcmp(servicePtr->_name, name) == 0 && strcmp(servicePtr->_proto, proto) == 0){
       if (servicePtr->_txts == 0) 
-        return false;
+        return 0;
       return servicePtr->_txts;
     }
   }
@@ -476,10 +519,10 @@ void MDNSResponder::_parsePacket(){
   bool protoParsed = false;
   bool localParsed = false;
 
-  char hostName[255];
+  char hostName[255] = { 0 };
   uint8_t hostNameLen;
 
-  char serviceName[32];
+  char serviceName[32] = { 0 };
   uint8_t serviceNameLen;
   uint16_t servicePort = 0;
 
@@ -519,6 +562,8 @@ void MDNSResponder::_parsePacket(){
     uint16_t answerPort = 0;
     uint8_t answerIp[4] = { 0,0,0,0 };
     char answerHostName[255];
+    char answerTxt[255];
+    uint8_t answerTxtLen = 0;
     bool serviceMatch = false;
     MDNSAnswer *answer;
     uint8_t partsCollected = 0;
@@ -532,6 +577,7 @@ void MDNSResponder::_parsePacket(){
       for (int n = oldAnswers - 1; n >= 0; n--) {
         answer = _getAnswerFromIdx(n);
         os_free(answer->hostname);
+        if (answer->txt) os_free(answer->txt);
         os_free(answer);
         answer = 0;
       }
@@ -621,6 +667,10 @@ void MDNSResponder::_parsePacket(){
       else if (answerType == MDNS_TYPE_TXT) {
         partsCollected |= 0x02;
         _conn_readS(hostName, answerRdlength); // Read rdata
+        if (answerRdlength <= 255) { // Longer records have been skipped above
+          memcpy(answerTxt, hostName, answerRdlength);
+          answerTxtLen = answerRdlength;
+        }
 #ifdef DEBUG_ESP_MDNS_RX
         DEBUG_ESP_PORT.printf("TXT %d ", answerRdlength);
         for (int n = 0; n < answerRdlength; n++) {
@@ -697,6 +747,8 @@ void MDNSResponder::_parsePacket(){
         }
         answer->next = 0;
         answer->hostname = 0;
+        answer->txt = 0;
+        answer->txtLen = 0;
 
         // Populate new answer
         answer->port = answerPort;
@@ -705,6 +757,11 @@ void MDNSResponder::_parsePacket(){
         }
         answer->hostname = (char *)os_malloc(strlen(answerHostName) + 1);
         os_strcpy(answer->hostname, answerHostName);
+        if (answerTxtLen > 0) {
+          answer->txt = (char *)os_malloc(answerTxtLen);
+          memcpy(answer->txt, answerTxt, answerTxtLen);
+          answer->txtLen = answerTxtLen;
+        }
         _conn->flush();
         return;
       }
@@ -72,7 +72,7 @@ public:
   void notifyAPChange();
   void update();
 
-  void addService(char *service, char *proto, uint16_t port);
+  void addService(char *service, char *proto, uint16_t port); // a service added again gets the new port
   void addService(const char *service, const char *proto, uint16_t port){
     addService((char *)service, (char *)proto, port);
   }
@@ -80,7 +80,7 @@ public:
     addService(service.c_str(), proto.c_str(), port);
   }
   
-  bool addServiceTxt(char *name, char *proto, char * key, char * value);
+  bool addServiceTxt(char *name, char *proto, char * key, char * value); // replaces the value of a key added before
   void addServiceTxt(const char *name, const char *proto, const char *key,const char * value){
     addServiceTxt((char *)name, (char *)proto, (char *)key, (char *)value);
   }
@@ -98,6 +98,7 @@ public:
   String hostname(int idx);
   IPAddress IP(int idx);
   uint16_t port(int idx);
+  String txt(int idx, const char *key); // value of key in the TXT record of the answer, empty if missing
   
   void enableArduino(uint16_t port, bool auth=false);
 
@@ -0,0 +1,578 @@
+#ifndef LWIP_OPEN_SRC
+#define LWIP_OPEN_SRC
+#endif
+#include <functional>
+#include "MulticastOTA.h"
+#include "MD5Builder.h"
+#include <UpdateSignature.h>
+#include <UpdateRollback.h>
+#include "eboot_command.h"
+
+extern "C" {
+  #include "osapi.h"
+  #include "ets_sys.h"
+  #include "user_interface.h"
+}
+
+#include "lwip/opt.h"
+#include "lwip/udp.h"
+#include "lwip/inet.h"
+#include "lwip/igmp.h"
+#include "lwip/mem.h"
+#include "include/UdpContext.h"
+
+extern "C" uint32_t _SPIFFS_start;
+
+#ifdef DEBUG_ESP_OTA
+#ifdef DEBUG_ESP_PORT
+#define MOTA_DEBUG DEBUG_ESP_PORT
+#endif
+#endif
+
+// Every packet starts with this header, little endian. The sender (tools/ota_multicast.py) sends
+// the image once in numbered blocks, with a parity block after every fec blocks, then ends the
+// round. Boards answer the round with the ranges they are missing and the sender sends them again
+// in the next round, until no board is missing anything.
+typedef struct __attribute__((packed)) {
+  uint32_t magic;   // MOTA_MAGIC
+  uint8_t type;     // MOTA_ANNOUNCE ...
+  uint8_t fec;      // blocks per parity group
+  uint16_t block;   // block size, a multiple of 4 that divides FLASH_SECTOR_SIZE
+  uint32_t session; // chosen by the sender for each image
+  uint32_t seq;     // meaning depends on the type
+} mota_header_t;
+
+#define MOTA_MAGIC    0x41544f4d // "MOTA"
+#define MOTA_ANNOUNCE 'S' // sender: u32 image size, 32 chars MD5, u8 length and the signature in hex
+#define MOTA_DATA     'D' // sender: block seq of the image
+#define MOTA_PARITY   'P' // sender: XOR of the blocks of group seq, zero padded
+#define MOTA_ROUND    'R' // sender: end of round seq, u16 NACK window in ms
+#define MOTA_NACK     'N' // board: seq ranges of missing blocks, u32 first and u32 count each
+#define MOTA_DONE     'K' // board: seq is the status below
+
+#define MOTA_STATUS_INSTALLED 0
+#define MOTA_STATUS_CURRENT   1     // the board already runs the image
+#define MOTA_STATUS_ERROR     0x100 // + mota_error_t
+
+#define MOTA_MAX_BLOCK  1024
+#define MOTA_MAX_RANGES 128
+
+static uint32_t sectorRound(uint32_t size) {
+  return (size + FLASH_SECTOR_SIZE - 1) & (~(FLASH_SECTOR_SIZE - 1));
+}
+
+// What Updater checks before it stages a sketch: the magic byte of the image header,
+// and a flash size in the header that is not larger than the chip
+static bool sketchHeaderValid(const uint8_t *header) {
+  return header[0] == 0xE9 && ESP.magicFlashChipSize((header[3] & 0xf0) >> 4) <= ESP.getFlashChipRealSize();
+}
+
+MulticastOTAClass::MulticastOTAClass()
+: _udp(0)
+, _group(MOTA_GROUP)
+, _port(MOTA_PORT)
+, _rebootOnSuccess(true)
+, _pending(false)
+, _state(MOTA_IDLE)
+, _session(0)
+, _status(0)
+, _size(0)
+, _blockSize(0)
+, _fec(0)
+, _blocks(0)
+, _received(0)
+, _address(0)
+, _packet(NULL)
+, _bitmap(NULL)
+, _buffer(NULL)
+, _lastPacket(0)
+, _nackAt(0)
+, _nackDue(false)
+, _start(0)
+, _senderPort(0)
+, _signature(NULL)
+, _start_callback(NULL)
+, _end_callback(NULL)
+, _error_callback(NULL)
+, _progress_callback(NULL)
+{
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+MulticastOTAClass::~MulticastOTAClass(){
+  end();
+  delete _signature;
+}
+
+void MulticastOTAClass::setGroup(IPAddress group, uint16_t port) {
+  if (!_udp) {
+    _group = group;
+    _port = port;
+  }
+}
+
+void MulticastOTAClass::setRebootOnSuccess(bool reboot){
+  _rebootOnSuccess = reboot;
+}
+
+void MulticastOTAClass::setPublicKey(const uint8_t * publicKey) {
+  if (!publicKey) {
+    delete _signature;
+    _signature = NULL;
+  } else if (!_signature) {
+    _signature = new UpdateSignature(publicKey);
+  } else {
+    _signature->setPublicKey(publicKey);
+  }
+}
+
+void MulticastOTAClass::onStart(THandlerFunction fn) {
+  _start_callback = fn;
+}
+
+void MulticastOTAClass::onEnd(THandlerFunction fn) {
+  _end_callback = fn;
+}
+
+void MulticastOTAClass::onProgress(THandlerFunction_Progress fn) {
+  _progress_callback = fn;
+}
+
+void MulticastOTAClass::onError(THandlerFunction_Error fn) {
+  _error_callback = fn;
+}
+
+bool MulticastOTAClass::begin() {
+  if (_udp)
+    return true;
+
+  _packet = (uint8_t*) malloc(sizeof(mota_header_t) + MOTA_MAX_BLOCK);
+  _udp = new UdpContext;
+  _udp->ref();
+
+  ip_addr_t group;
+  group.addr = (uint32_t) _group;
+  if (!_packet || igmp_joingroup(IP_ADDR_ANY, &group) != ERR_OK || !_udp->listen(*IP_ADDR_ANY, _port)) {
+    end();
+    return false;
+  }
+  _udp->onRx(std::bind(&MulticastOTAClass::_onRx, this));
+  _state = MOTA_IDLE;
+  _session = 0;
+#ifdef MOTA_DEBUG
+  MOTA_DEBUG.printf("Multicast OTA on %s:%u\n", _group.toString().c_str(), _port);
+#endif
+  return true;
+}
+
+void MulticastOTAClass::end() {
+  if (!_udp)
+    return;
+
+  ip_addr_t group;
+  group.addr = (uint32_t) _group;
+  igmp_leavegroup(IP_ADDR_ANY, &group);
+  _udp->unref();
+  _udp = 0;
+  _release();
+  free(_packet);
+  _packet = NULL;
+  _state = MOTA_IDLE;
+  _pending = false;
+}
+
+// tcp stack context: the packets are queued by UdpContext and read by handle()
+void MulticastOTAClass::_onRx() {
+  _pending = true;
+}
+
+void MulticastOTAClass::handle() {
+  if (!_udp)
+    return;
+
+  _pending = false;
+  while (_udp->next()) {
+    size_t len = _udp->getSize();
+    IPAddress ip(_udp->getRemoteAddress());
+    uint16_t port = _udp->getRemotePort();
+    if (len > sizeof(mota_header_t) + MOTA_MAX_BLOCK) {
+      _udp->flush();
+      continue;
+    }
+    _udp->read((char*) _packet, len);
+    _onPacket(_packet, len, ip, port);
+    if (!_udp) // the callbacks may have stopped the service
+      return;
+  }
+
+  if (_state == MOTA_RECEIVING && millis() - _lastPacket > MOTA_RECEIVE_TIMEOUT) {
+    _fail(MOTA_RECEIVE_ERROR);
+  }
+  if (_nackDue && (int32_t) (millis() - _nackAt) >= 0) {
+    _nackDue = false;
+    _sendNack();
+  }
+}
+
+bool MulticastOTAClass::isUpdatePending() {
+  return _pending || (_nackDue && (int32_t) (millis() - _nackAt) >= 0);
+}
+
+mota_state_t MulticastOTAClass::getState() {
+  return _state;
+}
+
+String MulticastOTAClass::getMD5() {
+  return _md5;
+}
+
+const mota_stats_t& MulticastOTAClass::getStats() {
+  return _stats;
+}
+
+void MulticastOTAClass::_onPacket(const uint8_t *packet, size_t len, IPAddress ip, uint16_t port) {
+  mota_header_t header;
+  if (len < sizeof(header))
+    return;
+  memcpy(&header, packet, sizeof(header));
+  if (header.magic != MOTA_MAGIC)
+    return;
+  const uint8_t *payload = packet + sizeof(header);
+  len -= sizeof(header);
+
+  if (header.type == MOTA_ANNOUNCE) {
+    // announces are repeated during the transfer, only a new image (or one that timed out) starts again
+    if (header.session != _session || _state == MOTA_IDLE) {
+      _release();
+      _session = header.session;
+      _fec = header.fec;
+      _blockSize = header.block;
+      _senderIP = ip;
+      _senderPort = port;
+      _onAnnounce(payload, len);
+    } else {
+      _lastPacket = millis();
+    }
+    return;
+  }
+  if (header.session != _session || _state == MOTA_IDLE)
+    return;
+
+  _lastPacket = millis();
+  if (header.type == MOTA_DATA && _state == MOTA_RECEIVING) {
+    _onData(header.seq, payload, len);
+  } else if (header.type == MOTA_PARITY && _state == MOTA_RECEIVING) {
+    _onParity(header.seq, payload, len);
+  } else if (header.type == MOTA_ROUND) {
+    if (_state == MOTA_FINISHED) {
+      _sendDone();
+    } else if (len >= 2) {
+      // spread the NACKs of the boards over the window the sender waits for them
+      uint16_t window = payload[0] | (payload[1] << 8);
+      _stats.rounds++;
+      _nackAt = millis() + RANDOM_REG32 % (window / 2 + 1);
+      _nackDue = true;
+    }
+  }
+}
+
+void MulticastOTAClass::_onAnnounce(const uint8_t *payload, size_t len) {
+  memset(&_stats, 0, sizeof(_stats));
+  _start = micros();
+  _lastPacket = millis();
+  if (len < 4 + 32 + 1) {
+    _fail(MOTA_BEGIN_ERROR);
+    return;
+  }
+  memcpy(&_size, payload, 4);
+  char md5[33];
+  memcpy(md5, payload + 4, 32);
+  md5[32] = '\0';
+  _md5 = md5;
+  _md5.toLowerCase();
+  String signature;
+  if (payload[36] > 0 && len >= 37u + payload[36]) {
+    char hex[UPDATE_SIGNATURE_HEX_SIZE + 1];
+    size_t n = std::min((size_t) payload[36], (size_t) UPDATE_SIGNATURE_HEX_SIZE);
+    memcpy(hex, payload + 37, n);
+    hex[n] = '\0';
+    signature = hex;
+  }
+
+  if (_md5 == ESP.getSketchMD5()) {
+    _state = MOTA_FINISHED;
+    _status = MOTA_STATUS_CURRENT;
+    _sendDone();
+    return;
+  }
+  // a sketch that was rolled back is not installed again
+  if (_md5 == UpdateRollback.rejectedMD5() || _size == 0 || _fec == 0 ||
+      _blockSize == 0 || _blockSize % 4 != 0 || _blockSize > MOTA_MAX_BLOCK || FLASH_SECTOR_SIZE % _blockSize != 0) {
+    _fail(MOTA_BEGIN_ERROR);
+    return;
+  }
+  if (_signature && !_signature->begin(signature)) {
+    _fail(MOTA_SIGNATURE_ERROR);
+    return;
+  }
+
+  // the same staging area as Update: right below SPIFFS, above the running sketch
+  uint32_t end = (uint32_t) (uintptr_t) &_SPIFFS_start - 0x40200000;
+  uint32_t rounded = sectorRound(_size);
+  if (end < rounded || end - rounded < sectorRound(ESP.getSketchSize())) {
+    _fail(MOTA_BEGIN_ERROR);
+    return;
+  }
+  _address = end - rounded;
+  _blocks = (_size + _blockSize - 1) / _blockSize;
+  _received = 0;
+  _bitmap = (uint8_t*) calloc((_blocks + 7) / 8, 1);
+  _buffer = (uint32_t*) malloc(2 * _blockSize);
+  if (!_bitmap || !_buffer) {
+    _fail(MOTA_BEGIN_ERROR);
+    return;
+  }
+
+  _state = MOTA_RECEIVING;
+  if (_start_callback) {
+    _start_callback();
+  }
+  // erased up front: blocks arrive in any order, and a program without erase leaves the radio running
+  uint32_t stage = micros();
+  for (uint32_t offset = 0; offset < rounded; offset += FLASH_SECTOR_SIZE) {
+    if (!ESP.flashEraseSector((_address + offset) / FLASH_SECTOR_SIZE)) {
+      _fail(MOTA_FLASH_ERROR);
+      return;
+    }
+    yield();
+  }
+  _stats.erase = micros() - stage;
+  _lastPacket = millis();
+#ifdef MOTA_DEBUG
+  MOTA_DEBUG.printf("Multicast OTA: %u bytes, %u blocks at 0x%08x\n", _size, _blocks, _address);
+#endif
+  if (_progress_callback) {
+    _progress_callback(0, _size);
+  }
+}
+
+void MulticastOTAClass::_onData(uint32_t block, const uint8_t *payload, size_t len) {
+  if (block >= _blocks || len != _blockLength(block))
+    return;
+  if (_has(block)) {
+    _stats.duplicates++;
+    return;
+  }
+  memcpy(_buffer, payload, len);
+  _stats.blocks++;
+  _writeBlock(block, (uint8_t*) _buffer);
+}
+
+// One missing block of a group is the XOR of the parity and of the other blocks, read back from flash
+void MulticastOTAClass::_onParity(uint32_t group, const uint8_t *payload, size_t len) {
+  uint32_t first = group * _fec;
+  if (len != _blockSize || first >= _blocks)
+    return;
+  uint32_t last = std::min(first + _fec, _blocks);
+  uint32_t missing = _blocks;
+  for (uint32_t block = first; block < last; block++) {
+    if (!_has(block)) {
+      if (missing != _blocks)
+        return; // more than one, the round ends with a NACK for them
+      missing = block;
+    }
+  }
+  if (missing == _blocks)
+    return;
+
+  uint8_t *data = (uint8_t*) _buffer;
+  uint8_t *read = (uint8_t*) (_buffer + _blockSize / 4);
+  memcpy(data, payload, _blockSize);
+  for (uint32_t block = first; block < last; block++) {
+    if (block == missing)
+      continue;
+    uint32_t blockLen = _blockLength(block);
+    if (!ESP.flashRead(_address + block * _blockSize, (uint32_t*) read, (blockLen + 3) & ~3)) {
+      _fail(MOTA_FLASH_ERROR);
+      return;
+    }
+    for (uint32_t i = 0; i < blockLen; i++) {
+      data[i] ^= read[i];
+    }
+  }
+  _stats.recovered++;
+  _writeBlock(missing, data);
+}
+
+// data is 4 byte aligned with room for the block size, the tail of the last block is padded
+bool MulticastOTAClass::_writeBlock(uint32_t block, uint8_t *data) {
+  uint32_t len = _blockLength(block);
+  uint32_t padded = (len + 3) & ~3;
+  memset(data + len, 0xff, padded - len);
+  if (block == 0 && !sketchHeaderValid(data)) {
+    _fail(MOTA_IMAGE_ERROR);
+    return false;
+  }
+  if (!ESP.flashWrite(_address + block * _blockSize, (uint32_t*) data, padded)) {
+    _fail(MOTA_FLASH_ERROR);
+    return false;
+  }
+  _bitmap[block / 8] |= 1 << (block % 8);
+  _received++;
+  _stats.bytes += len;
+  if (_progress_callback) {
+    _progress_callback(_stats.bytes, _size);
+  }
+  if (_received == _blocks) {
+    _finish();
+  }
+  return true;
+}
+
+void MulticastOTAClass::_finish() {
+  MD5Builder md5;
+  md5.begin();
+  Sha256 *hash = _signature ? _signature->hash() : NULL;
+  uint8_t *read = (uint8_t*) _buffer;
+  for (uint32_t block = 0; block < _blocks; block++) {
+    uint32_t len = _blockLength(block);
+    if (!ESP.flashRead(_address + block * _blockSize, _buffer, (len + 3) & ~3)) {
+      _fail(MOTA_FLASH_ERROR);
+      return;
+    }
+    if (block == 0 && !sketchHeaderValid(read)) {
+      _fail(MOTA_IMAGE_ERROR); // checked again on what eboot will copy
+      return;
+    }
+    md5.add(read, len);
+    if (hash) {
+      hash->add(read, len);
+    }
+    if ((block * _blockSize) % FLASH_SECTOR_SIZE == 0) {
+      yield();
+    }
+  }
+  md5.calculate();
+  if (md5.toString() != _md5) {
+    _fail(MOTA_VERIFY_ERROR);
+    return;
+  }
+
+  // what Update.end() leaves for eboot
+  struct eboot_command cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.action = ACTION_COPY_RAW;
+  cmd.args[0] = _address;
+  cmd.args[1] = 0x00000;
+  cmd.args[2] = _size;
+  eboot_command_write(&cmd);
+
+  if (_signature && !_signature->verify()) {
+    // the staged image has been dropped, the running sketch stays
+    _fail(MOTA_SIGNATURE_ERROR);
+    return;
+  }
+
+  _stats.total = micros() - _start;
+  _release();
+  // runs before the sender is told, it may still cancel the update by clearing the eboot command
+  if (_end_callback) {
+    _end_callback();
+  }
+  if (eboot_command_read(&cmd) != 0 || cmd.action != ACTION_COPY_RAW) {
+    _fail(MOTA_VERIFY_ERROR);
+    return;
+  }
+  ESP8266HTTPUpdate::forgetSketchMD5(); // the MD5 cached for httpUpdate is the running sketch's
+  _state = MOTA_FINISHED;
+  _status = MOTA_STATUS_INSTALLED;
+  _sendDone();
+#ifdef MOTA_DEBUG
+  MOTA_DEBUG.printf("Multicast OTA: %u blocks, %u recovered, %u NACKs\n", _stats.blocks, _stats.recovered, _stats.nacks);
+#endif
+  if (_rebootOnSuccess) {
+    //let serial/network finish tasks that might be given in _end_callback
+    delay(100);
+    ESP.restart();
+  }
+}
+
+void MulticastOTAClass::_fail(mota_error_t error) {
+#ifdef MOTA_DEBUG
+  MOTA_DEBUG.printf("Multicast OTA error %u\n", error);
+#endif
+  _stats.total = micros() - _start;
+  _release();
+  if (error == MOTA_RECEIVE_ERROR) {
+    _state = MOTA_IDLE; // the next announce starts again
+  } else {
+    _state = MOTA_FINISHED;
+    _status = MOTA_STATUS_ERROR + error;
+    _sendDone();
+  }
+  if (_error_callback) {
+    _error_callback(error);
+  }
+}
+
+void MulticastOTAClass::_release() {
+  free(_bitmap);
+  _bitmap = NULL;
+  free(_buffer);
+  _buffer = NULL;
+  _nackDue = false;
+}
+
+void MulticastOTAClass::_sendNack() {
+  if (_state != MOTA_RECEIVING)
+    return;
+
+  // ranges in the buffer, they are only sent between blocks
+  uint32_t *ranges = _buffer;
+  uint32_t max = std::min((uint32_t) MOTA_MAX_RANGES, (uint32_t) (2 * _blockSize / 8));
+  uint32_t count = 0;
+  uint32_t block = 0;
+  while (block < _blocks && count < max) {
+    if (_has(block)) {
+      block++;
+      continue;
+    }
+    uint32_t first = block;
+    while (block < _blocks && !_has(block))
+      block++;
+    ranges[2 * count] = first;
+    ranges[2 * count + 1] = block - first;
+    count++;
+  }
+  if (count) {
+    _send(MOTA_NACK, count, (const uint8_t*) ranges, count * 8);
+    _stats.nacks++;
+  }
+}
+
+void MulticastOTAClass::_sendDone() {
+  _send(MOTA_DONE, _status, NULL, 0);
+}
+
+void MulticastOTAClass::_send(uint8_t type, uint32_t seq, const uint8_t *payload, size_t len) {
+  mota_header_t header = { MOTA_MAGIC, type, _fec, _blockSize, _session, seq };
+  ip_addr_t addr;
+  addr.addr = (uint32_t) _senderIP;
+  _udp->append((const char*) &header, sizeof(header));
+  if (len) {
+    _udp->append((const char*) payload, len);
+  }
+  _udp->send(&addr, _senderPort);
+}
+
+uint32_t MulticastOTAClass::_blockLength(uint32_t block) {
+  return std::min((uint32_t) _blockSize, _size - block * _blockSize);
+}
+
+bool MulticastOTAClass::_has(uint32_t block) {
+  return _bitmap[block / 8] & (1 << (block % 8));
+}
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_MULTICASTOTA)
+MulticastOTAClass MulticastOTA;
+#endif
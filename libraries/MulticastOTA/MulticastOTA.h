@@ -0,0 +1,155 @@
+#ifndef __MULTICAST_OTA_H
+#define __MULTICAST_OTA_H
+
+#include <ESP8266WiFi.h>
+#include <functional>
+
+class UdpContext;
+class UpdateSignature;
+
+// Group and port the sketch is multicast to by tools/ota_multicast.py
+#ifndef MOTA_GROUP
+#define MOTA_GROUP IPAddress(239, 255, 82, 66)
+#endif
+
+#ifndef MOTA_PORT
+#define MOTA_PORT 8267
+#endif
+
+// A transfer with no packet for this long is dropped, the next announce starts it again
+#ifndef MOTA_RECEIVE_TIMEOUT
+#define MOTA_RECEIVE_TIMEOUT 30000
+#endif
+
+typedef enum {
+  MOTA_IDLE,      // waiting for an announce
+  MOTA_RECEIVING, // blocks of the announced image are being written
+  MOTA_FINISHED   // the announced image has been installed, refused or is already running
+} mota_state_t;
+
+typedef enum {
+  MOTA_BEGIN_ERROR,     // no space for the image, or an image with a bad announce
+  MOTA_RECEIVE_ERROR,   // the sender went quiet before every block was received
+  MOTA_VERIFY_ERROR,    // the MD5 of the image in flash does not match the announce
+  MOTA_FLASH_ERROR,     // erase or write failed
+  MOTA_SIGNATURE_ERROR, // unsigned or tampered image, see setPublicKey()
+  MOTA_IMAGE_ERROR      // not a sketch (no 0xE9 magic byte) or built for a larger flash chip
+} mota_error_t;
+
+// Counters of the last transfer
+typedef struct {
+  uint32_t bytes;      // image bytes written to flash
+  uint32_t blocks;     // blocks received, repeated ones not counted
+  uint32_t recovered;  // blocks rebuilt from a parity packet
+  uint32_t duplicates; // blocks received again, e.g. resent for another board
+  uint32_t nacks;      // NACK packets sent
+  uint32_t rounds;     // rounds ended by the sender while receiving
+  uint32_t total;      // from the announce to the verified image, in microseconds
+  uint32_t erase;      // erasing the staging area, in microseconds
+} mota_stats_t;
+
+class MulticastOTAClass
+{
+  public:
+    typedef std::function<void(void)> THandlerFunction;
+    typedef std::function<void(mota_error_t)> THandlerFunction_Error;
+    typedef std::function<void(unsigned int, unsigned int)> THandlerFunction_Progress;
+
+    MulticastOTAClass();
+    ~MulticastOTAClass();
+
+    //Sets the multicast group and port. Default MOTA_GROUP:MOTA_PORT
+    void setGroup(IPAddress group, uint16_t port);
+
+    //Sets if the device should be rebooted after successful update. Default true
+    void setRebootOnSuccess(bool reboot);
+
+    //Only accepts sketches signed with this Ed25519 key (ED25519_KEY_SIZE bytes, RAM or PROGMEM). Default NULL, unsigned
+    void setPublicKey(const uint8_t *publicKey);
+
+    //This callback will be called when the first block of a new image is about to be written
+    void onStart(THandlerFunction fn);
+
+    //This callback will be called when the image is verified and staged for eboot
+    void onEnd(THandlerFunction fn);
+
+    //This callback will be called when a transfer fails
+    void onError(THandlerFunction_Error fn);
+
+    //This callback will be called when blocks are received, with the bytes received so far
+    void onProgress(THandlerFunction_Progress fn);
+
+    //Joins the group, returns false if the socket can't be opened
+    bool begin();
+
+    //Leaves the group, begin() can be called again afterwards
+    void end();
+
+    //Call this in loop() to run the service, flash writes are done here and not in the receive callback
+    void handle();
+
+    //Returns true if packets are waiting for handle()
+    bool isUpdatePending();
+
+    mota_state_t getState();
+
+    //MD5 of the announced image, valid from onStart
+    String getMD5();
+
+    //Gets the counters of the last transfer, valid from onEnd/onError
+    const mota_stats_t& getStats();
+
+  private:
+    UdpContext *_udp;
+    IPAddress _group;
+    uint16_t _port;
+    bool _rebootOnSuccess;
+    volatile bool _pending;
+    mota_state_t _state;
+    uint32_t _session;
+    uint16_t _status;
+    uint32_t _size;
+    uint16_t _blockSize;
+    uint8_t _fec;
+    uint32_t _blocks;
+    uint32_t _received;
+    uint32_t _address;
+    uint8_t *_packet;
+    uint8_t *_bitmap;
+    uint32_t *_buffer;
+    uint32_t _lastPacket;
+    uint32_t _nackAt;
+    bool _nackDue;
+    uint32_t _start;
+    IPAddress _senderIP;
+    uint16_t _senderPort;
+    String _md5;
+    UpdateSignature *_signature;
+    mota_stats_t _stats;
+
+    THandlerFunction _start_callback;
+    THandlerFunction _end_callback;
+    THandlerFunction_Error _error_callback;
+    THandlerFunction_Progress _progress_callback;
+
+    void _onRx();
+    void _onPacket(const uint8_t *packet, size_t len, IPAddress ip, uint16_t port);
+    void _onAnnounce(const uint8_t *payload, size_t len);
+    void _onData(uint32_t block, const uint8_t *payload, size_t len);
+    void _onParity(uint32_t group, const uint8_t *payload, size_t len);
+    bool _writeBlock(uint32_t block, uint8_t *data);
+    void _finish();
+    void _fail(mota_error_t error);
+    void _release();
+    void _sendNack();
+    void _sendDone();
+    void _send(uint8_t type, uint32_t seq, const uint8_t *payload, size_t len);
+    uint32_t _blockLength(uint32_t block);
+    bool _has(uint32_t block);
+};
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_MULTICASTOTA)
+extern MulticastOTAClass MulticastOTA;
+#endif
+
+#endif /* __MULTICAST_OTA_H */
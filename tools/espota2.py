@@ -0,0 +1,347 @@
+#!/usr/bin/env python3
+"""
+ArduinoOTA uploader with the v2 transfer (see ArduinoOTA.cpp).
+
+  espota2.py -i 192.168.1.20 [-p 8266] [-P 0] [-a password] [-s] [--v1] [-k secret.key] -f sketch.bin
+  espota2.py bench [--size 400000] [--erase-ms 25] [--latency-ms 5]
+
+v1 is the transfer of the ArduinoIDE espota.py: the device acks every write
+with its length in ASCII and the uploader waits for that ack before sending
+the next 1460 bytes. v2 is asked for with a "2" after the MD5 in the
+invitation. The device answers "OK 2 <ack interval> <window>" and sends back
+5 byte frames, a type and a little endian u32:
+
+  A <bytes>  cumulative ack of the bytes consumed
+  O <bytes>  update done
+  E <error>  update failed, the error text follows until the socket closes
+
+The uploader streams and keeps at most <window> bytes unacked. A device
+without v2 ignores the invitation, and the uploader falls back to v1.
+
+Compressed images (ota_compress.py) are sent as they are, the invitation
+carries the size and MD5 of the decoded image.
+
+A device with ArduinoOTA.setPublicKey() needs the signature of the sketch
+(ota_sign.py) after the version: "<md5> <version> <signature>". It is made
+here with -k, or passed as it is with --signature.
+
+bench runs both transfers against a simulated device on the loopback
+interface, which sleeps erase_ms every 4 KB sector and delays its acks by
+latency_ms. It compares the protocols, not the radio: measure on a board
+with the stats line printed by AgruminoOTA.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import queue
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+
+U_FLASH = 0
+U_SPIFFS = 100
+U_AUTH = 200
+
+CHUNK = 1460
+SECTOR = 4096
+FRAME = 5
+
+
+class UploadError(Exception):
+    pass
+
+
+def image_info(data):
+    """Size and MD5 sent in the invitation, those of the decoded image for a compressed one"""
+    if data[:4] == b"ESPZ":
+        sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+        from ota_compress import decompress
+        data = decompress(data)
+    return len(data), hashlib.md5(data).hexdigest()
+
+
+def invite(remote, port, local_port, command, size, md5, version, password, timeout, signature=None):
+    """Returns (version, ack interval, window), None when a v2 invitation got no answer"""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(timeout)
+    try:
+        extra = " %d %s" % (version, signature) if signature else (" 2" if version >= 2 else "")
+        message = "%d %d %d %s%s\n" % (command, local_port, size, md5, extra)
+        sock.sendto(message.encode(), (remote, port))
+        try:
+            reply = sock.recv(64).decode()
+        except socket.timeout:
+            if version >= 2:
+                return None
+            raise UploadError("no answer from the device")
+
+        if reply.startswith("AUTH"):
+            if not password:
+                raise UploadError("the device asks for a password")
+            nonce = reply.split()[1]
+            cnonce = hashlib.md5(("%s%d%f" % (md5, size, time.time())).encode()).hexdigest()
+            passmd5 = hashlib.md5(password.encode()).hexdigest()
+            response = hashlib.md5(("%s:%s:%s" % (passmd5, nonce, cnonce)).encode()).hexdigest()
+            sock.settimeout(10)
+            sock.sendto(("%d %s %s\n" % (U_AUTH, cnonce, response)).encode(), (remote, port))
+            try:
+                reply = sock.recv(64).decode()
+            except socket.timeout:
+                raise UploadError("no answer to the authentication")
+
+        fields = reply.split()
+        if not fields or fields[0] != "OK":
+            raise UploadError(reply or "invitation refused")
+        if len(fields) >= 4 and fields[1] == "2":
+            return 2, int(fields[2]), int(fields[3])
+        return 1, 0, 0
+    finally:
+        sock.close()
+
+
+def send_v1(conn, data, progress):
+    conn.settimeout(10)
+    for offset in range(0, len(data), CHUNK):
+        conn.sendall(data[offset:offset + CHUNK])
+        # the ack is the length of the last write, only its arrival matters
+        if not conn.recv(32):
+            raise UploadError("connection closed by the device")
+        progress(min(offset + CHUNK, len(data)), len(data))
+
+    conn.settimeout(60)
+    reply = b""
+    while b"OK" not in reply:
+        chunk = conn.recv(64)
+        if not chunk:
+            raise UploadError(reply.decode(errors="replace").strip("0123456789") or "no result from the device")
+        reply += chunk
+
+
+def send_v2(conn, data, window, progress):
+    conn.setblocking(False)
+    sent = acked = 0
+    frames = b""
+    while True:
+        want = sent < len(data) and sent - acked < window
+        readable, writable, _ = select.select([conn], [conn] if want else [], [], 60 if sent == len(data) else 10)
+        if not readable and not writable:
+            raise UploadError("timeout, %d bytes sent, %d acked" % (sent, acked))
+        if writable:
+            sent += conn.send(data[sent:sent + min(CHUNK, window - (sent - acked))])
+        if not readable:
+            continue
+
+        chunk = conn.recv(256)
+        if not chunk:
+            raise UploadError("connection closed by the device, %d bytes acked" % acked)
+        frames += chunk
+        while len(frames) >= FRAME:
+            kind, value = frames[0:1], struct.unpack("<I", frames[1:FRAME])[0]
+            if kind == b"A":
+                acked = value
+                frames = frames[FRAME:]
+                progress(acked, len(data))
+            elif kind == b"O":
+                progress(value, len(data))
+                return
+            elif kind == b"E":
+                text = frames[FRAME:]
+                conn.setblocking(True)
+                conn.settimeout(5)
+                try:
+                    while True:
+                        chunk = conn.recv(256)
+                        if not chunk:
+                            break
+                        text += chunk
+                except socket.timeout:
+                    pass
+                raise UploadError("error %d: %s" % (value, text.decode(errors="replace").strip()))
+            else:
+                raise UploadError("unexpected frame %r" % frames[:FRAME])
+
+
+def upload(remote, port, local_port, data, command=U_FLASH, password=None, version=2, progress=None, timeout=10,
+           signature=None):
+    size, md5 = image_info(data)
+    progress = progress or (lambda done, total: None)
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("0.0.0.0", local_port))
+    server.listen(1)
+    local_port = server.getsockname()[1]
+    try:
+        answer = invite(remote, port, local_port, command, size, md5, version, password, timeout, signature)
+        if answer is None:
+            answer = invite(remote, port, local_port, command, size, md5, 1, password, timeout, signature)
+        version, ack_interval, window = answer
+
+        server.settimeout(10)
+        try:
+            conn, _ = server.accept()
+        except socket.timeout:
+            raise UploadError("the device did not connect back")
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+        start = time.time()
+        try:
+            if version >= 2:
+                send_v2(conn, data, window, progress)
+            else:
+                send_v1(conn, data, progress)
+        finally:
+            conn.close()
+        elapsed = time.time() - start
+    finally:
+        server.close()
+    return {"version": version, "bytes": len(data), "ack_interval": ack_interval, "window": window,
+            "total_s": round(elapsed, 3), "bytes_per_s": int(len(data) / elapsed) if elapsed else 0}
+
+
+class SimulatedDevice(threading.Thread):
+    """Loopback stand-in for ArduinoOTA, see bench"""
+
+    def __init__(self, v2, erase_ms, latency_ms, ack_interval, window):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.v2 = v2
+        self.erase = erase_ms / 1000.0
+        self.latency = latency_ms / 1000.0
+        self.ack_interval = ack_interval
+        self.window = window
+        self.error = None
+        self.replies = queue.Queue()
+        self.udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.udp.bind(("127.0.0.1", 0))
+        self.port = self.udp.getsockname()[1]
+
+    def _delayed(self, payload):
+        self.replies.put((time.time() + self.latency, payload))
+
+    def _reply(self, conn):
+        # one thread, so the replies keep their order
+        while True:
+            due, payload = self.replies.get()
+            if payload is None:
+                return
+            time.sleep(max(0, due - time.time()))
+            try:
+                conn.sendall(payload)
+            except OSError:
+                return
+
+    def run(self):
+        try:
+            self._run()
+        except Exception as e:
+            self.error = e
+
+    def _run(self):
+        while True:
+            message, sender = self.udp.recvfrom(128)
+            fields = message.decode().split()
+            if len(fields) > 4 and not self.v2:
+                continue  # an older device refuses the line
+            break
+        local_port, size, md5 = int(fields[1]), int(fields[2]), fields[3]
+        version = 2 if len(fields) > 4 and int(fields[4]) >= 2 else 1
+        reply = "OK 2 %d %d" % (self.ack_interval, self.window) if version >= 2 else "OK"
+        self.udp.sendto(reply.encode(), sender)
+        self.udp.close()
+
+        conn = socket.create_connection(("127.0.0.1", local_port))
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        replier = threading.Thread(target=self._reply, args=(conn,))
+        replier.start()
+        image = hashlib.md5()
+        received = acked = 0
+        while received < size:
+            chunk = conn.recv(self.window if version >= 2 else CHUNK)
+            if not chunk:
+                break
+            for _ in range((received + len(chunk)) // SECTOR - received // SECTOR):
+                time.sleep(self.erase)
+            received += len(chunk)
+            image.update(chunk)
+            if version < 2:
+                self._delayed(str(len(chunk)).encode())
+            elif received - acked >= self.ack_interval:
+                self._delayed(b"A" + struct.pack("<I", received))
+                acked = received
+        if image.hexdigest() == md5:
+            self._delayed(b"O" + struct.pack("<I", received) if version >= 2 else b"OK")
+        else:
+            self._delayed(b"E" + struct.pack("<I", 5) + b"MD5 Check Failed" if version >= 2 else b"MD5 Check Failed")
+        self.replies.put((0, None))
+        replier.join()
+        time.sleep(0.1)
+        conn.close()
+
+
+def bench(args):
+    data = os.urandom(args.size)
+    for version in (1, 2):
+        device = SimulatedDevice(version >= 2, args.erase_ms, args.latency_ms, args.ack_interval, args.window)
+        device.start()
+        result = upload("127.0.0.1", device.port, 0, data, version=version)
+        device.join(5)
+        if device.error:
+            raise device.error
+        result.update({"ota": "bench", "erase_ms": args.erase_ms, "latency_ms": args.latency_ms})
+        print(json.dumps(result, sort_keys=True))
+    return 0
+
+
+def main():
+    if len(sys.argv) > 1 and sys.argv[1] == "bench":
+        parser = argparse.ArgumentParser(prog="espota2.py bench", description="Compare the v1 and v2 transfers on loopback")
+        parser.add_argument("--size", type=int, default=400000)
+        parser.add_argument("--erase-ms", type=float, default=25)
+        parser.add_argument("--latency-ms", type=float, default=5)
+        parser.add_argument("--ack-interval", type=int, default=4096)
+        parser.add_argument("--window", type=int, default=8 * CHUNK)
+        return bench(parser.parse_args(sys.argv[2:]))
+
+    parser = argparse.ArgumentParser(description="Upload a sketch to ArduinoOTA")
+    parser.add_argument("-i", "--ip", required=True, help="device address")
+    parser.add_argument("-p", "--port", type=int, default=8266, help="device OTA port")
+    parser.add_argument("-P", "--host-port", type=int, default=0, help="local TCP port, random if 0")
+    parser.add_argument("-a", "--auth", default=None, help="OTA password")
+    parser.add_argument("-s", "--spiffs", action="store_true", help="upload a SPIFFS image")
+    parser.add_argument("-f", "--file", required=True)
+    parser.add_argument("--v1", action="store_true", help="use the ArduinoIDE transfer")
+    parser.add_argument("-k", "--key", default=None, help="sign the sketch with this ota_sign.py key")
+    parser.add_argument("--signature", default=None, help="signature made by ota_sign.py sign")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+
+    signature = args.signature
+    if args.key:
+        sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+        from ota_sign import read_seed, sign_image
+        signature = sign_image(read_seed(args.key), data)
+
+    def progress(done, total):
+        sys.stderr.write("\rUploading: %3d%%" % (100 * done // max(total, 1)))
+
+    try:
+        result = upload(args.ip, args.port, args.host_port, data, U_SPIFFS if args.spiffs else U_FLASH,
+                        args.auth, 1 if args.v1 else 2, progress, signature=signature)
+    except (UploadError, OSError) as e:
+        sys.stderr.write("\nUpload failed: %s\n" % e)
+        return 1
+    sys.stderr.write("\n")
+    print(json.dumps(result, sort_keys=True))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
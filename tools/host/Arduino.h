@@ -0,0 +1,127 @@
+/*
+  Host stand-in of the ESP8266 Arduino core (2.4), just what AgruminoOTA,
+  Agrumino and the bundled libraries use. See tools/ota_host_test.cpp.
+
+  Time is virtual: delay() advances the clock instead of sleeping, micros()
+  adds the host time spent since the harness started, so code runs at host
+  speed and waits cost nothing.
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint8_t uint8;
+typedef int8_t sint8;
+typedef uint16_t uint16;
+typedef int16_t sint16;
+typedef uint32_t uint32;
+typedef int32_t sint32;
+
+using std::min;
+using std::max;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT          0x00
+#define INPUT_PULLUP   0x02
+#define OUTPUT         0x01
+
+#define A0 17
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+#define ICACHE_RODATA_ATTR
+#define PROGMEM
+#define PGM_P const char*
+#define PGM_VOID_P const void*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*) (addr))
+#define pgm_read_word(addr) (*(const uint16_t*) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t*) (addr))
+#define memcpy_P memcpy
+#define memccpy_P memccpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strstr_P strstr
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define os_memcpy memcpy
+#define os_memset memset
+#define os_strlen strlen
+#define os_printf printf
+
+#define FLASH_SECTOR_SIZE 0x1000
+
+// The hardware random number generator, a fixed sequence on the host
+#define RANDOM_REG32 (host_random())
+extern "C" uint32_t host_random();
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+char* itoa(int value, char* result, int base);
+char* ltoa(long value, char* result, int base);
+char* utoa(unsigned value, char* result, int base);
+char* ultoa(unsigned long value, char* result, int base);
+char* dtostrf(double number, signed char width, unsigned char prec, char* s);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void optimistic_yield(uint32_t interval_us);
+extern "C" void esp_yield();
+extern "C" void esp_schedule();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+// Linker symbols of the flash layout, core.cpp places them at the mapped addresses of the board
+// (4M with 1M SPIFFS) so the harness is built with -fno-pie -no-pie
+extern "C" uint32_t _SPIFFS_start;
+extern "C" uint32_t _SPIFFS_end;
+
+#include "debug.h"
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+#include "Esp.h"
+#include "Updater.h"
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,89 @@
+#ifndef HOST_ESP8266HTTPCLIENT_H
+#define HOST_ESP8266HTTPCLIENT_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED  (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED       (-4)
+#define HTTPC_ERROR_CONNECTION_LOST     (-5)
+#define HTTPC_ERROR_NO_STREAM           (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER      (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM        (-8)
+#define HTTPC_ERROR_ENCODING            (-9)
+#define HTTPC_ERROR_STREAM_WRITE        (-10)
+#define HTTPC_ERROR_READ_TIMEOUT        (-11)
+
+#define HTTPCLIENT_DEFAULT_TCP_TIMEOUT (5000)
+
+typedef enum {
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_PARTIAL_CONTENT = 206,
+    HTTP_CODE_NOT_MODIFIED = 304,
+    HTTP_CODE_BAD_REQUEST = 400,
+    HTTP_CODE_FORBIDDEN = 403,
+    HTTP_CODE_NOT_FOUND = 404,
+    HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+    HTTP_CODE_SERVICE_UNAVAILABLE = 503
+} t_http_codes;
+
+// The HTTPClient of core 2.4 for plain http: a GET over WiFiClient, the status line
+// and the tracked headers are parsed, the body is left in getStreamPtr()
+class HTTPClient {
+public:
+    HTTPClient();
+    ~HTTPClient();
+
+    bool begin(String url);
+    bool begin(String url, String httpsFingerprint);
+    bool begin(String host, uint16_t port, String uri = "/");
+    bool begin(String host, uint16_t port, String uri, String httpsFingerprint);
+    void end(void);
+    bool connected(void);
+
+    void setReuse(bool reuse) { _reuse = reuse; }
+    void setUserAgent(const String& userAgent) { _userAgent = userAgent; }
+    void setTimeout(uint16_t timeout);
+    void useHTTP10(bool usehttp10 = true) { _useHTTP10 = usehttp10; }
+
+    int GET();
+
+    void addHeader(const String& name, const String& value, bool first = false, bool replace = true);
+    void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+    String header(const char* name);
+    bool hasHeader(const char* name);
+
+    int getSize(void) { return _size; }
+    WiFiClient* getStreamPtr(void);
+
+    static String errorToString(int error);
+
+private:
+    struct RequestArgument {
+        String key;
+        String value;
+    };
+
+    bool connect(void);
+    int handleHeaderResponse();
+
+    WiFiClient* _tcp;
+    String _host;
+    uint16_t _port;
+    String _uri;
+    bool _reuse;
+    bool _useHTTP10;
+    uint16_t _tcpTimeout;
+    String _userAgent;
+    String _headers;
+    std::vector<RequestArgument> _currentHeaders;
+    int _returnCode;
+    int _size;
+    bool _canReuse;
+};
+
+#endif // HOST_ESP8266HTTPCLIENT_H
@@ -0,0 +1,53 @@
+#ifndef HOST_ESP_H
+#define HOST_ESP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct rst_info;
+
+// EspClass of the core over the flash image and the RTC memory of host.h
+class EspClass {
+public:
+    void wdtEnable(uint32_t = 0) {}
+    void wdtDisable() {}
+    void wdtFeed() {}
+
+    void deepSleep(uint64_t time_us, int mode = 0);
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+    void reset() { restart(); }
+    void restart();
+
+    uint16_t getVcc() { return 3300; }
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getChipId();
+    const char* getSdkVersion() { return "2.2.1(host)"; }
+    String getCoreVersion() { return String("2_4_0"); }
+    uint8_t getBootVersion() { return 31; }
+    uint8_t getBootMode() { return 1; }
+    uint8_t getCpuFreqMHz() { return 80; }
+    uint32_t getCycleCount();
+
+    uint32_t getFlashChipId() { return 0x1640e0; }
+    uint32_t getFlashChipRealSize();
+    uint32_t getFlashChipSize() { return getFlashChipRealSize(); }
+    uint32_t getFlashChipSpeed() { return 40000000; }
+    uint32_t magicFlashChipSize(uint8_t byte);
+    bool checkFlashConfig(bool needsEquals = false) { (void) needsEquals; return true; }
+
+    bool flashEraseSector(uint32_t sector);
+    bool flashWrite(uint32_t offset, uint32_t* data, size_t size);
+    bool flashRead(uint32_t offset, uint32_t* data, size_t size);
+
+    uint32_t getSketchSize();
+    String getSketchMD5();
+    uint32_t getFreeSketchSpace();
+
+    String getResetReason();
+    struct rst_info* getResetInfoPtr();
+};
+
+extern EspClass ESP;
+
+#endif // HOST_ESP_H
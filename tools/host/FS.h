@@ -0,0 +1,38 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+
+namespace fs {
+
+// SPIFFS is not simulated: the file system is empty, a File never opens
+class File : public Stream {
+public:
+    size_t write(uint8_t) override { return 0; }
+    size_t write(const uint8_t*, size_t) override { return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+    size_t read(uint8_t*, size_t) { return 0; }
+    size_t size() const { return 0; }
+    void close() {}
+    const char* name() const { return ""; }
+    bool isDirectory() const { return false; }
+    operator bool() const { return false; }
+};
+
+class FS {
+public:
+    File open(const char*, const char*) { return File(); }
+    File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+    bool exists(const char*) { return false; }
+    bool exists(const String& path) { return exists(path.c_str()); }
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+
+#endif // HOST_FS_H
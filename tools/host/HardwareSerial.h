@@ -0,0 +1,25 @@
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+
+#include "Stream.h"
+
+// Serial goes to stderr when OTA_HOST_VERBOSE is set, stdout is left to the JSON lines of the harness
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    void end() {}
+    void setDebugOutput(bool) {}
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif // HOST_HARDWARESERIAL_H
@@ -0,0 +1,39 @@
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+
+#include <Arduino.h>
+
+class IPAddress : public Printable {
+public:
+    IPAddress() { _address.dword = 0; }
+    IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth);
+    IPAddress(uint32_t address) { _address.dword = address; }
+    IPAddress(const uint8_t* address) { memcpy(_address.bytes, address, 4); }
+
+    bool fromString(const char* address);
+    bool fromString(const String& address) { return fromString(address.c_str()); }
+
+    operator uint32_t() const { return _address.dword; }
+    bool operator==(const IPAddress& addr) const { return _address.dword == addr._address.dword; }
+    bool operator==(uint32_t addr) const { return _address.dword == addr; }
+    uint8_t operator[](int index) const { return _address.bytes[index]; }
+    uint8_t& operator[](int index) { return _address.bytes[index]; }
+    IPAddress& operator=(uint32_t address) { _address.dword = address; return *this; }
+
+    size_t printTo(Print& p) const override;
+    String toString() const;
+
+    friend class Client;
+    friend class UDP;
+
+private:
+    union {
+        uint8_t bytes[4];
+        uint32_t dword;
+    } _address;
+    uint8_t* raw_address() { return _address.bytes; }
+};
+
+extern const IPAddress INADDR_NONE;
+
+#endif // HOST_IPADDRESS_H
@@ -0,0 +1,31 @@
+#ifndef HOST_MD5BUILDER_H
+#define HOST_MD5BUILDER_H
+
+#include <Arduino.h>
+
+struct HostMD5Context {
+    uint32_t state[4];
+    uint64_t count;
+    uint8_t buffer[64];
+};
+
+class MD5Builder {
+public:
+    void begin(void);
+    void add(const uint8_t* data, uint16_t len);
+    void add(const char* data) { add((const uint8_t*) data, strlen(data)); }
+    void add(const String& data) { add((const uint8_t*) data.c_str(), data.length()); }
+    void addHexString(const char* data);
+    void addHexString(const String& data) { addHexString(data.c_str()); }
+    bool addStream(Stream& stream, const size_t maxLen);
+    void calculate(void);
+    void getBytes(uint8_t* output);
+    void getChars(char* output);
+    String toString(void);
+
+private:
+    HostMD5Context _ctx;
+    uint8_t _buf[16];
+};
+
+#endif // HOST_MD5BUILDER_H
@@ -0,0 +1,60 @@
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "WString.h"
+
+class Printable;
+
+class Print {
+public:
+    Print() : _writeError(0) {}
+    virtual ~Print() {}
+
+    int getWriteError() { return _writeError; }
+    void clearWriteError() { _writeError = 0; }
+
+    virtual size_t write(uint8_t) = 0;
+    size_t write(const char* str) { return str ? write((const uint8_t*) str, strlen(str)) : 0; }
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*) buffer, size); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t printf_P(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+    size_t print(const String& s) { return write((const uint8_t*) s.c_str(), s.length()); }
+    size_t print(const char s[]) { return write(s); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(unsigned char n, int base = DEC_BASE) { return print((unsigned long) n, base); }
+    size_t print(int n, int base = DEC_BASE) { return print((long) n, base); }
+    size_t print(unsigned int n, int base = DEC_BASE) { return print((unsigned long) n, base); }
+    size_t print(long n, int base = DEC_BASE);
+    size_t print(unsigned long n, int base = DEC_BASE);
+    size_t print(double n, int digits = 2);
+    size_t print(const Printable& p);
+
+    size_t println() { return write("\r\n"); }
+    template<typename T>
+    size_t println(const T& value) { size_t n = print(value); return n + println(); }
+    template<typename T>
+    size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+
+    virtual void flush() {}
+
+protected:
+    enum { DEC_BASE = 10 };
+    void setWriteError(int err = 1) { _writeError = err; }
+
+private:
+    int _writeError;
+};
+
+class Printable {
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print& p) const = 0;
+};
+
+#endif // HOST_PRINT_H
@@ -0,0 +1,11 @@
+#ifndef HOST_SERVER_H
+#define HOST_SERVER_H
+
+#include "Print.h"
+
+class Server : public Print {
+public:
+    virtual void begin() = 0;
+};
+
+#endif // HOST_SERVER_H
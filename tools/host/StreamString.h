@@ -0,0 +1,16 @@
+#ifndef HOST_STREAMSTRING_H
+#define HOST_STREAMSTRING_H
+
+#include <Arduino.h>
+
+class StreamString : public Stream, public String {
+public:
+    size_t write(const uint8_t* buffer, size_t size) override { concat((const char*) buffer, size); return size; }
+    size_t write(uint8_t data) override { concat((char) data); return 1; }
+    int available() override { return length(); }
+    int read() override;
+    int peek() override { return length() ? charAt(0) : -1; }
+    void flush() override {}
+};
+
+#endif // HOST_STREAMSTRING_H
@@ -0,0 +1,109 @@
+#ifndef HOST_UPDATER_H
+#define HOST_UPDATER_H
+
+#include <Arduino.h>
+#include <MD5Builder.h>
+
+#define UPDATE_ERROR_OK                 (0)
+#define UPDATE_ERROR_WRITE              (1)
+#define UPDATE_ERROR_ERASE              (2)
+#define UPDATE_ERROR_READ               (3)
+#define UPDATE_ERROR_SPACE              (4)
+#define UPDATE_ERROR_SIZE               (5)
+#define UPDATE_ERROR_STREAM             (6)
+#define UPDATE_ERROR_MD5                (7)
+#define UPDATE_ERROR_FLASH_CONFIG       (8)
+#define UPDATE_ERROR_NEW_FLASH_CONFIG   (9)
+#define UPDATE_ERROR_MAGIC_BYTE         (10)
+#define UPDATE_ERROR_BOOTSTRAP          (11)
+
+#define U_FLASH   0
+#define U_SPIFFS  100
+#define U_AUTH    200
+
+// The Updater of core 2.4: a sector sized buffer written to the flash of host.h,
+// Update.end() leaves the eboot command that copies the image at the next boot
+class UpdaterClass {
+public:
+    UpdaterClass();
+
+    bool begin(size_t size, int command = U_FLASH);
+    bool setMD5(const char* expected_md5);
+    size_t write(uint8_t* data, size_t len);
+    size_t writeStream(Stream& data);
+    bool end(bool evenIfRemaining = false);
+
+    // What data has available, like the template of the core
+    template<typename T>
+    size_t write(T& data)
+    {
+        size_t written = 0;
+        if(hasError() || !isRunning()) {
+            return 0;
+        }
+        size_t available = data.available();
+        while(available) {
+            if(_bufferLen + available > remaining()) {
+                available = remaining() - _bufferLen;
+            }
+            if(_bufferLen + available > _bufferSize) {
+                size_t toBuff = _bufferSize - _bufferLen;
+                data.read(_buffer + _bufferLen, toBuff);
+                _bufferLen += toBuff;
+                if(!_writeBuffer()) {
+                    return written;
+                }
+                written += toBuff;
+            } else {
+                data.read(_buffer + _bufferLen, available);
+                _bufferLen += available;
+                written += available;
+                if(_bufferLen == remaining()) {
+                    if(!_writeBuffer()) {
+                        return written;
+                    }
+                }
+            }
+            if(remaining() == 0) {
+                return written;
+            }
+            yield();
+            available = data.available();
+        }
+        return written;
+    }
+
+    void printError(Print& out);
+    String md5String(void) { return _md5.toString(); }
+    void md5(uint8_t* result) { _md5.getBytes(result); }
+
+    uint8_t getError() { return _error; }
+    void clearError() { _error = UPDATE_ERROR_OK; }
+    bool hasError() { return _error != UPDATE_ERROR_OK; }
+    bool isRunning() { return _size > 0; }
+    bool isFinished() { return _currentAddress == (_startAddress + _size); }
+    size_t size() { return _size; }
+    size_t progress() { return _currentAddress - _startAddress; }
+    size_t remaining() { return _size - (_currentAddress - _startAddress); }
+
+private:
+    void _reset();
+    bool _writeBuffer();
+    bool _verifyHeader(uint8_t data);
+    void _setError(int error) { _error = error; }
+
+    uint8_t _error;
+    uint8_t* _buffer;
+    size_t _bufferLen;
+    size_t _bufferSize;
+    size_t _size;
+    uint32_t _startAddress;
+    uint32_t _currentAddress;
+    uint32_t _command;
+    String _target_md5;
+    MD5Builder _md5;
+};
+
+extern UpdaterClass Update;
+
+#endif // HOST_UPDATER_H
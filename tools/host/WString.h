@@ -0,0 +1,119 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+class __FlashStringHelper;
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper*>(p))
+#define F(s) FPSTR(s)
+
+// The String of the core, over a heap buffer
+class String {
+public:
+    String(const char* cstr = "");
+    String(const String& str);
+    String(String&& str);
+    String(const __FlashStringHelper* str) : String(reinterpret_cast<const char*>(str)) {}
+    explicit String(char c);
+    explicit String(unsigned char value, unsigned char base = 10);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(float value, unsigned char decimalPlaces = 2);
+    explicit String(double value, unsigned char decimalPlaces = 2);
+    ~String();
+
+    String& operator=(const String& rhs);
+    String& operator=(String&& rhs);
+    String& operator=(const char* cstr);
+    String& operator=(const __FlashStringHelper* str) { return *this = reinterpret_cast<const char*>(str); }
+
+    unsigned char reserve(unsigned int size);
+    unsigned int length() const { return _len; }
+    const char* c_str() const { return _buf ? _buf : ""; }
+    operator bool() const { return true; }
+
+    unsigned char concat(const String& str) { return concat(str.c_str(), str._len); }
+    unsigned char concat(const char* cstr) { return cstr ? concat(cstr, strlen(cstr)) : 0; }
+    unsigned char concat(const char* cstr, unsigned int length);
+    unsigned char concat(char c) { return concat(&c, 1); }
+    unsigned char concat(unsigned char num) { return concat(String(num)); }
+    unsigned char concat(int num) { return concat(String(num)); }
+    unsigned char concat(unsigned int num) { return concat(String(num)); }
+    unsigned char concat(long num) { return concat(String(num)); }
+    unsigned char concat(unsigned long num) { return concat(String(num)); }
+    unsigned char concat(float num) { return concat(String(num)); }
+    unsigned char concat(double num) { return concat(String(num)); }
+    unsigned char concat(const __FlashStringHelper* str) { return concat(reinterpret_cast<const char*>(str)); }
+
+    template<typename T>
+    String& operator+=(const T& rhs) { concat(rhs); return *this; }
+
+    int compareTo(const String& s) const;
+    unsigned char equals(const String& s) const { return compareTo(s) == 0; }
+    unsigned char equals(const char* cstr) const { return strcmp(c_str(), cstr ? cstr : "") == 0; }
+    unsigned char operator==(const String& rhs) const { return equals(rhs); }
+    unsigned char operator==(const char* cstr) const { return equals(cstr); }
+    unsigned char operator!=(const String& rhs) const { return !equals(rhs); }
+    unsigned char operator!=(const char* cstr) const { return !equals(cstr); }
+    unsigned char operator<(const String& rhs) const { return compareTo(rhs) < 0; }
+    unsigned char equalsIgnoreCase(const String& s) const;
+    bool equalsConstantTime(const String& s) const;
+    unsigned char startsWith(const String& prefix) const { return startsWith(prefix, 0); }
+    unsigned char startsWith(const String& prefix, unsigned int offset) const;
+    unsigned char endsWith(const String& suffix) const;
+
+    char charAt(unsigned int index) const { return index < _len ? _buf[index] : 0; }
+    void setCharAt(unsigned int index, char c) { if(index < _len) _buf[index] = c; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index);
+    void getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index = 0) const;
+    void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const { getBytes((unsigned char*) buf, bufsize, index); }
+    const char* begin() const { return c_str(); }
+    const char* end() const { return c_str() + _len; }
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const;
+    int indexOf(const String& str, unsigned int fromIndex = 0) const;
+    int lastIndexOf(char ch) const { return lastIndexOf(ch, _len - 1); }
+    int lastIndexOf(char ch, unsigned int fromIndex) const;
+    int lastIndexOf(const String& str) const { return lastIndexOf(str, _len - str._len); }
+    int lastIndexOf(const String& str, unsigned int fromIndex) const;
+    String substring(unsigned int beginIndex) const { return substring(beginIndex, _len); }
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void replace(char find, char replace);
+    void replace(const String& find, const String& replace);
+    void remove(unsigned int index) { remove(index, (unsigned int) -1); }
+    void remove(unsigned int index, unsigned int count);
+    void toLowerCase();
+    void toUpperCase();
+    void trim();
+
+    long toInt() const { return _buf ? atol(_buf) : 0; }
+    float toFloat() const { return _buf ? (float) atof(_buf) : 0; }
+
+private:
+    char* _buf;
+    unsigned int _capacity;
+    unsigned int _len;
+};
+
+String operator+(const String& lhs, const String& rhs);
+String operator+(const String& lhs, const char* rhs);
+String operator+(const char* lhs, const String& rhs);
+String operator+(const String& lhs, char rhs);
+String operator+(const String& lhs, int rhs);
+String operator+(const String& lhs, unsigned int rhs);
+String operator+(const String& lhs, long rhs);
+String operator+(const String& lhs, unsigned long rhs);
+String operator+(const String& lhs, float rhs);
+String operator+(const String& lhs, double rhs);
+String operator+(const String& lhs, const __FlashStringHelper* rhs);
+
+extern const String emptyString;
+
+#endif // HOST_WSTRING_H
@@ -0,0 +1,56 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH 32
+
+// TwoWire of the core over the I2C stand-ins of host.h, at 100 kHz every byte
+// on the bus (address included) advances the clock by 90 us
+class TwoWire : public Stream {
+public:
+    TwoWire();
+    void begin(int sda, int scl);
+    void begin();
+    void setClock(uint32_t frequency);
+    void setClockStretchLimit(uint32_t) {}
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+    uint8_t endTransmission(void) { return endTransmission(true); }
+    uint8_t endTransmission(uint8_t sendStop);
+
+    size_t requestFrom(uint8_t address, size_t size, bool sendStop);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity) { return requestFrom(address, (size_t) quantity, true); }
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop) { return requestFrom(address, (size_t) quantity, (bool) sendStop); }
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t) address, (size_t) quantity, true); }
+    uint8_t requestFrom(int address, int quantity, int sendStop) { return requestFrom((uint8_t) address, (size_t) quantity, (bool) sendStop); }
+
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t* data, size_t quantity) override;
+    size_t write(unsigned long n) { return write((uint8_t) n); }
+    size_t write(long n) { return write((uint8_t) n); }
+    size_t write(unsigned int n) { return write((uint8_t) n); }
+    size_t write(int n) { return write((uint8_t) n); }
+    int available(void) override { return _rxLength - _rxIndex; }
+    int read(void) override { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1; }
+    int peek(void) override { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex] : -1; }
+    void flush(void) override { _rxIndex = _rxLength = _txLength = 0; }
+
+    using Print::write;
+
+private:
+    void _busTime(size_t bytes);
+
+    uint32_t _frequency;
+    uint8_t _txAddress;
+    uint8_t _txBuffer[BUFFER_LENGTH];
+    size_t _txLength;
+    uint8_t _rxBuffer[BUFFER_LENGTH];
+    size_t _rxIndex;
+    size_t _rxLength;
+};
+
+extern TwoWire Wire;
+
+#endif // HOST_WIRE_H
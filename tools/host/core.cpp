@@ -0,0 +1,1671 @@
+/*
+  Host stand-in of the ESP8266 Arduino core (2.4): time and the event queue
+  of the network, pins, String, Print, Stream, Serial, the flash and RTC
+  memory of EspClass, eboot, the SDK software timers, base64 of libb64,
+  MD5Builder and the Updater.
+*/
+
+#include <Arduino.h>
+#include <MD5Builder.h>
+#include <StreamString.h>
+#include <Updater.h>
+#include <eboot_command.h>
+#include <libb64/cencode.h>
+#include <osapi.h>
+#include <user_interface.h>
+
+#include "host.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+
+// The flash layout of the board, &_SPIFFS_start - 0x40200000 is the flash offset of SPIFFS
+__asm__(".globl _SPIFFS_start\n\t.set _SPIFFS_start, 0x40500000\n\t"
+        ".globl _SPIFFS_end\n\t.set _SPIFFS_end, 0x405fb000");
+
+#define RTC_CALIBRATION  22528 // 5.5 us per tick of the RTC timer, Q12
+
+////////////
+// Time   //
+////////////
+
+static const auto hostStart = std::chrono::steady_clock::now();
+static uint64_t virtualUs; // time let pass by delay(), yield(), hostAdvance() and the flash
+static std::vector<os_timer_t*> timers;
+static bool runningTimers;
+
+struct HostEvent {
+    uint64_t at;
+    uint64_t seq;
+    std::function<void()> fn;
+
+    bool operator>(const HostEvent& other) const { return at != other.at ? at > other.at : seq > other.seq; }
+};
+
+static std::priority_queue<HostEvent, std::vector<HostEvent>, std::greater<HostEvent>> events;
+static uint64_t eventSeq;
+static bool runningEvents;
+static bool scheduled; // esp_schedule() was called, the sketch goes on from esp_yield() or delay()
+
+#define HOST_MAX_YIELD_US (3600ULL * 1000000) // an esp_yield() nothing resumes is a bug of the harness or the sketch
+
+static uint64_t nowUs()
+{
+    return virtualUs + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+static void runTimers()
+{
+    if(runningTimers) {
+        return;
+    }
+    runningTimers = true;
+    uint32_t now = nowUs() / 1000;
+    for(size_t i = 0; i < timers.size(); ++i) {
+        os_timer_t* timer = timers[i];
+        if((int32_t) (now - timer->timer_expire) < 0) {
+            continue;
+        }
+        if(timer->timer_period) {
+            timer->timer_expire = now + timer->timer_period;
+        } else {
+            timers.erase(timers.begin() + i--);
+        }
+        timer->timer_func(timer->timer_arg);
+    }
+    runningTimers = false;
+}
+
+// The timers and the events that are due, not from inside one of them
+static void runDue()
+{
+    runTimers();
+    if(runningEvents) {
+        return;
+    }
+    runningEvents = true;
+    while(!events.empty() && events.top().at <= nowUs()) {
+        std::function<void()> fn = events.top().fn;
+        events.pop();
+        fn();
+    }
+    runningEvents = false;
+}
+
+// When the next timer or event is due
+static uint64_t nextDue()
+{
+    uint64_t next = events.empty() ? UINT64_MAX : events.top().at;
+    uint64_t nowMs = nowUs() / 1000;
+    for(os_timer_t* timer : timers) {
+        int32_t left = (int32_t) (timer->timer_expire - (uint32_t) nowMs);
+        next = std::min(next, (nowMs + std::max(left, 0)) * 1000);
+    }
+    return next;
+}
+
+// Lets the clock run to endUs, the timers and the events fire on the way.
+// With untilScheduled it stops early at esp_schedule(), true if it did
+static bool runUntil(uint64_t endUs, bool untilScheduled)
+{
+    if(runningEvents) {
+        // a wait inside a callback of the network: only the clock moves, like a busy loop
+        virtualUs += endUs > nowUs() ? endUs - nowUs() : 0;
+        runTimers();
+        return false;
+    }
+    while(true) {
+        runDue();
+        if(untilScheduled && scheduled) {
+            scheduled = false;
+            return true;
+        }
+        uint64_t now = nowUs();
+        uint64_t next = nextDue();
+        if(next > endUs || now >= endUs) {
+            break;
+        }
+        if(next > now) {
+            virtualUs += next - now;
+        }
+    }
+    uint64_t now = nowUs();
+    if(endUs > now) {
+        virtualUs += endUs - now;
+    }
+    runDue();
+    if(untilScheduled && scheduled) {
+        scheduled = false;
+        return true;
+    }
+    return false;
+}
+
+uint64_t hostNow()
+{
+    return nowUs();
+}
+
+void hostAt(uint64_t us, std::function<void()> fn)
+{
+    events.push(HostEvent { us, eventSeq++, fn });
+}
+
+unsigned long millis()
+{
+    return (uint32_t) (nowUs() / 1000);
+}
+
+unsigned long micros()
+{
+    return (uint32_t) nowUs();
+}
+
+// Ends early at esp_schedule() like the delay() of the core, ClientContext waits for its callbacks this way
+void delay(unsigned long ms)
+{
+    runUntil(nowUs() + (uint64_t) ms * 1000, ms > 0);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    virtualUs += us;
+}
+
+// A context switch, it also lets polling loops reach their timeouts in virtual time
+void yield()
+{
+    virtualUs += 10;
+    if(!runningEvents) {
+        runDue();
+    }
+}
+
+void optimistic_yield(uint32_t interval_us)
+{
+    (void) interval_us;
+    yield();
+}
+
+// Back to the SDK until esp_schedule(): the network and the timers run meanwhile
+extern "C" void esp_yield()
+{
+    if(runningEvents) {
+        fprintf(stderr, "esp_yield() from a callback of the network\n");
+        abort();
+    }
+    if(!runUntil(nowUs() + HOST_MAX_YIELD_US, true)) {
+        fprintf(stderr, "esp_yield() was never resumed\n");
+        abort();
+    }
+}
+
+extern "C" void esp_schedule()
+{
+    scheduled = true;
+}
+
+void hostAdvance(uint64_t us)
+{
+    virtualUs += us;
+}
+
+extern "C" void os_timer_setfn(os_timer_t* ptimer, os_timer_func_t* pfunction, void* parg)
+{
+    ptimer->timer_func = pfunction;
+    ptimer->timer_arg = parg;
+}
+
+extern "C" void os_timer_arm(os_timer_t* ptimer, uint32_t milliseconds, bool repeat_flag)
+{
+    os_timer_disarm(ptimer);
+    ptimer->timer_expire = millis() + milliseconds;
+    ptimer->timer_period = repeat_flag ? milliseconds : 0;
+    timers.push_back(ptimer);
+}
+
+extern "C" void os_timer_disarm(os_timer_t* ptimer)
+{
+    for(size_t i = 0; i < timers.size(); ++i) {
+        if(timers[i] == ptimer) {
+            timers.erase(timers.begin() + i);
+            return;
+        }
+    }
+}
+
+////////////
+// Pins   //
+////////////
+
+#define HOST_PINS 18
+
+static uint8_t pinModes[HOST_PINS];
+static uint8_t pinOutputs[HOST_PINS];
+static int pinInputs[HOST_PINS] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+static int analogValue = 761; // 3.9 V of battery through the divider of the Agrumino
+
+// wire.cpp, the I2C chips follow their supply on GPIO15
+void hostPinChanged(uint8_t pin, uint8_t level);
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if(pin < HOST_PINS) {
+        pinModes[pin] = mode;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if(pin < HOST_PINS && pinOutputs[pin] != (val ? HIGH : LOW)) {
+        pinOutputs[pin] = val ? HIGH : LOW;
+        hostPinChanged(pin, pinOutputs[pin]);
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    if(pin >= HOST_PINS) {
+        return LOW;
+    }
+    if(pinModes[pin] == OUTPUT) {
+        return pinOutputs[pin];
+    }
+    if(pinInputs[pin] >= 0) {
+        return pinInputs[pin];
+    }
+    return pinModes[pin] == INPUT_PULLUP ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+    return pin == A0 ? analogValue : 0;
+}
+
+void hostSetPin(uint8_t pin, int level)
+{
+    if(pin < HOST_PINS) {
+        pinInputs[pin] = level;
+    }
+}
+
+void hostSetAnalog(int value)
+{
+    analogValue = value;
+}
+
+//////////////
+// Helpers  //
+//////////////
+
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+static char* formatUnsigned(unsigned long value, char* result, int base)
+{
+    char tmp[8 * sizeof(long) + 1];
+    int i = 0;
+    if(base < 2 || base > 36) {
+        *result = 0;
+        return result;
+    }
+    do {
+        int digit = value % base;
+        tmp[i++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while(value);
+    for(int j = 0; j < i; ++j) {
+        result[j] = tmp[i - 1 - j];
+    }
+    result[i] = 0;
+    return result;
+}
+
+char* ltoa(long value, char* result, int base)
+{
+    if(value < 0 && base == 10) {
+        *result = '-';
+        formatUnsigned(-(unsigned long) value, result + 1, base);
+        return result;
+    }
+    return formatUnsigned((unsigned long) value, result, base);
+}
+
+char* itoa(int value, char* result, int base)
+{
+    if(value < 0 && base != 10) {
+        return formatUnsigned((unsigned) value, result, base);
+    }
+    return ltoa(value, result, base);
+}
+
+char* utoa(unsigned value, char* result, int base)
+{
+    return formatUnsigned(value, result, base);
+}
+
+char* ultoa(unsigned long value, char* result, int base)
+{
+    return formatUnsigned(value, result, base);
+}
+
+char* dtostrf(double number, signed char width, unsigned char prec, char* s)
+{
+    sprintf(s, "%*.*f", width, prec, number);
+    return s;
+}
+
+extern "C" int base64_encode_chars(const char* plaintext_in, int length_in, char* code_out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t* in = (const uint8_t*) plaintext_in;
+    char* out = code_out;
+    for(int i = 0; i < length_in; i += 3) {
+        uint32_t triple = in[i] << 16 | (i + 1 < length_in ? in[i + 1] << 8 : 0) | (i + 2 < length_in ? in[i + 2] : 0);
+        *out++ = alphabet[(triple >> 18) & 0x3f];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = i + 1 < length_in ? alphabet[(triple >> 6) & 0x3f] : '=';
+        *out++ = i + 2 < length_in ? alphabet[triple & 0x3f] : '=';
+    }
+    *out = 0;
+    return out - code_out;
+}
+
+extern "C" uint32_t host_random()
+{
+    static uint32_t state = 0x2545f491;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+////////////
+// String //
+////////////
+
+const String emptyString;
+
+String::String(const char* cstr) : _buf(NULL), _capacity(0), _len(0)
+{
+    if(cstr) {
+        concat(cstr, strlen(cstr));
+    }
+}
+
+String::String(const String& str) : _buf(NULL), _capacity(0), _len(0)
+{
+    concat(str.c_str(), str._len);
+}
+
+String::String(String&& str) : _buf(str._buf), _capacity(str._capacity), _len(str._len)
+{
+    str._buf = NULL;
+    str._capacity = 0;
+    str._len = 0;
+}
+
+String::String(char c) : String()
+{
+    concat(&c, 1);
+}
+
+String::String(unsigned char value, unsigned char base) : String((unsigned long) value, base)
+{
+}
+
+String::String(int value, unsigned char base) : String((long) value, base)
+{
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long) value, base)
+{
+}
+
+String::String(long value, unsigned char base) : String()
+{
+    char buf[2 + 8 * sizeof(long)];
+    *this = ltoa(value, buf, base);
+}
+
+String::String(unsigned long value, unsigned char base) : String()
+{
+    char buf[1 + 8 * sizeof(long)];
+    *this = ultoa(value, buf, base);
+}
+
+String::String(float value, unsigned char decimalPlaces) : String((double) value, decimalPlaces)
+{
+}
+
+String::String(double value, unsigned char decimalPlaces) : String()
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    *this = buf;
+}
+
+String::~String()
+{
+    free(_buf);
+}
+
+String& String::operator=(const String& rhs)
+{
+    if(this != &rhs) {
+        _len = 0;
+        concat(rhs.c_str(), rhs._len);
+    }
+    return *this;
+}
+
+String& String::operator=(String&& rhs)
+{
+    if(this != &rhs) {
+        free(_buf);
+        _buf = rhs._buf;
+        _capacity = rhs._capacity;
+        _len = rhs._len;
+        rhs._buf = NULL;
+        rhs._capacity = 0;
+        rhs._len = 0;
+    }
+    return *this;
+}
+
+String& String::operator=(const char* cstr)
+{
+    if(!cstr) {
+        return *this = String();
+    }
+    // Keeps the buffer like copy() of the core, cstr may point into it
+    size_t len = strlen(cstr);
+    if(_buf && cstr >= _buf && cstr <= _buf + _len) {
+        memmove(_buf, cstr, len + 1);
+    } else {
+        if(!reserve(len)) {
+            return *this;
+        }
+        memcpy(_buf, cstr, len + 1);
+    }
+    _len = len;
+    return *this;
+}
+
+unsigned char String::reserve(unsigned int size)
+{
+    if(_buf && _capacity >= size) {
+        return 1;
+    }
+    char* buf = (char*) realloc(_buf, size + 1);
+    if(!buf) {
+        return 0;
+    }
+    if(!_buf) {
+        buf[0] = 0;
+    }
+    _buf = buf;
+    _capacity = size;
+    return 1;
+}
+
+unsigned char String::concat(const char* cstr, unsigned int length)
+{
+    if(!cstr) {
+        return 0;
+    }
+    if(_buf && cstr >= _buf && cstr < _buf + _capacity + 1) { // appending a part of itself
+        String copy;
+        copy.concat(cstr, length);
+        return concat(copy.c_str(), length);
+    }
+    if(!reserve(_len + length)) {
+        return 0;
+    }
+    memcpy(_buf + _len, cstr, length);
+    _len += length;
+    _buf[_len] = 0;
+    return 1;
+}
+
+int String::compareTo(const String& s) const
+{
+    return strcmp(c_str(), s.c_str());
+}
+
+unsigned char String::equalsIgnoreCase(const String& s) const
+{
+    return _len == s._len && strcasecmp(c_str(), s.c_str()) == 0;
+}
+
+// Looks at every byte whatever the first difference, like the core
+bool String::equalsConstantTime(const String& s) const
+{
+    if(_len != s._len) {
+        return false;
+    }
+    unsigned char diff = 0;
+    for(unsigned int i = 0; i < _len; ++i) {
+        diff |= _buf[i] ^ s._buf[i];
+    }
+    return diff == 0;
+}
+
+unsigned char String::startsWith(const String& prefix, unsigned int offset) const
+{
+    if(offset > _len || prefix._len > _len - offset) {
+        return 0;
+    }
+    return strncmp(c_str() + offset, prefix.c_str(), prefix._len) == 0;
+}
+
+unsigned char String::endsWith(const String& suffix) const
+{
+    if(suffix._len > _len) {
+        return 0;
+    }
+    return strcmp(c_str() + _len - suffix._len, suffix.c_str()) == 0;
+}
+
+char& String::operator[](unsigned int index)
+{
+    static char dummy;
+    if(index >= _len) {
+        dummy = 0;
+        return dummy;
+    }
+    return _buf[index];
+}
+
+void String::getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index) const
+{
+    if(!bufsize || !buf) {
+        return;
+    }
+    if(index >= _len) {
+        buf[0] = 0;
+        return;
+    }
+    unsigned int n = std::min(bufsize - 1, _len - index);
+    memcpy(buf, _buf + index, n);
+    buf[n] = 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+    if(fromIndex >= _len) {
+        return -1;
+    }
+    const char* found = strchr(_buf + fromIndex, ch);
+    return found ? found - _buf : -1;
+}
+
+int String::indexOf(const String& str, unsigned int fromIndex) const
+{
+    if(fromIndex >= _len) {
+        return -1;
+    }
+    const char* found = strstr(_buf + fromIndex, str.c_str());
+    return found ? found - _buf : -1;
+}
+
+int String::lastIndexOf(char ch, unsigned int fromIndex) const
+{
+    if(fromIndex >= _len) {
+        return -1;
+    }
+    for(int i = fromIndex; i >= 0; --i) {
+        if(_buf[i] == ch) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int String::lastIndexOf(const String& str, unsigned int fromIndex) const
+{
+    if(str._len == 0 || str._len > _len || fromIndex >= _len) {
+        return -1;
+    }
+    for(int i = std::min(fromIndex, _len - str._len); i >= 0; --i) {
+        if(strncmp(_buf + i, str.c_str(), str._len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+String String::substring(unsigned int left, unsigned int right) const
+{
+    if(left > right) {
+        std::swap(left, right);
+    }
+    String out;
+    if(left >= _len) {
+        return out;
+    }
+    right = std::min(right, _len);
+    out.concat(_buf + left, right - left);
+    return out;
+}
+
+void String::replace(char find, char replace)
+{
+    for(unsigned int i = 0; i < _len; ++i) {
+        if(_buf[i] == find) {
+            _buf[i] = replace;
+        }
+    }
+}
+
+void String::replace(const String& find, const String& replace)
+{
+    if(_len == 0 || find._len == 0) {
+        return;
+    }
+    String out;
+    unsigned int i = 0;
+    while(i < _len) {
+        if(strncmp(_buf + i, find.c_str(), find._len) == 0) {
+            out += replace;
+            i += find._len;
+        } else {
+            out.concat(_buf[i++]);
+        }
+    }
+    *this = std::move(out);
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+    if(index >= _len) {
+        return;
+    }
+    count = std::min(count, _len - index);
+    memmove(_buf + index, _buf + index + count, _len - index - count + 1);
+    _len -= count;
+}
+
+void String::toLowerCase()
+{
+    for(unsigned int i = 0; i < _len; ++i) {
+        _buf[i] = tolower((unsigned char) _buf[i]);
+    }
+}
+
+void String::toUpperCase()
+{
+    for(unsigned int i = 0; i < _len; ++i) {
+        _buf[i] = toupper((unsigned char) _buf[i]);
+    }
+}
+
+void String::trim()
+{
+    if(!_len) {
+        return;
+    }
+    unsigned int begin = 0;
+    while(begin < _len && isspace((unsigned char) _buf[begin])) {
+        ++begin;
+    }
+    unsigned int end = _len;
+    while(end > begin && isspace((unsigned char) _buf[end - 1])) {
+        --end;
+    }
+    _len = end - begin;
+    memmove(_buf, _buf + begin, _len);
+    _buf[_len] = 0;
+}
+
+String operator+(const String& lhs, const String& rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, const char* rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const char* lhs, const String& rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, char rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, int rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, unsigned int rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, long rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, unsigned long rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, float rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, double rhs) { String s(lhs); s += rhs; return s; }
+String operator+(const String& lhs, const __FlashStringHelper* rhs) { String s(lhs); s += rhs; return s; }
+
+///////////////////////////
+// Print, Stream, Serial //
+///////////////////////////
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+    while(size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+static size_t vprintTo(Print& out, const char* format, va_list arg)
+{
+    char buf[64];
+    va_list copy;
+    va_copy(copy, arg);
+    int len = vsnprintf(buf, sizeof(buf), format, copy);
+    va_end(copy);
+    if(len < 0) {
+        return 0;
+    }
+    if(len < (int) sizeof(buf)) {
+        return out.write((const uint8_t*) buf, len);
+    }
+    std::vector<char> big(len + 1);
+    vsnprintf(&big[0], big.size(), format, arg);
+    return out.write((const uint8_t*) &big[0], len);
+}
+
+size_t Print::printf(const char* format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    size_t n = vprintTo(*this, format, arg);
+    va_end(arg);
+    return n;
+}
+
+size_t Print::printf_P(const char* format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    size_t n = vprintTo(*this, format, arg);
+    va_end(arg);
+    return n;
+}
+
+size_t Print::print(long n, int base)
+{
+    char buf[2 + 8 * sizeof(long)];
+    return write(base == 10 ? ltoa(n, buf, base) : ultoa((unsigned long) n, buf, base));
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buf[1 + 8 * sizeof(long)];
+    return write(ultoa(n, buf, base));
+}
+
+size_t Print::print(double n, int digits)
+{
+    return printf("%.*f", digits, n);
+}
+
+size_t Print::print(const Printable& p)
+{
+    return p.printTo(*this);
+}
+
+int Stream::timedRead()
+{
+    _startMillis = millis();
+    do {
+        int c = read();
+        if(c >= 0) {
+            return c;
+        }
+        yield();
+    } while(millis() - _startMillis < _timeout);
+    return -1;
+}
+
+int Stream::timedPeek()
+{
+    _startMillis = millis();
+    do {
+        int c = peek();
+        if(c >= 0) {
+            return c;
+        }
+        yield();
+    } while(millis() - _startMillis < _timeout);
+    return -1;
+}
+
+bool Stream::find(const char* target)
+{
+    return find(target, strlen(target));
+}
+
+bool Stream::find(const char* target, size_t length)
+{
+    size_t index = 0;
+    if(length == 0) {
+        return true;
+    }
+    int c;
+    while((c = timedRead()) >= 0) {
+        if(c == target[index]) {
+            if(++index >= length) {
+                return true;
+            }
+        } else {
+            index = (c == target[0]) ? 1 : 0;
+        }
+    }
+    return false;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length) {
+        int c = timedRead();
+        if(c < 0) {
+            break;
+        }
+        *buffer++ = (char) c;
+        count++;
+    }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char* buffer, size_t length)
+{
+    size_t index = 0;
+    while(index < length) {
+        int c = timedRead();
+        if(c < 0 || c == terminator) {
+            break;
+        }
+        *buffer++ = (char) c;
+        index++;
+    }
+    return index;
+}
+
+String Stream::readString()
+{
+    String ret;
+    int c = timedRead();
+    while(c >= 0) {
+        ret += (char) c;
+        c = timedRead();
+    }
+    return ret;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+    String ret;
+    int c = timedRead();
+    while(c >= 0 && c != terminator) {
+        ret += (char) c;
+        c = timedRead();
+    }
+    return ret;
+}
+
+int StreamString::read()
+{
+    if(!length()) {
+        return -1;
+    }
+    char c = charAt(0);
+    remove(0, 1);
+    return (uint8_t) c;
+}
+
+static const bool serialVerbose = getenv("OTA_HOST_VERBOSE") != NULL;
+static std::string serialLog;
+
+std::string& hostSerialLog()
+{
+    return serialLog;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+    if(serialVerbose) {
+        fwrite(buffer, 1, size, stderr);
+    }
+    serialLog.append((const char*) buffer, size);
+    return size;
+}
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+///////////////////////////
+// Flash, RTC and boot   //
+///////////////////////////
+
+// Time the SPI flash takes, the sketch waits for it with the interrupts off
+#define FLASH_ERASE_US      45000   // a sector, like ERASE_S of tools/ota_multicast.py
+#define FLASH_PAGE_US       700     // programming 256 bytes
+#define FLASH_READ_KB_US    50
+
+static std::vector<uint8_t> flash(HOST_FLASH_SIZE, 0xff);
+static HostFlashStats flashStats;
+static std::map<uint32_t, uint8_t> flashStuck; // address, bits that stay 0
+static uint32_t rtcMemory[128];
+static struct rst_info resetInfo = { REASON_DEFAULT_RST, 0, 0, 0, 0, 0, 0 };
+static uint64_t rtcStartUs; // the RTC timer restarts at every reset but the deep sleep wake up
+static bool restartPending;
+static uint64_t deepSleepUs;
+static uint32_t sketchSize;
+static String sketchMD5;
+
+uint8_t* hostFlash()
+{
+    return &flash[0];
+}
+
+HostFlashStats& hostFlashStats()
+{
+    return flashStats;
+}
+
+void hostFlashStuck(uint32_t address, uint8_t bits)
+{
+    if(bits) {
+        flashStuck[address] = bits;
+    } else {
+        flashStuck.erase(address);
+    }
+}
+
+static void applyStuck(uint32_t offset, size_t size)
+{
+    for(auto it = flashStuck.lower_bound(offset); it != flashStuck.end() && it->first < offset + size; ++it) {
+        flash[it->first] &= ~it->second;
+    }
+}
+
+bool hostRestartPending()
+{
+    return restartPending;
+}
+
+uint64_t hostDeepSleepUs()
+{
+    return deepSleepUs;
+}
+
+// copy_raw() of eboot, whole sectors
+static void ebootCopy(uint32_t from, uint32_t to, uint32_t size)
+{
+    uint32_t left = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    for(uint32_t offset = 0; offset < left; offset += FLASH_SECTOR_SIZE) {
+        memcpy(&flash[to + offset], &flash[from + offset], FLASH_SECTOR_SIZE);
+        applyStuck(to + offset, FLASH_SECTOR_SIZE);
+    }
+}
+
+// lwip.cpp, the connections of the sketch end at a reset
+void hostNetBoot();
+
+void hostBoot(rst_reason reason)
+{
+    if(reason == REASON_DEFAULT_RST) {
+        for(size_t i = 0; i < sizeof(rtcMemory) / 4; ++i) {
+            rtcMemory[i] = host_random();
+        }
+    }
+    if(reason != REASON_DEEP_SLEEP_AWAKE) {
+        rtcStartUs = nowUs();
+    }
+
+    struct eboot_command cmd;
+    if(eboot_command_read(&cmd) == 0) {
+        if(cmd.action == ACTION_COPY_RAW) {
+            ebootCopy(cmd.args[0], cmd.args[1], cmd.args[2]);
+        }
+        eboot_command_clear();
+    }
+
+    // the RAM of the sketch starts over
+    timers.clear();
+    events = decltype(events)();
+    scheduled = false;
+    hostNetBoot();
+    memset(pinModes, 0, sizeof(pinModes));
+    for(uint8_t pin = 0; pin < HOST_PINS; ++pin) {
+        digitalWrite(pin, LOW);
+    }
+    memset(&resetInfo, 0, sizeof(resetInfo));
+    resetInfo.reason = reason;
+    restartPending = false;
+    deepSleepUs = 0;
+    sketchSize = 0;
+    sketchMD5 = String();
+}
+
+static uint32_t ebootCrc(const struct eboot_command* cmd)
+{
+    uint32_t crc = 0xffffffff;
+    const uint8_t* data = (const uint8_t*) cmd;
+    for(size_t n = offsetof(struct eboot_command, crc32); n; --n) {
+        uint8_t c = *data++;
+        for(uint32_t i = 0x80; i > 0; i >>= 1) {
+            bool bit = crc & 0x80000000;
+            if(c & i) {
+                bit = !bit;
+            }
+            crc <<= 1;
+            if(bit) {
+                crc ^= 0x04c11db7;
+            }
+        }
+    }
+    return crc;
+}
+
+extern "C" int eboot_command_read(struct eboot_command* cmd)
+{
+    memcpy(cmd, rtcMemory, sizeof(*cmd));
+    if((cmd->magic & EBOOT_MAGIC_MASK) != EBOOT_MAGIC || cmd->crc32 != ebootCrc(cmd)) {
+        return 1;
+    }
+    return 0;
+}
+
+extern "C" void eboot_command_write(struct eboot_command* cmd)
+{
+    cmd->magic = EBOOT_MAGIC;
+    cmd->crc32 = ebootCrc(cmd);
+    memcpy(rtcMemory, cmd, sizeof(*cmd));
+}
+
+extern "C" void eboot_command_clear()
+{
+    rtcMemory[offsetof(struct eboot_command, magic) / 4] = 0;
+    rtcMemory[offsetof(struct eboot_command, crc32) / 4] = 0;
+}
+
+extern "C" uint32 system_get_rtc_time(void)
+{
+    return (uint32) (((nowUs() - rtcStartUs) << 12) / RTC_CALIBRATION);
+}
+
+extern "C" uint32 system_rtc_clock_cali_proc(void)
+{
+    return RTC_CALIBRATION;
+}
+
+extern "C" void system_restart(void)
+{
+    restartPending = true;
+}
+
+extern "C" uint32 system_get_chip_id(void)
+{
+    return 0x00a1b2c3;
+}
+
+extern "C" bool wifi_set_sleep_type(enum sleep_type type)
+{
+    (void) type;
+    return true;
+}
+
+EspClass ESP;
+
+void EspClass::deepSleep(uint64_t time_us, int mode)
+{
+    (void) mode;
+    deepSleepUs = time_us;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size)
+{
+    if(offset * 4 + size > sizeof(rtcMemory) || size == 0) {
+        return false;
+    }
+    memcpy(data, (uint8_t*) rtcMemory + offset * 4, size);
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size)
+{
+    if(offset * 4 + size > sizeof(rtcMemory) || size == 0) {
+        return false;
+    }
+    memcpy((uint8_t*) rtcMemory + offset * 4, data, size);
+    return true;
+}
+
+void EspClass::restart()
+{
+    system_restart();
+}
+
+uint32_t EspClass::getChipId()
+{
+    return system_get_chip_id();
+}
+
+uint32_t EspClass::getCycleCount()
+{
+    return (uint32_t) (nowUs() * getCpuFreqMHz());
+}
+
+uint32_t EspClass::getFlashChipRealSize()
+{
+    return HOST_FLASH_SIZE;
+}
+
+uint32_t EspClass::magicFlashChipSize(uint8_t byte)
+{
+    switch(byte & 0x0f) {
+    case 0x0: return 0x80000;
+    case 0x1: return 0x40000;
+    case 0x2: return 0x100000;
+    case 0x3: return 0x200000;
+    case 0x4: return 0x400000;
+    case 0x8: return 0x800000;
+    case 0x9: return 0x1000000;
+    default: return 0;
+    }
+}
+
+bool EspClass::flashEraseSector(uint32_t sector)
+{
+    if((sector + 1) * FLASH_SECTOR_SIZE > HOST_FLASH_SIZE) {
+        return false;
+    }
+    memset(&flash[sector * FLASH_SECTOR_SIZE], 0xff, FLASH_SECTOR_SIZE);
+    applyStuck(sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    flashStats.erases++;
+    virtualUs += FLASH_ERASE_US;
+    return true;
+}
+
+bool EspClass::flashWrite(uint32_t offset, uint32_t* data, size_t size)
+{
+    if((offset & 3) || (size & 3) || offset + size > HOST_FLASH_SIZE) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*) data;
+    for(size_t i = 0; i < size; ++i) {
+        flash[offset + i] &= bytes[i]; // NOR flash: programming only clears bits
+    }
+    applyStuck(offset, size);
+    flashStats.writes++;
+    flashStats.bytesWritten += size;
+    virtualUs += (size + 255) / 256 * FLASH_PAGE_US;
+    return true;
+}
+
+bool EspClass::flashRead(uint32_t offset, uint32_t* data, size_t size)
+{
+    if(offset + size > HOST_FLASH_SIZE) {
+        return false;
+    }
+    memcpy(data, &flash[offset], size);
+    flashStats.reads++;
+    flashStats.bytesRead += size;
+    virtualUs += size * FLASH_READ_KB_US / 1024;
+    return true;
+}
+
+// The image headers from APP_START_OFFSET on, like the core
+uint32_t EspClass::getSketchSize()
+{
+    if(sketchSize) {
+        return sketchSize;
+    }
+    uint32_t pos = APP_START_OFFSET;
+    uint8_t header[8];
+    if(!flashRead(pos, (uint32_t*) header, sizeof(header))) {
+        return 0;
+    }
+    pos += sizeof(header);
+    for(uint8_t segment = 0; segment < header[1]; ++segment) {
+        uint32_t section[2];
+        if(!flashRead(pos, section, sizeof(section))) {
+            return 0;
+        }
+        pos += sizeof(section) + section[1];
+    }
+    sketchSize = (pos + 16) & ~15;
+    return sketchSize;
+}
+
+String EspClass::getSketchMD5()
+{
+    if(sketchMD5.length()) {
+        return sketchMD5;
+    }
+    uint32_t size = getSketchSize();
+    MD5Builder md5;
+    md5.begin();
+    uint32_t buf[128];
+    for(uint32_t offset = 0; offset < size; offset += sizeof(buf)) {
+        uint32_t len = std::min((uint32_t) sizeof(buf), size - offset);
+        if(!flashRead(offset, buf, (len + 3) & ~3)) {
+            return String();
+        }
+        md5.add((uint8_t*) buf, len);
+    }
+    md5.calculate();
+    sketchMD5 = md5.toString();
+    return sketchMD5;
+}
+
+uint32_t EspClass::getFreeSketchSpace()
+{
+    uint32_t usedSize = (getSketchSize() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    return (uint32_t) (size_t) &_SPIFFS_start - 0x40200000 - usedSize;
+}
+
+String EspClass::getResetReason()
+{
+    switch(resetInfo.reason) {
+    case REASON_DEFAULT_RST: return "Power on";
+    case REASON_WDT_RST: return "Hardware Watchdog";
+    case REASON_EXCEPTION_RST: return "Exception";
+    case REASON_SOFT_WDT_RST: return "Software Watchdog";
+    case REASON_SOFT_RESTART: return "Software/System restart";
+    case REASON_DEEP_SLEEP_AWAKE: return "Deep-Sleep Wake";
+    case REASON_EXT_SYS_RST: return "External System";
+    }
+    return "Unknown";
+}
+
+struct rst_info* EspClass::getResetInfoPtr()
+{
+    return &resetInfo;
+}
+
+////////////
+// MD5    //
+////////////
+
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5R[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5Block(uint32_t state[4], const uint8_t block[64])
+{
+    uint32_t w[16];
+    for(int i = 0; i < 16; ++i) {
+        w[i] = block[i * 4] | (block[i * 4 + 1] << 8) | (block[i * 4 + 2] << 16) | ((uint32_t) block[i * 4 + 3] << 24);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for(int i = 0; i < 64; ++i) {
+        uint32_t f;
+        int g;
+        if(i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if(i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if(i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        uint32_t tmp = d;
+        d = c;
+        c = b;
+        uint32_t x = a + f + md5K[i] + w[g];
+        b = b + ((x << md5R[i]) | (x >> (32 - md5R[i])));
+        a = tmp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void MD5Builder::begin(void)
+{
+    _ctx.state[0] = 0x67452301;
+    _ctx.state[1] = 0xefcdab89;
+    _ctx.state[2] = 0x98badcfe;
+    _ctx.state[3] = 0x10325476;
+    _ctx.count = 0;
+    memset(_buf, 0, sizeof(_buf));
+}
+
+void MD5Builder::add(const uint8_t* data, uint16_t len)
+{
+    while(len--) {
+        _ctx.buffer[_ctx.count++ % 64] = *data++;
+        if(_ctx.count % 64 == 0) {
+            md5Block(_ctx.state, _ctx.buffer);
+        }
+    }
+}
+
+void MD5Builder::addHexString(const char* data)
+{
+    size_t len = strlen(data);
+    for(size_t i = 0; i + 1 < len; i += 2) {
+        char hex[3] = { data[i], data[i + 1], 0 };
+        uint8_t value = strtoul(hex, NULL, 16);
+        add(&value, 1);
+    }
+}
+
+bool MD5Builder::addStream(Stream& stream, const size_t maxLen)
+{
+    uint8_t buf[64];
+    size_t left = maxLen;
+    while(left) {
+        size_t len = stream.readBytes(buf, std::min(left, sizeof(buf)));
+        if(!len) {
+            return false;
+        }
+        add(buf, len);
+        left -= len;
+    }
+    return true;
+}
+
+void MD5Builder::calculate(void)
+{
+    uint64_t bits = _ctx.count * 8;
+    uint8_t pad = 0x80;
+    add(&pad, 1);
+    pad = 0;
+    while(_ctx.count % 64 != 56) {
+        add(&pad, 1);
+    }
+    uint8_t length[8];
+    for(int i = 0; i < 8; ++i) {
+        length[i] = bits >> (8 * i);
+    }
+    add(length, 8);
+    for(int i = 0; i < 16; ++i) {
+        _buf[i] = _ctx.state[i / 4] >> (8 * (i % 4));
+    }
+}
+
+void MD5Builder::getBytes(uint8_t* output)
+{
+    memcpy(output, _buf, 16);
+}
+
+void MD5Builder::getChars(char* output)
+{
+    for(int i = 0; i < 16; ++i) {
+        sprintf(output + i * 2, "%02x", _buf[i]);
+    }
+}
+
+String MD5Builder::toString(void)
+{
+    char out[33];
+    getChars(out);
+    return String(out);
+}
+
+//////////////
+// Updater  //
+//////////////
+
+static HostUpdateStats updateStats;
+
+HostUpdateStats& hostUpdateStats()
+{
+    return updateStats;
+}
+
+UpdaterClass Update;
+
+UpdaterClass::UpdaterClass()
+    : _error(0), _buffer(0), _bufferLen(0), _bufferSize(0), _size(0), _startAddress(0), _currentAddress(0), _command(U_FLASH)
+{
+}
+
+void UpdaterClass::_reset()
+{
+    delete[] _buffer;
+    _buffer = 0;
+    _bufferLen = 0;
+    _startAddress = 0;
+    _currentAddress = 0;
+    _size = 0;
+    _command = U_FLASH;
+}
+
+bool UpdaterClass::begin(size_t size, int command)
+{
+    if(_size > 0) {
+        return false;
+    }
+    if(size == 0) {
+        _error = UPDATE_ERROR_SIZE;
+        return false;
+    }
+
+    _reset();
+    _error = 0;
+    _target_md5 = String();
+
+    uint32_t updateStartAddress = 0;
+    if(command == U_FLASH) {
+        // the new image goes at the top of the free space, below SPIFFS
+        uint32_t currentSketchSize = (ESP.getSketchSize() + FLASH_SECTOR_SIZE - 1) & (~(FLASH_SECTOR_SIZE - 1));
+        uint32_t updateEndAddress = (uint32_t) (size_t) &_SPIFFS_start - 0x40200000;
+        uint32_t roundedSize = (size + FLASH_SECTOR_SIZE - 1) & (~(FLASH_SECTOR_SIZE - 1));
+        updateStartAddress = (updateEndAddress > roundedSize) ? (updateEndAddress - roundedSize) : 0;
+        if(updateStartAddress < currentSketchSize) {
+            _error = UPDATE_ERROR_SPACE;
+            return false;
+        }
+    } else if(command == U_SPIFFS) {
+        updateStartAddress = (uint32_t) (size_t) &_SPIFFS_start - 0x40200000;
+    } else {
+        return false;
+    }
+
+    _startAddress = updateStartAddress;
+    _currentAddress = _startAddress;
+    _size = size;
+    _bufferSize = FLASH_SECTOR_SIZE;
+    _buffer = new uint8_t[_bufferSize];
+    _command = command;
+    _md5.begin();
+    memset(&updateStats, 0, sizeof(updateStats));
+    return true;
+}
+
+bool UpdaterClass::setMD5(const char* expected_md5)
+{
+    if(strlen(expected_md5) != 32) {
+        return false;
+    }
+    _target_md5 = expected_md5;
+    return true;
+}
+
+bool UpdaterClass::end(bool evenIfRemaining)
+{
+    if(_size == 0) {
+        return false;
+    }
+    if(hasError() || (!isFinished() && !evenIfRemaining)) {
+        _reset();
+        return false;
+    }
+    if(evenIfRemaining) {
+        if(_bufferLen > 0) {
+            _writeBuffer();
+        }
+        _size = progress();
+    }
+
+    _md5.calculate();
+    if(_target_md5.length() && _target_md5 != _md5.toString()) {
+        _setError(UPDATE_ERROR_MD5);
+        _reset();
+        return false;
+    }
+
+    if(_command == U_FLASH) {
+        struct eboot_command ebcmd;
+        memset(&ebcmd, 0, sizeof(ebcmd));
+        ebcmd.action = ACTION_COPY_RAW;
+        ebcmd.args[0] = _startAddress;
+        ebcmd.args[1] = 0x00000;
+        ebcmd.args[2] = _size;
+        eboot_command_write(&ebcmd);
+    }
+
+    _reset();
+    return true;
+}
+
+bool UpdaterClass::_writeBuffer()
+{
+    bool eraseResult = true, writeResult = true;
+    if(_currentAddress % FLASH_SECTOR_SIZE == 0) {
+        yield();
+        uint64_t start = nowUs();
+        eraseResult = ESP.flashEraseSector(_currentAddress / FLASH_SECTOR_SIZE);
+        updateStats.eraseUs += nowUs() - start;
+        updateStats.sectors++;
+    }
+    if(eraseResult) {
+        yield();
+        uint64_t start = nowUs();
+        writeResult = ESP.flashWrite(_currentAddress, (uint32_t*) _buffer, (_bufferLen + 3) & ~3);
+        updateStats.writeUs += nowUs() - start;
+    }
+    if(!eraseResult || !writeResult) {
+        _currentAddress = (_startAddress + _size);
+        _setError(eraseResult ? UPDATE_ERROR_WRITE : UPDATE_ERROR_ERASE);
+        return false;
+    }
+    uint64_t start = nowUs();
+    _md5.add(_buffer, _bufferLen);
+    updateStats.md5Us += nowUs() - start;
+    _currentAddress += _bufferLen;
+    _bufferLen = 0;
+    return true;
+}
+
+size_t UpdaterClass::write(uint8_t* data, size_t len)
+{
+    if(hasError() || !isRunning()) {
+        return 0;
+    }
+    if(len > remaining()) {
+        _setError(UPDATE_ERROR_SPACE);
+        return 0;
+    }
+
+    size_t left = len;
+    while((_bufferLen + left) > _bufferSize) {
+        size_t toBuff = _bufferSize - _bufferLen;
+        memcpy(_buffer + _bufferLen, data + (len - left), toBuff);
+        _bufferLen += toBuff;
+        if(!_writeBuffer()) {
+            return len - left;
+        }
+        left -= toBuff;
+        yield();
+    }
+    memcpy(_buffer + _bufferLen, data + (len - left), left);
+    _bufferLen += left;
+    if(_bufferLen == remaining()) {
+        if(!_writeBuffer()) {
+            return len - left;
+        }
+    }
+    return len;
+}
+
+bool UpdaterClass::_verifyHeader(uint8_t data)
+{
+    if(_command == U_FLASH) {
+        if(data != 0xE9) {
+            _currentAddress = (_startAddress + _size);
+            _setError(UPDATE_ERROR_MAGIC_BYTE);
+            return false;
+        }
+        return true;
+    }
+    return _command == U_SPIFFS;
+}
+
+size_t UpdaterClass::writeStream(Stream& data)
+{
+    size_t written = 0;
+    size_t toRead = 0;
+    if(hasError() || !isRunning()) {
+        return 0;
+    }
+
+    if(!_verifyHeader(data.peek())) {
+        _reset();
+        return 0;
+    }
+
+    while(remaining()) {
+        size_t bytesToRead = _bufferSize - _bufferLen;
+        if(bytesToRead > remaining()) {
+            bytesToRead = remaining();
+        }
+        toRead = data.readBytes(_buffer + _bufferLen, bytesToRead);
+        if(toRead == 0) { // timeout
+            delay(100);
+            toRead = data.readBytes(_buffer + _bufferLen, bytesToRead);
+            if(toRead == 0) {
+                _currentAddress = (_startAddress + _size);
+                _setError(UPDATE_ERROR_STREAM);
+                _reset();
+                return written;
+            }
+        }
+        _bufferLen += toRead;
+        if((_bufferLen == remaining() || _bufferLen == _bufferSize) && !_writeBuffer()) {
+            return written;
+        }
+        written += toRead;
+        yield();
+    }
+    return written;
+}
+
+void UpdaterClass::printError(Print& out)
+{
+    out.printf_P(PSTR("ERROR[%u]: "), _error);
+    switch(_error) {
+    case UPDATE_ERROR_OK: out.println(F("No Error")); break;
+    case UPDATE_ERROR_WRITE: out.println(F("Flash Write Failed")); break;
+    case UPDATE_ERROR_ERASE: out.println(F("Flash Erase Failed")); break;
+    case UPDATE_ERROR_READ: out.println(F("Flash Read Failed")); break;
+    case UPDATE_ERROR_SPACE: out.println(F("Not Enough Space")); break;
+    case UPDATE_ERROR_SIZE: out.println(F("Bad Size Given")); break;
+    case UPDATE_ERROR_STREAM: out.println(F("Stream Read Timeout")); break;
+    case UPDATE_ERROR_MD5: out.println(F("MD5 Check Failed")); break;
+    case UPDATE_ERROR_MAGIC_BYTE: out.println(F("Magic byte is wrong, not 0xE9")); break;
+    default: out.println(F("UNKNOWN")); break;
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef HOST_DEBUG_H
+#define HOST_DEBUG_H
+
+// The debug output of the core is compiled out like in the release builds
+#define DEBUGV(...) do { } while(0)
+
+#endif // HOST_DEBUG_H
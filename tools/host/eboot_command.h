@@ -0,0 +1,34 @@
+#ifndef HOST_EBOOT_COMMAND_H
+#define HOST_EBOOT_COMMAND_H
+
+#include <stdint.h>
+
+// The command left to the bootloader in RTC user memory blocks 0-31, hostBoot() carries it out
+enum action_t {
+    ACTION_COPY_RAW = 0x00000001,
+    ACTION_LOAD_APP = 0xffffffff
+};
+
+#define EBOOT_MAGIC 0xeb001000
+#define EBOOT_MAGIC_MASK 0xfffff000
+
+struct eboot_command {
+    uint32_t magic;
+    enum action_t action;
+    uint32_t args[29];
+    uint32_t crc32;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int eboot_command_read(struct eboot_command* cmd);
+void eboot_command_write(struct eboot_command* cmd);
+void eboot_command_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_EBOOT_COMMAND_H
@@ -0,0 +1,7 @@
+#ifndef HOST_ETS_SYS_H
+#define HOST_ETS_SYS_H
+
+#include "c_types.h"
+#include "osapi.h"
+
+#endif // HOST_ETS_SYS_H
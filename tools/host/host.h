@@ -0,0 +1,182 @@
+/*
+  Controls of the host stand-in of the board, for the harness in tools/ota_host_test.cpp.
+
+  The flash is a 4 MB image with the NOR semantics of the SPI chip (a write can
+  only clear bits, an erase sets a sector to 0xff), the sketch is at 0 and the
+  SPIFFS area starts at 0x300000 like the 4M (1M SPIFFS) layout of the board.
+  The RTC user memory holds the eboot command and the records of the libraries,
+  it survives hostBoot() unless the board is powered up again.
+*/
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <user_interface.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#define HOST_FLASH_SIZE     0x400000
+#define HOST_SPIFFS_START   0x300000
+#define HOST_SPIFFS_END     0x3fb000
+#define APP_START_OFFSET    0x1000  // the sketch image follows the sector of eboot
+
+// Flash
+
+struct HostFlashStats {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+};
+
+uint8_t* hostFlash();
+HostFlashStats& hostFlashStats();
+// A worn cell: the bits of address read 0 after every erase and write from now on, 0 repairs it
+void hostFlashStuck(uint32_t address, uint8_t bits);
+
+// Where Update.write() spent its time since the last Update.begin(): the erases and the programming
+// of the flash model, and the MD5 on the CPU of the host, which is not modelled
+struct HostUpdateStats {
+    uint32_t sectors;
+    uint64_t eraseUs;
+    uint64_t writeUs;
+    uint64_t md5Us;
+};
+
+HostUpdateStats& hostUpdateStats();
+
+// Boot and power
+
+// Runs eboot: carries out the command in RTC memory, then the sketch starts with the given reset reason.
+// REASON_DEFAULT_RST is a power up: RTC memory and the RTC timer start from scratch
+void hostBoot(rst_reason reason);
+// ESP.restart() or system_restart() was called, cleared by hostBoot()
+bool hostRestartPending();
+// Microseconds of the last ESP.deepSleep(), 0 if the sketch did not sleep
+uint64_t hostDeepSleepUs();
+
+// Time
+
+// Lets time pass without running the sketch, like a deep sleep
+void hostAdvance(uint64_t us);
+// The virtual clock, what micros() reads without the wrap
+uint64_t hostNow();
+// Runs fn once the clock reaches us, from the next delay(), yield() or esp_yield() of the sketch.
+// The network delivers its frames this way; hostBoot() drops what is still pending
+void hostAt(uint64_t us, std::function<void()> fn);
+
+// Pins and sensors
+
+void hostSetPin(uint8_t pin, int level);
+void hostSetAnalog(int value);
+
+struct HostSensors {
+    float tempC;        // MCP9800 at 0x48
+    float lux;          // ISL29003 at 0x44
+    uint16_t soilRaw;   // MCP3221 at 0x4D, 12 bit
+};
+
+struct HostI2CStats {
+    uint32_t transactions;  // addressed transfers, acknowledged or not
+    uint32_t bytes;         // bytes on the bus, addresses included
+    uint32_t nacks;         // transfers to a device that is off or missing
+    uint32_t ledOn;         // times the bottom LED (PCA9536 IO0) was turned on
+};
+
+HostSensors& hostSensors();
+HostI2CStats& hostI2CStats();
+
+// Serial
+
+// What the sketch printed on Serial and Serial1, kept until the caller clears it
+std::string& hostSerialLog();
+
+// Network
+//
+// The board is 192.168.1.50 on a LAN with the host PC at 192.168.1.2 and the servers named
+// in hostListen(). The real WiFiClient, WiFiServer and WiFiUdp run over the lwIP of
+// tools/host/lwip.cpp: every frame takes its turn on the air, then arrives after the latency.
+
+struct HostLink {
+    uint32_t latencyUs;         // one way
+    uint32_t bytesPerSecond;    // of the air, shared by the frames of both directions
+    uint32_t udpQueue;          // bytes of datagrams lwIP holds for the sketch, the next ones are dropped
+};
+
+HostLink& hostLink();
+
+struct host_tcp;
+
+// The host end of a TCP connection with the board
+class HostSocket {
+public:
+    std::function<void(const std::string& data)> onData;    // a segment from the board
+    std::function<void(bool reset)> onClose;                // FIN or RST of the board, or the connection was refused
+
+    // Queued, it leaves as the receive window of the board allows
+    void send(const std::string& data);
+    // FIN after the queued data
+    void close();
+    // RST, the queued data is dropped
+    void abort();
+    // The board accepted and did not close or reset
+    bool connected() const;
+    // Bytes of send() not delivered to the board yet
+    size_t queued() const;
+
+private:
+    friend struct host_tcp;
+    HostSocket(host_tcp* tcp) : _tcp(tcp) {}
+    host_tcp* _tcp;
+};
+
+typedef std::shared_ptr<HostSocket> HostSocketPtr;
+
+// The address of a host: dotted, or the one given to a name at its first use. WiFi.hostByName() resolves the names
+IPAddress hostAddress(const char* host);
+// Connections of the board to host:port reach accept, the others are refused
+void hostListen(const char* host, uint16_t port, std::function<void(HostSocketPtr socket)> accept);
+// A connection of the host PC to a server of the board, refused if nothing listens on port
+HostSocketPtr hostConnect(uint16_t port);
+
+// A datagram from host:fromPort to the board, a broadcast or a group the board joined
+void hostUdpSend(const char* from, uint16_t fromPort, const char* to, uint16_t port, const std::string& data);
+// Datagrams of the board to host:port, host may be a group
+void hostUdpListen(const char* host, uint16_t port, std::function<void(const std::string& data, IPAddress from, uint16_t fromPort)> receive);
+
+// What a server sends back for a request: the whole response, the connection
+// is dropped after cutAt bytes of it, or closed after it unless keepAlive
+struct HostResponse {
+    std::string data;
+    size_t cutAt;
+    bool keepAlive;
+
+    HostResponse(const std::string& data = std::string()) : data(data), cutAt(std::string::npos), keepAlive(false) {}
+};
+
+// Called with the head of every request (request line and headers), the body of a GET is empty
+typedef std::function<HostResponse(const std::string& request)> HostHandler;
+
+struct HostNetStats {
+    uint32_t connections;   // accepted by the host or by the board
+    uint32_t requests;      // heads handled by hostServe()
+    uint64_t sent;          // TCP bytes from the board
+    uint64_t received;      // TCP bytes to the board
+    uint32_t segments;      // TCP segments from the board
+    uint32_t datagramsSent;
+    uint32_t datagramsReceived;
+    uint32_t datagramsDropped;  // over udpQueue
+    uint32_t pcbs;          // TCP connections lwIP holds for the sketch
+    uint32_t pbufs;         // allocated and not freed
+};
+
+// An HTTP/1.1 server on hostListen(): handler answers every request on the connection
+void hostServe(const char* host, uint16_t port, HostHandler handler);
+HostNetStats& hostNetStats();
+
+#endif // HOST_H
@@ -0,0 +1,17 @@
+#ifndef HOST_CENCODE_H
+#define HOST_CENCODE_H
+
+// Base64 of libb64 in the core, without the line breaks
+#define base64_encode_expected_len(n) ((((4 * (n)) / 3) + 3) & ~3)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int base64_encode_chars(const char* plaintext_in, int length_in, char* code_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_CENCODE_H
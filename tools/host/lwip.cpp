@@ -0,0 +1,953 @@
+/*
+  The lwIP of the board on the host: TCP and UDP between the pcbs of WiFiClient,
+  WiFiServer and UdpContext and the HostSocket and datagram handlers of host.h.
+
+  One link carries every frame: a frame waits for the air to be free, takes its
+  size over bytesPerSecond, then arrives latencyUs later through hostAt(), so the
+  callbacks of lwIP run from delay(), yield() and esp_yield() of the sketch like
+  they run from the SDK on the board. The host acks every segment as it arrives,
+  it sends no more than the window the board advertised: TCP_WND less what the
+  sketch has not tcp_recved() yet. Like lwIP, tcp_recved() sends a window
+  update only once the window opened by TCP_WND_UPDATE_THRESHOLD, smaller ones
+  go with the next ack. A segment of the host reaches the sketch as one pbuf,
+  like a pbuf of the pool of the SDK.
+
+  The pcbs are kept for the whole run, ClientContext::_error() still clears the
+  callbacks of a pcb lwIP has let go of.
+*/
+
+#include <Arduino.h>
+
+#include "lwip/opt.h"
+#include "lwip/ip.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "lwip/igmp.h"
+#include "lwip/inet.h"
+#include "lwip/netif.h"
+
+#include "host.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+#define HOST_ADDR(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+#define BOARD_ADDR          HOST_ADDR(192, 168, 1, 50)
+#define PC_ADDR             HOST_ADDR(192, 168, 1, 2)
+#define SUBNET_BROADCAST    HOST_ADDR(192, 168, 1, 255)
+
+#define FRAME_OVERHEAD      34      // MAC header and FCS of every frame
+#define TCP_HEADERS         40
+#define UDP_HEADERS         (IP_HLEN + UDP_HLEN)
+#define PBUF_HEADROOM       44      // link, IP and UDP headers in front of the payload
+#define PBUF_FLAG_UDP_RX    0x80    // a datagram held for the sketch, it counts against udpQueue
+#define POLL_INTERVAL_US    500000  // the slow timer of lwIP
+
+static HostLink link = { 1000, 2000000, 8192 };
+static HostNetStats netStats;
+static uint64_t airFreeUs;
+static uint32_t udpRxBytes;
+static uint16_t nextPort = 49152;
+static uint8_t nextHost = 100;
+static std::map<std::string, uint32_t> names;
+
+const ip_addr_t ip_addr_any = { IPADDR_ANY };
+const ip_addr_t ip_addr_broadcast = { IPADDR_NONE };
+
+static struct netif station = { NULL, { BOARD_ADDR }, { HOST_ADDR(255, 255, 255, 0) }, { HOST_ADDR(192, 168, 1, 1) }, 0 };
+struct netif* netif_default = &station;
+
+HostLink& hostLink()
+{
+    return link;
+}
+
+HostNetStats& hostNetStats()
+{
+    return netStats;
+}
+
+// Queues a frame carrying size bytes, the time it arrives
+static uint64_t transmit(size_t size)
+{
+    uint64_t start = std::max(hostNow(), airFreeUs);
+    airFreeUs = start + (size + FRAME_OVERHEAD) * 1000000ULL / link.bytesPerSecond;
+    return airFreeUs + link.latencyUs;
+}
+
+IPAddress hostAddress(const char* host)
+{
+    IPAddress address;
+    if(address.fromString(host)) {
+        return address;
+    }
+    auto name = names.find(host);
+    if(name == names.end()) {
+        name = names.insert(std::make_pair(std::string(host), HOST_ADDR(192, 168, 1, nextHost++))).first;
+    }
+    return IPAddress(name->second);
+}
+
+// WiFi.hostByName(), the names that have an address only
+bool hostResolve(const char* host, IPAddress& address)
+{
+    if(address.fromString(host)) {
+        return true;
+    }
+    auto name = names.find(host);
+    if(name == names.end()) {
+        return false;
+    }
+    address = name->second;
+    return true;
+}
+
+extern "C" struct netif* ip_route(ip_addr_t* dest)
+{
+    (void) dest;
+    return &station;
+}
+
+///////////
+// pbuf  //
+///////////
+
+extern "C" struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
+{
+    (void) layer;
+    struct pbuf* p = (struct pbuf*) malloc(sizeof(struct pbuf) + PBUF_HEADROOM + length);
+    if(!p) {
+        return NULL;
+    }
+    p->next = NULL;
+    p->payload = (uint8_t*) (p + 1) + PBUF_HEADROOM;
+    p->tot_len = length;
+    p->len = length;
+    p->type = type;
+    p->flags = 0;
+    p->ref = 1;
+    netStats.pbufs++;
+    return p;
+}
+
+extern "C" u8_t pbuf_free(struct pbuf* p)
+{
+    u8_t count = 0;
+    while(p && --p->ref == 0) {
+        struct pbuf* next = p->next;
+        if(p->flags & PBUF_FLAG_UDP_RX) {
+            udpRxBytes -= p->len;
+        }
+        free(p);
+        netStats.pbufs--;
+        ++count;
+        p = next;
+    }
+    return count;
+}
+
+extern "C" void pbuf_ref(struct pbuf* p)
+{
+    if(p) {
+        ++p->ref;
+    }
+}
+
+extern "C" void pbuf_cat(struct pbuf* head, struct pbuf* tail)
+{
+    struct pbuf* p = head;
+    for(; p->next; p = p->next) {
+        p->tot_len += tail->tot_len;
+    }
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}
+
+extern "C" u16_t pbuf_copy_partial(struct pbuf* p, void* dataptr, u16_t len, u16_t offset)
+{
+    u16_t copied = 0;
+    for(; p && copied < len; p = p->next) {
+        if(offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        u16_t size = std::min((u16_t) (p->len - offset), (u16_t) (len - copied));
+        memcpy((uint8_t*) dataptr + copied, (uint8_t*) p->payload + offset, size);
+        copied += size;
+        offset = 0;
+    }
+    return copied;
+}
+
+//////////
+// TCP  //
+//////////
+
+struct host_tcp {
+    tcp_pcb* pcb;           // the board end
+    HostSocketPtr socket;   // the host end
+    bool live;              // the sketch holds pcb: accepted or connected, not closed, aborted or reset
+    bool boardEstablished;
+    bool hostEstablished;
+    bool boardDead;         // the board reset the connection or got a reset, nothing more leaves or arrives there
+    bool hostDead;
+
+    // board to host
+    std::vector<std::string> unsent;    // segments of tcp_write() not output yet
+    size_t unacked;
+    bool finQueued;         // tcp_close(), the FIN follows the queued data
+    bool finSent;
+    bool boardFinArrived;
+
+    // host to board
+    std::string out;        // HostSocket::send() not transmitted yet, from outPos on
+    size_t outPos;
+    size_t inFlight;        // transmitted and not acked
+    size_t window;          // the last window the board advertised
+    size_t unread;          // delivered to the sketch, not tcp_recved() yet
+    size_t advertised;      // the last window the board sent
+    bool hostFinQueued;
+    bool hostFinSent;
+
+    static host_tcp* open(tcp_pcb* pcb)
+    {
+        host_tcp* t = new host_tcp();
+        t->pcb = pcb;
+        t->socket = HostSocketPtr(new HostSocket(t));
+        t->window = TCP_WND;
+        t->advertised = TCP_WND;
+        pcb->host = t;
+        return t;
+    }
+};
+
+static std::vector<host_tcp*> connections;
+static std::map<uint16_t, tcp_pcb*> listeners;
+static std::map<std::pair<uint32_t, uint16_t>, std::function<void(HostSocketPtr)>> hostListeners;
+static bool polling;
+
+static void output(host_tcp* t);
+static void pump(host_tcp* t);
+
+static void hold(host_tcp* t)
+{
+    t->live = true;
+    netStats.pcbs++;
+}
+
+// lwIP lets go of the pcb, the sketch must not use it any more
+static void release(host_tcp* t)
+{
+    if(t->live) {
+        t->live = false;
+        netStats.pcbs--;
+    }
+}
+
+// A RST reaches the host
+static void resetHost(host_tcp* t)
+{
+    if(t->hostDead) {
+        return;
+    }
+    t->hostDead = true;
+    if(t->socket->onClose) {
+        t->socket->onClose(true);
+    }
+}
+
+// A RST reaches the board, the error callback gets ERR_RST
+static void resetBoard(host_tcp* t)
+{
+    if(t->boardDead) {
+        return;
+    }
+    t->boardDead = true;
+    t->pcb->state = CLOSED;
+    bool live = t->live;
+    release(t);
+    if(live && t->pcb->errf) {
+        t->pcb->errf(t->pcb->callback_arg, ERR_RST);
+    }
+}
+
+// The board sends a RST
+static void abortBoard(host_tcp* t)
+{
+    t->boardDead = true;
+    t->pcb->state = CLOSED;
+    release(t);
+    hostAt(transmit(TCP_HEADERS), [t]() { resetHost(t); });
+}
+
+// An ack of the host reaches the board
+static void acked(host_tcp* t, size_t size)
+{
+    if(t->boardDead) {
+        return;
+    }
+    t->unacked -= size;
+    t->pcb->snd_buf += size;
+    t->pcb->snd_queuelen--;
+    if(t->live && t->pcb->sent) {
+        t->pcb->sent(t->pcb->callback_arg, t->pcb, size);
+    }
+    output(t);
+}
+
+// A segment of the board reaches the host
+static void segmentArrived(host_tcp* t, const std::string& data)
+{
+    if(t->hostDead) {
+        hostAt(transmit(TCP_HEADERS), [t]() { resetBoard(t); });
+        return;
+    }
+    netStats.sent += data.size();
+    if(t->socket->onData) {
+        t->socket->onData(data);
+    }
+    size_t size = data.size();
+    hostAt(transmit(TCP_HEADERS), [t, size]() { acked(t, size); });
+}
+
+static void finArrived(host_tcp* t)
+{
+    if(t->hostDead || t->boardFinArrived) {
+        return;
+    }
+    t->boardFinArrived = true;
+    if(t->socket->onClose) {
+        t->socket->onClose(false);
+    }
+}
+
+static void output(host_tcp* t)
+{
+    while(!t->boardDead && t->boardEstablished && !t->unsent.empty()) {
+        tcp_pcb* pcb = t->pcb;
+        std::string& segment = t->unsent.front();
+        bool nagle = !tcp_nagle_disabled(pcb) && t->unacked && t->unsent.size() == 1 && segment.size() < TCP_MSS
+            && !t->finQueued && pcb->snd_buf && pcb->snd_queuelen < TCP_SND_QUEUELEN;
+        if(nagle) {
+            break;
+        }
+        std::string data;
+        data.swap(segment);
+        t->unsent.erase(t->unsent.begin());
+        t->unacked += data.size();
+        netStats.segments++;
+        hostAt(transmit(TCP_HEADERS + data.size()), [t, data]() { segmentArrived(t, data); });
+    }
+    if(!t->boardDead && t->boardEstablished && t->finQueued && !t->finSent && t->unsent.empty()) {
+        t->finSent = true;
+        hostAt(transmit(TCP_HEADERS), [t]() { finArrived(t); });
+    }
+}
+
+// A segment of the host reaches the board
+static void deliver(host_tcp* t, const std::string& data)
+{
+    if(t->boardDead) {
+        return;
+    }
+    size_t size = data.size();
+    if(t->live && t->pcb->recv) {
+        netStats.received += size;
+        t->unread += size;
+        struct pbuf* p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+        memcpy(p->payload, data.data(), size);
+        t->pcb->recv(t->pcb->callback_arg, t->pcb, p, ERR_OK);
+        if(t->boardDead) {
+            return;
+        }
+    } // else tcp_recv_null(): acked and dropped
+    size_t window = TCP_WND - std::min(t->unread, (size_t) TCP_WND);
+    t->advertised = window;
+    hostAt(transmit(TCP_HEADERS), [t, size, window]() {
+        if(t->hostDead) {
+            return;
+        }
+        t->inFlight -= size;
+        t->window = window;
+        pump(t);
+    });
+}
+
+// The FIN of the host reaches the board
+static void hostFinArrived(host_tcp* t)
+{
+    if(t->boardDead) {
+        return;
+    }
+    tcp_pcb* pcb = t->pcb;
+    if(!t->live) {
+        return; // both ends closed
+    }
+    if(pcb->state == ESTABLISHED) {
+        pcb->state = CLOSE_WAIT;
+    }
+    if(pcb->recv) {
+        pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK);
+    } else {
+        tcp_close(pcb);
+    }
+}
+
+static void pump(host_tcp* t)
+{
+    while(!t->hostDead && t->hostEstablished && t->outPos < t->out.size()) {
+        size_t usable = t->window > t->inFlight ? t->window - t->inFlight : 0;
+        size_t size = std::min(std::min(t->out.size() - t->outPos, (size_t) TCP_MSS), usable);
+        if(!size) {
+            break;
+        }
+        std::string data = t->out.substr(t->outPos, size);
+        t->outPos += size;
+        t->inFlight += size;
+        hostAt(transmit(TCP_HEADERS + size), [t, data]() { deliver(t, data); });
+    }
+    if(t->outPos == t->out.size()) {
+        t->out.clear();
+        t->outPos = 0;
+    }
+    if(!t->hostDead && t->hostEstablished && t->out.empty() && t->hostFinQueued && !t->hostFinSent) {
+        t->hostFinSent = true;
+        hostAt(transmit(TCP_HEADERS), [t]() { hostFinArrived(t); });
+    }
+}
+
+static void pollTick()
+{
+    polling = false;
+    for(size_t i = 0; i < connections.size(); ++i) {
+        host_tcp* t = connections[i];
+        tcp_pcb* pcb = t->pcb;
+        if(!t->live || !pcb->poll) {
+            continue;
+        }
+        polling = true;
+        if(++pcb->polltmr >= pcb->pollinterval) {
+            pcb->polltmr = 0;
+            pcb->poll(pcb->callback_arg, pcb);
+            output(t);
+        }
+    }
+    if(polling) {
+        hostAt(hostNow() + POLL_INTERVAL_US, pollTick);
+    }
+}
+
+extern "C" struct tcp_pcb* tcp_new(void)
+{
+    tcp_pcb* pcb = (tcp_pcb*) calloc(1, sizeof(tcp_pcb));
+    pcb->state = CLOSED;
+    pcb->prio = TCP_PRIO_NORMAL;
+    pcb->ttl = 255;
+    pcb->snd_buf = TCP_SND_BUF;
+    pcb->keep_idle = 7200000;
+    pcb->keep_intvl = 75000;
+    pcb->keep_cnt = 9;
+    return pcb;
+}
+
+extern "C" void tcp_arg(struct tcp_pcb* pcb, void* arg)
+{
+    pcb->callback_arg = arg;
+}
+
+extern "C" void tcp_accept(struct tcp_pcb* pcb, tcp_accept_fn accept)
+{
+    pcb->accept = accept;
+}
+
+extern "C" void tcp_recv(struct tcp_pcb* pcb, tcp_recv_fn recv)
+{
+    pcb->recv = recv;
+}
+
+extern "C" void tcp_sent(struct tcp_pcb* pcb, tcp_sent_fn sent)
+{
+    pcb->sent = sent;
+}
+
+extern "C" void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err)
+{
+    pcb->errf = err;
+}
+
+extern "C" void tcp_poll(struct tcp_pcb* pcb, tcp_poll_fn poll, u8_t interval)
+{
+    pcb->poll = poll;
+    pcb->pollinterval = interval;
+    if(poll && !polling) {
+        polling = true;
+        hostAt(hostNow() + POLL_INTERVAL_US, pollTick);
+    }
+}
+
+extern "C" void tcp_accepted(struct tcp_pcb* pcb)
+{
+    (void) pcb;
+}
+
+extern "C" void tcp_setprio(struct tcp_pcb* pcb, u8_t prio)
+{
+    pcb->prio = prio;
+}
+
+extern "C" void tcp_recved(struct tcp_pcb* pcb, u16_t len)
+{
+    host_tcp* t = pcb->host;
+    if(!t || t->boardDead) {
+        return;
+    }
+    t->unread -= std::min((size_t) len, t->unread);
+    size_t window = TCP_WND - t->unread;
+    if(window - t->advertised < TCP_WND_UPDATE_THRESHOLD) {
+        return; // goes with the next ack
+    }
+    t->advertised = window;
+    hostAt(transmit(TCP_HEADERS), [t, window]() {
+        if(!t->hostDead) {
+            t->window = window;
+            pump(t);
+        }
+    });
+}
+
+extern "C" err_t tcp_bind(struct tcp_pcb* pcb, ip_addr_t* ipaddr, u16_t port)
+{
+    if(!port) {
+        port = nextPort++;
+    }
+    auto listener = listeners.find(port);
+    if(listener != listeners.end() && listener->second != pcb && !(pcb->so_options & listener->second->so_options & SOF_REUSEADDR)) {
+        return ERR_USE;
+    }
+    pcb->local_ip.addr = ipaddr ? ipaddr->addr : IPADDR_ANY;
+    pcb->local_port = port;
+    return ERR_OK;
+}
+
+extern "C" struct tcp_pcb* tcp_listen(struct tcp_pcb* pcb)
+{
+    pcb->state = LISTEN;
+    listeners[pcb->local_port] = pcb;
+    return pcb;
+}
+
+static void unlisten(struct tcp_pcb* pcb)
+{
+    auto listener = listeners.find(pcb->local_port);
+    if(listener != listeners.end() && listener->second == pcb) {
+        listeners.erase(listener);
+    }
+    pcb->state = CLOSED;
+}
+
+extern "C" err_t tcp_connect(struct tcp_pcb* pcb, ip_addr_t* ipaddr, u16_t port, tcp_connected_fn connected)
+{
+    if(pcb->state != CLOSED || pcb->host) {
+        return ERR_ISCONN;
+    }
+    if(!pcb->local_port) {
+        pcb->local_port = nextPort++;
+    }
+    pcb->local_ip = station.ip_addr;
+    pcb->remote_ip = *ipaddr;
+    pcb->remote_port = port;
+    pcb->state = SYN_SENT;
+    pcb->connected = connected;
+
+    host_tcp* t = host_tcp::open(pcb);
+    connections.push_back(t);
+    hold(t);
+    std::pair<uint32_t, uint16_t> to(ipaddr->addr, port);
+    hostAt(transmit(TCP_HEADERS), [t, to]() { // the SYN at the host
+        if(t->boardDead) {
+            return;
+        }
+        auto listener = hostListeners.find(to);
+        if(listener == hostListeners.end()) {
+            t->hostDead = true;
+            hostAt(transmit(TCP_HEADERS), [t]() { resetBoard(t); });
+            return;
+        }
+        netStats.connections++;
+        t->hostEstablished = true;
+        listener->second(t->socket);
+        hostAt(transmit(TCP_HEADERS), [t]() { // the SYN-ACK at the board
+            if(t->boardDead) {
+                return;
+            }
+            t->boardEstablished = true;
+            t->pcb->state = ESTABLISHED;
+            if(t->pcb->connected) {
+                t->pcb->connected(t->pcb->callback_arg, t->pcb, ERR_OK);
+            }
+            output(t);
+        });
+        pump(t);
+    });
+    return ERR_OK;
+}
+
+extern "C" err_t tcp_write(struct tcp_pcb* pcb, const void* dataptr, u16_t len, u8_t apiflags)
+{
+    (void) apiflags; // always copied
+    host_tcp* t = pcb->host;
+    if(!t || !t->live || t->finQueued || (pcb->state != ESTABLISHED && pcb->state != CLOSE_WAIT)) {
+        return ERR_CONN;
+    }
+    if(len > pcb->snd_buf) {
+        return ERR_MEM;
+    }
+    size_t room = t->unsent.empty() ? 0 : TCP_MSS - t->unsent.back().size();
+    size_t segments = len > room ? (len - room + TCP_MSS - 1) / TCP_MSS : 0;
+    if(pcb->snd_queuelen + segments > TCP_SND_QUEUELEN) {
+        return ERR_MEM;
+    }
+    const char* data = (const char*) dataptr;
+    size_t left = len;
+    size_t size = std::min(room, left);
+    if(size) {
+        t->unsent.back().append(data, size);
+        data += size;
+        left -= size;
+    }
+    while(left) {
+        size = std::min(left, (size_t) TCP_MSS);
+        t->unsent.push_back(std::string(data, size));
+        data += size;
+        left -= size;
+    }
+    pcb->snd_buf -= len;
+    pcb->snd_queuelen += segments;
+    return ERR_OK;
+}
+
+extern "C" err_t tcp_output(struct tcp_pcb* pcb)
+{
+    if(pcb->host) {
+        output(pcb->host);
+    }
+    return ERR_OK;
+}
+
+extern "C" void tcp_abort(struct tcp_pcb* pcb)
+{
+    host_tcp* t = pcb->host;
+    if(pcb->state == LISTEN || !t) {
+        unlisten(pcb);
+        return;
+    }
+    if(t->boardDead) {
+        return;
+    }
+    tcp_err_fn errf = t->live ? pcb->errf : NULL;
+    abortBoard(t);
+    if(errf) {
+        errf(pcb->callback_arg, ERR_ABRT);
+    }
+}
+
+extern "C" err_t tcp_close(struct tcp_pcb* pcb)
+{
+    host_tcp* t = pcb->host;
+    if(pcb->state == LISTEN || !t) {
+        unlisten(pcb);
+        return ERR_OK;
+    }
+    if(t->boardDead || !t->live) {
+        return ERR_OK;
+    }
+    if(!t->boardEstablished || t->unread) {
+        // lwIP resets a connection closed with received data left unread
+        abortBoard(t);
+        return ERR_OK;
+    }
+    pcb->state = pcb->state == CLOSE_WAIT ? LAST_ACK : FIN_WAIT_1;
+    t->finQueued = true;
+    release(t);
+    output(t);
+    return ERR_OK;
+}
+
+////////////////
+// HostSocket //
+////////////////
+
+void HostSocket::send(const std::string& data)
+{
+    if(_tcp->hostDead || _tcp->hostFinQueued) {
+        return;
+    }
+    _tcp->out += data;
+    pump(_tcp);
+}
+
+void HostSocket::close()
+{
+    if(_tcp->hostDead || _tcp->hostFinQueued) {
+        return;
+    }
+    _tcp->hostFinQueued = true;
+    pump(_tcp);
+}
+
+void HostSocket::abort()
+{
+    if(_tcp->hostDead) {
+        return;
+    }
+    host_tcp* t = _tcp;
+    t->hostDead = true;
+    t->out.clear();
+    t->outPos = 0;
+    hostAt(transmit(TCP_HEADERS), [t]() { resetBoard(t); });
+}
+
+bool HostSocket::connected() const
+{
+    return _tcp->hostEstablished && !_tcp->hostDead && !_tcp->boardFinArrived;
+}
+
+size_t HostSocket::queued() const
+{
+    return _tcp->out.size() - _tcp->outPos;
+}
+
+void hostListen(const char* host, uint16_t port, std::function<void(HostSocketPtr socket)> accept)
+{
+    hostListeners[std::make_pair((uint32_t) hostAddress(host), port)] = accept;
+}
+
+HostSocketPtr hostConnect(uint16_t port)
+{
+    tcp_pcb* pcb = tcp_new();
+    pcb->local_ip = station.ip_addr;
+    pcb->local_port = port;
+    pcb->remote_ip.addr = PC_ADDR;
+    pcb->remote_port = nextPort++;
+    host_tcp* t = host_tcp::open(pcb);
+    connections.push_back(t);
+
+    hostAt(transmit(TCP_HEADERS), [t, port]() { // the SYN at the board
+        auto listener = listeners.find(port);
+        if(listener == listeners.end() || !listener->second->accept) {
+            t->boardDead = true;
+            hostAt(transmit(TCP_HEADERS), [t]() { resetHost(t); });
+            return;
+        }
+        tcp_pcb* server = listener->second;
+        t->pcb->state = SYN_RCVD;
+        hostAt(transmit(TCP_HEADERS), [t, server]() { // the SYN-ACK at the host
+            if(t->hostDead) {
+                return;
+            }
+            t->hostEstablished = true;
+            hostAt(transmit(TCP_HEADERS), [t, server]() { // the ACK at the board
+                if(t->boardDead) {
+                    return;
+                }
+                if(server->state != LISTEN) {
+                    abortBoard(t);
+                    return;
+                }
+                t->boardEstablished = true;
+                t->pcb->state = ESTABLISHED;
+                hold(t);
+                netStats.connections++;
+                if(server->accept(server->callback_arg, t->pcb, ERR_OK) != ERR_OK && !t->boardDead) {
+                    abortBoard(t);
+                }
+            });
+            pump(t);
+        });
+    });
+    return t->socket;
+}
+
+//////////
+// UDP  //
+//////////
+
+struct HostUdpListener {
+    uint32_t addr;
+    uint16_t port;
+    std::function<void(const std::string& data, IPAddress from, uint16_t fromPort)> receive;
+};
+
+// Never freed: the responder of ESP8266mDNS is a global, it removes its pcb after the statics of this file
+static std::vector<udp_pcb*>& udpPcbs = *new std::vector<udp_pcb*>();
+static std::vector<HostUdpListener> udpListeners;
+static std::multiset<uint32_t> groups;
+
+extern "C" struct udp_pcb* udp_new(void)
+{
+    udp_pcb* pcb = (udp_pcb*) calloc(1, sizeof(udp_pcb));
+    pcb->ttl = 255;
+    udpPcbs.push_back(pcb);
+    return pcb;
+}
+
+extern "C" void udp_remove(struct udp_pcb* pcb)
+{
+    udpPcbs.erase(std::find(udpPcbs.begin(), udpPcbs.end(), pcb));
+    free(pcb);
+}
+
+extern "C" err_t udp_bind(struct udp_pcb* pcb, ip_addr_t* ipaddr, u16_t port)
+{
+    if(!port) {
+        port = nextPort++;
+    }
+    for(udp_pcb* other : udpPcbs) {
+        if(other != pcb && other->local_port == port && !(pcb->so_options & other->so_options & SOF_REUSEADDR)) {
+            return ERR_USE;
+        }
+    }
+    pcb->local_ip.addr = ipaddr ? ipaddr->addr : IPADDR_ANY;
+    pcb->local_port = port;
+    return ERR_OK;
+}
+
+extern "C" err_t udp_connect(struct udp_pcb* pcb, ip_addr_t* ipaddr, u16_t port)
+{
+    if(!pcb->local_port && udp_bind(pcb, IP_ADDR_ANY, 0) != ERR_OK) {
+        return ERR_USE;
+    }
+    pcb->remote_ip = *ipaddr;
+    pcb->remote_port = port;
+    return ERR_OK;
+}
+
+extern "C" void udp_disconnect(struct udp_pcb* pcb)
+{
+    pcb->remote_ip.addr = IPADDR_ANY;
+    pcb->remote_port = 0;
+}
+
+extern "C" void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* recv_arg)
+{
+    pcb->recv = recv;
+    pcb->recv_arg = recv_arg;
+}
+
+extern "C" err_t udp_sendto(struct udp_pcb* pcb, struct pbuf* p, ip_addr_t* dst_ip, u16_t dst_port)
+{
+    if(!pcb->local_port && udp_bind(pcb, IP_ADDR_ANY, 0) != ERR_OK) {
+        return ERR_USE;
+    }
+    std::string data(p->tot_len, '\0');
+    pbuf_copy_partial(p, &data[0], p->tot_len, 0);
+    uint32_t to = dst_ip->addr;
+    uint16_t from = pcb->local_port;
+    netStats.datagramsSent++;
+    hostAt(transmit(UDP_HEADERS + data.size()), [data, to, dst_port, from]() {
+        std::vector<HostUdpListener> receivers = udpListeners;
+        for(HostUdpListener& listener : receivers) {
+            if(listener.port == dst_port && (listener.addr == to || to == IPADDR_NONE || to == SUBNET_BROADCAST)) {
+                listener.receive(data, IPAddress(BOARD_ADDR), from);
+            }
+        }
+    });
+    return ERR_OK;
+}
+
+extern "C" err_t udp_send(struct udp_pcb* pcb, struct pbuf* p)
+{
+    return udp_sendto(pcb, p, &pcb->remote_ip, pcb->remote_port);
+}
+
+extern "C" err_t igmp_joingroup(ip_addr_t* ifaddr, ip_addr_t* groupaddr)
+{
+    (void) ifaddr;
+    groups.insert(groupaddr->addr);
+    return ERR_OK;
+}
+
+extern "C" err_t igmp_leavegroup(ip_addr_t* ifaddr, ip_addr_t* groupaddr)
+{
+    (void) ifaddr;
+    auto group = groups.find(groupaddr->addr);
+    if(group == groups.end()) {
+        return ERR_VAL;
+    }
+    groups.erase(group);
+    return ERR_OK;
+}
+
+// A datagram reaches the board, the first pcb bound to its port gets it
+static void datagramArrived(uint32_t from, uint16_t fromPort, uint32_t to, uint16_t port, const std::string& data)
+{
+    ip_addr_t dest = { to };
+    if(to != BOARD_ADDR && to != IPADDR_NONE && to != SUBNET_BROADCAST && !(ip_addr_ismulticast(&dest) && groups.count(to))) {
+        return;
+    }
+    udp_pcb* pcb = NULL;
+    for(udp_pcb* bound : udpPcbs) {
+        if(bound->local_port == port && (bound->local_ip.addr == IPADDR_ANY || bound->local_ip.addr == to)) {
+            pcb = bound;
+            break;
+        }
+    }
+    if(!pcb || !pcb->recv) {
+        return;
+    }
+    if(udpRxBytes + data.size() > link.udpQueue) {
+        netStats.datagramsDropped++;
+        return;
+    }
+    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, data.size(), PBUF_RAM);
+    memcpy(p->payload, data.data(), data.size());
+    p->flags |= PBUF_FLAG_UDP_RX;
+    udpRxBytes += data.size();
+
+    ip_hdr* iphdr = (ip_hdr*) ((uint8_t*) p->payload - UDP_HLEN - IP_HLEN);
+    memset(iphdr, 0, IP_HLEN);
+    iphdr->src.addr = from;
+    iphdr->dest.addr = to;
+    udp_hdr* udphdr = (udp_hdr*) ((uint8_t*) p->payload - UDP_HLEN);
+    udphdr->src = htons(fromPort);
+    udphdr->dest = htons(port);
+    udphdr->len = htons(UDP_HLEN + data.size());
+    udphdr->chksum = 0;
+
+    netStats.datagramsReceived++;
+    ip_addr_t source = { from };
+    pcb->recv(pcb->recv_arg, pcb, p, &source, fromPort);
+}
+
+void hostUdpSend(const char* from, uint16_t fromPort, const char* to, uint16_t port, const std::string& data)
+{
+    uint32_t source = hostAddress(from);
+    uint32_t dest = hostAddress(to);
+    hostAt(transmit(UDP_HEADERS + data.size()), [source, fromPort, dest, port, data]() {
+        datagramArrived(source, fromPort, dest, port, data);
+    });
+}
+
+void hostUdpListen(const char* host, uint16_t port, std::function<void(const std::string& data, IPAddress from, uint16_t fromPort)> receive)
+{
+    HostUdpListener listener = { hostAddress(host), port, receive };
+    udpListeners.push_back(listener);
+}
+
+// core.cpp, at every boot: the connections and the servers of the sketch are gone, the
+// hosts are not told. The UDP pcbs stay with the objects that hold them across boots
+void hostNetBoot()
+{
+    for(host_tcp* t : connections) {
+        t->boardDead = true;
+        t->pcb->state = CLOSED;
+        release(t);
+    }
+    for(auto& listener : listeners) {
+        listener.second->state = CLOSED;
+    }
+    listeners.clear();
+    polling = false;
+}
@@ -0,0 +1,20 @@
+#ifndef HOST_LWIP_IGMP_H
+#define HOST_LWIP_IGMP_H
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The groups the board receives datagrams of, the interface address is not looked at
+err_t igmp_joingroup(ip_addr_t* ifaddr, ip_addr_t* groupaddr);
+err_t igmp_leavegroup(ip_addr_t* ifaddr, ip_addr_t* groupaddr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_LWIP_IGMP_H
@@ -0,0 +1,20 @@
+#ifndef HOST_LWIP_INET_H
+#define HOST_LWIP_INET_H
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+
+// INADDR_NONE is left to the IPAddress of the core
+#define INADDR_ANY          IPADDR_ANY
+#define INADDR_BROADCAST    IPADDR_NONE
+
+// The byte order helpers of lwIP, the system headers are not included
+static inline u16_t lwip_htons(u16_t n) { return (u16_t) ((n << 8) | (n >> 8)); }
+static inline u32_t lwip_htonl(u32_t n) { return __builtin_bswap32(n); }
+
+#define htons(x) lwip_htons(x)
+#define ntohs(x) lwip_htons(x)
+#define htonl(x) lwip_htonl(x)
+#define ntohl(x) lwip_htonl(x)
+
+#endif // HOST_LWIP_INET_H
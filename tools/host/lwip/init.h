@@ -0,0 +1,8 @@
+#ifndef HOST_LWIP_INIT_H
+#define HOST_LWIP_INIT_H
+
+#define LWIP_VERSION_MAJOR  1
+#define LWIP_VERSION_MINOR  4
+#define LWIP_VERSION_REVISION 0
+
+#endif // HOST_LWIP_INIT_H
@@ -0,0 +1,38 @@
+#ifndef HOST_LWIP_IP_H
+#define HOST_LWIP_IP_H
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+
+#define IP_HLEN 20
+
+#define SOF_REUSEADDR   0x04U
+#define SOF_KEEPALIVE   0x08U
+#define SOF_BROADCAST   0x20U
+
+// In front of the UDP header in a received pbuf, UdpContext reads the addresses of the datagram there
+struct ip_hdr {
+    u16_t _v_hl_tos;
+    u16_t _len;
+    u16_t _id;
+    u16_t _offset;
+    u8_t _ttl;
+    u8_t _proto;
+    u16_t _chksum;
+    ip_addr_t src;
+    ip_addr_t dest;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct netif* ip_route(ip_addr_t* dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_LWIP_IP_H
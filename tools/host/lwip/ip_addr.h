@@ -0,0 +1,49 @@
+#ifndef HOST_LWIP_IP_ADDR_H
+#define HOST_LWIP_IP_ADDR_H
+
+#include "lwip/opt.h"
+
+// In network order like IPAddress: the first byte of the address is the lowest of addr on the host
+struct ip_addr {
+    u32_t addr;
+};
+typedef struct ip_addr ip_addr_t;
+
+// wifi_get_ip_info() of the SDK
+struct ip_info {
+    struct ip_addr ip;
+    struct ip_addr netmask;
+    struct ip_addr gw;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const ip_addr_t ip_addr_any;
+extern const ip_addr_t ip_addr_broadcast;
+
+#ifdef __cplusplus
+}
+#endif
+
+#define IP_ADDR_ANY         ((ip_addr_t*) &ip_addr_any)
+#define IP_ADDR_BROADCAST   ((ip_addr_t*) &ip_addr_broadcast)
+#define IPADDR_ANY          ((u32_t) 0x00000000UL)
+#define IPADDR_NONE         ((u32_t) 0xffffffffUL)
+
+#define IP4_ADDR(ipaddr, a, b, c, d) \
+    (ipaddr)->addr = ((u32_t) ((d) & 0xff) << 24) | ((u32_t) ((c) & 0xff) << 16) | ((u32_t) ((b) & 0xff) << 8) | (u32_t) ((a) & 0xff)
+#define ip4_addr1(ipaddr) (((const u8_t*) (ipaddr))[0])
+#define ip4_addr2(ipaddr) (((const u8_t*) (ipaddr))[1])
+#define ip4_addr3(ipaddr) (((const u8_t*) (ipaddr))[2])
+#define ip4_addr4(ipaddr) (((const u8_t*) (ipaddr))[3])
+
+#define ip_addr_copy(dest, src) ((dest).addr = (src).addr)
+#define ip_addr_set(dest, src) ((dest)->addr = ((src) == NULL ? 0 : (src)->addr))
+#define ip_addr_cmp(addr1, addr2) ((addr1)->addr == (addr2)->addr)
+#define ip_addr_isany(addr1) ((addr1) == NULL || (addr1)->addr == IPADDR_ANY)
+#define ip_addr_ismulticast(addr1) (((addr1)->addr & 0xf0UL) == 0xe0UL)
+#define ip_addr_netcmp(addr1, addr2, mask) (((addr1)->addr & (mask)->addr) == ((addr2)->addr & (mask)->addr))
+
+#endif // HOST_LWIP_IP_ADDR_H
@@ -0,0 +1,10 @@
+#ifndef HOST_LWIP_MEM_H
+#define HOST_LWIP_MEM_H
+
+#include "lwip/opt.h"
+#include <mem.h>
+
+#define mem_malloc(size) os_malloc(size)
+#define mem_free(ptr) os_free(ptr)
+
+#endif // HOST_LWIP_MEM_H
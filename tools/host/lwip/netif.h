@@ -0,0 +1,26 @@
+#ifndef HOST_LWIP_NETIF_H
+#define HOST_LWIP_NETIF_H
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+
+struct netif {
+    struct netif* next;
+    ip_addr_t ip_addr;
+    ip_addr_t netmask;
+    ip_addr_t gw;
+    u8_t num;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The station interface, the only one on the host
+extern struct netif* netif_default;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_LWIP_NETIF_H
@@ -0,0 +1,31 @@
+/*
+  Host stand-in of the lwIP 1.4 of the core: the types, options and calls that
+  ClientContext, UdpContext and the libraries use. The stack is tools/host/lwip.cpp.
+*/
+
+#ifndef HOST_LWIP_OPT_H
+#define HOST_LWIP_OPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8_t;
+typedef int8_t s8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+typedef uintptr_t mem_ptr_t;
+
+// LWIP_ERR_T of the core, WiFiServer hands its accept callback over as long (void*, tcp_pcb*, long)
+typedef long err_t;
+
+// lwipopts.h of the core
+#define TCP_MSS                 1460
+#define TCP_WND                 (4 * TCP_MSS)
+#define TCP_WND_UPDATE_THRESHOLD (TCP_WND / 4)
+#define TCP_SND_BUF             (2 * TCP_MSS)
+#define TCP_SND_QUEUELEN        ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+#define LWIP_IGMP               1
+
+#endif // HOST_LWIP_OPT_H
@@ -0,0 +1,45 @@
+#ifndef HOST_LWIP_PBUF_H
+#define HOST_LWIP_PBUF_H
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+
+typedef enum {
+    PBUF_TRANSPORT,
+    PBUF_IP,
+    PBUF_LINK,
+    PBUF_RAW
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM,
+    PBUF_ROM,
+    PBUF_REF,
+    PBUF_POOL
+} pbuf_type;
+
+struct pbuf {
+    struct pbuf* next;
+    void* payload;
+    u16_t tot_len;
+    u16_t len;
+    u8_t type;
+    u8_t flags;
+    u16_t ref;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t pbuf_free(struct pbuf* p);
+void pbuf_ref(struct pbuf* p);
+void pbuf_cat(struct pbuf* head, struct pbuf* tail);
+u16_t pbuf_copy_partial(struct pbuf* p, void* dataptr, u16_t len, u16_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_LWIP_PBUF_H
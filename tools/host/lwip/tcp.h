@@ -0,0 +1,108 @@
+#ifndef __LWIP_TCP_H__
+#define __LWIP_TCP_H__  // the guard of lwIP, wl_definitions.h leaves out its copy of the states after it
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/ip.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+enum tcp_state {
+    CLOSED      = 0,
+    LISTEN      = 1,
+    SYN_SENT    = 2,
+    SYN_RCVD    = 3,
+    ESTABLISHED = 4,
+    FIN_WAIT_1  = 5,
+    FIN_WAIT_2  = 6,
+    CLOSE_WAIT  = 7,
+    CLOSING     = 8,
+    LAST_ACK    = 9,
+    TIME_WAIT   = 10
+};
+
+#define TCP_PRIO_MIN    1
+#define TCP_PRIO_NORMAL 64
+#define TCP_PRIO_MAX    127
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+#define TF_NODELAY  ((u8_t) 0x40U)
+
+struct tcp_pcb;
+struct host_tcp;
+
+typedef err_t (*tcp_accept_fn)(void* arg, struct tcp_pcb* newpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void* arg, struct tcp_pcb* tpcb, struct pbuf* p, err_t err);
+typedef err_t (*tcp_sent_fn)(void* arg, struct tcp_pcb* tpcb, u16_t len);
+typedef err_t (*tcp_poll_fn)(void* arg, struct tcp_pcb* tpcb);
+typedef void (*tcp_err_fn)(void* arg, err_t err);
+typedef err_t (*tcp_connected_fn)(void* arg, struct tcp_pcb* tpcb, err_t err);
+
+struct tcp_pcb {
+    ip_addr_t local_ip;
+    ip_addr_t remote_ip;
+    u8_t so_options;
+    u8_t tos;
+    u8_t ttl;
+    u8_t prio;
+    enum tcp_state state;
+    u16_t local_port;
+    u16_t remote_port;
+    u8_t flags;
+
+    u16_t snd_buf;          // free room of the send buffer
+    u16_t snd_queuelen;     // segments queued, sent or not
+
+    u32_t keep_idle;
+    u32_t keep_intvl;
+    u8_t keep_cnt;
+
+    u8_t polltmr;
+    u8_t pollinterval;
+
+    void* callback_arg;
+    tcp_accept_fn accept;
+    tcp_recv_fn recv;
+    tcp_sent_fn sent;
+    tcp_poll_fn poll;
+    tcp_err_fn errf;
+    tcp_connected_fn connected;
+
+    struct host_tcp* host;  // the connection in tools/host/lwip.cpp
+};
+
+#define tcp_nagle_disable(pcb)  ((pcb)->flags |= TF_NODELAY)
+#define tcp_nagle_enable(pcb)   ((pcb)->flags &= (u8_t) ~TF_NODELAY)
+#define tcp_nagle_disabled(pcb) (((pcb)->flags & TF_NODELAY) != 0)
+#define tcp_sndbuf(pcb)         ((pcb)->snd_buf)
+#define tcp_sndqueuelen(pcb)    ((pcb)->snd_queuelen)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tcp_pcb* tcp_new(void);
+void tcp_arg(struct tcp_pcb* pcb, void* arg);
+void tcp_accept(struct tcp_pcb* pcb, tcp_accept_fn accept);
+void tcp_recv(struct tcp_pcb* pcb, tcp_recv_fn recv);
+void tcp_sent(struct tcp_pcb* pcb, tcp_sent_fn sent);
+void tcp_poll(struct tcp_pcb* pcb, tcp_poll_fn poll, u8_t interval);
+void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err);
+void tcp_accepted(struct tcp_pcb* pcb);
+void tcp_recved(struct tcp_pcb* pcb, u16_t len);
+err_t tcp_bind(struct tcp_pcb* pcb, ip_addr_t* ipaddr, u16_t port);
+err_t tcp_connect(struct tcp_pcb* pcb, ip_addr_t* ipaddr, u16_t port, tcp_connected_fn connected);
+struct tcp_pcb* tcp_listen(struct tcp_pcb* pcb);
+void tcp_abort(struct tcp_pcb* pcb);
+err_t tcp_close(struct tcp_pcb* pcb);
+err_t tcp_write(struct tcp_pcb* pcb, const void* dataptr, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb* pcb);
+void tcp_setprio(struct tcp_pcb* pcb, u8_t prio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LWIP_TCP_H__
@@ -0,0 +1,58 @@
+#ifndef HOST_LWIP_UDP_H
+#define HOST_LWIP_UDP_H
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/ip.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+#define UDP_HLEN 8
+
+struct udp_hdr {
+    u16_t src;
+    u16_t dest;
+    u16_t len;
+    u16_t chksum;
+};
+
+struct udp_pcb;
+
+typedef void (*udp_recv_fn)(void* arg, struct udp_pcb* pcb, struct pbuf* p, ip_addr_t* addr, u16_t port);
+
+struct udp_pcb {
+    ip_addr_t local_ip;
+    ip_addr_t remote_ip;
+    u8_t so_options;
+    u8_t tos;
+    u8_t ttl;
+    u8_t flags;
+    u16_t local_port;
+    u16_t remote_port;
+    ip_addr_t multicast_ip;
+    u8_t mcast_ttl;
+    udp_recv_fn recv;
+    void* recv_arg;
+};
+
+#define udp_set_multicast_netif_addr(pcb, ip)   ((pcb)->multicast_ip = (ip))
+#define udp_set_multicast_ttl(pcb, value)       ((pcb)->mcast_ttl = (value))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct udp_pcb* udp_new(void);
+void udp_remove(struct udp_pcb* pcb);
+err_t udp_bind(struct udp_pcb* pcb, ip_addr_t* ipaddr, u16_t port);
+err_t udp_connect(struct udp_pcb* pcb, ip_addr_t* ipaddr, u16_t port);
+void udp_disconnect(struct udp_pcb* pcb);
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* recv_arg);
+err_t udp_sendto(struct udp_pcb* pcb, struct pbuf* p, ip_addr_t* dst_ip, u16_t dst_port);
+err_t udp_send(struct udp_pcb* pcb, struct pbuf* p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_LWIP_UDP_H
@@ -0,0 +1,12 @@
+#ifndef HOST_MEM_H
+#define HOST_MEM_H
+
+#include <stdlib.h>
+
+// The heap of the SDK
+#define os_malloc(size) malloc(size)
+#define os_zalloc(size) calloc(1, size)
+#define os_realloc(ptr, size) realloc(ptr, size)
+#define os_free(ptr) free(ptr)
+
+#endif // HOST_MEM_H
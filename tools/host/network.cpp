@@ -0,0 +1,426 @@
+/*
+  IPAddress, the station part of WiFi, the HTTPClient of the core, and the
+  HTTP servers of the harness. WiFiClient, WiFiServer and WiFiUdp are the real
+  ones of ESP8266WiFi over the lwIP of tools/host/lwip.cpp.
+*/
+
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#include <user_interface.h>
+
+#include "lwip/netif.h"
+
+#include "host.h"
+
+#include <string>
+
+// lwip.cpp, the names hostAddress() gave an address to
+bool hostResolve(const char* host, IPAddress& address);
+
+// A response goes out as it is, the next request on the connection is answered after it
+void hostServe(const char* host, uint16_t port, HostHandler handler)
+{
+    hostListen(host, port, [handler](HostSocketPtr socket) {
+        std::shared_ptr<std::string> request = std::make_shared<std::string>();
+        HostSocket* connection = socket.get(); // the socket owns the callback
+        socket->onData = [connection, request, handler](const std::string& data) {
+            request->append(data);
+            size_t end;
+            while(connection->connected() && (end = request->find("\r\n\r\n")) != std::string::npos) {
+                hostNetStats().requests++;
+                HostResponse response = handler(request->substr(0, end + 4));
+                request->erase(0, end + 4);
+                bool keepAlive = response.keepAlive;
+                if(response.cutAt < response.data.size()) {
+                    response.data.resize(response.cutAt);
+                    keepAlive = false;
+                }
+                connection->send(response.data);
+                if(!keepAlive) {
+                    connection->close();
+                    request->clear();
+                }
+            }
+        };
+    });
+}
+
+///////////////
+// IPAddress //
+///////////////
+
+const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+IPAddress::IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth)
+{
+    _address.bytes[0] = first;
+    _address.bytes[1] = second;
+    _address.bytes[2] = third;
+    _address.bytes[3] = fourth;
+}
+
+bool IPAddress::fromString(const char* address)
+{
+    unsigned int b[4];
+    char end;
+    if(sscanf(address, "%u.%u.%u.%u%c", &b[0], &b[1], &b[2], &b[3], &end) != 4) {
+        return false;
+    }
+    for(int i = 0; i < 4; ++i) {
+        if(b[i] > 255) {
+            return false;
+        }
+        _address.bytes[i] = b[i];
+    }
+    return true;
+}
+
+size_t IPAddress::printTo(Print& p) const
+{
+    return p.print(toString());
+}
+
+String IPAddress::toString() const
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _address.bytes[0], _address.bytes[1], _address.bytes[2], _address.bytes[3]);
+    return String(buf);
+}
+
+//////////
+// WiFi //
+//////////
+
+static const uint8_t staMac[6] = { 0x5c, 0xcf, 0x7f, 0xa1, 0xb2, 0xc3 };
+
+ESP8266WiFiGenericClass::ESP8266WiFiGenericClass()
+{
+}
+
+bool ESP8266WiFiGenericClass::mode(WiFiMode_t)
+{
+    return true;
+}
+
+bool ESP8266WiFiGenericClass::setSleepMode(WiFiSleepType_t)
+{
+    return true;
+}
+
+wl_status_t ESP8266WiFiSTAClass::begin(const char*, const char*, int32_t, const uint8_t*, bool)
+{
+    return WL_CONNECTED;
+}
+
+uint8_t ESP8266WiFiSTAClass::waitForConnectResult()
+{
+    return WL_CONNECTED;
+}
+
+IPAddress ESP8266WiFiSTAClass::localIP()
+{
+    return IPAddress(192, 168, 1, 50);
+}
+
+uint8_t* ESP8266WiFiSTAClass::macAddress(uint8_t* mac)
+{
+    memcpy(mac, staMac, sizeof(staMac));
+    return mac;
+}
+
+uint8_t* ESP8266WiFiAPClass::softAPmacAddress(uint8_t* mac)
+{
+    memcpy(mac, staMac, sizeof(staMac));
+    mac[0] |= 0x02; // locally administered, like the SDK
+    return mac;
+}
+
+static String macString(const uint8_t* mac)
+{
+    char macStr[18] = { 0 };
+    sprintf(macStr, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return String(macStr);
+}
+
+String ESP8266WiFiSTAClass::macAddress()
+{
+    uint8_t mac[6];
+    return macString(macAddress(mac));
+}
+
+String ESP8266WiFiAPClass::softAPmacAddress()
+{
+    uint8_t mac[6];
+    return macString(softAPmacAddress(mac));
+}
+
+int ESP8266WiFiGenericClass::hostByName(const char* aHostname, IPAddress& aResult)
+{
+    return hostByName(aHostname, aResult, 10000);
+}
+
+int ESP8266WiFiGenericClass::hostByName(const char* aHostname, IPAddress& aResult, uint32_t timeout_ms)
+{
+    (void) timeout_ms;
+    return hostResolve(aHostname, aResult) ? 1 : 0;
+}
+
+// The station never loses its connection on the host, the handlers are not called
+struct WiFiEventHandlerOpaque {
+};
+
+WiFiEventHandler ESP8266WiFiGenericClass::onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)>)
+{
+    return std::make_shared<WiFiEventHandlerOpaque>();
+}
+
+WiFiEventHandler ESP8266WiFiGenericClass::onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)>)
+{
+    return std::make_shared<WiFiEventHandlerOpaque>();
+}
+
+extern "C" uint8 wifi_get_opmode(void)
+{
+    return STATION_MODE;
+}
+
+extern "C" bool wifi_get_ip_info(uint8 if_index, struct ip_info* info)
+{
+    memset(info, 0, sizeof(*info));
+    if(if_index == STATION_IF) {
+        info->ip = netif_default->ip_addr;
+        info->netmask = netif_default->netmask;
+        info->gw = netif_default->gw;
+    }
+    return true;
+}
+
+ESP8266WiFiClass WiFi;
+
+////////////////
+// HTTPClient //
+////////////////
+
+HTTPClient::HTTPClient()
+    : _tcp(NULL), _port(80), _reuse(false), _useHTTP10(false), _tcpTimeout(HTTPCLIENT_DEFAULT_TCP_TIMEOUT)
+    , _userAgent(F("ESP8266HTTPClient")), _returnCode(0), _size(-1), _canReuse(false)
+{
+}
+
+HTTPClient::~HTTPClient()
+{
+    delete _tcp;
+}
+
+bool HTTPClient::begin(String url)
+{
+    if(!url.startsWith("http://")) {
+        return false;
+    }
+    url.remove(0, 7);
+    int slash = url.indexOf('/');
+    String host = slash >= 0 ? url.substring(0, slash) : url;
+    _uri = slash >= 0 ? url.substring(slash) : String("/");
+    int colon = host.indexOf(':');
+    _port = colon >= 0 ? host.substring(colon + 1).toInt() : 80;
+    _host = colon >= 0 ? host.substring(0, colon) : host;
+    return true;
+}
+
+bool HTTPClient::begin(String url, String httpsFingerprint)
+{
+    (void) url;
+    (void) httpsFingerprint;
+    return false; // https is not simulated
+}
+
+bool HTTPClient::begin(String host, uint16_t port, String uri)
+{
+    _host = host;
+    _port = port;
+    _uri = uri;
+    return true;
+}
+
+bool HTTPClient::begin(String host, uint16_t port, String uri, String httpsFingerprint)
+{
+    (void) host;
+    (void) port;
+    (void) uri;
+    (void) httpsFingerprint;
+    return false;
+}
+
+void HTTPClient::end(void)
+{
+    if(connected()) {
+        while(_tcp->available() > 0) {
+            _tcp->read();
+        }
+        if(!_reuse || !_canReuse) {
+            _tcp->stop();
+        }
+    }
+}
+
+bool HTTPClient::connected()
+{
+    return _tcp && (_tcp->connected() || _tcp->available() > 0);
+}
+
+void HTTPClient::setTimeout(uint16_t timeout)
+{
+    _tcpTimeout = timeout;
+    if(connected()) {
+        _tcp->setTimeout(timeout);
+    }
+}
+
+void HTTPClient::addHeader(const String& name, const String& value, bool first, bool replace)
+{
+    (void) replace;
+    String header = name + ": " + value + "\r\n";
+    if(first) {
+        _headers = header + _headers;
+    } else {
+        _headers += header;
+    }
+}
+
+void HTTPClient::collectHeaders(const char* headerKeys[], const size_t headerKeysCount)
+{
+    _currentHeaders.clear();
+    for(size_t i = 0; i < headerKeysCount; ++i) {
+        RequestArgument header;
+        header.key = headerKeys[i];
+        _currentHeaders.push_back(header);
+    }
+}
+
+String HTTPClient::header(const char* name)
+{
+    for(size_t i = 0; i < _currentHeaders.size(); ++i) {
+        if(_currentHeaders[i].key.equalsIgnoreCase(name)) {
+            return _currentHeaders[i].value;
+        }
+    }
+    return String();
+}
+
+bool HTTPClient::hasHeader(const char* name)
+{
+    return header(name).length() > 0;
+}
+
+bool HTTPClient::connect(void)
+{
+    if(connected()) {
+        while(_tcp->available() > 0) {
+            _tcp->read();
+        }
+        return true;
+    }
+    if(!_tcp) {
+        _tcp = new WiFiClient();
+    }
+    if(!_tcp->connect(_host.c_str(), _port)) {
+        return false;
+    }
+    _tcp->setTimeout(_tcpTimeout);
+    return connected();
+}
+
+int HTTPClient::GET()
+{
+    if(!connect()) {
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+
+    String request = String("GET ") + _uri + (_useHTTP10 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
+    request += String("Host: ") + _host + (_port != 80 ? String(":") + String(_port) : String()) + "\r\n";
+    request += String("User-Agent: ") + _userAgent + "\r\n";
+    request += (_reuse && !_useHTTP10) ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if(!_useHTTP10) {
+        request += "Accept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+    }
+    request += _headers + "\r\n";
+    if(_tcp->write((const uint8_t*) request.c_str(), request.length()) != request.length()) {
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+    return handleHeaderResponse();
+}
+
+int HTTPClient::handleHeaderResponse()
+{
+    _returnCode = 0;
+    _size = -1;
+    _canReuse = _reuse && !_useHTTP10;
+    for(size_t i = 0; i < _currentHeaders.size(); ++i) {
+        _currentHeaders[i].value = String();
+    }
+
+    unsigned long lastDataTime = millis();
+    while(connected()) {
+        if(_tcp->available() <= 0) {
+            if(millis() - lastDataTime > _tcpTimeout) {
+                return HTTPC_ERROR_READ_TIMEOUT;
+            }
+            delay(0);
+            yield();
+            continue;
+        }
+        String line = _tcp->readStringUntil('\n');
+        line.trim();
+        lastDataTime = millis();
+
+        if(line.startsWith("HTTP/1.")) {
+            _returnCode = line.substring(9, line.indexOf(' ', 9)).toInt();
+            if(line.startsWith("HTTP/1.0")) {
+                _canReuse = false;
+            }
+        } else if(line.indexOf(':') > 0) {
+            String name = line.substring(0, line.indexOf(':'));
+            String value = line.substring(line.indexOf(':') + 1);
+            value.trim();
+            if(name.equalsIgnoreCase("Content-Length")) {
+                _size = value.toInt();
+            }
+            if(name.equalsIgnoreCase("Connection") && value.equalsIgnoreCase("close")) {
+                _canReuse = false;
+            }
+            for(size_t i = 0; i < _currentHeaders.size(); ++i) {
+                if(_currentHeaders[i].key.equalsIgnoreCase(name)) {
+                    _currentHeaders[i].value = value;
+                }
+            }
+        }
+
+        if(line == "") {
+            return _returnCode ? _returnCode : HTTPC_ERROR_NO_HTTP_SERVER;
+        }
+    }
+    return HTTPC_ERROR_CONNECTION_LOST;
+}
+
+WiFiClient* HTTPClient::getStreamPtr(void)
+{
+    return connected() ? _tcp : NULL;
+}
+
+String HTTPClient::errorToString(int error)
+{
+    switch(error) {
+    case HTTPC_ERROR_CONNECTION_REFUSED: return F("connection refused");
+    case HTTPC_ERROR_SEND_HEADER_FAILED: return F("send header failed");
+    case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return F("send payload failed");
+    case HTTPC_ERROR_NOT_CONNECTED: return F("not connected");
+    case HTTPC_ERROR_CONNECTION_LOST: return F("connection lost");
+    case HTTPC_ERROR_NO_STREAM: return F("no stream");
+    case HTTPC_ERROR_NO_HTTP_SERVER: return F("no HTTP server");
+    case HTTPC_ERROR_TOO_LESS_RAM: return F("too less ram");
+    case HTTPC_ERROR_ENCODING: return F("Transfer-Encoding not supported");
+    case HTTPC_ERROR_STREAM_WRITE: return F("Stream write error");
+    case HTTPC_ERROR_READ_TIMEOUT: return F("read Timeout");
+    }
+    return String();
+}
@@ -0,0 +1,38 @@
+#ifndef HOST_OSAPI_H
+#define HOST_OSAPI_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define os_strcpy strcpy
+#define os_strncpy strncpy
+#define os_strcat strcat
+#define os_strcmp strcmp
+#define os_strncmp strncmp
+#define os_strstr strstr
+#define os_memcmp memcmp
+
+typedef void os_timer_func_t(void* timer_arg);
+
+// Software timers of the SDK, they fire from delay() and yield() once their time has come
+typedef struct _os_timer_t {
+    struct _os_timer_t* timer_next;
+    uint32_t timer_expire;
+    uint32_t timer_period;
+    os_timer_func_t* timer_func;
+    void* timer_arg;
+} os_timer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void os_timer_setfn(os_timer_t* ptimer, os_timer_func_t* pfunction, void* parg);
+void os_timer_arm(os_timer_t* ptimer, uint32_t milliseconds, bool repeat_flag);
+void os_timer_disarm(os_timer_t* ptimer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_OSAPI_H
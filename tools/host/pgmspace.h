@@ -0,0 +1,6 @@
+#ifndef HOST_PGMSPACE_H
+#define HOST_PGMSPACE_H
+
+#include <Arduino.h>
+
+#endif // HOST_PGMSPACE_H
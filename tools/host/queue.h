@@ -0,0 +1,6 @@
+#ifndef HOST_QUEUE_H
+#define HOST_QUEUE_H
+
+// The SDK list macros, ESP8266WiFiType.h includes this header without using it
+
+#endif // HOST_QUEUE_H
@@ -0,0 +1,58 @@
+#ifndef HOST_USER_INTERFACE_H
+#define HOST_USER_INTERFACE_H
+
+#include <stdint.h>
+#include "c_types.h"
+#include "lwip/ip_addr.h"
+
+#define STATION_IF      0x00
+#define SOFTAP_IF       0x01
+
+#define NULL_MODE       0x00
+#define STATION_MODE    0x01
+#define SOFTAP_MODE     0x02
+#define STATIONAP_MODE  0x03
+
+enum rst_reason {
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST = 1,
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6
+};
+
+struct rst_info {
+    uint32 reason;
+    uint32 exccause;
+    uint32 epc1;
+    uint32 epc2;
+    uint32 epc3;
+    uint32 excvaddr;
+    uint32 depc;
+};
+
+enum sleep_type {
+    NONE_SLEEP_T = 0,
+    LIGHT_SLEEP_T,
+    MODEM_SLEEP_T
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32 system_get_rtc_time(void);
+uint32 system_rtc_clock_cali_proc(void);
+void system_restart(void);
+uint32 system_get_chip_id(void);
+bool wifi_set_sleep_type(enum sleep_type type);
+uint8 wifi_get_opmode(void);
+bool wifi_get_ip_info(uint8 if_index, struct ip_info* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_USER_INTERFACE_H
@@ -0,0 +1,225 @@
+/*
+  TwoWire over stand-ins of the I2C chips of the Agrumino R3. They are powered
+  by the MOSFET on GPIO15: while it is low they do not acknowledge, when it goes
+  high they start from their power up state.
+
+    MCP9800  0x48  temperature, register pointer, config reads 0 at power up
+    ISL29003 0x44  light, command registers 0x00/0x01, data LSB/MSB at 0x02/0x03
+    MCP3221  0x4D  12 bit ADC of the soil sensor, no registers
+    PCA9536  0x41  GPIO expander: input, output, polarity, config, the LED is on IO0
+*/
+
+#include <Wire.h>
+
+#include "host.h"
+
+#define PIN_POWER   15
+#define BUS_BYTE_US 90 // 9 clocks at 100 kHz
+
+static HostSensors sensors = { 21.5f, 320.0f, 2600 };
+static HostI2CStats i2cStats;
+
+HostSensors& hostSensors()
+{
+    return sensors;
+}
+
+HostI2CStats& hostI2CStats()
+{
+    return i2cStats;
+}
+
+struct Chips {
+    bool powered;
+    uint8_t tempPointer;
+    uint8_t tempConfig;
+    uint8_t luxPointer;
+    uint8_t luxCommand[2];
+    uint8_t gpioPointer;
+    uint8_t gpio[4]; // input, output, polarity, config
+};
+
+static Chips chips;
+
+// Power up state when the MOSFET turns on, the registers are lost when it turns off
+void hostPinChanged(uint8_t pin, uint8_t level)
+{
+    if(pin != PIN_POWER) {
+        return;
+    }
+    memset(&chips, 0, sizeof(chips));
+    chips.powered = (level == HIGH);
+    chips.gpio[1] = 0xff; // outputs high
+    chips.gpio[3] = 0xff; // all inputs
+}
+
+static bool ledOn()
+{
+    return !(chips.gpio[3] & 0x01) && (chips.gpio[1] & 0x01);
+}
+
+static bool present(uint8_t address)
+{
+    return address == 0x48 || address == 0x44 || address == 0x4D || address == 0x41;
+}
+
+static void chipWrite(uint8_t address, const uint8_t* data, size_t len)
+{
+    if(!len) {
+        return;
+    }
+    switch(address) {
+    case 0x48:
+        chips.tempPointer = data[0] & 0x03;
+        if(len > 1 && chips.tempPointer == 1) {
+            chips.tempConfig = data[1];
+        }
+        break;
+    case 0x44:
+        chips.luxPointer = data[0];
+        for(size_t i = 1; i < len && chips.luxPointer < 2; ++i) {
+            chips.luxCommand[chips.luxPointer++] = data[i];
+        }
+        break;
+    case 0x41: {
+        bool wasOn = ledOn();
+        chips.gpioPointer = data[0] & 0x03;
+        if(len > 1 && chips.gpioPointer > 0) {
+            chips.gpio[chips.gpioPointer] = data[1];
+        }
+        if(!wasOn && ledOn()) {
+            i2cStats.ledOn++;
+        }
+        break;
+    }
+    }
+}
+
+static size_t chipRead(uint8_t address, uint8_t* data, size_t len)
+{
+    switch(address) {
+    case 0x48: {
+        // ambient temperature, 12 bit two's complement left aligned in 16 bits
+        int16_t temp = (int16_t) lroundf(sensors.tempC * 16) << 4;
+        uint8_t regs[2] = { (uint8_t) (temp >> 8), (uint8_t) temp };
+        if(chips.tempPointer == 1) {
+            regs[0] = chips.tempConfig;
+        }
+        for(size_t i = 0; i < len; ++i) {
+            data[i] = regs[i % 2];
+        }
+        return len;
+    }
+    case 0x44: {
+        uint16_t count = (uint16_t) std::min(65535.0f, sensors.lux * 65536.0f / 64000.0f);
+        uint8_t regs[4] = { chips.luxCommand[0], chips.luxCommand[1], (uint8_t) count, (uint8_t) (count >> 8) };
+        for(size_t i = 0; i < len; ++i) {
+            data[i] = regs[(chips.luxPointer + i) & 0x03];
+        }
+        return len;
+    }
+    case 0x4D:
+        for(size_t i = 0; i < len; ++i) {
+            data[i] = (i % 2) ? (uint8_t) sensors.soilRaw : (uint8_t) ((sensors.soilRaw >> 8) & 0x0f);
+        }
+        return len;
+    case 0x41: {
+        // inputs read the driven level of the outputs, the others float high
+        chips.gpio[0] = ((chips.gpio[1] & ~chips.gpio[3]) | chips.gpio[3]) ^ chips.gpio[2];
+        for(size_t i = 0; i < len; ++i) {
+            data[i] = chips.gpio[chips.gpioPointer];
+        }
+        return len;
+    }
+    }
+    return 0;
+}
+
+TwoWire::TwoWire()
+    : _frequency(100000), _txAddress(0), _txLength(0), _rxIndex(0), _rxLength(0)
+{
+}
+
+void TwoWire::begin(int sda, int scl)
+{
+    (void) sda;
+    (void) scl;
+    begin();
+}
+
+void TwoWire::begin()
+{
+    flush();
+}
+
+void TwoWire::setClock(uint32_t frequency)
+{
+    _frequency = frequency;
+}
+
+void TwoWire::_busTime(size_t bytes)
+{
+    i2cStats.transactions++;
+    i2cStats.bytes += bytes;
+    delayMicroseconds(bytes * BUS_BYTE_US * 100000 / _frequency);
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    _txAddress = address;
+    _txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+    if(_txLength >= BUFFER_LENGTH) {
+        setWriteError();
+        return 0;
+    }
+    _txBuffer[_txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t quantity)
+{
+    for(size_t i = 0; i < quantity; ++i) {
+        if(!write(data[i])) {
+            return i;
+        }
+    }
+    return quantity;
+}
+
+// 0: success, 2: address not acknowledged, like the core
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+    (void) sendStop;
+    size_t length = _txLength;
+    _txLength = 0;
+    if(!chips.powered || !present(_txAddress)) {
+        _busTime(1);
+        i2cStats.nacks++;
+        return 2;
+    }
+    _busTime(1 + length);
+    chipWrite(_txAddress, _txBuffer, length);
+    return 0;
+}
+
+size_t TwoWire::requestFrom(uint8_t address, size_t size, bool sendStop)
+{
+    (void) sendStop;
+    size = std::min(size, (size_t) BUFFER_LENGTH);
+    _rxIndex = 0;
+    _rxLength = 0;
+    if(!chips.powered || !present(address)) {
+        _busTime(1);
+        i2cStats.nacks++;
+        return 0;
+    }
+    _busTime(1 + size);
+    _rxLength = chipRead(address, _rxBuffer, size);
+    return _rxLength;
+}
+
+TwoWire Wire;
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""
+Compressed OTA images (see LzssDecoder.h for the format).
+
+  ota_compress.py [-w window_bits] [-l lookahead_bits] image.bin image.bin.z
+
+The body is a heatshrink bit stream, the device needs 2^window_bits bytes
+of heap to decode it. The x-MD5 header (httpUpdate) and the MD5 sent in the
+ArduinoOTA invitation are the MD5 of image.bin, not of the compressed file.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"ESPZ"
+MAX_CANDIDATES = 16
+
+
+class BitWriter(object):
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def put(self, value, count):
+        self.bits = (self.bits << count) | value
+        self.count += count
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.bits >> self.count) & 0xff)
+        self.bits &= (1 << self.count) - 1
+
+    def flush(self):
+        if self.count:
+            self.out.append((self.bits << (8 - self.count)) & 0xff)
+            self.count = 0
+        return bytes(self.out)
+
+
+def compress(data, window_bits, lookahead_bits):
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    # a backref costs 1 + w + l bits, a literal 9
+    min_len = (1 + window_bits + lookahead_bits) // 9 + 1
+    chains = {}
+    bits = BitWriter()
+    pos = 0
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        key = data[pos:pos + 3]
+        for cand in reversed(chains.get(key, ())):
+            dist = pos - cand
+            if dist > window:
+                break
+            length = 0
+            while length < max_len and pos + length < len(data) and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_dist = length, dist
+                if length == max_len:
+                    break
+        if best_len >= min_len:
+            bits.put(0, 1)
+            bits.put(best_dist - 1, window_bits)
+            bits.put(best_len - 1, lookahead_bits)
+            step = best_len
+        else:
+            bits.put(1, 1)
+            bits.put(data[pos], 8)
+            step = 1
+        for p in range(pos, pos + step):
+            chain = chains.setdefault(data[p:p + 3], [])
+            chain.append(p)
+            if len(chain) > MAX_CANDIDATES:
+                del chain[0]
+        pos += step
+    header = MAGIC + struct.pack("<IBB", len(data), window_bits, lookahead_bits)
+    return header + bits.flush()
+
+
+def decompress(blob):
+    if blob[:4] != MAGIC:
+        raise ValueError("not a compressed image")
+    size, window_bits, lookahead_bits = struct.unpack_from("<IBB", blob, 4)
+    mask = (1 << window_bits) - 1
+    window = bytearray(1 << window_bits)
+    out = bytearray()
+    stream = blob[10:]
+    pos = [0, 0]  # byte, bit
+
+    def get(count):
+        value = 0
+        for _ in range(count):
+            byte = stream[pos[0]]
+            value = (value << 1) | ((byte >> (7 - pos[1])) & 1)
+            pos[1] += 1
+            if pos[1] == 8:
+                pos[0] += 1
+                pos[1] = 0
+        return value
+
+    while len(out) < size:
+        if get(1):
+            c = get(8)
+            window[len(out) & mask] = c
+            out.append(c)
+        else:
+            index = get(window_bits) + 1
+            count = get(lookahead_bits) + 1
+            for _ in range(count):
+                c = window[(len(out) - index) & mask]
+                window[len(out) & mask] = c
+                out.append(c)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compress an OTA image")
+    parser.add_argument("-w", "--window", type=int, default=11, choices=range(4, 13))
+    parser.add_argument("-l", "--lookahead", type=int, default=4)
+    parser.add_argument("image")
+    parser.add_argument("output")
+    args = parser.parse_args()
+    if not 3 <= args.lookahead < args.window:
+        parser.error("lookahead must be at least 3 and smaller than window")
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    blob = compress(data, args.window, args.lookahead)
+    if decompress(blob) != data:
+        raise RuntimeError("compressed image does not decode")
+    with open(args.output, "wb") as f:
+        f.write(blob)
+    sys.stderr.write("%d -> %d bytes (%.1f%%)\n" % (len(data), len(blob), 100.0 * len(blob) / max(len(data), 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
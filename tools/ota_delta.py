@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+Delta patches for ESP8266httpUpdate (see DeltaStream.h for the format).
+
+  ota_delta.py make  old.bin new.bin patch.bin
+  ota_delta.py apply old.bin patch.bin out.bin
+
+The server sends patch.bin instead of new.bin when the request carries
+"x-ESP8266-delta: 1" and "x-ESP8266-sketch-md5" matches the MD5 of old.bin.
+The x-MD5 header must still be the MD5 of new.bin.
+"""
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b"ESPD"
+OP_END = 0x00
+OP_COPY = 0x01
+OP_DATA = 0x02
+
+BLOCK = 32       # match granularity
+MIN_COPY = 16    # shorter matches are cheaper as literals
+
+
+def make(old, new):
+    index = {}
+    for off in range(0, len(old) - BLOCK + 1, 4):
+        index.setdefault(old[off:off + BLOCK], off)
+
+    ops = []
+    literal = bytearray()
+    pos = 0
+    while pos < len(new):
+        src = index.get(new[pos:pos + BLOCK])
+        if src is None:
+            literal.append(new[pos])
+            pos += 1
+            continue
+        # extend the match backwards into pending literals and forwards
+        while literal and src > 0 and old[src - 1] == literal[-1]:
+            literal.pop()
+            src -= 1
+            pos -= 1
+        length = 0
+        while pos + length < len(new) and src + length < len(old) and new[pos + length] == old[src + length]:
+            length += 1
+        if length < MIN_COPY:
+            literal += new[pos:pos + length]
+        else:
+            if literal:
+                ops.append((OP_DATA, bytes(literal)))
+                literal = bytearray()
+            ops.append((OP_COPY, src, length))
+        pos += length
+    if literal:
+        ops.append((OP_DATA, bytes(literal)))
+
+    out = bytearray(MAGIC)
+    out += struct.pack("<I", len(new))
+    out += hashlib.md5(old).digest()
+    for op in ops:
+        if op[0] == OP_COPY:
+            out += struct.pack("<BII", OP_COPY, op[1], op[2])
+        else:
+            out += struct.pack("<BI", OP_DATA, len(op[1])) + op[1]
+    out.append(OP_END)
+    return bytes(out)
+
+
+def apply(old, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError("not a delta patch")
+    size, = struct.unpack_from("<I", patch, 4)
+    if patch[8:24] != hashlib.md5(old).digest():
+        raise ValueError("patch is for another base image")
+    pos = 24
+    out = bytearray()
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            src, length = struct.unpack_from("<II", patch, pos)
+            pos += 8
+            if src + length > len(old):
+                raise ValueError("copy outside the base image")
+            out += old[src:src + length]
+        elif op == OP_DATA:
+            length, = struct.unpack_from("<I", patch, pos)
+            pos += 4
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError("unknown op 0x%02x" % op)
+    if len(out) != size:
+        raise ValueError("size mismatch")
+    return bytes(out)
+
+
+def main():
+    if len(sys.argv) != 5 or sys.argv[1] not in ("make", "apply"):
+        sys.stderr.write(__doc__)
+        return 1
+    with open(sys.argv[2], "rb") as f:
+        old = f.read()
+    with open(sys.argv[3], "rb") as f:
+        second = f.read()
+    if sys.argv[1] == "make":
+        result = make(old, second)
+        if apply(old, result) != second:
+            raise RuntimeError("patch does not rebuild the new image")
+        sys.stderr.write("%d -> %d bytes\n" % (len(second), len(result)))
+    else:
+        result = apply(old, second)
+    with open(sys.argv[4], "wb") as f:
+        f.write(result)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
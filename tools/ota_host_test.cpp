@@ -0,0 +1,1522 @@
+/*
+  Host run of AgruminoOTA: the sketch side of an HTTP update end to end, on
+  the stand-ins of tools/host (in-memory flash and Updater, RTC memory and
+  eboot, lwIP on a simulated link, the I2C chips of the board), and of the
+  ArduinoOTA and MulticastOTA services against the uploaders of tools/.
+
+    g++ -O1 -std=c++11 -Wall -funsigned-char -fno-pie -no-pie -DARDUINO=10805 -DESP8266 -DARDUINO_ARCH_AVR \
+        -I tools/host -I . -I libraries/Agrumino -I libraries/ESP8266WiFi/src \
+        -I libraries/ESP8266httpUpdate/src -I libraries/ArduinoOTA -I libraries/MulticastOTA \
+        -I libraries/ESP8266WebServer/src -I libraries/ESP8266HTTPUpdateServer/src -I libraries/ESP8266mDNS \
+        tools/ota_host_test.cpp tools/host/[a-z]*.cpp AgruminoOTA.cpp libraries/Agrumino/Agrumino.cpp \
+        libraries/ESP8266httpUpdate/src/[A-Z]*.cpp libraries/ESP8266WiFi/src/WiFiClient.cpp \
+        libraries/ESP8266WiFi/src/WiFiServer.cpp libraries/ESP8266WiFi/src/WiFiUdp.cpp \
+        libraries/ArduinoOTA/ArduinoOTA.cpp libraries/MulticastOTA/MulticastOTA.cpp \
+        libraries/ESP8266WebServer/src/ESP8266WebServer.cpp libraries/ESP8266WebServer/src/Parsing.cpp \
+        libraries/ESP8266WebServer/src/detail/mimetable.cpp \
+        libraries/ESP8266HTTPUpdateServer/src/ESP8266HTTPUpdateServer.cpp \
+        libraries/ESP8266mDNS/ESP8266mDNS.cpp -o ota_host_test
+    ./ota_host_test
+
+  -fno-pie -no-pie keep _SPIFFS_start at the absolute address of the board,
+  -funsigned-char makes char unsigned like on the Xtensa (ClientContext::read()
+  returns a char).
+  The libraries are the real ones, WiFiClient, WiFiServer and WiFiUdp included,
+  over the lwIP of tools/host/lwip.cpp. The server is the logic of
+  tools/ota_server.py for one release: 304 for the installed image or its
+  ETag, 206 for a Range, the plain image otherwise. The uploader and the
+  sender follow tools/espota2.py and tools/ota_multicast.py on the host PC. Time is virtual, it moves
+  with delay(), yield(), flash work, the bytes on the I2C bus and the link.
+
+    sensors       turnBoardOn() and a read of every sensor
+    update        a board on v1 gets v2, restarts, eboot copies it, the trial is confirmed
+    not_modified  the next check sends the ETag, gets a 304, does not power the board
+    resume        a download dropped halfway continues from its last sector on the next wake
+    trial_sleep   a new sketch that sleeps before confirming is rolled back by its running time, then by its wakes
+    stale_md5     builds with the size and the last sector of the running sketch, uploaded over serial or staged
+    ide           ArduinoOTA from the uploader of tools/espota2.py, v2 with and without the receive buffers, then v1
+    ide_cancel    a stuck flash bit fails the read back of onEnd, the uploader gets the cancel, no restart
+    multicast     MulticastOTA from the sender of tools/ota_multicast.py, lost blocks rebuilt or NACKed
+    multicast_cancel  an onEnd that clears the eboot command, the sender gets the error, no restart
+    small_image   a 60 KB image over a 1.5 MB sketch installs without a rollback, the sketch is not touched
+    lzss          LzssDecoder and LzssStream rebuild the images of tools/ota_compress.py, whatever the settings
+    compressed    a compressed image through the three paths, ArduinoOTA erases one sector per write
+    delta         DeltaStream rebuilds the images of tools/ota_delta.py patches, one through httpUpdate()
+    resume_random downloads dropped at random offsets, in and at the end of a sector, right after a save
+
+  The result is a JSON line per scenario, the exit code is 1 when a check
+  fails. OTA_HOST_VERBOSE=1 sends the serial log of the sketch to stderr.
+  lzss, compressed and delta run the Python tools of tools/ with python3.
+
+    ./ota_host_test image <size> <seed> > sketch.bin
+    ./ota_host_test multicast [cancel]
+    ./ota_host_test bench
+
+  write a test image, and run the board for tools/ota_multicast.py host:
+  MulticastOTA on the virtual clock, driven over stdin and stdout (see
+  Pipe mode below). bench pushes images of 256 KB, 512 KB and 1 MB
+  through httpUpdate(), ArduinoOTA with and without its receive buffers
+  and the web browser mode, and prints
+  a JSON line per transfer: the stages the sketch reports on Serial, and
+  the erases, programming and MD5 of Update.write().
+*/
+
+#include <Agrumino.h>
+#include <AgruminoOTA.h>
+#include <ArduinoOTA.h>
+#include <ESP8266httpUpdate.h>
+#include <DeltaStream.h>
+#include <LzssDecoder.h>
+#include <MulticastOTA.h>
+#include <UpdateRollback.h>
+#include <MD5Builder.h>
+
+#include "host.h"
+#include "eboot_command.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define OTA_SERVER  "ota.example.com"
+#define OTA_PORT    80
+#define OTA_PATH    "/agrumino.bin"
+#define OTA_VERSION "1"
+
+#define PC          "192.168.1.2"
+#define BOARD       "192.168.1.50"
+#define ESPOTA_UDP_PORT 48266 // the invitation and its answer
+#define ESPOTA_TCP_PORT 48267 // the board connects back here for the image
+#define MOTA_SENDER_PORT 48268
+
+static int failures;
+
+static void check(bool ok, const char* name, const char* what)
+{
+    if(!ok) {
+        fprintf(stderr, "%s: %s\n", name, what);
+        failures++;
+    }
+}
+
+// The headers esptool writes: the one of the bootloader with the flash size at 0,
+// one segment of the application at APP_START_OFFSET, so ESP.getSketchSize() is
+// the size of the image. The size is a multiple of 16
+static void stampHeaders(std::string& image)
+{
+    image[0] = (char) 0xE9;
+    image[1] = 1;
+    image[3] = 0x40; // 4M
+    uint8_t app[16] = { 0xE9, 1 };
+    uint32_t segment[2] = { 0x40201010, (uint32_t) (image.size() - APP_START_OFFSET - sizeof(app) - 16) };
+    memcpy(&app[8], segment, sizeof(segment));
+    image.replace(APP_START_OFFSET, sizeof(app), (const char*) app, sizeof(app));
+}
+
+static uint32_t xorshift(uint32_t& seed)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// A sketch image of random bytes, it does not compress
+static std::string makeImage(size_t size, uint32_t seed)
+{
+    std::string image(size, '\0');
+    for(size_t i = 0; i < size; ++i) {
+        image[i] = (char) xorshift(seed);
+    }
+    stampHeaders(image);
+    return image;
+}
+
+// A sketch image that compresses about like a real one, to 60-70 %: instructions
+// from a small set, random constants, and runs of zeros of up to 6 KB like the
+// padding between sections
+static std::string makeCompressible(size_t size, uint32_t seed)
+{
+    std::string words;
+    for(int i = 0; i < 64 * 3; ++i) {
+        words += (char) xorshift(seed);
+    }
+    std::string image;
+    while(image.size() < size) {
+        uint32_t kind = xorshift(seed) % 10000;
+        if(kind == 0) {
+            image.append(1024 + xorshift(seed) % 5120, '\0');
+        } else if(kind < 6000) {
+            image.append(words, xorshift(seed) % 64 * 3, 3);
+        } else {
+            image += (char) xorshift(seed);
+        }
+    }
+    image.resize(size);
+    stampHeaders(image);
+    return image;
+}
+
+static std::string md5(const std::string& data)
+{
+    MD5Builder builder;
+    builder.begin();
+    for(size_t offset = 0; offset < data.size(); offset += 4096) {
+        builder.add((const uint8_t*) data.data() + offset, std::min((size_t) 4096, data.size() - offset));
+    }
+    builder.calculate();
+    return builder.toString().c_str();
+}
+
+static bool flashHolds(const std::string& image)
+{
+    return memcmp(hostFlash(), image.data(), image.size()) == 0;
+}
+
+////////////
+// Server //
+////////////
+
+struct Release {
+    std::string image;
+    std::string md5;
+    size_t dropAt;          // body bytes sent before the connection drops, npos for none
+    std::string compressed; // sent to a board that accepts espz when not empty
+    std::string delta;      // sent to a board that runs the base and accepts deltas when not empty
+    std::string baseMD5;
+};
+
+static Release release;
+static std::map<std::string, std::string> lastRequest; // lower case header names, "" is the request line
+static int lastCode;
+
+static std::map<std::string, std::string> parseHead(const std::string& head)
+{
+    std::map<std::string, std::string> headers;
+    size_t pos = 0;
+    while(pos < head.size()) {
+        size_t eol = head.find("\r\n", pos);
+        std::string line = head.substr(pos, eol - pos);
+        pos = (eol == std::string::npos) ? head.size() : eol + 2;
+        if(line.empty()) {
+            break;
+        }
+        size_t colon = line.find(':');
+        if(headers.empty() || colon == std::string::npos) {
+            headers[""] = line;
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t value = line.find_first_not_of(' ', colon + 1);
+        headers[name] = (value == std::string::npos) ? std::string() : line.substr(value);
+    }
+    return headers;
+}
+
+static std::string header(const std::map<std::string, std::string>& headers, const char* name)
+{
+    auto it = headers.find(name);
+    return (it == headers.end()) ? std::string() : it->second;
+}
+
+static HostResponse serve(const std::string& request)
+{
+    lastRequest = parseHead(request);
+    std::string etag = "\"" + release.md5 + "\"";
+
+    if(header(lastRequest, "if-none-match") == etag || header(lastRequest, "x-esp8266-sketch-md5") == release.md5) {
+        lastCode = 304;
+        return HostResponse("HTTP/1.1 304 Not Modified\r\nETag: " + etag + "\r\nConnection: close\r\n\r\n");
+    }
+
+    size_t start = 0;
+    unsigned long first;
+    const std::string* body = &release.image;
+    if(sscanf(header(lastRequest, "range").c_str(), "bytes=%lu-", &first) == 1 && first < release.image.size()) {
+        start = first;
+    } else if(!release.delta.empty() && header(lastRequest, "x-esp8266-delta") == "1" &&
+              header(lastRequest, "x-esp8266-sketch-md5") == release.baseMD5) {
+        body = &release.delta;
+    } else if(!release.compressed.empty() && header(lastRequest, "x-esp8266-compression").find("espz") != std::string::npos) {
+        body = &release.compressed;
+    }
+    lastCode = start ? 206 : 200;
+    std::string head = start ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+    head += "Content-Type: application/octet-stream\r\n";
+    head += "ETag: " + etag + "\r\n";
+    head += "x-MD5: " + release.md5 + "\r\n";
+    if(start) {
+        head += "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(release.image.size() - 1) + "/" +
+                std::to_string(release.image.size()) + "\r\n";
+    }
+    head += "Content-Length: " + std::to_string(body->size() - start) + "\r\n";
+    head += "Connection: close\r\n\r\n";
+
+    HostResponse response(head + body->substr(start));
+    if(release.dropAt != std::string::npos) {
+        response.cutAt = head.size() + release.dropAt;
+        release.dropAt = std::string::npos;
+    }
+    return response;
+}
+
+static void publish(const std::string& image)
+{
+    release.image = image;
+    release.md5 = md5(image);
+    release.dropAt = std::string::npos;
+    release.compressed.clear();
+    release.delta.clear();
+    release.baseMD5.clear();
+}
+
+//////////////
+// Uploader //
+//////////////
+
+// tools/espota2.py: the invitation over UDP, then the board connects back for the image.
+// v2 keeps at most the window of the answer unacked, v1 waits for the ack of every 1460 bytes
+struct Upload {
+    std::string image;
+    bool v2;
+    uint32_t window;
+    size_t sent;
+    size_t acked;
+    std::string answer;     // to the invitation
+    std::string received;   // from the board over TCP
+    HostSocketPtr socket;
+    bool done;
+    uint32_t result;        // 0 once the board said OK, else the code of the 'E' frame
+};
+
+static Upload upload;
+
+static void uploadPump()
+{
+    if(!upload.socket || upload.sent >= upload.image.size()) {
+        return;
+    }
+    size_t len = std::min((size_t) 1460, upload.image.size() - upload.sent);
+    if(upload.v2) {
+        if(upload.sent - upload.acked >= upload.window) {
+            return;
+        }
+        len = std::min(len, (size_t) (upload.window - (upload.sent - upload.acked)));
+    }
+    upload.socket->send(upload.image.substr(upload.sent, len));
+    upload.sent += len;
+    if(upload.v2) {
+        uploadPump();
+    }
+}
+
+static void uploadReceived(const std::string& data)
+{
+    upload.received += data;
+    if(!upload.v2) {
+        // the lengths written, then "OK" or the error text
+        if(upload.received.find("OK") != std::string::npos) {
+            upload.done = true;
+        } else {
+            uploadPump();
+        }
+        return;
+    }
+    while(!upload.done && upload.received.size() >= 5) {
+        uint32_t value;
+        memcpy(&value, upload.received.data() + 1, 4);
+        char type = upload.received[0];
+        upload.received.erase(0, 5);
+        if(type == 'A') {
+            upload.acked = value;
+            uploadPump();
+        } else {
+            upload.done = true;
+            upload.result = (type == 'O') ? 0 : value;
+        }
+    }
+}
+
+// payload is what goes over TCP when not empty, a compressed image is announced with the size and MD5 of the image
+static void uploadStart(const std::string& image, bool v2, const std::string& payload)
+{
+    upload = Upload();
+    upload.image = payload.empty() ? image : payload;
+    upload.v2 = v2;
+    char invitation[96];
+    snprintf(invitation, sizeof(invitation), "%d %d %u %s%s\n", U_FLASH, ESPOTA_TCP_PORT, (unsigned) image.size(),
+             md5(image).c_str(), v2 ? " 2" : "");
+    hostUdpSend(PC, ESPOTA_UDP_PORT, BOARD, 8266, invitation);
+}
+
+static void uploadListen()
+{
+    hostUdpListen(PC, ESPOTA_UDP_PORT, [](const std::string& data, IPAddress, uint16_t) {
+        upload.answer = data;
+        unsigned interval, window;
+        if(sscanf(data.c_str(), "OK 2 %u %u", &interval, &window) == 2) {
+            upload.window = window;
+        } else {
+            upload.v2 = false;
+        }
+    });
+    hostListen(PC, ESPOTA_TCP_PORT, [](HostSocketPtr socket) {
+        upload.socket = socket;
+        socket->onData = uploadReceived;
+        socket->onClose = [](bool) { upload.done = true; };
+        uploadPump();
+    });
+}
+
+//////////////////////
+// Multicast sender //
+//////////////////////
+
+// tools/ota_multicast.py in short: announces while the board erases, the blocks with
+// the parity of every fec of them, a round, then the blocks NACKed in it, until the
+// board answers with its status. drop() loses data packets of the first round on the air
+#define MOTA_RATE       40960   // bytes per second, the default --rate
+#define MOTA_LEAD_US    6000000
+#define MOTA_WINDOW_MS  500
+
+struct Multicast {
+    std::string image;
+    uint16_t block;
+    uint8_t fec;
+    uint32_t session;
+    uint32_t blocks;
+    std::set<uint32_t> missing; // NACKed in the last round
+    uint32_t rounds;
+    uint32_t packets;
+    uint32_t nacks;
+    uint32_t resent;
+    int status;                 // of the DONE of the board, -1 before it
+    std::function<bool(uint32_t block)> drop;
+};
+
+static Multicast multicast;
+
+static std::string motaPacket(char type, uint32_t seq, const std::string& payload)
+{
+    uint8_t header[16] = { 'M', 'O', 'T', 'A', (uint8_t) type, multicast.fec };
+    memcpy(&header[6], &multicast.block, 2);
+    memcpy(&header[8], &multicast.session, 4);
+    memcpy(&header[12], &seq, 4);
+    return std::string((const char*) header, sizeof(header)) + payload;
+}
+
+// Sent at the given time, returns when the next packet goes at MOTA_RATE
+static uint64_t motaSend(uint64_t at, const std::string& packet, bool lost = false)
+{
+    multicast.packets++;
+    if(!lost) {
+        hostAt(at, [packet]() { hostUdpSend(PC, MOTA_SENDER_PORT, "239.255.82.66", 8267, packet); });
+    }
+    return at + packet.size() * 1000000ULL / MOTA_RATE;
+}
+
+static void motaRound(uint64_t at, const std::vector<uint32_t>& blocks)
+{
+    multicast.rounds++;
+    if(multicast.rounds > 1) {
+        multicast.resent += blocks.size();
+    }
+    std::set<uint32_t> wanted(blocks.begin(), blocks.end());
+    std::set<uint32_t> groups;
+    for(uint32_t block : blocks) {
+        groups.insert(block / multicast.fec);
+    }
+    for(uint32_t group : groups) {
+        std::string parity(multicast.block, '\0');
+        for(uint32_t index = group * multicast.fec; index < std::min((group + 1) * multicast.fec, multicast.blocks); ++index) {
+            std::string data = multicast.image.substr(index * multicast.block, multicast.block);
+            for(size_t i = 0; i < data.size(); ++i) {
+                parity[i] ^= data[i];
+            }
+            if(wanted.count(index)) {
+                at = motaSend(at, motaPacket('D', index, data), multicast.rounds == 1 && multicast.drop(index));
+            }
+        }
+        at = motaSend(at, motaPacket('P', group, parity));
+    }
+    uint16_t window = MOTA_WINDOW_MS;
+    at = motaSend(at, motaPacket('R', multicast.rounds, std::string((const char*) &window, 2)));
+    multicast.missing.clear();
+    hostAt(at + MOTA_WINDOW_MS * 1000ULL, []() {
+        if(multicast.status < 0 && multicast.rounds < 20) {
+            motaRound(hostNow(), std::vector<uint32_t>(multicast.missing.begin(), multicast.missing.end()));
+        }
+    });
+}
+
+static void multicastStart(const std::string& image, uint32_t session, std::function<bool(uint32_t block)> drop)
+{
+    multicast = Multicast();
+    multicast.image = image;
+    multicast.block = 1024;
+    multicast.fec = 8;
+    multicast.session = session;
+    multicast.blocks = (image.size() + multicast.block - 1) / multicast.block;
+    multicast.status = -1;
+    multicast.drop = drop;
+
+    uint32_t size = image.size();
+    std::string announce = motaPacket('S', 0, std::string((const char*) &size, 4) + md5(image) + std::string(1, '\0'));
+    uint64_t at = hostNow();
+    for(uint64_t t = 0; t < MOTA_LEAD_US; t += 500000) {
+        motaSend(at + t, announce);
+    }
+    std::vector<uint32_t> blocks;
+    for(uint32_t block = 0; block < multicast.blocks; ++block) {
+        blocks.push_back(block);
+    }
+    hostAt(at + MOTA_LEAD_US, [blocks]() { motaRound(hostNow(), blocks); });
+}
+
+static void multicastListen()
+{
+    hostUdpListen(PC, MOTA_SENDER_PORT, [](const std::string& data, IPAddress, uint16_t) {
+        uint32_t session, seq;
+        if(data.size() < 16 || data.compare(0, 4, "MOTA") != 0) {
+            return;
+        }
+        memcpy(&session, data.data() + 8, 4);
+        memcpy(&seq, data.data() + 12, 4);
+        if(session != multicast.session) {
+            return;
+        }
+        if(data[4] == 'N') {
+            multicast.nacks++;
+            for(uint32_t i = 0; i < seq && 16 + 8 * (i + 1) <= data.size(); ++i) {
+                uint32_t range[2];
+                memcpy(range, data.data() + 16 + 8 * i, 8);
+                for(uint32_t block = range[0]; block < range[0] + range[1] && block < multicast.blocks; ++block) {
+                    multicast.missing.insert(block);
+                }
+            }
+        } else if(data[4] == 'K') {
+            multicast.status = seq;
+        }
+    });
+}
+
+////////////////
+// Host tools //
+////////////////
+
+static void writeFile(const std::string& path, const std::string& data)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if(f) {
+        fwrite(data.data(), 1, data.size(), f);
+        fclose(f);
+    }
+}
+
+static std::string readFile(const std::string& path)
+{
+    std::string data;
+    FILE* f = fopen(path.c_str(), "rb");
+    if(f) {
+        char buf[4096];
+        size_t len;
+        while((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+            data.append(buf, len);
+        }
+        fclose(f);
+    }
+    return data;
+}
+
+// python3 tools/<command> a [b] out in a scratch directory, returns out, empty when the tool failed
+static std::string runTool(const std::string& command, const std::string& a, const std::string& b = std::string())
+{
+    std::string source(__FILE__);
+    std::string tools = source.find('/') == std::string::npos ? "." : source.substr(0, source.rfind('/'));
+    char dir[] = "/tmp/ota_host_test.XXXXXX";
+    if(!mkdtemp(dir)) {
+        return std::string();
+    }
+    std::string in = std::string(dir) + "/a.bin", base = std::string(dir) + "/b.bin", out = std::string(dir) + "/out.bin";
+    writeFile(in, a);
+    std::string line = "python3 " + tools + "/" + command + " " + in;
+    if(!b.empty()) {
+        writeFile(base, b);
+        line += " " + base;
+    }
+    line += " " + out + " > /dev/null 2>&1";
+    std::string result = (system(line.c_str()) == 0) ? readFile(out) : std::string();
+    unlink(in.c_str());
+    unlink(base.c_str());
+    unlink(out.c_str());
+    rmdir(dir);
+    return result;
+}
+
+// A response body as the decoders read it from a WiFiClient: available() is what
+// arrived, up to a segment at a time, readBytes() waits for the rest
+class ChunkStream : public Stream
+{
+public:
+    ChunkStream(const std::string& data, uint32_t seed) : _data(data), _pos(0), _seed(seed) {}
+
+    int available() override
+    {
+        return std::min(_data.size() - _pos, (size_t) (1 + xorshift(_seed) % 1460));
+    }
+    int read() override
+    {
+        return _pos < _data.size() ? (uint8_t) _data[_pos++] : -1;
+    }
+    int peek() override
+    {
+        return _pos < _data.size() ? (uint8_t) _data[_pos] : -1;
+    }
+    using Stream::readBytes;
+    size_t readBytes(char* buffer, size_t length) override
+    {
+        size_t len = std::min(length, _data.size() - _pos);
+        memcpy(buffer, _data.data() + _pos, len);
+        _pos += len;
+        return len;
+    }
+    void flush() override {}
+    size_t write(uint8_t) override
+    {
+        return 0;
+    }
+
+private:
+    const std::string& _data;
+    size_t _pos;
+    uint32_t _seed;
+};
+
+///////////
+// Board //
+///////////
+
+// What the sample sketch does on a wake that checks for updates, from the
+// boot to the end of httpUpdate(): the trial first, the board stays off
+static void wake(rst_reason reason)
+{
+    hostBoot(reason);
+    lastRequest.clear();
+    lastCode = 0;
+    AgruminoOTA::beginTrial(60000);
+    Agrumino agrumino;
+    agrumino.setup();
+    AgruminoOTA::confirmUpdate();
+    AgruminoOTA::httpUpdate(agrumino, OTA_SERVER, OTA_PORT, OTA_PATH, OTA_VERSION);
+}
+
+// A sketch started from the EN pin that runs an OTA service in its loop()
+static AgruminoOTA::State serviceState;
+
+static void runService(void (*begin)(AgruminoOTA& service, Agrumino& agrumino), std::function<void()> start,
+                       std::function<bool()> done)
+{
+    hostBoot(REASON_EXT_SYS_RST);
+    AgruminoOTA::beginTrial(60000);
+    Agrumino agrumino;
+    agrumino.setup();
+    AgruminoOTA::confirmUpdate();
+    AgruminoOTA service;
+    begin(service, agrumino);
+    start();
+    uint64_t deadline = hostNow() + 120000000ULL;
+    while(!done() && !hostRestartPending() && hostNow() < deadline && service.loop()) {
+    }
+    serviceState = service.getState();
+    service.end(); // the UDP pcbs outlive hostBoot()
+}
+
+// Returns the microseconds from the invitation to the end of the upload
+static uint32_t ideUpload(const std::string& image, bool v2, const std::string& payload = std::string())
+{
+    uint64_t start = 0;
+    runService([](AgruminoOTA& service, Agrumino& agrumino) { service.beginIdeUpdate(agrumino); },
+               [&]() {
+                   start = hostNow();
+                   uploadStart(image, v2, payload);
+               },
+               []() { return upload.done; });
+    return hostNow() - start;
+}
+
+// The form of /update posted like the web browser mode does, the board answers, then restarts
+static std::string webResponse;
+
+static uint32_t webUpload(const std::string& image)
+{
+    uint64_t start = 0;
+    HostSocketPtr socket;
+    webResponse.clear();
+    runService([](AgruminoOTA& service, Agrumino& agrumino) { service.beginWebServer(agrumino, "agrumino", 80); },
+               [&]() {
+                   start = hostNow();
+                   std::string boundary = "----agruminoform";
+                   std::string body = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"update\"; filename=\"sketch.bin\"\r\n"
+                                      "Content-Type: application/octet-stream\r\n\r\n" + image + "\r\n--" + boundary + "--\r\n";
+                   socket = hostConnect(80);
+                   socket->onData = [](const std::string& data) { webResponse += data; };
+                   socket->send("POST /update HTTP/1.1\r\nHost: " BOARD "\r\nContent-Type: multipart/form-data; boundary=" + boundary +
+                                "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+               },
+               []() { return webResponse.find("\r\n\r\n") != std::string::npos; });
+    return hostNow() - start;
+}
+
+static void multicastReceive(const std::string& image, uint32_t session, std::function<bool(uint32_t block)> drop,
+                             std::function<void()> onEnd = nullptr)
+{
+    runService([](AgruminoOTA& service, Agrumino& agrumino) { service.beginMulticast(agrumino); },
+               [&]() {
+                   if(onEnd) {
+                       MulticastOTA.onEnd(onEnd);
+                   }
+                   multicastStart(image, session, drop);
+               },
+               []() { return multicast.status >= 0; });
+}
+
+static bool ebootStaged()
+{
+    struct eboot_command cmd;
+    return eboot_command_read(&cmd) == 0 && cmd.action == ACTION_COPY_RAW;
+}
+
+///////////////
+// Scenarios //
+///////////////
+
+static void testSensors()
+{
+    hostBoot(REASON_DEEP_SLEEP_AWAKE);
+    HostI2CStats& i2c = hostI2CStats();
+    memset(&i2c, 0, sizeof(i2c));
+
+    Agrumino agrumino;
+    agrumino.setup();
+    uint32_t start = micros();
+    agrumino.turnBoardOn();
+    uint32_t on = micros() - start;
+    uint32_t transactions = i2c.transactions;
+
+    start = micros();
+    float temp = agrumino.readTempC();
+    uint32_t tempUs = micros() - start;
+    start = micros();
+    float lux = agrumino.readLux();
+    uint32_t luxUs = micros() - start;
+    start = micros();
+    unsigned int soil = agrumino.readSoil();
+    uint32_t soilUs = micros() - start;
+    agrumino.turnBoardOff();
+
+    check(agrumino.isBoardOn() == false, "sensors", "board still on");
+    check(fabsf(temp - hostSensors().tempC) < 0.1f, "sensors", "temperature");
+    check(fabsf(lux - hostSensors().lux) < hostSensors().lux * 0.05f, "sensors", "illuminance");
+    check(soil <= 100, "sensors", "soil moisture");
+    check(i2c.nacks == 0, "sensors", "a chip did not acknowledge");
+
+    printf("{\"test\":\"sensors\",\"board_on_us\":%u,\"init_transactions\":%u,\"temp_us\":%u,\"lux_us\":%u,\"soil_us\":%u,"
+           "\"transactions\":%u,\"bus_bytes\":%u,\"temp\":%.2f,\"lux\":%.1f,\"soil\":%u}\n",
+           on, transactions, tempUs, luxUs, soilUs, i2c.transactions, i2c.bytes, temp, lux, soil);
+}
+
+static void testUpdate(const std::string& v2)
+{
+    publish(v2);
+    HostI2CStats& i2c = hostI2CStats();
+    memset(&i2c, 0, sizeof(i2c));
+    HostFlashStats& flash = hostFlashStats();
+    memset(&flash, 0, sizeof(flash));
+    uint32_t start = micros();
+
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    uint32_t wakeUs = micros() - start;
+    const HTTPUpdateStats& stats = ESPhttpUpdate.getStats();
+
+    check(lastCode == 200, "update", "no image sent");
+    check(hostRestartPending(), "update", "no restart after the update");
+    // 4 blinks, and initGpioExpander() lights it once while IO0 turns into an output at the power up level
+    check(i2c.ledOn == 5, "update", "OTA mode did not blink the LED");
+    check(UpdateRollback.state() == ROLLBACK_PENDING, "update", "running sketch not saved");
+
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v2), "update", "eboot did not install the image");
+    bool trial = AgruminoOTA::beginTrial(60000);
+    check(trial, "update", "new sketch not on trial");
+    AgruminoOTA::confirmUpdate();
+    check(UpdateRollback.state() == ROLLBACK_NONE, "update", "trial not confirmed");
+
+    printf("{\"test\":\"update\",\"bytes\":%u,\"wake_us\":%u,\"receive_us\":%u,\"write_us\":%u,\"kib_per_s\":%.1f,"
+           "\"erases\":%u,\"flash_written\":%llu,\"led_on\":%u,\"trial\":%s}\n",
+           stats.bytes, wakeUs, stats.receive, stats.write, stats.total ? stats.bytes * 1e6 / 1024.0 / stats.total : 0.0,
+           flash.erases, (unsigned long long) flash.bytesWritten, i2c.ledOn, trial ? "true" : "false");
+}
+
+static void testNotModified(const std::string& v2)
+{
+    HostI2CStats& i2c = hostI2CStats();
+    memset(&i2c, 0, sizeof(i2c));
+    HostNetStats& net = hostNetStats();
+    memset(&net, 0, sizeof(net));
+    uint32_t start = micros();
+
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    uint32_t wakeUs = micros() - start;
+
+    check(lastCode == 304, "not_modified", "image sent again");
+    check(header(lastRequest, "if-none-match") == "\"" + md5(v2) + "\"", "not_modified", "no ETag of the installed image");
+    check(!hostRestartPending(), "not_modified", "restart without an update");
+    check(i2c.transactions == 0 && i2c.ledOn == 0, "not_modified", "the board was powered for a 304");
+
+    printf("{\"test\":\"not_modified\",\"wake_us\":%u,\"requests\":%u,\"sent\":%llu,\"received\":%llu,\"i2c_transactions\":%u}\n",
+           wakeUs, net.requests, (unsigned long long) net.sent, (unsigned long long) net.received, i2c.transactions);
+}
+
+static void testResume(const std::string& v3)
+{
+    publish(v3);
+    release.dropAt = v3.size() / 2;
+    HostNetStats& net = hostNetStats();
+    memset(&net, 0, sizeof(net));
+
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    check(lastCode == 200, "resume", "no image sent");
+    check(!hostRestartPending(), "resume", "restart after a dropped download");
+    uint64_t firstReceived = net.received;
+
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    unsigned long from = 0;
+    sscanf(header(lastRequest, "range").c_str(), "bytes=%lu-", &from);
+    check(lastCode == 206, "resume", "download not resumed");
+    check(from > 0 && from <= v3.size() / 2 && from % FLASH_SECTOR_SIZE == 0, "resume", "Range not at a committed sector");
+    check(hostRestartPending(), "resume", "no restart after the resumed download");
+
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v3), "resume", "eboot did not install the image");
+    AgruminoOTA::beginTrial(60000);
+    AgruminoOTA::confirmUpdate();
+
+    printf("{\"test\":\"resume\",\"size\":%u,\"dropped_at\":%u,\"resumed_from\":%lu,\"first_received\":%llu,\"received\":%llu}\n",
+           (unsigned) v3.size(), (unsigned) (v3.size() / 2), from, (unsigned long long) firstReceived,
+           (unsigned long long) net.received);
+}
+
+// Downloads dropped at random offsets, every wake resumes from the last sector saved in RTC
+// memory. Update writes a sector out with the first byte of the next one, then it is saved.
+// The drops fall inside a sector, on the last byte of a sector still in the buffer of
+// Update, right after the write that saved a sector, and before the first byte of the body
+static void testResumeRandom(const std::string& image, uint32_t seed)
+{
+    enum { INSIDE, SECTOR_END, SAVED, NOTHING };
+    static const int drops[] = { INSIDE, SAVED, SECTOR_END, NOTHING, INSIDE, SAVED, INSIDE, SECTOR_END };
+    publish(image);
+    HostNetStats& net = hostNetStats();
+    memset(&net, 0, sizeof(net));
+
+    uint32_t from = 0;
+    std::string offsets;
+    for(int drop : drops) {
+        uint32_t sector = from / FLASH_SECTOR_SIZE + 1 + xorshift(seed) % 4;
+        uint32_t at = from; // the first byte not received
+        if(drop == INSIDE) {
+            at = from + 1 + xorshift(seed) % 30000;
+        } else if(drop == SECTOR_END) {
+            at = sector * FLASH_SECTOR_SIZE;
+        } else if(drop == SAVED) {
+            at = sector * FLASH_SECTOR_SIZE + 1 + xorshift(seed) % 256;
+        }
+        at = std::min(at, (uint32_t) image.size() - 1);
+        offsets += (offsets.empty() ? "" : ",") + std::to_string(at);
+        release.dropAt = at - from;
+
+        wake(REASON_DEEP_SLEEP_AWAKE);
+        unsigned long range = 0;
+        sscanf(header(lastRequest, "range").c_str(), "bytes=%lu-", &range);
+        check(range == from && lastCode == (from ? 206 : 200), "resume_random", "not resumed from the saved sector");
+        check(!hostRestartPending(), "resume_random", "restart after a dropped download");
+        if(at > from) {
+            from = (at - 1) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+        }
+    }
+
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    unsigned long range = 0;
+    sscanf(header(lastRequest, "range").c_str(), "bytes=%lu-", &range);
+    check(range == from && lastCode == 206, "resume_random", "last download not resumed from the saved sector");
+    bool restarted = hostRestartPending();
+    hostBoot(REASON_SOFT_RESTART);
+    check(restarted && flashHolds(image), "resume_random", "eboot did not install the image");
+    AgruminoOTA::beginTrial(60000);
+    AgruminoOTA::confirmUpdate();
+
+    printf("{\"test\":\"resume_random\",\"size\":%u,\"dropped_at\":[%s],\"resumed_from\":%u,\"received\":%llu}\n",
+           (unsigned) image.size(), offsets.c_str(), from, (unsigned long long) net.received);
+}
+
+static void testSmallImage(const std::string& sketch, const std::string& image)
+{
+    // flashed over serial, the board starts from scratch
+    memcpy(hostFlash(), sketch.data(), sketch.size());
+    hostBoot(REASON_DEFAULT_RST);
+    publish(image);
+
+    // staged at 0x300000 - 64 KB, a copy of the sketch right below it would start inside the sketch
+    uint32_t staged = HOST_SPIFFS_START - 0x10000;
+    uint32_t address = UpdateRollbackClass::saveAddress(staged, image.size(), sketch.size());
+    check(address == 0, "small_image", "copy of the sketch over the sketch");
+    check(UpdateRollbackClass::saveAddress(HOST_SPIFFS_START - 0x51000, 330000, 307760) == 0x262000, "small_image",
+          "no room below an image larger than the sketch");
+
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    check(lastCode == 200, "small_image", "no image sent");
+    check(hostRestartPending(), "small_image", "no restart after the update");
+    check(UpdateRollback.state() == ROLLBACK_NONE, "small_image", "rollback prepared without room");
+    check(flashHolds(sketch), "small_image", "running sketch overwritten");
+
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(image), "small_image", "eboot did not install the image");
+    check(!AgruminoOTA::beginTrial(60000), "small_image", "trial without a saved sketch");
+
+    printf("{\"test\":\"small_image\",\"sketch\":%u,\"image\":%u,\"save_address\":%u}\n", (unsigned) sketch.size(),
+           (unsigned) image.size(), address);
+}
+
+// The new sketch sleeps before confirming: the trial time and the wakes carry over the deep sleeps
+static void testTrialSleep(const std::string& sketch, const std::string& v4, const std::string& v5)
+{
+    publish(v4);
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    check(hostRestartPending(), "trial_sleep", "no restart after the update");
+
+    // 25 s + 25 s + 10 s of a 60 s timeout, then the timer rolls back
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v4), "trial_sleep", "eboot did not install the image");
+    unsigned runs = 0;
+    while(AgruminoOTA::beginTrial(60000) && !hostRestartPending() && runs < 5) {
+        runs++;
+        delay(25000);
+        if(!hostRestartPending()) {
+            hostAdvance(300000000ULL);
+            hostBoot(REASON_DEEP_SLEEP_AWAKE);
+        }
+    }
+    check(runs == 3 && hostRestartPending(), "trial_sleep", "the time of the earlier wakes was not counted");
+    check(UpdateRollback.state() == ROLLBACK_REVERTED, "trial_sleep", "not rolled back after the timeout");
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(sketch), "trial_sleep", "the saved sketch was not copied back");
+
+    // wakes shorter than a tick, the first one past UPDATE_ROLLBACK_WAKES rolls back
+    publish(v5);
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v5), "trial_sleep", "eboot did not install the second image");
+    unsigned wakes = 0;
+    while(AgruminoOTA::beginTrial(60000) && !hostRestartPending() && wakes < 20) {
+        delay(200);
+        hostAdvance(300000000ULL);
+        hostBoot(REASON_DEEP_SLEEP_AWAKE);
+        wakes++;
+    }
+    check(wakes == UPDATE_ROLLBACK_WAKES + 1 && hostRestartPending(), "trial_sleep", "the wakes were not counted");
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(sketch), "trial_sleep", "the saved sketch was not copied back after the wakes");
+
+    printf("{\"test\":\"trial_sleep\",\"timeout_ms\":60000,\"runs\":%u,\"short_wakes\":%u}\n", runs, wakes);
+}
+
+// The cached sketch MD5 of a build that keeps the size and the last sector of the running one
+static void testStaleMD5(const std::string& sketch)
+{
+    std::string serial = sketch;
+    serial[sketch.size() / 3] ^= 0x5a;
+    std::string staged = sketch;
+    staged[sketch.size() / 2] ^= 0xa5;
+
+    publish(sketch);
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    check(header(lastRequest, "x-esp8266-sketch-md5") == md5(sketch), "stale_md5", "wrong MD5 before the installs");
+
+    // a serial upload, the board is reset from the EN pin and keeps its RTC memory
+    publish(serial); // answered with a 304, httpUpdate does not touch the cache
+    memcpy(hostFlash(), serial.data(), serial.size());
+    wake(REASON_EXT_SYS_RST);
+    check(header(lastRequest, "x-esp8266-sketch-md5") == md5(serial), "stale_md5", "cached MD5 sent after a serial upload");
+
+    // staged by another update path, like ArduinoOTA does
+    uint32_t address = HOST_SPIFFS_START - ((staged.size() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1));
+    memcpy(hostFlash() + address, staged.data(), staged.size());
+    struct eboot_command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.action = ACTION_COPY_RAW;
+    cmd.args[0] = address;
+    cmd.args[2] = staged.size();
+    eboot_command_write(&cmd);
+    ESP8266HTTPUpdate::forgetSketchMD5();
+    publish(staged);
+    wake(REASON_SOFT_RESTART);
+    check(flashHolds(staged), "stale_md5", "eboot did not install the image");
+    check(header(lastRequest, "x-esp8266-sketch-md5") == md5(staged), "stale_md5", "cached MD5 sent after another update path");
+
+    check(lastCode == 304, "stale_md5", "the installed build was downloaded again");
+
+    publish(sketch);
+    memcpy(hostFlash(), sketch.data(), sketch.size());
+    wake(REASON_EXT_SYS_RST);
+    printf("{\"test\":\"stale_md5\",\"size\":%u,\"serial\":\"%s\",\"staged\":\"%s\"}\n", (unsigned) sketch.size(),
+           md5(serial).c_str(), md5(staged).c_str());
+}
+
+// ArduinoOTA with the v2 transfer of tools/espota2.py through the receive buffers and
+// from the pbufs, then with the v1 one of the ArduinoIDE
+static void testIde(const std::string& v2image, const std::string& v1image)
+{
+    uint32_t v2us = ideUpload(v2image, true);
+    ota_stats_t stats = ArduinoOTA.getStats();
+    uint32_t window = upload.window;
+    check(window > 0, "ide", "no v2 answer to the invitation");
+    check(upload.done && upload.result == 0 && upload.sent == v2image.size(), "ide", "v2 upload not acknowledged");
+    check(serviceState == AgruminoOTA::STATE_DONE && hostRestartPending(), "ide", "no restart after the v2 upload");
+    check(UpdateRollback.state() == ROLLBACK_PENDING, "ide", "running sketch not saved");
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v2image), "ide", "eboot did not install the v2 upload");
+    check(AgruminoOTA::beginTrial(60000), "ide", "v2 upload not on trial");
+    AgruminoOTA::confirmUpdate();
+
+    ArduinoOTA.setRxBuffers(0);
+    ideUpload(v2image, true);
+    ArduinoOTA.setRxBuffers(OTA_RX_BUFFERS);
+    ota_stats_t pbufs = ArduinoOTA.getStats();
+    check(upload.done && upload.result == 0 && hostRestartPending(), "ide", "v2 upload from the pbufs not acknowledged");
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v2image), "ide", "eboot did not install the v2 upload from the pbufs");
+    AgruminoOTA::beginTrial(60000);
+    AgruminoOTA::confirmUpdate();
+
+    ideUpload(v1image, false);
+    ota_stats_t v1 = ArduinoOTA.getStats();
+    check(upload.done && upload.sent == v1image.size(), "ide", "v1 upload not acknowledged");
+    check(hostRestartPending(), "ide", "no restart after the v1 upload");
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(v1image), "ide", "eboot did not install the v1 upload");
+    AgruminoOTA::beginTrial(60000);
+    AgruminoOTA::confirmUpdate();
+
+    // the transfer, then onEnd saves the running sketch for the rollback before the uploader gets the OK
+    printf("{\"test\":\"ide\",\"bytes\":%u,\"window\":%u,\"upload_us\":%u,\"total_us\":%u,\"receive_us\":%u,\"write_us\":%u,"
+           "\"sectors\":%u,\"stall_max_us\":%u,\"kib_per_s\":%.1f,\"pbufs_total_us\":%u,\"pbufs_receive_us\":%u,"
+           "\"pbufs_kib_per_s\":%.1f,\"v1_total_us\":%u,\"v1_kib_per_s\":%.1f}\n",
+           stats.bytes, window, v2us, stats.total, stats.receive, stats.write, stats.sectors, stats.stall_max,
+           stats.bytes * 1e6 / 1024.0 / stats.total, pbufs.total, pbufs.receive, pbufs.bytes * 1e6 / 1024.0 / pbufs.total, v1.total,
+           v1.bytes * 1e6 / 1024.0 / v1.total);
+}
+
+// A worn cell in the staging area: the upload streams with the right MD5, the read back of
+// onEnd (AgruminoOTA::prepareRollback) does not match and cancels the update
+static void testIdeCancel(const std::string& sketch, const std::string& image)
+{
+    uint32_t staged = HOST_SPIFFS_START - ((image.size() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1));
+    size_t offset = image.size() / 2;
+    while(!(image[offset] & 1)) {
+        offset++;
+    }
+    hostFlashStuck(staged + offset, 1);
+    ideUpload(image, true);
+    hostFlashStuck(staged + offset, 0);
+
+    check(upload.done && upload.result == 0x200, "ide_cancel", "the uploader was not told of the cancel");
+    check(serviceState == AgruminoOTA::STATE_FAILED, "ide_cancel", "session not failed");
+    check(!hostRestartPending(), "ide_cancel", "restart after a cancelled update");
+    check(!ebootStaged(), "ide_cancel", "the damaged image is still staged");
+    check(UpdateRollback.getLastError() == UPDATE_ROLLBACK_ERROR_VERIFY, "ide_cancel", "not cancelled by the read back");
+    hostBoot(REASON_EXT_SYS_RST);
+    check(flashHolds(sketch), "ide_cancel", "running sketch replaced");
+
+    printf("{\"test\":\"ide_cancel\",\"bytes\":%u,\"stuck_at\":%u,\"error\":%u}\n", (unsigned) image.size(),
+           (unsigned) (staged + offset), upload.result);
+}
+
+// MulticastOTA: one block of a parity group lost is rebuilt, two are NACKed and sent again
+static void testMulticast(const std::string& image)
+{
+    auto drop = [](uint32_t block) { return block % 61 == 7 || block == 100 || block == 101; };
+    uint32_t single = 0;
+    for(uint32_t block = 0; block < (image.size() + 1023) / 1024; ++block) {
+        single += block % 61 == 7;
+    }
+    uint64_t start = hostNow();
+    multicastReceive(image, 0x1234, drop);
+    uint32_t elapsed = hostNow() - start;
+    mota_stats_t stats = MulticastOTA.getStats();
+
+    check(multicast.status == 0, "multicast", "board did not report the install");
+    check(serviceState == AgruminoOTA::STATE_DONE && hostRestartPending(), "multicast", "no restart after the update");
+    check(stats.recovered == single, "multicast", "lost blocks not rebuilt from the parity");
+    check(multicast.resent == 2 && stats.nacks >= 1, "multicast", "the blocks of a group lost twice were not NACKed");
+    check(UpdateRollback.state() == ROLLBACK_PENDING, "multicast", "running sketch not saved");
+    hostBoot(REASON_SOFT_RESTART);
+    check(flashHolds(image), "multicast", "eboot did not install the image");
+    check(AgruminoOTA::beginTrial(60000), "multicast", "new sketch not on trial");
+    AgruminoOTA::confirmUpdate();
+
+    printf("{\"test\":\"multicast\",\"bytes\":%u,\"blocks\":%u,\"us\":%u,\"rounds\":%u,\"packets\":%u,\"recovered\":%u,"
+           "\"nacks\":%u,\"resent\":%u,\"erase_us\":%u,\"total_us\":%u}\n",
+           stats.bytes, multicast.blocks, elapsed, multicast.rounds, multicast.packets, stats.recovered, multicast.nacks,
+           multicast.resent, stats.erase, stats.total);
+}
+
+// An onEnd that clears the eboot command cancels the update, the sender is told
+static void testMulticastCancel(const std::string& sketch, const std::string& image)
+{
+    multicastReceive(image, 0x1235, [](uint32_t) { return false; }, []() { eboot_command_clear(); });
+
+    check(multicast.status == 0x100 + MOTA_VERIFY_ERROR, "multicast_cancel", "the sender was not told of the cancel");
+    check(serviceState == AgruminoOTA::STATE_FAILED, "multicast_cancel", "session not failed");
+    check(!hostRestartPending(), "multicast_cancel", "restart after a cancelled update");
+    check(!ebootStaged(), "multicast_cancel", "image still staged");
+    hostBoot(REASON_EXT_SYS_RST);
+    check(flashHolds(sketch), "multicast_cancel", "running sketch replaced");
+
+    printf("{\"test\":\"multicast_cancel\",\"bytes\":%u,\"status\":%d}\n", (unsigned) image.size(), multicast.status);
+}
+
+// The image of a compressed one, decoded in slices of random sizes in and out
+static std::string lzssDecode(LzssDecoder& decoder, const std::string& compressed, uint32_t seed)
+{
+    std::string image;
+    uint8_t buf[600];
+    const uint8_t* in = (const uint8_t*) compressed.data();
+    size_t left = compressed.size();
+    while(!decoder.hasError() && !decoder.isFinished()) {
+        size_t len = std::min(left, (size_t) (1 + xorshift(seed) % 300));
+        size_t inLen = len;
+        size_t produced = decoder.decode(in, inLen, buf, 1 + xorshift(seed) % sizeof(buf));
+        left -= len - inLen;
+        image.append((const char*) buf, produced);
+        if(!produced && !left) {
+            break;
+        }
+    }
+    return image;
+}
+
+// LzssDecoder and LzssStream on the images of tools/ota_compress.py, windows of 16 bytes
+// to 4 KB, back references of up to 2 KB. A cut image waits for more, a bad header fails
+static void testLzss(const std::string& image)
+{
+    static const unsigned settings[][2] = { { 4, 3 }, { 8, 4 }, { 11, 4 }, { 12, 8 }, { 12, 11 } };
+    std::string cut;
+    for(const unsigned* setting : settings) {
+        char command[48];
+        snprintf(command, sizeof(command), "ota_compress.py -w %u -l %u", setting[0], setting[1]);
+        std::string compressed = runTool(command, image);
+        check(!compressed.empty(), "lzss", "tools/ota_compress.py failed");
+        if(compressed.empty()) {
+            continue;
+        }
+        cut = compressed.substr(0, compressed.size() - 8);
+
+        LzssDecoder decoder;
+        std::string decoded = lzssDecode(decoder, compressed, setting[0]);
+        check(decoder.isFinished() && !decoder.hasError() && decoded == image, "lzss", "LzssDecoder did not rebuild the image");
+
+        ChunkStream body(compressed, setting[1]);
+        LzssStream lzss(body);
+        std::string streamed;
+        uint32_t seed = setting[0] * 100 + setting[1];
+        if(lzss.begin()) {
+            char buf[700];
+            size_t len;
+            while((len = lzss.readBytes(buf, 1 + xorshift(seed) % sizeof(buf))) > 0) {
+                streamed.append(buf, len);
+            }
+        }
+        check(lzss.size() == image.size() && !lzss.hasError() && streamed == image, "lzss", "LzssStream did not rebuild the image");
+
+        printf("{\"test\":\"lzss\",\"window\":%u,\"lookahead\":%u,\"bytes\":%u,\"compressed\":%u,\"ratio\":%.2f}\n", setting[0],
+               setting[1], (unsigned) image.size(), (unsigned) compressed.size(), (double) compressed.size() / image.size());
+    }
+
+    LzssDecoder decoder;
+    lzssDecode(decoder, cut, 1);
+    check(!decoder.isFinished() && !decoder.hasError(), "lzss", "a cut image did not wait for the rest");
+    std::string header = cut.substr(0, LZSS_HEADER_SIZE);
+    header[8] = LZSS_MAX_WINDOW_BITS + 1;
+    decoder.reset();
+    lzssDecode(decoder, header, 1);
+    check(decoder.hasError(), "lzss", "a window over 4 KB was accepted");
+    header[8] = 8;
+    header[9] = 8;
+    decoder.reset();
+    lzssDecode(decoder, header, 1);
+    check(decoder.hasError(), "lzss", "a lookahead as large as the window was accepted");
+}
+
+// A compressed image through httpUpdate(), ArduinoOTA and the web browser mode. With -l 8 a
+// back reference is up to 256 bytes, a slice of 256 bytes decodes to several sectors, and
+// ArduinoOTA still erases at most one per write so the socket is read between the erases
+static void testCompressed(const std::string& image)
+{
+    std::string compressed = runTool("ota_compress.py -w 12 -l 8", image);
+    check(!compressed.empty(), "compressed", "tools/ota_compress.py failed");
+    if(compressed.empty()) {
+        return;
+    }
+    auto installed = [&image](const char* what) {
+        bool restarted = hostRestartPending();
+        hostBoot(REASON_SOFT_RESTART);
+        check(restarted && flashHolds(image), "compressed", what);
+        AgruminoOTA::beginTrial(60000);
+        AgruminoOTA::confirmUpdate();
+    };
+
+    publish(image);
+    release.compressed = compressed;
+    HostNetStats& net = hostNetStats();
+    memset(&net, 0, sizeof(net));
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    uint64_t received = net.received;
+    check(lastCode == 200 && received < compressed.size() + 1024, "compressed", "httpUpdate did not get the compressed image");
+    installed("httpUpdate did not install the compressed image");
+
+    ideUpload(image, true, compressed);
+    ota_stats_t stats = ArduinoOTA.getStats();
+    check(upload.done && upload.result == 0 && upload.sent == compressed.size(), "compressed", "ArduinoOTA upload not acknowledged");
+    check(stats.sectors == (image.size() + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE, "compressed",
+          "an ArduinoOTA write erased more than one sector");
+    installed("ArduinoOTA did not install the compressed image");
+
+    ArduinoOTA.setRxBuffers(0);
+    ideUpload(image, true, compressed);
+    ArduinoOTA.setRxBuffers(OTA_RX_BUFFERS);
+    check(ArduinoOTA.getStats().sectors == stats.sectors, "compressed", "an ArduinoOTA write from the pbufs erased more than one sector");
+    installed("ArduinoOTA did not install the compressed image from the pbufs");
+
+    webUpload(compressed);
+    installed("the web browser mode did not install the compressed image");
+
+    printf("{\"test\":\"compressed\",\"bytes\":%u,\"compressed\":%u,\"http_received\":%llu,\"ide_sectors\":%u,"
+           "\"ide_stall_max_us\":%u,\"ide_kib_per_s\":%.1f}\n",
+           (unsigned) image.size(), (unsigned) compressed.size(), (unsigned long long) received, stats.sectors, stats.stall_max,
+           stats.bytes * 1e6 / 1024.0 / stats.total);
+}
+
+// The image DeltaStream rebuilds from a patch, read in slices of random sizes
+static std::string deltaApply(DeltaStream& delta, uint32_t seed)
+{
+    std::string image;
+    if(delta.begin()) {
+        char buf[700];
+        size_t len;
+        while((len = delta.readBytes(buf, 1 + xorshift(seed) % sizeof(buf))) > 0) {
+            image.append(buf, len);
+        }
+    }
+    return image;
+}
+
+// DeltaStream on the patches of tools/ota_delta.py against the running sketch: bytes
+// changed, a block inserted, blocks swapped and a tail added. A cut patch and a copy
+// from outside the sketch fail. Then a patch through httpUpdate()
+static void testDelta(const std::string& sketch)
+{
+    memcpy(hostFlash(), sketch.data(), sketch.size());
+    hostBoot(REASON_DEFAULT_RST);
+    std::string sketchMD5 = md5(sketch);
+
+    std::string changed = sketch;
+    for(size_t offset = 0x2000; offset < changed.size(); offset += 0x3F01) {
+        changed[offset] ^= 0x5A;
+    }
+    std::string inserted = sketch.substr(0, sketch.size() / 2) + makeCompressible(16384, 16).substr(8192, 1024) + sketch.substr(sketch.size() / 2);
+    stampHeaders(inserted);
+    std::string moved = sketch;
+    moved.replace(0x10000, 0x2000, sketch, 0x30000, 0x2000);
+    moved.replace(0x30000, 0x2000, sketch, 0x10000, 0x2000);
+    moved += makeCompressible(16384, 17).substr(8192, 4096);
+    stampHeaders(moved);
+
+    struct {
+        const char* name;
+        const std::string& image;
+    } cases[] = { { "changed", changed }, { "inserted", inserted }, { "moved", moved } };
+    std::string patch;
+    for(auto& c : cases) {
+        patch = runTool("ota_delta.py make", sketch, c.image);
+        check(!patch.empty(), "delta", "tools/ota_delta.py failed");
+        if(patch.empty()) {
+            continue;
+        }
+        ChunkStream body(patch, c.image.size());
+        DeltaStream delta(body);
+        std::string rebuilt = deltaApply(delta, c.image.size());
+        check(delta.size() == c.image.size() && delta.baseMD5() == sketchMD5.c_str(), "delta", "wrong patch header");
+        check(!delta.hasError() && rebuilt == c.image, "delta", "DeltaStream did not rebuild the image");
+        printf("{\"test\":\"delta\",\"case\":\"%s\",\"bytes\":%u,\"patch\":%u}\n", c.name, (unsigned) c.image.size(),
+               (unsigned) patch.size());
+    }
+    if(patch.empty()) {
+        return;
+    }
+
+    std::string cut = patch.substr(0, patch.size() - 100);
+    ChunkStream cutBody(cut, 1);
+    DeltaStream cutDelta(cutBody);
+    deltaApply(cutDelta, 1);
+    check(cutDelta.hasError(), "delta", "a cut patch was not detected");
+    uint32_t outside[2] = { (uint32_t) sketch.size() - 8, 16 };
+    std::string bad = patch.substr(0, DELTA_HEADER_SIZE) + '\x01' + std::string((const char*) outside, sizeof(outside)) + '\0';
+    ChunkStream badBody(bad, 1);
+    DeltaStream badDelta(badBody);
+    deltaApply(badDelta, 1);
+    check(badDelta.hasError(), "delta", "a copy from outside the sketch was not detected");
+
+    // the last case through the update server
+    publish(moved);
+    release.delta = patch;
+    release.baseMD5 = sketchMD5;
+    HostNetStats& net = hostNetStats();
+    memset(&net, 0, sizeof(net));
+    wake(REASON_DEEP_SLEEP_AWAKE);
+    uint64_t received = net.received;
+    check(lastCode == 200 && received < patch.size() + 1024, "delta", "httpUpdate did not get the patch");
+    bool restarted = hostRestartPending();
+    hostBoot(REASON_SOFT_RESTART);
+    check(restarted && flashHolds(moved), "delta", "httpUpdate did not install the patched image");
+    AgruminoOTA::beginTrial(60000);
+    AgruminoOTA::confirmUpdate();
+
+    printf("{\"test\":\"delta\",\"case\":\"http\",\"bytes\":%u,\"patch\":%u,\"received\":%llu}\n", (unsigned) moved.size(),
+           (unsigned) patch.size(), (unsigned long long) received);
+}
+
+///////////////
+// Benchmark //
+///////////////
+
+// The value of "name": in a JSON line of the sketch
+static uint32_t statsField(const std::string& line, const char* name)
+{
+    size_t at = line.find(std::string("\"") + name + "\":");
+    return at == std::string::npos ? 0 : strtoul(line.c_str() + at + strlen(name) + 3, NULL, 10);
+}
+
+// The last line of the serial log that starts with {"ota":"<path>"
+static std::string statsLine(const char* path)
+{
+    const std::string& log = hostSerialLog();
+    size_t at = log.rfind(std::string("{\"ota\":\"") + path + "\"");
+    return at == std::string::npos ? std::string() : log.substr(at, log.find('\n', at) - at);
+}
+
+// An image through one path of AgruminoOTA, installed by eboot and confirmed like after a real restart.
+// The stages are those the sketch prints at the end of the transfer, the write stage is split with
+// where Update.write() spent its time in the harness
+static void bench(const char* path, const std::string& image, uint8_t rxBuffers = OTA_RX_BUFFERS)
+{
+    hostSerialLog().clear();
+    ArduinoOTA.setRxBuffers(rxBuffers);
+    if(strcmp(path, "http") == 0) {
+        publish(image);
+        wake(REASON_DEEP_SLEEP_AWAKE);
+    } else if(strcmp(path, "ide") == 0) {
+        ideUpload(image, true);
+    } else {
+        webUpload(image);
+    }
+    HostUpdateStats update = hostUpdateStats();
+    std::string line = statsLine(path);
+    bool restarted = hostRestartPending();
+    hostBoot(REASON_SOFT_RESTART);
+    check(!line.empty(), path, "no per-stage line on Serial");
+    check(restarted && flashHolds(image), path, "image not installed");
+    AgruminoOTA::beginTrial(60000);
+    AgruminoOTA::confirmUpdate();
+
+    uint32_t bytes = statsField(line, "bytes"), total = statsField(line, "total_us");
+    printf("{\"bench\":\"ota\",\"path\":\"%s\",\"rx_buffers\":%u,\"bytes\":%u,\"total_us\":%u,\"kib_per_s\":%.1f,\"receive_us\":%u,"
+           "\"write_us\":%u,\"erase_us\":%llu,\"program_us\":%llu,\"md5_us\":%llu,\"callback_us\":%u,\"sectors\":%u}\n",
+           path, rxBuffers, bytes, total, total ? bytes * 1e6 / 1024.0 / total : 0.0, statsField(line, "receive_us"),
+           statsField(line, "write_us"), (unsigned long long) update.eraseUs, (unsigned long long) update.writeUs,
+           (unsigned long long) update.md5Us, statsField(line, "callback_us"), update.sectors);
+}
+
+static int runBench()
+{
+    static const char* paths[] = { "http", "ide", "web" };
+    static const size_t sizes[] = { 256 * 1024, 512 * 1024, 1024 * 1024 };
+    uint32_t seed = 100;
+    for(size_t size : sizes) {
+        for(const char* path : paths) {
+            bench(path, makeImage(size, seed++));
+        }
+        bench("ide", makeImage(size, seed++), 0);
+    }
+    return failures ? 1 : 0;
+}
+
+///////////////
+// Pipe mode //
+///////////////
+
+// The board for tools/ota_multicast.py host, one command per line on stdin:
+//   S <hex>   a datagram of the sender to the group, now
+//   W <us>    lets the board run for us, then prints R <hex> for every reply and T <now us>
+//   E         ends, like EOF
+// The last line on stdout is the result of the board
+static std::vector<std::string> pipeReplies;
+static uint64_t pipeWaitUntil;
+static bool pipeWaiting;
+static bool pipeEnded;
+
+static std::string toHex(const std::string& data)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for(unsigned char c : data) {
+        hex += digits[c >> 4];
+        hex += digits[c & 15];
+    }
+    return hex;
+}
+
+static std::string fromHex(const char* hex)
+{
+    std::string data;
+    unsigned value;
+    while(sscanf(hex, "%2x", &value) == 1) {
+        data += (char) value;
+        hex += 2;
+    }
+    return data;
+}
+
+static void pipeRead();
+
+static void pipeWake()
+{
+    pipeWaiting = false;
+    for(const std::string& reply : pipeReplies) {
+        printf("R %s\n", toHex(reply).c_str());
+    }
+    pipeReplies.clear();
+    printf("T %llu\n", (unsigned long long) hostNow());
+    fflush(stdout);
+    pipeRead();
+}
+
+static void pipeRead()
+{
+    static char line[4096];
+    while(fgets(line, sizeof(line), stdin)) {
+        if(line[0] == 'S' && line[1] == ' ') {
+            hostUdpSend(PC, MOTA_SENDER_PORT, "239.255.82.66", 8267, fromHex(line + 2));
+        } else if(line[0] == 'W' && line[1] == ' ') {
+            pipeWaitUntil = hostNow() + strtoull(line + 2, NULL, 10);
+            pipeWaiting = true;
+            hostAt(pipeWaitUntil, pipeWake);
+            return;
+        } else {
+            break;
+        }
+    }
+    pipeEnded = true;
+}
+
+// MulticastOTA behind the service of AgruminoOTA on a board running image 1, cancel
+// clears the eboot command in onEnd. After the install the new sketch boots and idles
+static int runPipe(bool cancel)
+{
+    hostUdpListen(PC, MOTA_SENDER_PORT, [](const std::string& data, IPAddress, uint16_t) { pipeReplies.push_back(data); });
+    std::string v1 = makeImage(307760, 1);
+    memcpy(hostFlash(), v1.data(), v1.size());
+    hostBoot(REASON_DEFAULT_RST);
+
+    runService([](AgruminoOTA& service, Agrumino& agrumino) { service.beginMulticast(agrumino); },
+               [cancel]() {
+                   if(cancel) {
+                       MulticastOTA.onEnd([]() { eboot_command_clear(); });
+                   }
+                   pipeRead();
+               },
+               []() { return pipeEnded; });
+    mota_stats_t stats = MulticastOTA.getStats();
+    String announced = MulticastOTA.getMD5();
+    bool restarted = hostRestartPending();
+    bool trial = false;
+    if(restarted) {
+        hostBoot(REASON_SOFT_RESTART); // drops the pending wake, the sender still waits for it
+        trial = AgruminoOTA::beginTrial(60000);
+        if(pipeWaiting) {
+            hostAt(std::max(pipeWaitUntil, hostNow()), pipeWake);
+        }
+        while(!pipeEnded) {
+            delay(10);
+        }
+    }
+    String running = ESP.getSketchMD5();
+
+    static const char* states[] = { "idle", "armed", "receiving", "verifying", "done", "failed" };
+    printf("{\"state\":\"%s\",\"restarted\":%s,\"installed\":%s,\"trial\":%s,\"running_md5\":\"%s\",\"bytes\":%u,"
+           "\"blocks\":%u,\"recovered\":%u,\"duplicates\":%u,\"nacks\":%u,\"rounds\":%u,\"erase_us\":%u,\"total_us\":%u}\n",
+           states[serviceState], restarted ? "true" : "false", running == announced ? "true" : "false",
+           trial ? "true" : "false", running.c_str(), stats.bytes, stats.blocks, stats.recovered, stats.duplicates,
+           stats.nacks, stats.rounds, stats.erase, stats.total);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // a test image for the tools, ota_host_test image <size> <seed> > sketch.bin
+    if(argc == 4 && strcmp(argv[1], "image") == 0) {
+        std::string image = makeImage(strtoul(argv[2], NULL, 0) & ~15UL, strtoul(argv[3], NULL, 0));
+        fwrite(image.data(), 1, image.size(), stdout);
+        return 0;
+    }
+    if(argc >= 2 && strcmp(argv[1], "multicast") == 0) {
+        return runPipe(argc >= 3 && strcmp(argv[2], "cancel") == 0);
+    }
+
+    hostServe(OTA_SERVER, OTA_PORT, serve);
+    uploadListen();
+    multicastListen();
+
+    // v1 is on the board, flashed over serial
+    std::string v1 = makeImage(307760, 1);
+    memcpy(hostFlash(), v1.data(), v1.size());
+    hostBoot(REASON_DEFAULT_RST);
+    publish(v1);
+
+    if(argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return runBench();
+    }
+
+    testSensors();
+    testUpdate(makeImage(330000, 2));
+    testNotModified(makeImage(330000, 2));
+    testResume(makeImage(350000, 3));
+    testTrialSleep(makeImage(350000, 3), makeImage(340000, 6), makeImage(345000 - 8, 7));
+    testStaleMD5(makeImage(350000, 3));
+    testIde(makeImage(340000, 8), makeImage(320000, 9));
+    testIdeCancel(makeImage(320000, 9), makeImage(330000, 10));
+    testMulticast(makeImage(340000, 11));
+    testMulticastCancel(makeImage(340000, 11), makeImage(330000, 12));
+    testSmallImage(makeImage(1572000, 4), makeImage(60000, 5));
+    testLzss(makeCompressible(65536, 13));
+    testCompressed(makeCompressible(330000, 14));
+    testDelta(makeCompressible(320000, 15));
+    testResumeRandom(makeImage(350000, 18), 0x5EED);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""
+Load generator for an update server, simulating a fleet of devices
+checking in with the requests of ESP8266httpUpdate.
+
+  ota_load.py [--url http://127.0.0.1:8080/update] [--devices 2000]
+              [--concurrency 256] [--spread 0] [--outdated 0.05] [--etag]
+  ota_load.py --serve sketch.bin [ota_server.py options] ...
+
+Every device sends one check-in with its own MAC. A share of them
+(--outdated) runs an older sketch and downloads the image, the others
+already run the release; with --etag they send If-None-Match like
+lightCheck(). --spread spreads the check-ins over that many seconds,
+0 starts them together like a fleet waking up at the same time.
+
+--serve runs ota_server.py on a free loopback port in this process, with
+--rollout, --max-downloads and --retry-after passed through.
+
+The result is a JSON line with the latency percentiles (connect to last
+byte, in ms) overall and per status code, and the Retry-After values seen.
+"""
+
+import argparse
+import asyncio
+import hashlib
+import json
+import os
+import random
+import sys
+import threading
+import time
+from urllib.parse import urlparse
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    k = min(len(values) - 1, max(0, int(round(p / 100.0 * len(values) + 0.5)) - 1))
+    return values[k]
+
+
+def summary(values):
+    return {"n": len(values), "p50_ms": round(percentile(values, 50), 2), "p90_ms": round(percentile(values, 90), 2),
+            "p99_ms": round(percentile(values, 99), 2), "max_ms": round(max(values), 2) if values else 0}
+
+
+def device_headers(index, sketch_md5, etag, version):
+    mac = "18:FE:34:%02X:%02X:%02X" % ((index >> 16) & 0xff, (index >> 8) & 0xff, index & 0xff)
+    headers = [
+        ("User-Agent", "ESP8266-http-Update"),
+        ("x-ESP8266-STA-MAC", mac),
+        ("x-ESP8266-AP-MAC", "1A" + mac[2:]),
+        ("x-ESP8266-free-space", "671744"),
+        ("x-ESP8266-sketch-size", "373940"),
+        ("x-ESP8266-sketch-md5", sketch_md5),
+        ("x-ESP8266-chip-size", "4194304"),
+        ("x-ESP8266-sdk-version", "2.2.1"),
+        ("x-ESP8266-compression", "espz"),
+        ("x-ESP8266-mode", "sketch"),
+        ("x-ESP8266-version", version),
+    ]
+    if etag:
+        headers.append(("If-None-Match", etag))
+    return headers
+
+
+async def read_body(reader, headers):
+    if headers.get("transfer-encoding", "").lower() == "chunked":
+        total = 0
+        while True:
+            size = int((await reader.readline()).split(b";")[0], 16)
+            if size == 0:
+                await reader.readline()
+                return total
+            total += len(await reader.readexactly(size))
+            await reader.readline()
+    length = int(headers.get("content-length", "0"))
+    if length:
+        await reader.readexactly(length)
+    return length
+
+
+async def check_in(url, headers, timeout):
+    """Returns (status, ms, bytes, Retry-After or None), status 0 on errors"""
+    start = time.perf_counter()
+    writer = None
+    try:
+        reader, writer = await asyncio.wait_for(asyncio.open_connection(url.hostname, url.port or 80), timeout)
+        request = "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n" % (url.path or "/", url.netloc)
+        request += "".join("%s: %s\r\n" % header for header in headers) + "\r\n"
+        writer.write(request.encode())
+        status_line = await asyncio.wait_for(reader.readline(), timeout)
+        status = int(status_line.split()[1])
+        response = {}
+        while True:
+            line = (await asyncio.wait_for(reader.readline(), timeout)).decode().strip()
+            if not line:
+                break
+            name, _, value = line.partition(":")
+            response[name.strip().lower()] = value.strip()
+        size = 0 if status == 304 else await asyncio.wait_for(read_body(reader, response), timeout)
+        retry_after = response.get("retry-after")
+        return status, (time.perf_counter() - start) * 1000, size, int(retry_after) if retry_after else None
+    except (OSError, ValueError, IndexError, asyncio.TimeoutError, asyncio.IncompleteReadError):
+        return 0, (time.perf_counter() - start) * 1000, 0, None
+    finally:
+        if writer is not None:
+            writer.close()
+
+
+async def probe(url, timeout):
+    """Release MD5 and ETag from the /stats of ota_server.py, empty if unknown"""
+    stats_url = urlparse("%s://%s/stats" % (url.scheme, url.netloc))
+    try:
+        reader, writer = await asyncio.open_connection(stats_url.hostname, stats_url.port or 80)
+        writer.write(("GET /stats HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % url.netloc).encode())
+        data = await asyncio.wait_for(reader.read(), timeout)
+        writer.close()
+        stats = json.loads(data.split(b"\r\n\r\n", 1)[1])
+        return stats["release"], stats["etag"]
+    except (OSError, ValueError, KeyError, IndexError, asyncio.TimeoutError):
+        return "", ""
+
+
+async def run(args):
+    url = urlparse(args.url)
+    release, etag = await probe(url, args.timeout)
+    rng = random.Random(args.seed)
+    semaphore = asyncio.Semaphore(args.concurrency)
+    results = []
+
+    async def device(index):
+        outdated = rng.random() < args.outdated or not release
+        sketch_md5 = hashlib.md5(b"old%d" % index).hexdigest() if outdated else release
+        headers = device_headers(index, sketch_md5, etag if args.etag and not outdated else "", args.version)
+        delay = rng.uniform(0, args.spread) if args.spread else 0
+        await asyncio.sleep(delay)
+        async with semaphore:
+            results.append(await check_in(url, headers, args.timeout))
+
+    start = time.perf_counter()
+    await asyncio.gather(*(device(i) for i in range(args.devices)))
+    elapsed = time.perf_counter() - start
+
+    by_status = {}
+    for status, ms, _, _ in results:
+        by_status.setdefault(str(status), []).append(ms)
+    retry = [r for _, _, _, r in results if r is not None]
+    return {
+        "ota": "load", "devices": args.devices, "concurrency": args.concurrency, "spread_s": args.spread,
+        "elapsed_s": round(elapsed, 3), "checkins_per_s": round(len(results) / elapsed, 1) if elapsed else 0,
+        "bytes": sum(size for _, _, size, _ in results),
+        "latency": summary([ms for _, ms, _, _ in results]),
+        "status": dict((status, summary(values)) for status, values in sorted(by_status.items())),
+        "retry_after_s": {"n": len(retry), "min": min(retry), "max": max(retry)} if retry else {"n": 0},
+    }
+
+
+def serve(args):
+    from ota_server import Release, Rollout, UpdateServer
+    with open(args.serve, "rb") as f:
+        release = Release(f.read())
+    server = UpdateServer(("127.0.0.1", 0), release, Rollout(args.rollout), args.retry_after,
+                          max_downloads=args.max_downloads)
+    thread = threading.Thread(target=server.serve_forever)
+    thread.daemon = True
+    thread.start()
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate a fleet of devices checking in for updates")
+    parser.add_argument("--url", default="http://127.0.0.1:8080/update")
+    parser.add_argument("--devices", type=int, default=2000)
+    parser.add_argument("--concurrency", type=int, default=256, help="open connections at most")
+    parser.add_argument("--spread", type=float, default=0, help="seconds the check-ins are spread over")
+    parser.add_argument("--outdated", type=float, default=0.05, help="share of devices running an old sketch")
+    parser.add_argument("--etag", action="store_true", help="up to date devices send If-None-Match")
+    parser.add_argument("--version", default="1.0.0", help="x-ESP8266-version")
+    parser.add_argument("--timeout", type=float, default=30)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--serve", default=None, help="run ota_server.py with this image on loopback")
+    parser.add_argument("--rollout", default="100")
+    parser.add_argument("--retry-after", type=int, default=0)
+    parser.add_argument("--max-downloads", type=int, default=0)
+    args = parser.parse_args()
+
+    server = None
+    if args.serve:
+        server = serve(args)
+        args.url = "http://127.0.0.1:%d/update" % server.server_address[1]
+    try:
+        result = asyncio.run(run(args))
+    finally:
+        if server:
+            server.shutdown()
+    if server:
+        result["server"] = server.stats.snapshot()["counters"]
+    print(json.dumps(result, sort_keys=True))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,593 @@
+#!/usr/bin/env python3
+"""
+Multicast sender for MulticastOTA (AgruminoOTA::multicastUpdate), and a
+lossy network simulator for it.
+
+  ota_multicast.py send [--group 239.255.82.66] [--port 8267] [--ttl 1]
+                        [--iface 192.168.1.10] [--rate 40] [--fec 8]
+                        [--expect 30] [--key secret.key] sketch.bin
+  ota_multicast.py simulate [--boards 30] [--loss 0.02] [--burst 4]
+                            [--uplink-loss 0.02] [--late 0.1] sketch.bin
+  ota_multicast.py host [--harness ./ota_host_test] [--loss 0.02] [--burst 4]
+                        [--uplink-loss 0.02] [--cancel] sketch.bin
+
+The image is sent once to every board in numbered blocks (--block bytes),
+with the XOR of every --fec blocks after them: a board that lost one block
+of a group rebuilds it from the parity and the blocks it already wrote.
+Each round ends with a round packet, boards answer within --window ms with
+the ranges they still miss (NACK) or, once the image is verified, with
+their status. The next round sends the missed blocks again with the parity
+of their groups, until a round gets no NACK (and --expect boards answered)
+or --rounds is reached.
+
+Before the first block the image is announced for --lead seconds, the
+boards erase the staging area meanwhile. Announces are repeated during the
+transfer so late boards join and NACK what they missed.
+
+Packets start with a 16 byte little endian header: "MOTA", type, fec,
+block size, session, seq (see MulticastOTA.cpp).
+
+simulate runs the same sender against simulated boards on a virtual
+clock, with Gilbert-Elliott loss per board (--loss on average, in bursts
+of --burst packets), lost replies (--uplink-loss) and boards joining
+after the start (--late), and compares the bytes sent with one unicast
+transfer per board.
+
+host runs the same sender against the real MulticastOTA.cpp, compiled in
+tools/ota_host_test.cpp (the build command is at its top) and driven over
+its stdin: the datagrams go through lwIP to one board on the virtual clock
+of the harness, with the same losses. The board installs the image, or with
+--cancel has its onEnd drop it. The image has to be a sketch for a 4M
+board, "ota_host_test image 340000 11 > sketch.bin" writes one.
+
+The result is a single JSON line.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import random
+import select
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+MAGIC = b"MOTA"
+HEADER = struct.Struct("<4sBBHII")
+ANNOUNCE, DATA, PARITY, ROUND, NACK, DONE = b"S", b"D", b"P", b"R", b"N", b"K"
+
+STATUS_INSTALLED = 0
+STATUS_CURRENT = 1
+STATUS_ERROR = 0x100
+ERRORS = ["begin", "receive", "verify", "flash", "signature", "image"]
+
+FLASH_SECTOR = 4096
+ERASE_S = 0.045  # one sector on the ESP8266 flash chips
+
+
+def status_name(status):
+    if status == STATUS_INSTALLED:
+        return "installed"
+    if status == STATUS_CURRENT:
+        return "current"
+    error = status - STATUS_ERROR
+    return "error_" + (ERRORS[error] if 0 <= error < len(ERRORS) else str(error))
+
+
+def xor_into(target, data):
+    for i, b in enumerate(data):
+        target[i] ^= b
+
+
+class Image(object):
+    def __init__(self, image, block, fec, session, signature=""):
+        if block % 4 or FLASH_SECTOR % block or block > 1024:
+            raise ValueError("the block size has to divide 4096, up to 1024")
+        if not 1 <= fec <= 255:
+            raise ValueError("fec is 1 to 255 blocks per parity")
+        self.image = image
+        self.block = block
+        self.fec = fec
+        self.session = session
+        self.md5 = hashlib.md5(image).hexdigest()
+        self.signature = signature
+        self.blocks = (len(image) + block - 1) // block
+
+    def header(self, kind, seq):
+        return HEADER.pack(MAGIC, ord(kind), self.fec, self.block, self.session, seq)
+
+    def announce(self):
+        sig = self.signature.encode()
+        return self.header(ANNOUNCE, 0) + struct.pack("<I", len(self.image)) + self.md5.encode() + bytes([len(sig)]) + sig
+
+    def data(self, index):
+        return self.header(DATA, index) + self.image[index * self.block:(index + 1) * self.block]
+
+    def parity(self, group):
+        parity = bytearray(self.block)
+        for index in range(group * self.fec, min((group + 1) * self.fec, self.blocks)):
+            xor_into(parity, self.image[index * self.block:(index + 1) * self.block])
+        return self.header(PARITY, group) + bytes(parity)
+
+    def round_end(self, number, window_ms):
+        return self.header(ROUND, number) + struct.pack("<H", window_ms)
+
+
+def parse(packet):
+    """(type, fec, block, session, seq, payload), None if not a MulticastOTA packet"""
+    if len(packet) < HEADER.size:
+        return None
+    magic, kind, fec, block, session, seq = HEADER.unpack_from(packet)
+    if magic != MAGIC:
+        return None
+    return bytes([kind]), fec, block, session, seq, packet[HEADER.size:]
+
+
+class Sender(object):
+    def __init__(self, image, transport, lead=6.0, window_ms=500, rounds=20, expect=0, announce_every=64):
+        self.image = image
+        self.transport = transport
+        self.lead = lead
+        self.window_ms = window_ms
+        self.max_rounds = rounds
+        self.expect = expect
+        self.announce_every = announce_every
+        self.packets = 0
+        self.bytes = 0
+        self.done = {}
+        self.nacks = 0
+        self.resent = 0
+
+    def _emit(self, packet):
+        self.transport.send(packet)
+        self.packets += 1
+        self.bytes += len(packet)
+
+    def _send(self, packet):
+        self._emit(packet)
+        # late boards join on the next announce and NACK what they missed
+        if self.packets % self.announce_every == 0:
+            self._emit(self.image.announce())
+
+    def _collect(self, timeout):
+        missing = set()
+        for address, packet in self.transport.receive(timeout):
+            fields = parse(packet)
+            if not fields or fields[3] != self.image.session:
+                continue
+            kind, _, _, _, seq, payload = fields
+            if kind == NACK:
+                self.nacks += 1
+                for i in range(min(seq, len(payload) // 8)):
+                    first, count = struct.unpack_from("<II", payload, 8 * i)
+                    missing.update(b for b in range(first, first + count) if b < self.image.blocks)
+            elif kind == DONE:
+                self.done[address] = seq
+        return missing
+
+    def _send_blocks(self, blocks):
+        groups = sorted(set(b // self.image.fec for b in blocks))
+        wanted = set(blocks)
+        for group in groups:
+            first = group * self.image.fec
+            for index in range(first, min(first + self.image.fec, self.image.blocks)):
+                if index in wanted:
+                    self._send(self.image.data(index))
+            self._send(self.image.parity(group))
+
+    def run(self):
+        start = self.transport.now()
+        announce = self.image.announce()
+        while self.transport.now() - start < self.lead:
+            self._emit(announce)
+            self._collect(0.5)
+
+        blocks = list(range(self.image.blocks))
+        rounds = 0
+        quiet = 0
+        while rounds < self.max_rounds:
+            rounds += 1
+            if blocks:
+                self._send_blocks(blocks)
+                if rounds > 1:
+                    self.resent += len(blocks)
+            self._emit(self.image.round_end(rounds, self.window_ms))
+            missing = self._collect(self.window_ms / 1000.0)
+            blocks = sorted(missing)
+            if blocks:
+                quiet = 0
+                continue
+            quiet += 1
+            if self.expect and len(self.done) >= self.expect:
+                break
+            # a quiet round may have lost every NACK, one more confirms it
+            if not self.expect and quiet >= 2:
+                break
+
+        statuses = {}
+        for status in self.done.values():
+            name = status_name(status)
+            statuses[name] = statuses.get(name, 0) + 1
+        return {
+            "image_bytes": len(self.image.image), "blocks": self.image.blocks, "block": self.image.block,
+            "fec": self.image.fec, "rounds": rounds, "packets": self.packets, "bytes_sent": self.bytes,
+            "resent_blocks": self.resent, "nacks": self.nacks, "boards": statuses,
+            "missing_blocks": len(blocks), "elapsed_s": round(self.transport.now() - start, 3),
+        }
+
+
+class UdpTransport(object):
+    """Multicast out, unicast replies back on the same socket, paced to rate KB/s"""
+
+    def __init__(self, group, port, ttl, iface, rate):
+        self.group = (group, port)
+        self.rate = rate * 1024.0
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, ttl)
+        if iface:
+            self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(iface))
+        self.sock.bind((iface or "", 0))
+        self.started = time.monotonic()
+        self.sent = 0
+
+    def now(self):
+        return time.monotonic()
+
+    def send(self, packet):
+        self.sock.sendto(packet, self.group)
+        self.sent += len(packet)
+        ahead = self.sent / self.rate - (time.monotonic() - self.started)
+        if ahead > 0:
+            time.sleep(ahead)
+
+    def receive(self, timeout):
+        replies = []
+        deadline = time.monotonic() + timeout
+        while True:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                break
+            ready, _, _ = select.select([self.sock], [], [], left)
+            if ready:
+                packet, address = self.sock.recvfrom(2048)
+                replies.append((address[0], packet))
+        # the pacing restarts after the pause, it is not caught up in a burst
+        self.started = time.monotonic()
+        self.sent = 0
+        return replies
+
+
+class GilbertElliott(object):
+    """Average loss in bursts of the given mean length"""
+
+    def __init__(self, rng, loss, burst):
+        self.rng = rng
+        self.bad = False
+        burst = max(1.0, burst)
+        self.leave = 1.0 / burst
+        self.enter = loss * self.leave / (1.0 - loss) if loss < 1 else 1.0
+
+    def lost(self):
+        if self.bad:
+            self.bad = self.rng.random() >= self.leave
+        else:
+            self.bad = self.rng.random() < self.enter
+        return self.bad
+
+
+class SimBoard(object):
+    """What MulticastOTA.cpp does with the packets, without the flash"""
+
+    def __init__(self, name, running_md5, channel, join_at):
+        self.name = name
+        self.running_md5 = running_md5
+        self.channel = channel
+        self.join_at = join_at
+        self.session = None
+        self.state = "idle"
+        self.status = None
+        self.busy_until = 0.0
+        self.nack_at = None
+        self.stats = {"blocks": 0, "recovered": 0, "duplicates": 0, "dropped_busy": 0, "lost": 0}
+
+    def receive(self, now, packet, reply):
+        if now < self.join_at:
+            return
+        if self.channel.lost():
+            self.stats["lost"] += 1
+            return
+        if now < self.busy_until:
+            self.stats["dropped_busy"] += 1  # erasing, the lwIP buffers ran out
+            return
+        fields = parse(packet)
+        if not fields:
+            return
+        kind, fec, block, session, seq, payload = fields
+        if kind == ANNOUNCE:
+            if session != self.session or self.state == "idle":
+                self.session = session
+                self._announce(now, fec, block, payload, reply)
+            return
+        if session != self.session or self.state == "idle":
+            return
+        if kind == DATA and self.state == "receiving":
+            self._data(seq, payload)
+        elif kind == PARITY and self.state == "receiving":
+            self._parity(seq, payload)
+        elif kind == ROUND:
+            if self.state == "finished":
+                reply(self._done())
+            else:
+                window = struct.unpack_from("<H", payload)[0]
+                self.nack_at = now + random.random() * window / 2000.0
+
+    def _announce(self, now, fec, block, payload, reply):
+        size = struct.unpack_from("<I", payload)[0]
+        self.md5 = payload[4:36].decode()
+        self.fec, self.block, self.size = fec, block, size
+        if self.md5 == self.running_md5:
+            self.state, self.status = "finished", STATUS_CURRENT
+            reply(self._done())
+            return
+        self.blocks = (size + block - 1) // block
+        self.have = [None] * self.blocks
+        self.received = 0
+        self.state = "receiving"
+        sectors = (size + FLASH_SECTOR - 1) // FLASH_SECTOR
+        self.busy_until = now + sectors * ERASE_S
+
+    def _length(self, index):
+        return min(self.block, self.size - index * self.block)
+
+    def _data(self, index, payload):
+        if index >= self.blocks or len(payload) != self._length(index):
+            return
+        if self.have[index] is not None:
+            self.stats["duplicates"] += 1
+            return
+        self.stats["blocks"] += 1
+        self._write(index, bytes(payload))
+
+    def _parity(self, group, payload):
+        first = group * self.fec
+        if len(payload) != self.block or first >= self.blocks:
+            return
+        blocks = range(first, min(first + self.fec, self.blocks))
+        missing = [b for b in blocks if self.have[b] is None]
+        if len(missing) != 1:
+            return
+        data = bytearray(payload)
+        for index in blocks:
+            if index != missing[0]:
+                xor_into(data, self.have[index])
+        self.stats["recovered"] += 1
+        self._write(missing[0], bytes(data[:self._length(missing[0])]))
+
+    def _write(self, index, data):
+        self.have[index] = data
+        self.received += 1
+        if self.received == self.blocks:
+            image = b"".join(self.have)
+            ok = hashlib.md5(image).hexdigest() == self.md5
+            self.state = "finished"
+            self.status = STATUS_INSTALLED if ok else STATUS_ERROR + ERRORS.index("verify")
+            self.nack_at = None
+
+    def _done(self):
+        return HEADER.pack(MAGIC, ord(DONE), self.fec, self.block, self.session, self.status)
+
+    def nack(self, now):
+        if self.nack_at is None or now < self.nack_at or self.state != "receiving":
+            return None
+        self.nack_at = None
+        ranges = []
+        index = 0
+        while index < self.blocks and len(ranges) < 128:
+            if self.have[index] is not None:
+                index += 1
+                continue
+            first = index
+            while index < self.blocks and self.have[index] is None:
+                index += 1
+            ranges.append(struct.pack("<II", first, index - first))
+        return HEADER.pack(MAGIC, ord(NACK), self.fec, self.block, self.session, len(ranges)) + b"".join(ranges)
+
+
+class SimTransport(object):
+    """Virtual clock, each packet takes its size over the rate to send"""
+
+    def __init__(self, boards, rate, uplink_loss, rng):
+        self.boards = boards
+        self.rate = rate * 1024.0
+        self.uplink_loss = uplink_loss
+        self.rng = rng
+        self.clock = 0.0
+        self.replies = []
+
+    def now(self):
+        return self.clock
+
+    def _reply(self, board):
+        def reply(packet):
+            if self.rng.random() >= self.uplink_loss:
+                self.replies.append((board.name, packet))
+        return reply
+
+    def send(self, packet):
+        self.clock += len(packet) / self.rate
+        for board in self.boards:
+            board.receive(self.clock, packet, self._reply(board))
+
+    def receive(self, timeout):
+        end = self.clock + timeout
+        for board in self.boards:
+            packet = board.nack(end)
+            if packet is not None:
+                self._reply(board)(packet)
+        self.clock = end
+        replies, self.replies = self.replies, []
+        return replies
+
+
+class HostTransport(object):
+    """The board of ota_host_test, its clock is the virtual one of the harness"""
+
+    def __init__(self, harness, cancel, rate, channel, uplink_loss, rng):
+        command = [harness, "multicast"] + (["cancel"] if cancel else [])
+        self.proc = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE, universal_newlines=True)
+        self.rate = rate * 1024.0
+        self.channel = channel
+        self.uplink_loss = uplink_loss
+        self.rng = rng
+        self.clock = 0.0
+        self.replies = []
+
+    def now(self):
+        return self.clock
+
+    def _run(self, seconds):
+        self.proc.stdin.write("W %d\n" % int(seconds * 1e6))
+        self.proc.stdin.flush()
+        while True:
+            line = self.proc.stdout.readline()
+            if not line:
+                raise RuntimeError("ota_host_test ended")
+            kind, value = line.split()
+            if kind == "T":
+                self.clock = int(value) / 1e6
+                return
+            if self.rng.random() >= self.uplink_loss:
+                self.replies.append(("board", bytes.fromhex(value)))
+
+    def send(self, packet):
+        if not self.channel.lost():
+            self.proc.stdin.write("S %s\n" % packet.hex())
+        self._run(len(packet) / self.rate)
+
+    def receive(self, timeout):
+        self._run(timeout)
+        replies, self.replies = self.replies, []
+        return replies
+
+    def close(self):
+        """The result of the board"""
+        out, _ = self.proc.communicate("E\n")
+        lines = out.strip().splitlines()
+        if self.proc.returncode or not lines:
+            raise RuntimeError("ota_host_test failed")
+        return json.loads(lines[-1])
+
+
+def make_image(args):
+    with open(args.image, "rb") as f:
+        data = f.read()
+    signature = ""
+    if args.key:
+        from ota_sign import read_seed, sign_image
+        signature = sign_image(read_seed(args.key), data)
+    session = args.session if args.session else random.SystemRandom().randrange(1, 1 << 32)
+    return Image(data, args.block, args.fec, session, signature)
+
+
+def send(args):
+    image = make_image(args)
+    transport = UdpTransport(args.group, args.port, args.ttl, args.iface, args.rate)
+    sys.stderr.write("sending %s (%d bytes, md5 %s) to %s:%d\n" % (args.image, len(image.image), image.md5,
+                                                                 args.group, args.port))
+    result = Sender(image, transport, args.lead, args.window, args.rounds, args.expect).run()
+    result["ota"] = "multicast"
+    print(json.dumps(result, sort_keys=True))
+    return 0 if not result["missing_blocks"] else 1
+
+
+def simulate(args):
+    image = make_image(args)
+    rng = random.Random(args.seed)
+    random.seed(args.seed)
+    boards = []
+    for i in range(args.boards):
+        join_at = rng.uniform(args.lead, args.lead + len(image.image) / (args.rate * 1024.0)) if rng.random() < args.late else 0
+        running = image.md5 if rng.random() < args.current else "0" * 32
+        boards.append(SimBoard("board%03d" % i, running, GilbertElliott(rng, args.loss, args.burst), join_at))
+    transport = SimTransport(boards, args.rate, args.uplink_loss, rng)
+    result = Sender(image, transport, args.lead, args.window, args.rounds, args.boards).run()
+
+    unicast = len(image.image) * sum(1 for b in boards if b.running_md5 != image.md5)
+    totals = {}
+    for board in boards:
+        for key, value in board.stats.items():
+            totals[key] = totals.get(key, 0) + value
+    result.update({
+        "ota": "multicast_sim", "loss": args.loss, "burst": args.burst, "uplink_loss": args.uplink_loss,
+        "installed": sum(1 for b in boards if b.status == STATUS_INSTALLED),
+        "unfinished": sum(1 for b in boards if b.state != "finished"),
+        "unicast_bytes": unicast, "unicast_s": round(unicast / (args.rate * 1024.0), 3),
+        "bytes_vs_unicast": round(result["bytes_sent"] / float(unicast), 3) if unicast else 0,
+        "board_totals": totals,
+    })
+    print(json.dumps(result, sort_keys=True))
+    return 0 if not result["unfinished"] else 1
+
+
+def host(args):
+    image = make_image(args)
+    rng = random.Random(args.seed)
+    transport = HostTransport(args.harness, args.cancel, args.rate, GilbertElliott(rng, args.loss, args.burst),
+                              args.uplink_loss, rng)
+    result = Sender(image, transport, args.lead, args.window, args.rounds, 1).run()
+    board = transport.close()
+    result.update({"ota": "multicast_host", "loss": args.loss, "burst": args.burst, "uplink_loss": args.uplink_loss,
+                   "board": board})
+    print(json.dumps(result, sort_keys=True))
+    if args.cancel:
+        return 0 if result["boards"].get("error_verify") and not board["restarted"] else 1
+    return 0 if board["installed"] else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Multicast a sketch to MulticastOTA boards")
+    sub = parser.add_subparsers(dest="command")
+    sub.required = True
+    for name in ("send", "simulate", "host"):
+        p = sub.add_parser(name)
+        p.add_argument("image")
+        p.add_argument("--block", type=int, default=1024, help="bytes per block, divides 4096")
+        p.add_argument("--fec", type=int, default=8, help="blocks per XOR parity block")
+        p.add_argument("--rate", type=float, default=40, help="KB/s, what the boards write without dropping")
+        p.add_argument("--lead", type=float, default=6, help="seconds of announces before the first block")
+        p.add_argument("--window", type=int, default=500, help="ms the boards have to answer a round")
+        p.add_argument("--rounds", type=int, default=20)
+        p.add_argument("--key", default=None, help="ota_sign.py key, for boards with setPublicKey()")
+        p.add_argument("--session", type=int, default=0, help="session id, random by default")
+    p = sub.choices["send"]
+    p.add_argument("--group", default="239.255.82.66")
+    p.add_argument("--port", type=int, default=8267)
+    p.add_argument("--ttl", type=int, default=1)
+    p.add_argument("--iface", default=None, help="address of the interface to send from")
+    p.add_argument("--expect", type=int, default=0, help="boards that have to answer before stopping")
+    p = sub.choices["simulate"]
+    p.add_argument("--boards", type=int, default=30)
+    p.add_argument("--loss", type=float, default=0.02, help="average packet loss per board")
+    p.add_argument("--burst", type=float, default=4, help="mean length of the loss bursts, in packets")
+    p.add_argument("--uplink-loss", type=float, default=0.02, help="loss of the NACKs and status replies")
+    p.add_argument("--late", type=float, default=0.1, help="share of the boards joining during the transfer")
+    p.add_argument("--current", type=float, default=0.0, help="share of the boards already running the image")
+    p.add_argument("--seed", type=int, default=1)
+    p = sub.choices["host"]
+    p.add_argument("--harness", default="./ota_host_test", help="tools/ota_host_test.cpp built")
+    p.add_argument("--loss", type=float, default=0.02, help="average packet loss")
+    p.add_argument("--burst", type=float, default=4, help="mean length of the loss bursts, in packets")
+    p.add_argument("--uplink-loss", type=float, default=0.02, help="loss of the NACKs and status replies")
+    p.add_argument("--cancel", action="store_true", help="the onEnd of the board drops the staged sketch")
+    p.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    return {"send": send, "simulate": simulate, "host": host}[args.command](args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
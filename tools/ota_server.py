@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+"""
+Reference update server for ESP8266httpUpdate (AgruminoOTA::httpUpdate).
+
+  ota_server.py [-p 8080] [--rollout 10[:10:60]] [--retry-after 3600]
+                [--max-downloads 20] [--base old.bin] [--compress]
+                [--key secret.key] [--chunked] sketch.bin
+
+Every GET is answered from the x-ESP8266-* headers sent by handleUpdate:
+
+  304  the device runs the release (x-ESP8266-sketch-md5, or If-None-Match
+       with the release ETag), or it is not in the rollout yet
+  200  the release: the plain image, a compressed one (--compress, when
+       x-ESP8266-compression has espz) or a delta patch against --base
+       (x-ESP8266-delta: 1 and the device runs base)
+  206  the rest of the plain image for a Range request (resumed download)
+  403  not an ESP8266, SPIFFS request, or the image does not fit
+  503  more than --max-downloads images on the way, with Retry-After
+
+Staged rollout: a device takes part when a hash of its chip ID (the last
+three bytes of x-ESP8266-STA-MAC) and of the release MD5 falls below the
+rollout percentage, so each release picks another first group and a device
+stays in once it is in. "--rollout 10:10:60" starts at 10% and adds 10%
+every 60 minutes. Devices left out get 304 and, with --retry-after, the
+delay before their next check.
+
+Every answer is a single JSON line on stdout with -v, GET /stats returns
+the counters. The image ETag is the release MD5, the same for the plain,
+compressed and delta answers: they all install the same sketch.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+USER_AGENT = "ESP8266-http-Update"
+CHUNK = 1460
+
+# flash size field of the image header (magic byte 3, high nibble) in bytes
+FLASH_SIZES = {0: 512 << 10, 1: 256 << 10, 2: 1 << 20, 3: 2 << 20, 4: 4 << 20, 8: 8 << 20, 9: 16 << 20}
+
+
+def chip_id(sta_mac):
+    """ESP.getChipId(), the last three bytes of the station MAC"""
+    fields = sta_mac.split(":")
+    if len(fields) != 6:
+        return None
+    try:
+        return int("".join(fields[3:]), 16)
+    except ValueError:
+        return None
+
+
+def rollout_bucket(chip, release_md5):
+    """0-99, stable for a chip within a release"""
+    digest = hashlib.sha256(("%06x:%s" % (chip, release_md5)).encode()).digest()
+    return int.from_bytes(digest[:4], "big") % 100
+
+
+class Rollout(object):
+    """START[:STEP:MINUTES] percent of the devices, growing with time"""
+
+    def __init__(self, spec, now=None):
+        fields = [float(f) for f in spec.split(":")]
+        if len(fields) not in (1, 3):
+            raise ValueError("rollout is START or START:STEP:MINUTES")
+        self.start = fields[0]
+        self.step = fields[1] if len(fields) == 3 else 0
+        self.minutes = fields[2] if len(fields) == 3 else 0
+        self.started = now if now is not None else time.time()
+
+    def percent(self, now=None):
+        elapsed = (now if now is not None else time.time()) - self.started
+        steps = int(elapsed // (self.minutes * 60)) if self.minutes > 0 else 0
+        return min(100.0, self.start + steps * self.step)
+
+
+class Release(object):
+    def __init__(self, image, base=None, compress=False, key=None):
+        self.image = image
+        self.md5 = hashlib.md5(image).hexdigest()
+        self.etag = '"%s"' % self.md5
+        self.flash_size = FLASH_SIZES.get(image[3] >> 4, 0) if len(image) > 3 and image[0] == 0xE9 else 0
+        self.compressed = None
+        self.delta = None
+        self.base_md5 = None
+        self.signature = None
+        if compress:
+            from ota_compress import compress as lzss
+            self.compressed = lzss(image, 11, 4)
+            if len(self.compressed) >= len(image):
+                self.compressed = None
+        if base is not None:
+            from ota_delta import make
+            self.delta = make(base, image)
+            self.base_md5 = hashlib.md5(base).hexdigest()
+        if key:
+            from ota_sign import read_seed, sign_image
+            self.signature = sign_image(read_seed(key), image)
+
+
+class Stats(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.counters = {}
+        self.active = 0
+        self.bytes = 0
+
+    def count(self, outcome, sent=0):
+        with self.lock:
+            self.counters[outcome] = self.counters.get(outcome, 0) + 1
+            self.bytes += sent
+
+    def begin_download(self, limit):
+        with self.lock:
+            if limit and self.active >= limit:
+                return False
+            self.active += 1
+            return True
+
+    def end_download(self):
+        with self.lock:
+            self.active -= 1
+
+    def snapshot(self):
+        with self.lock:
+            return {"counters": dict(self.counters), "active": self.active, "bytes": self.bytes}
+
+
+class UpdateHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "ota_server"
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def _answer(self, code, outcome, headers=None, body=b""):
+        self.send_response(code)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        if code != 304:
+            self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if body:
+            self.wfile.write(body)
+        self._log(code, outcome, len(body))
+
+    def _log(self, code, outcome, sent):
+        self.server.stats.count(outcome, sent)
+        if self.server.verbose:
+            print(json.dumps({"ota": "server", "code": code, "outcome": outcome, "bytes": sent,
+                              "mac": self.headers.get("x-ESP8266-STA-MAC", ""),
+                              "version": self.headers.get("x-ESP8266-version", "")}), flush=True)
+
+    def do_GET(self):
+        if self.path == "/stats":
+            stats = self.server.stats.snapshot()
+            stats.update({"release": self.server.release.md5, "etag": self.server.release.etag,
+                          "rollout_percent": self.server.rollout.percent()})
+            return self._answer(200, "stats", {"Content-Type": "application/json"}, json.dumps(stats).encode())
+        self._update()
+
+    def _retry_after(self):
+        return {"Retry-After": str(self.server.retry_after)} if self.server.retry_after else {}
+
+    def _update(self):
+        release = self.server.release
+        headers = self.headers
+        chip = chip_id(headers.get("x-ESP8266-STA-MAC", ""))
+
+        if headers.get("User-Agent") != USER_AGENT or chip is None or "x-ESP8266-sketch-md5" not in headers:
+            return self._answer(403, "not_esp")
+        if headers.get("x-ESP8266-mode", "sketch") != "sketch":
+            return self._answer(403, "spiffs")
+
+        # cheapest answers first: most check-ins find nothing new
+        if headers.get("If-None-Match") == release.etag:
+            return self._answer(304, "etag", {"ETag": release.etag})
+        sketch_md5 = headers.get("x-ESP8266-sketch-md5", "").lower()
+        if sketch_md5 == release.md5:
+            return self._answer(304, "current", {"ETag": release.etag})
+        if rollout_bucket(chip, release.md5) >= self.server.rollout.percent():
+            return self._answer(304, "rollout", self._retry_after())
+
+        try:
+            free_space = int(headers.get("x-ESP8266-free-space", "0"))
+            chip_size = int(headers.get("x-ESP8266-chip-size", "0"))
+        except ValueError:
+            return self._answer(403, "bad_headers")
+        if len(release.image) > free_space or (release.flash_size and release.flash_size > chip_size):
+            return self._answer(403, "no_space")
+
+        body, kind, start = release.image, "image", 0
+        range_match = re.match(r"bytes=(\d+)-$", headers.get("Range", ""))
+        if range_match:
+            start = int(range_match.group(1))
+            if start >= len(release.image):
+                return self._answer(416, "bad_range", {"Content-Range": "bytes */%d" % len(release.image)})
+            kind = "resume"
+        elif release.delta is not None and headers.get("x-ESP8266-delta") == "1" and sketch_md5 == release.base_md5:
+            body, kind = release.delta, "delta"
+        elif release.compressed is not None and "espz" in headers.get("x-ESP8266-compression", ""):
+            body, kind = release.compressed, "compressed"
+
+        if not self.server.stats.begin_download(self.server.max_downloads):
+            return self._answer(503, "busy", {"Retry-After": str(self.server.busy_retry_after)})
+        try:
+            self._send_image(body, kind, start)
+        finally:
+            self.server.stats.end_download()
+
+    def _send_image(self, body, kind, start):
+        release = self.server.release
+        chunked = self.server.chunked and self.request_version == "HTTP/1.1"
+        self.send_response(206 if start else 200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("ETag", release.etag)
+        self.send_header("x-MD5", release.md5)
+        if release.signature:
+            self.send_header("x-Signature", release.signature)
+        if start:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, len(body) - 1, len(body)))
+        if chunked and not start:
+            self.send_header("Transfer-Encoding", "chunked")
+        else:
+            self.send_header("Content-Length", str(len(body) - start))
+        self.end_headers()
+
+        sent = 0
+        try:
+            for offset in range(start, len(body), CHUNK):
+                piece = body[offset:offset + CHUNK]
+                if chunked and not start:
+                    self.wfile.write(b"%x\r\n%s\r\n" % (len(piece), piece))
+                else:
+                    self.wfile.write(piece)
+                sent += len(piece)
+            if chunked and not start:
+                self.wfile.write(b"0\r\n\r\n")
+        except OSError:
+            self.close_connection = True
+            return self._log(200, kind + "_dropped", sent)
+        self._log(206 if start else 200, kind, sent)
+
+
+class UpdateServer(ThreadingHTTPServer):
+    daemon_threads = True
+    request_queue_size = 1024
+
+    def __init__(self, address, release, rollout, retry_after=0, busy_retry_after=60, max_downloads=0,
+                 chunked=False, verbose=False):
+        ThreadingHTTPServer.__init__(self, address, UpdateHandler)
+        self.release = release
+        self.rollout = rollout
+        self.retry_after = retry_after
+        self.busy_retry_after = busy_retry_after
+        self.max_downloads = max_downloads
+        self.chunked = chunked
+        self.verbose = verbose
+        self.stats = Stats()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Serve a sketch to ESP8266httpUpdate")
+    parser.add_argument("image")
+    parser.add_argument("-b", "--bind", default="0.0.0.0")
+    parser.add_argument("-p", "--port", type=int, default=8080)
+    parser.add_argument("--rollout", default="100", help="percent of the devices, START or START:STEP:MINUTES")
+    parser.add_argument("--retry-after", type=int, default=0, help="seconds sent to devices left out of the rollout")
+    parser.add_argument("--max-downloads", type=int, default=0, help="concurrent images, 0 for no limit")
+    parser.add_argument("--busy-retry-after", type=int, default=60, help="seconds sent with 503 when busy")
+    parser.add_argument("--base", default=None, help="sketch the devices run, delta patches are sent against it")
+    parser.add_argument("--compress", action="store_true", help="send the image compressed to devices that accept it")
+    parser.add_argument("--key", default=None, help="ota_sign.py key, the signature goes in x-Signature")
+    parser.add_argument("--chunked", action="store_true", help="Transfer-Encoding: chunked to HTTP/1.1 clients")
+    parser.add_argument("-v", "--verbose", action="store_true", help="a JSON line for every answer")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    base = None
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+    release = Release(image, base, args.compress, args.key)
+    server = UpdateServer((args.bind, args.port), release, Rollout(args.rollout), args.retry_after,
+                          args.busy_retry_after, args.max_downloads, args.chunked, args.verbose)
+    sys.stderr.write("serving %s (%d bytes, md5 %s) on %s:%d\n" % (args.image, len(image), release.md5,
+                                                                   args.bind, server.server_address[1]))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""
+Ed25519 signed sketches (see UpdateSignature.h).
+
+  ota_sign.py keygen secret.key      new key, prints the public key as a C array
+  ota_sign.py pubkey secret.key      prints the public key of an existing key
+  ota_sign.py sign secret.key image.bin
+  ota_sign.py verify secret.key image.bin signature
+
+The signature is over the SHA-256 of the image as it is written to flash:
+a compressed image (ota_compress.py) is signed over the decoded image, a
+delta patch (ota_delta.py) over the new sketch the patch rebuilds, so pass
+that sketch to sign. sign prints the 128 hex digits to send as the
+x-Signature header (httpUpdate), after the version in the ArduinoOTA
+invitation (espota2.py --signature) or as the signature query argument of
+the web updater.
+
+secret.key holds the 32 byte seed in hex. Keep it off the devices and out
+of the repository, the devices only get the public key.
+"""
+
+import argparse
+import hashlib
+import os
+import sys
+
+P = 2 ** 255 - 19
+L = 2 ** 252 + 27742317777372353535851937790883648493
+D = -121665 * pow(121666, P - 2, P) % P
+SQRT_M1 = pow(2, (P - 1) // 4, P)
+
+
+def _recover_x(y, sign):
+    x2 = (y * y - 1) * pow(D * y * y + 1, P - 2, P)
+    x = pow(x2, (P + 3) // 8, P)
+    if (x * x - x2) % P:
+        x = x * SQRT_M1 % P
+    if (x * x - x2) % P:
+        raise ValueError("not a curve point")
+    if x & 1 != sign:
+        x = P - x
+    return x
+
+
+G_Y = 4 * pow(5, P - 2, P) % P
+G = (_recover_x(G_Y, 0), G_Y, 1, _recover_x(G_Y, 0) * G_Y % P)
+
+
+def _add(p, q):
+    a = (p[1] - p[0]) * (q[1] - q[0]) % P
+    b = (p[1] + p[0]) * (q[1] + q[0]) % P
+    c = 2 * p[3] * q[3] * D % P
+    d = 2 * p[2] * q[2] % P
+    e, f, g, h = b - a, d - c, d + c, b + a
+    return (e * f % P, g * h % P, f * g % P, e * h % P)
+
+
+def _mul(s, p):
+    q = (0, 1, 1, 0)
+    while s:
+        if s & 1:
+            q = _add(q, p)
+        p = _add(p, p)
+        s >>= 1
+    return q
+
+
+def _encode(p):
+    zi = pow(p[2], P - 2, P)
+    x, y = p[0] * zi % P, p[1] * zi % P
+    return (y | ((x & 1) << 255)).to_bytes(32, "little")
+
+
+def _decode(s):
+    y = int.from_bytes(s, "little")
+    sign = y >> 255
+    y &= (1 << 255) - 1
+    if y >= P:
+        raise ValueError("not a curve point")
+    x = _recover_x(y, sign)
+    return (x, y, 1, x * y % P)
+
+
+def _equal(p, q):
+    return (p[0] * q[2] - q[0] * p[2]) % P == 0 and (p[1] * q[2] - q[1] * p[2]) % P == 0
+
+
+def _expand(seed):
+    h = hashlib.sha512(seed).digest()
+    a = int.from_bytes(h[:32], "little")
+    a &= (1 << 254) - 8
+    a |= 1 << 254
+    return a, h[32:]
+
+
+def public_key(seed):
+    return _encode(_mul(_expand(seed)[0], G))
+
+
+def sign(seed, message):
+    a, prefix = _expand(seed)
+    pub = _encode(_mul(a, G))
+    r = int.from_bytes(hashlib.sha512(prefix + message).digest(), "little") % L
+    rs = _encode(_mul(r, G))
+    h = int.from_bytes(hashlib.sha512(rs + pub + message).digest(), "little") % L
+    return rs + ((r + h * a) % L).to_bytes(32, "little")
+
+
+def verify(pub, message, signature):
+    if len(signature) != 64:
+        return False
+    try:
+        a = _decode(pub)
+        r = _decode(signature[:32])
+    except ValueError:
+        return False
+    s = int.from_bytes(signature[32:], "little")
+    if s >= L:
+        return False
+    h = int.from_bytes(hashlib.sha512(signature[:32] + pub + message).digest(), "little") % L
+    return _equal(_mul(s, G), _add(r, _mul(h, a)))
+
+
+def image_digest(data):
+    """SHA-256 of the bytes written to flash"""
+    if data[:4] == b"ESPZ":
+        sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+        from ota_compress import decompress
+        data = decompress(data)
+    return hashlib.sha256(data).digest()
+
+
+def sign_image(seed, data):
+    return sign(seed, image_digest(data)).hex()
+
+
+def read_seed(path):
+    with open(path) as f:
+        seed = bytes.fromhex(f.read().strip())
+    if len(seed) != 32:
+        raise ValueError("%s does not hold a 32 byte key" % path)
+    return seed
+
+
+def c_array(pub):
+    rows = ["    " + ", ".join("0x%02x" % b for b in pub[i:i + 8]) for i in range(0, len(pub), 8)]
+    return "static const uint8_t otaPublicKey[32] PROGMEM = {\n%s\n};" % ",\n".join(rows)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sign OTA images with Ed25519")
+    commands = parser.add_subparsers(dest="command")
+    commands.required = True
+    keygen = commands.add_parser("keygen", help="write a new secret key, print the public one")
+    keygen.add_argument("key")
+    pubkey = commands.add_parser("pubkey", help="print the public key")
+    pubkey.add_argument("key")
+    signer = commands.add_parser("sign", help="print the signature of an image")
+    signer.add_argument("key")
+    signer.add_argument("image")
+    checker = commands.add_parser("verify", help="check a signature")
+    checker.add_argument("key")
+    checker.add_argument("image")
+    checker.add_argument("signature")
+    args = parser.parse_args()
+
+    if args.command == "keygen":
+        if os.path.exists(args.key):
+            parser.error("%s exists, not overwritten" % args.key)
+        seed = os.urandom(32)
+        fd = os.open(args.key, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0o600)
+        with os.fdopen(fd, "w") as f:
+            f.write(seed.hex() + "\n")
+        print(c_array(public_key(seed)))
+        return 0
+
+    seed = read_seed(args.key)
+    if args.command == "pubkey":
+        print(c_array(public_key(seed)))
+        return 0
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    if args.command == "sign":
+        print(sign_image(seed, data))
+        return 0
+
+    if verify(public_key(seed), image_digest(data), bytes.fromhex(args.signature)):
+        print("OK")
+        return 0
+    print("signature does not match")
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
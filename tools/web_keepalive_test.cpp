@@ -0,0 +1,382 @@
+/*
+  Host test of the kept and pipelined connections of ESP8266WebServer:
+  requests written at once go through handleClient(), the test checks the
+  responses and when the server closes the connection.
+
+    g++ -O1 -std=c++11 -Wall -funsigned-char -fno-pie -no-pie -DARDUINO=10805 -DESP8266 -DARDUINO_ARCH_AVR \
+        -I tools/host -I libraries/ESP8266WiFi/src -I libraries/ESP8266WebServer/src \
+        tools/web_keepalive_test.cpp tools/host/[a-z]*.cpp \
+        libraries/ESP8266WiFi/src/WiFiClient.cpp libraries/ESP8266WiFi/src/WiFiServer.cpp \
+        libraries/ESP8266WebServer/src/ESP8266WebServer.cpp libraries/ESP8266WebServer/src/Parsing.cpp \
+        libraries/ESP8266WebServer/src/detail/mimetable.cpp -o web_keepalive_test
+    ./web_keepalive_test
+
+    pipelined       a GET, a POST with Content-Length and a HEAD in one write: the first two keep
+                    the connection, HEAD is answered like GET and closes it
+    keepalive_off   the same without setKeepAlive(): one response, then the server closes
+    idle            a kept connection without a next request is closed after the 2 s timeout
+    client_close    the second of three requests asks for Connection: close, the third is not answered
+    http10          HTTP/1.0 closes unless it asks for keep-alive
+    max_requests    setKeepAlive(true, 3): the third response closes
+    chunked         a chunked response keeps the connection, the second one asks to close it
+    other_client    a kept connection that is idle is closed as soon as another client connects
+
+  The server runs on the host harness (see tools/ota_host_test.cpp) with
+  the lwIP of tools/host, time is virtual. The result is a JSON line per
+  scenario, the exit code is 1 when a check fails.
+
+    ./web_keepalive_test serve <port>
+
+  serves the same handlers (/status, POST /config, /chunked) with
+  setKeepAlive(true) on 127.0.0.1:<port>, for tools/web_load.py: every
+  connection accepted there is carried to the server over the lwIP of
+  tools/host, the clock runs in real time. Ctrl-C ends it.
+*/
+
+#include <ESP8266WebServer.h>
+
+#include "host.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+static int failures;
+
+static void check(bool ok, const char* name, const std::string& what)
+{
+    if(!ok) {
+        fprintf(stderr, "%s: %s\n", name, what.c_str());
+        failures++;
+    }
+}
+
+static const char statusJson[] =
+    "{\"temp\":21.50,\"lux\":319.3,\"soil\":53,\"battery\":3.92,\"usb\":false,\"charging\":false,\"button\":false}";
+
+struct Response {
+    int status;
+    std::map<std::string, std::string> headers; // names in lower case
+    std::string body;
+    bool complete;
+};
+
+// Splits what the server sent into responses, by Content-Length, chunks, or the end of the connection
+static std::vector<Response> responses(const std::string& stream)
+{
+    std::vector<Response> all;
+    size_t pos = 0;
+    while(pos < stream.size()) {
+        size_t end = stream.find("\r\n\r\n", pos);
+        if(end == std::string::npos) {
+            break;
+        }
+        Response response;
+        response.complete = true;
+        response.status = atoi(stream.c_str() + stream.find(' ', pos) + 1);
+        for(size_t line = stream.find("\r\n", pos) + 2; line < end; line = stream.find("\r\n", line) + 2) {
+            size_t colon = stream.find(':', line);
+            std::string name = stream.substr(line, colon - line);
+            for(char& c : name) {
+                c = tolower(c);
+            }
+            size_t value = stream.find_first_not_of(' ', colon + 1);
+            response.headers[name] = stream.substr(value, stream.find("\r\n", line) - value);
+        }
+        pos = end + 4;
+        if(response.headers.count("content-length")) {
+            size_t length = strtoul(response.headers["content-length"].c_str(), NULL, 10);
+            response.body = stream.substr(pos, length);
+            response.complete = response.body.size() == length;
+            pos += length;
+        } else if(response.headers["transfer-encoding"] == "chunked") {
+            response.complete = false;
+            size_t line;
+            while((line = stream.find("\r\n", pos)) != std::string::npos) {
+                size_t size = strtoul(stream.c_str() + pos, NULL, 16);
+                if(line + 2 + size + 2 > stream.size()) {
+                    break;
+                }
+                response.body += stream.substr(line + 2, size);
+                pos = line + 2 + size + 2;
+                if(!size) {
+                    response.complete = true;
+                    break;
+                }
+            }
+            if(!response.complete) {
+                pos = stream.size();
+            }
+        } else {
+            response.complete = false; // until the server closes
+            response.body = stream.substr(pos);
+            pos = stream.size();
+        }
+        all.push_back(response);
+    }
+    return all;
+}
+
+struct Exchange {
+    std::string stream;
+    std::vector<Response> responses;
+    bool closed;
+    uint32_t closedMs; // from the last byte of the server to the end of the connection
+};
+
+// Writes the requests at once and runs the server for 5 s or until it closes. Like a
+// browser or tools/web_load.py the client closes after a response with Connection: close
+static Exchange exchange(ESP8266WebServer& server, const std::string& requests)
+{
+    Exchange result;
+    result.closed = false;
+    uint64_t last = hostNow();
+    uint64_t closedAt = 0;
+    HostSocketPtr socket = hostConnect(80);
+    HostSocket* client = socket.get();
+    socket->onData = [&result, &last, client](const std::string& data) {
+        result.stream += data;
+        last = hostNow();
+        std::vector<Response> all = responses(result.stream);
+        if(all.size() && all.back().complete && all.back().headers["connection"] == "close") {
+            client->close();
+        }
+    };
+    socket->onClose = [&result, &closedAt](bool) {
+        result.closed = true;
+        closedAt = hostNow();
+    };
+    socket->send(requests);
+    uint64_t deadline = hostNow() + 5000000;
+    while(!result.closed && hostNow() < deadline) {
+        server.handleClient();
+        delay(1);
+    }
+    if(!result.closed) {
+        socket->close();
+        while(server.client().connected()) {
+            server.handleClient();
+            delay(1);
+        }
+    }
+    result.responses = responses(result.stream);
+    result.closedMs = result.closed ? (uint32_t) ((closedAt - last) / 1000) : 0;
+    return result;
+}
+
+static std::string get(const char* path, const char* version = "1.1", const char* connection = NULL)
+{
+    std::string request = std::string("GET ") + path + " HTTP/" + version + "\r\nHost: 192.168.1.50\r\n";
+    if(connection) {
+        request += std::string("Connection: ") + connection + "\r\n";
+    }
+    return request + "\r\n";
+}
+
+static const std::string post =
+    "POST /config HTTP/1.1\r\nHost: 192.168.1.50\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 13\r\n\r\nsleep=600&x=1";
+
+static const std::string head = "HEAD /status HTTP/1.1\r\nHost: 192.168.1.50\r\n\r\n";
+
+// The status, Connection header and body of every response, and whether the connection ended
+// right after the last one (closed_ms under 100) or was kept to the idle timeout of the server
+static void run(const char* name, const Exchange& got, const std::vector<Response>& expected, bool closes)
+{
+    check(got.responses.size() == expected.size(), name,
+          std::to_string(got.responses.size()) + " responses, " + std::to_string(expected.size()) + " expected");
+    std::string connections;
+    for(size_t i = 0; i < got.responses.size() && i < expected.size(); i++) {
+        Response response = got.responses[i];
+        std::string at = "response " + std::to_string(i + 1) + ": ";
+        check(response.status == expected[i].status, name, at + "status " + std::to_string(response.status));
+        check(response.headers["connection"] == expected[i].headers.at("connection"), name,
+              at + "Connection: " + response.headers["connection"]);
+        check(response.body == expected[i].body, name, at + "body " + response.body);
+        connections += (i ? "," : "") + response.headers["connection"];
+    }
+    check(got.closed && (closes ? got.closedMs < 100 : got.closedMs >= HTTP_KEEPALIVE_TIMEOUT - 100), name,
+          got.closed ? "closed after " + std::to_string(got.closedMs) + " ms" : "not closed");
+    printf("{\"test\":\"%s\",\"responses\":%u,\"connection\":\"%s\",\"bytes\":%u,\"closed_ms\":%u}\n", name,
+           (unsigned) got.responses.size(), connections.c_str(), (unsigned) got.stream.size(), got.closedMs);
+}
+
+static Response expect(const char* connection, const std::string& body = statusJson)
+{
+    Response response;
+    response.status = 200;
+    response.headers["connection"] = connection;
+    response.body = body;
+    return response;
+}
+
+static void testOtherClient(ESP8266WebServer& server)
+{
+    const char* name = "other_client";
+    std::string first, second;
+    bool firstClosed = false, secondClosed = false;
+    uint64_t firstClosedAt = 0, connectedAt = 0;
+    HostSocketPtr a = hostConnect(80);
+    a->onData = [&first](const std::string& data) { first += data; };
+    a->onClose = [&firstClosed, &firstClosedAt](bool) {
+        firstClosed = true;
+        firstClosedAt = hostNow();
+    };
+    a->send(get("/status"));
+    HostSocketPtr b;
+    uint64_t deadline = hostNow() + 5000000;
+    while(!secondClosed && hostNow() < deadline) {
+        if(!b && first.size() && hostNow() > deadline - 4500000) {
+            connectedAt = hostNow();
+            b = hostConnect(80);
+            b->onData = [&second](const std::string& data) { second += data; };
+            b->onClose = [&secondClosed](bool) { secondClosed = true; };
+            b->send(get("/status", "1.1", "close"));
+        }
+        server.handleClient();
+        delay(1);
+    }
+    std::vector<Response> got = responses(first), other = responses(second);
+    check(got.size() == 1 && got[0].headers["connection"] == "keep-alive", name, "first client not kept");
+    check(firstClosed && firstClosedAt - connectedAt < 100000, name, "first client not closed for the second");
+    check(other.size() == 1 && other[0].body == statusJson, name, "second client not served");
+    printf("{\"test\":\"%s\",\"closed_ms\":%u,\"served\":%u}\n", name, (unsigned) ((firstClosedAt - connectedAt) / 1000),
+           (unsigned) other.size());
+}
+
+// Carries the connections of 127.0.0.1:port to the server over the lwIP of tools/host
+struct Bridge {
+    int fd;
+    HostSocketPtr socket;
+    bool clientDone; // FIN of the client passed on
+    bool closed;
+};
+
+static int serve(ESP8266WebServer& server, int port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(listener, (struct sockaddr*) &address, sizeof(address)) || listen(listener, 16)) {
+        perror("serve");
+        return 1;
+    }
+    fprintf(stderr, "serving on 127.0.0.1:%d\n", port);
+
+    std::list<Bridge> bridges;
+    while(true) {
+        std::vector<struct pollfd> fds;
+        std::vector<Bridge*> polled;
+        fds.push_back({listener, POLLIN, 0});
+        for(Bridge& bridge : bridges) {
+            if(!bridge.closed && !bridge.clientDone) {
+                fds.push_back({bridge.fd, POLLIN, 0});
+                polled.push_back(&bridge);
+            }
+        }
+        // the clock of tools/host runs with the real one besides delay(), the link goes on meanwhile
+        poll(fds.data(), fds.size(), 1);
+
+        if(fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if(fd >= 0) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                bridges.push_back({fd, hostConnect(80), false, false});
+                Bridge* bridge = &bridges.back();
+                bridge->socket->onData = [bridge](const std::string& data) {
+                    if(!bridge->closed && write(bridge->fd, data.data(), data.size()) < 0) {
+                        bridge->socket->abort();
+                    }
+                };
+                bridge->socket->onClose = [bridge](bool) {
+                    if(!bridge->closed) {
+                        bridge->closed = true;
+                        close(bridge->fd);
+                    }
+                };
+            }
+        }
+        for(size_t i = 1; i < fds.size(); i++) {
+            if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buf[1460];
+                ssize_t n = recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if(n > 0) {
+                    polled[i - 1]->socket->send(std::string(buf, n));
+                } else if(n == 0 || errno != EAGAIN) {
+                    polled[i - 1]->clientDone = true;
+                    polled[i - 1]->socket->close();
+                }
+            }
+        }
+        server.handleClient();
+        yield();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    hostBoot(REASON_DEFAULT_RST);
+    ESP8266WebServer server(80); // destroyed before the stand-ins of the core
+    String chunk;
+    for(int i = 0; i < 200; ++i) {
+        chunk += (char) ('a' + i % 26);
+    }
+    server.on("/status", [&server]() { server.send(200, "application/json", statusJson); });
+    server.on("/config", HTTP_POST, [&server]() { server.send(200, "text/plain", server.arg("sleep")); });
+    server.on("/chunked", [&server, &chunk]() {
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(200, "text/plain", "");
+        server.sendContent(chunk);
+        server.sendContent(chunk);
+        server.sendContent("");
+    });
+    server.begin();
+
+    if(argc > 2 && strcmp(argv[1], "serve") == 0) {
+        server.setKeepAlive(true);
+        return serve(server, atoi(argv[2]));
+    }
+
+    server.setKeepAlive(true);
+    run("pipelined", exchange(server, get("/status") + post + head),
+        {expect("keep-alive"), expect("keep-alive", "600"), expect("close")}, true);
+
+    server.setKeepAlive(false);
+    run("keepalive_off", exchange(server, get("/status") + post + head), {expect("close")}, true);
+
+    server.setKeepAlive(true);
+    run("idle", exchange(server, get("/status")), {expect("keep-alive")}, false);
+    run("client_close", exchange(server, get("/status") + get("/status", "1.1", "close") + get("/status")),
+        {expect("keep-alive"), expect("close")}, true);
+    run("http10", exchange(server, get("/status", "1.0") + get("/status")), {expect("close")}, true);
+    run("http10_keepalive", exchange(server, get("/status", "1.0", "keep-alive") + get("/status", "1.0")),
+        {expect("keep-alive"), expect("close")}, true);
+
+    server.setKeepAlive(true, 3);
+    run("max_requests", exchange(server, get("/status") + get("/status") + get("/status") + get("/status")),
+        {expect("keep-alive"), expect("keep-alive"), expect("close")}, true);
+
+    server.setKeepAlive(true);
+    std::string chunks = (chunk + chunk).c_str();
+    run("chunked", exchange(server, get("/chunked") + get("/chunked", "1.1", "close")),
+        {expect("keep-alive", chunks), expect("close", chunks)}, true);
+
+    testOtherClient(server);
+    return failures ? 1 : 0;
+}
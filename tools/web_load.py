@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""
+Load test of the web server of a board (ESP8266WebServer), comparing a
+new connection per request with kept and pipelined connections.
+
+  web_load.py --url http://192.168.1.50/ [--requests 300] [--depth 4]
+              [--mode close,keepalive,pipeline]
+
+close sends every request on its own connection with Connection: close,
+like the server did before setKeepAlive(). keepalive sends them one after
+the other on one connection, opening a new one when the server closes it
+(idle timeout or the request limit). pipeline writes --depth requests at
+once on the connection before reading the responses.
+
+The result is a JSON line per mode with the requests per second, the
+connections opened and the latency percentiles (request written to last
+byte of the response, in ms).
+"""
+
+import argparse
+import json
+import socket
+import sys
+import time
+from urllib.parse import urlparse
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    k = min(len(values) - 1, max(0, int(round(p / 100.0 * len(values) + 0.5)) - 1))
+    return values[k]
+
+
+class Connection:
+    def __init__(self, host, port, timeout):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b""
+
+    def close(self):
+        self.sock.close()
+
+    def _fill(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise EOFError("connection closed by the server")
+        self.buf += data
+
+    def _line(self):
+        while b"\r\n" not in self.buf:
+            self._fill()
+        line, self.buf = self.buf.split(b"\r\n", 1)
+        return line
+
+    def _bytes(self, n):
+        while len(self.buf) < n:
+            self._fill()
+        data, self.buf = self.buf[:n], self.buf[n:]
+        return data
+
+    # Returns (status, body, keep) of the next response
+    def response(self):
+        status = int(self._line().split()[1])
+        headers = {}
+        while True:
+            line = self._line()
+            if not line:
+                break
+            name, _, value = line.decode("latin-1").partition(":")
+            headers[name.strip().lower()] = value.strip()
+        keep = headers.get("connection", "").lower() != "close"
+        if "content-length" in headers:
+            body = self._bytes(int(headers["content-length"]))
+        elif headers.get("transfer-encoding", "").lower() == "chunked":
+            body = b""
+            while True:
+                size = int(self._line().split(b";")[0], 16)
+                body += self._bytes(size)
+                self._line()
+                if not size:
+                    break
+        else:
+            # the end of the connection ends the content
+            try:
+                while True:
+                    self._fill()
+            except EOFError:
+                pass
+            body, self.buf, keep = self.buf, b"", False
+        return status, body, keep
+
+
+def request(host, path, close):
+    return ("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n"
+            % (path, host, "close" if close else "keep-alive")).encode()
+
+
+def run(mode, host, port, path, requests, depth, timeout):
+    latencies = []
+    errors = 0
+    connections = 0
+    statuses = {}
+    conn = None
+    start = time.monotonic()
+    done = 0
+    while done < requests:
+        batch = min(depth if mode == "pipeline" else 1, requests - done)
+        try:
+            if conn is None:
+                conn = Connection(host, port, timeout)
+                connections += 1
+            sent = time.monotonic()
+            conn.sock.sendall(request(host, path, mode == "close") * batch)
+            for _ in range(batch):
+                status, _, keep = conn.response()
+                latencies.append((time.monotonic() - sent) * 1000)
+                statuses[status] = statuses.get(status, 0) + 1
+                done += 1
+                if not keep:
+                    break
+        except (OSError, EOFError, ValueError, IndexError):
+            errors += 1
+            keep = False
+            if errors > requests // 10 + 5:
+                break
+        if conn is not None and (mode == "close" or not keep):
+            conn.close()
+            conn = None
+    if conn:
+        conn.close()
+    elapsed = time.monotonic() - start
+    return {"load": "web", "mode": mode, "requests": done, "connections": connections, "errors": errors,
+            "req_per_s": round(done / elapsed, 1) if elapsed else 0,
+            "p50_ms": round(percentile(latencies, 50), 2), "p90_ms": round(percentile(latencies, 90), 2),
+            "p99_ms": round(percentile(latencies, 99), 2), "status": statuses}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load test of the web server of a board")
+    parser.add_argument("--url", default="http://192.168.4.1/")
+    parser.add_argument("--requests", type=int, default=300)
+    parser.add_argument("--depth", type=int, default=4, help="requests written at once by pipeline")
+    parser.add_argument("--mode", default="close,keepalive,pipeline")
+    parser.add_argument("--timeout", type=float, default=10)
+    args = parser.parse_args()
+
+    url = urlparse(args.url)
+    path = url.path or "/"
+    if url.query:
+        path += "?" + url.query
+    for mode in args.mode.split(","):
+        if mode not in ("close", "keepalive", "pipeline"):
+            sys.exit("unknown mode " + mode)
+        print(json.dumps(run(mode, url.hostname, url.port or 80, path, args.requests, args.depth, args.timeout)))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,282 @@
+/*
+  Host test of the request parser of ESP8266WebServer (detail/RequestParser.h).
+
+    g++ -O1 -std=c++11 -Wall -I libraries/ESP8266WebServer/src tools/web_request_test.cpp -o web_request_test
+    ./web_request_test
+
+    split       a request received in two reads, split at every byte offset, and a byte per read
+    small       the same over a buffer of 128 bytes, header lines handled are dropped to make room
+    too_large   a request line or a header line longer than the buffer, and one that just fits
+    line_ends   bare LF line endings, leading empty lines, trimmed values, lines without ':'
+    request     method, URI and query split, version, and the request lines that are refused
+    pipelined   a GET, a POST with a body and a HEAD in one stream, handed over by next(),
+                split at every byte offset
+
+  Reads are fed like _parseRequest() does: parse(), then at most room()
+  bytes at space() when it asks for more. The result is a JSON line per
+  group with the cases run, the exit code is 1 when a check fails.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// As in ESP8266WebServer.h
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+#define HTTP_REQUEST_BUFLEN 1024
+
+#include "detail/RequestParser.h"
+
+static int failures;
+
+static void check(bool ok, const char* name, const std::string& what) {
+  if (!ok) {
+    fprintf(stderr, "%s: %s\n", name, what.c_str());
+    failures++;
+  }
+}
+
+// What a request parsed into, compared as a string
+struct Parsed {
+  RequestParser::Result result;
+  std::string request;
+  std::string headers;
+  std::string body;
+};
+
+static std::string describe(const Parsed& parsed) {
+  static const char* results[] = {"NEED_MORE", "DONE", "BAD_REQUEST", "TOO_LARGE"};
+  return std::string(results[parsed.result]) + " " + parsed.request + " [" + parsed.headers + "] [" + parsed.body + "]";
+}
+
+// The input of a connection, handed out up to the end of the current read
+struct Input {
+  std::string data;
+  std::vector<size_t> reads; // end offsets of the reads, the last one is data.size()
+  size_t pos;
+  size_t read;
+
+  Input(const std::string& data, const std::vector<size_t>& reads) : data(data), reads(reads), pos(0), read(0) {}
+
+  size_t available() {
+    while (read < reads.size() && pos == reads[read])
+      read++;
+    return read < reads.size() ? reads[read] - pos : 0;
+  }
+};
+
+// Parses the next request of the connection and reads a body of Content-Length bytes
+static Parsed parseOne(RequestParser& parser, Input& input) {
+  Parsed parsed;
+  size_t contentLength = 0;
+  auto onHeader = [&parsed, &contentLength](const char* name, const char* value) {
+    parsed.headers += std::string(parsed.headers.empty() ? "" : "|") + name + "=" + value;
+    if (strcmp(name, "Content-Length") == 0)
+      contentLength = strtoul(value, NULL, 10);
+  };
+  while ((parsed.result = parser.parse(onHeader)) == RequestParser::NEED_MORE) {
+    size_t avail = input.available();
+    if (!avail || !parser.room())
+      return parsed;
+    if (avail > parser.room())
+      avail = parser.room();
+    memcpy(parser.space(), input.data.data() + input.pos, avail);
+    parser.received(avail);
+    input.pos += avail;
+  }
+  if (parsed.result != RequestParser::DONE)
+    return parsed;
+
+  char line[160];
+  snprintf(line, sizeof(line), "%d%s %s ? %s 1.%u", (int) parser.method(), parser.knownMethod() ? "" : "*",
+           parser.uri(), parser.query(), parser.version());
+  parsed.request = line;
+  // the body, what the parser received past the headers first, like RequestBody
+  while (parsed.body.size() < contentLength) {
+    uint8_t buf[7];
+    size_t want = contentLength - parsed.body.size() < sizeof(buf) ? contentLength - parsed.body.size() : sizeof(buf);
+    size_t n = parser.available() ? parser.read(buf, want) : 0;
+    if (!n) {
+      size_t avail = input.available();
+      if (!avail)
+        break;
+      n = avail < want ? avail : want;
+      memcpy(buf, input.data.data() + input.pos, n);
+      input.pos += n;
+    }
+    parsed.body.append((const char*) buf, n);
+  }
+  return parsed;
+}
+
+// Parses every request of the input like a kept connection, over a buffer of size bytes
+static std::vector<Parsed> parseAll(const std::string& data, const std::vector<size_t>& reads, size_t size, size_t requests) {
+  std::vector<char> buf(size);
+  RequestParser parser;
+  parser.begin(buf.data(), size);
+  Input input(data, reads);
+  std::vector<Parsed> all;
+  for (size_t i = 0; i < requests; i++) {
+    if (i)
+      parser.next();
+    all.push_back(parseOne(parser, input));
+    if (all.back().result != RequestParser::DONE)
+      break;
+  }
+  return all;
+}
+
+static std::vector<Parsed> parseAll(const std::string& data, size_t size, size_t requests = 1) {
+  return parseAll(data, {data.size()}, size, requests);
+}
+
+static std::string describe(const std::vector<Parsed>& all) {
+  std::string text;
+  for (const Parsed& parsed : all)
+    text += describe(parsed) + "\n";
+  return text;
+}
+
+// Every two-read split and a byte per read must parse like a single read
+static unsigned splits(const char* name, const std::string& data, size_t size, size_t requests, const std::string& expected) {
+  unsigned cases = 0;
+  check(describe(parseAll(data, size, requests)) == expected, name, "single read: " + describe(parseAll(data, size, requests)));
+  for (size_t at = 1; at < data.size(); at++, cases++) {
+    std::string got = describe(parseAll(data, {at, data.size()}, size, requests));
+    check(got == expected, name, "split at " + std::to_string(at) + ": " + got);
+  }
+  std::vector<size_t> bytes;
+  for (size_t at = 1; at <= data.size(); at++)
+    bytes.push_back(at);
+  std::string got = describe(parseAll(data, bytes, size, requests));
+  check(got == expected, name, "a byte per read: " + got);
+  return cases + 2;
+}
+
+static const std::string request =
+    "POST /api/config?name=agrumino&sleep=600 HTTP/1.1\r\n"
+    "Host: 192.168.1.50\r\n"
+    "User-Agent: web_request_test\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 13\r\n"
+    "\r\n"
+    "sleep=600&x=1";
+
+static const std::string requestParsed =
+    "DONE 2 /api/config ? name=agrumino&sleep=600 1.1 "
+    "[Host=192.168.1.50|User-Agent=web_request_test|Content-Type=application/x-www-form-urlencoded|Content-Length=13] "
+    "[sleep=600&x=1]\n";
+
+static void testSplit() {
+  unsigned cases = splits("split", request, HTTP_REQUEST_BUFLEN, 1, requestParsed);
+  printf("{\"test\":\"split\",\"bytes\":%u,\"cases\":%u}\n", (unsigned) request.size(), cases);
+}
+
+static void testSmall() {
+  // the request line and the longest header line fit in 128 bytes, all the headers do not
+  unsigned cases = splits("small", request, 128, 1, requestParsed);
+  printf("{\"test\":\"small\",\"buffer\":128,\"cases\":%u}\n", cases);
+}
+
+static void testTooLarge() {
+  const std::string line = "GET /status HTTP/1.1\r\n";
+  std::string cookie = "Cookie: ";
+  // request line and header line together take the whole buffer
+  cookie += std::string(HTTP_REQUEST_BUFLEN - line.size() - cookie.size() - 2, 'c') + "\r\n";
+  std::string fits = line + cookie + "Host: a\r\n\r\n";
+  std::vector<Parsed> all = parseAll(fits, HTTP_REQUEST_BUFLEN);
+  check(all[0].result == RequestParser::DONE, "too_large", "a header line that fits: " + describe(all[0]));
+  check(all[0].headers == "Cookie=" + cookie.substr(8, cookie.size() - 10) + "|Host=a", "too_large", "a header line that fits");
+
+  std::string over = line + "Cookie: c" + cookie.substr(8) + "Host: a\r\n\r\n";
+  all = parseAll(over, HTTP_REQUEST_BUFLEN);
+  check(all[0].result == RequestParser::TOO_LARGE, "too_large", "a header line a byte too long: " + describe(all[0]));
+
+  std::string uri = "GET /" + std::string(HTTP_REQUEST_BUFLEN, 'u') + " HTTP/1.1\r\n\r\n";
+  all = parseAll(uri, HTTP_REQUEST_BUFLEN);
+  check(all[0].result == RequestParser::TOO_LARGE, "too_large", "a request line too long: " + describe(all[0]));
+
+  // many short headers add up past the buffer, that is not too large
+  std::string many = line;
+  for (int i = 0; i < 200; i++)
+    many += "X-Header-" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+  many += "\r\n";
+  all = parseAll(many, HTTP_REQUEST_BUFLEN);
+  check(all[0].result == RequestParser::DONE && all[0].headers.find("X-Header-199=199") != std::string::npos, "too_large",
+        "200 short headers: " + describe(all[0]).substr(0, 60));
+  printf("{\"test\":\"too_large\",\"buffer\":%u,\"header_line\":%u,\"headers_bytes\":%u}\n", (unsigned) HTTP_REQUEST_BUFLEN,
+         (unsigned) cookie.size(), (unsigned) many.size());
+}
+
+static void testLineEnds() {
+  struct Case {
+    const char* data;
+    const char* expected;
+  } cases[] = {
+    {"GET /a HTTP/1.1\nHost: x\n\n", "DONE 1 /a ?  1.1 [Host=x] []\n"},
+    {"\r\n\r\nGET /a HTTP/1.0\r\n\r\n", "DONE 1 /a ?  1.0 [] []\n"},
+    {"\n\nGET /a HTTP/1.1\r\nHost: x\n\r\n", "DONE 1 /a ?  1.1 [Host=x] []\n"},
+    {"GET /a HTTP/1.1\r\nHost:x\r\nX-A: \t v w \t\r\nX-B:\r\n\r\n", "DONE 1 /a ?  1.1 [Host=x|X-A=v w|X-B=] []\n"},
+    {"GET /a HTTP/1.1\r\nno colon here\r\nHost: x\r\n\r\n", "DONE 1 /a ?  1.1 [Host=x] []\n"},
+    {"GET /a HTTP/1.1\r\nHost: x\r\n", "NEED_MORE  [Host=x] []\n"},
+  };
+  unsigned count = 0;
+  for (const Case& c : cases)
+    count += splits("line_ends", c.data, HTTP_REQUEST_BUFLEN, 1, c.expected);
+  printf("{\"test\":\"line_ends\",\"requests\":%u,\"cases\":%u}\n", (unsigned) (sizeof(cases) / sizeof(cases[0])), count);
+}
+
+static void testRequest() {
+  struct Case {
+    const char* line;
+    const char* expected;
+  } cases[] = {
+    {"GET /path?a=1&b=2 HTTP/1.1", "DONE 1 /path ? a=1&b=2 1.1 [] []\n"},
+    {"GET /path HTTP/1.1", "DONE 1 /path ?  1.1 [] []\n"},
+    {"GET /path? HTTP/1.1", "DONE 1 /path ?  1.1 [] []\n"},
+    {"GET /?x?y=z HTTP/1.1", "DONE 1 / ? x?y=z 1.1 [] []\n"},
+    {"GET /a%20b?q=%3F HTTP/1.0", "DONE 1 /a%20b ? q=%3F 1.0 [] []\n"},
+    {"POST /update HTTP/1.1", "DONE 2 /update ?  1.1 [] []\n"},
+    {"PUT /f HTTP/1.1", "DONE 3 /f ?  1.1 [] []\n"},
+    {"PATCH /f HTTP/1.1", "DONE 4 /f ?  1.1 [] []\n"},
+    {"DELETE /f HTTP/1.1", "DONE 5 /f ?  1.1 [] []\n"},
+    {"OPTIONS * HTTP/1.1", "DONE 6 * ?  1.1 [] []\n"},
+    {"HEAD /f HTTP/1.1", "DONE 1* /f ?  1.1 [] []\n"},
+    {"BREW /pot HTTP/1.1", "DONE 1* /pot ?  1.1 [] []\n"},
+    {"GET /f HTTP/1", "DONE 1 /f ?  1.0 [] []\n"},
+    {"GET /f", "BAD_REQUEST  [] []\n"},
+    {"GET", "BAD_REQUEST  [] []\n"},
+  };
+  for (const Case& c : cases) {
+    std::string got = describe(parseAll(std::string(c.line) + "\r\n\r\n", HTTP_REQUEST_BUFLEN));
+    check(got == c.expected, "request", std::string(c.line) + ": " + got);
+  }
+  printf("{\"test\":\"request\",\"cases\":%u}\n", (unsigned) (sizeof(cases) / sizeof(cases[0])));
+}
+
+static void testPipelined() {
+  std::string stream =
+      "GET /status HTTP/1.1\r\nHost: a\r\n\r\n" +
+      request +
+      "HEAD /files/log.txt?tail=1 HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+  std::string expected =
+      "DONE 1 /status ?  1.1 [Host=a] []\n" +
+      requestParsed +
+      "DONE 1* /files/log.txt ? tail=1 1.1 [Host=a|Connection=close] []\n";
+  unsigned cases = splits("pipelined", stream, HTTP_REQUEST_BUFLEN, 3, expected);
+  cases += splits("pipelined", stream, 128, 3, expected);
+  printf("{\"test\":\"pipelined\",\"requests\":3,\"bytes\":%u,\"cases\":%u}\n", (unsigned) stream.size(), cases);
+}
+
+int main() {
+  testSplit();
+  testSmall();
+  testTooLarge();
+  testLineEnds();
+  testRequest();
+  testPipelined();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+/*
+  Host test of the responses of ESP8266WebServer: the bytes, TCP segments
+  and heap allocations of send(), send_P() and sendContent(), compared with
+  the server before the gather writes.
+
+    g++ -O1 -std=c++11 -Wall -funsigned-char -fno-pie -no-pie -DARDUINO=10805 -DESP8266 -DARDUINO_ARCH_AVR \
+        -I tools/host -I $SRC/libraries/ESP8266WiFi/src -I $SRC/libraries/ESP8266WebServer/src \
+        tools/web_response_test.cpp tools/host/[a-z]*.cpp \
+        $SRC/libraries/ESP8266WiFi/src/WiFiClient.cpp $SRC/libraries/ESP8266WiFi/src/WiFiServer.cpp \
+        $SRC/libraries/ESP8266WebServer/src/ESP8266WebServer.cpp $SRC/libraries/ESP8266WebServer/src/Parsing.cpp \
+        $SRC/libraries/ESP8266WebServer/src/detail/mimetable.cpp \
+        -Wl,--wrap=tcp_write,--wrap=tcp_output,--wrap=esp_yield -o $OUT
+
+  SRC=. OUT=web_response_test builds the server of the tree. The one from
+  before is the same command with SRC a checkout of the commit that
+  precedes "Send small responses in one write with a gather write":
+
+    git worktree add /tmp/web_base $(git log -1 --format=%H --grep="^\[user-024\] Send small")~1
+    SRC=/tmp/web_base OUT=web_response_base ...
+    ./web_response_base > before.jsonl
+    ./web_response_test before.jsonl
+
+  The server runs on the host stand-in of the core and the lwIP of
+  tools/host (see tools/ota_host_test.cpp), with Nagle like on the board.
+  A request is sent for each handler, the response is read until the
+  server closes. Allocations are the malloc(), realloc() and new of the
+  handler, that is of the response methods, the content is built before.
+  Those of the stand-in of lwIP are left out (see __wrap_tcp_write below).
+
+  The result is a JSON line per response. Given the lines of the build
+  from before, the test checks that the responses are the same bytes,
+  headers in the same order, that they take no more segments and no more
+  allocations, and that a small response takes one segment. The exit code
+  is 1 when a check fails.
+*/
+
+#include <ESP8266WebServer.h>
+#include <MD5Builder.h>
+
+#include "host.h"
+#include "lwip/opt.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <map>
+#include <string>
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+
+static bool counting;
+static size_t allocations;
+
+extern "C" void* malloc(size_t size)
+{
+    allocations += counting;
+    return __libc_malloc(size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    allocations += counting;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    allocations += counting;
+    return __libc_calloc(count, size);
+}
+
+// The lwIP and the clock of tools/host allocate unlike the pools of the board, with
+// -Wl,--wrap they are not counted when the server calls them
+struct tcp_pcb;
+extern "C" err_t __real_tcp_write(struct tcp_pcb* pcb, const void* dataptr, uint16_t len, uint8_t apiflags);
+extern "C" err_t __real_tcp_output(struct tcp_pcb* pcb);
+extern "C" void __real_esp_yield();
+
+extern "C" err_t __wrap_tcp_write(struct tcp_pcb* pcb, const void* dataptr, uint16_t len, uint8_t apiflags)
+{
+    bool was = counting;
+    counting = false;
+    err_t err = __real_tcp_write(pcb, dataptr, len, apiflags);
+    counting = was;
+    return err;
+}
+
+extern "C" err_t __wrap_tcp_output(struct tcp_pcb* pcb)
+{
+    bool was = counting;
+    counting = false;
+    err_t err = __real_tcp_output(pcb);
+    counting = was;
+    return err;
+}
+
+extern "C" void __wrap_esp_yield()
+{
+    bool was = counting;
+    counting = false;
+    __real_esp_yield();
+    counting = was;
+}
+
+static int failures;
+
+static void check(bool ok, const char* name, const char* what)
+{
+    if(!ok) {
+        fprintf(stderr, "%s: %s\n", name, what);
+        failures++;
+    }
+}
+
+// Content built before the handlers count
+static String json;
+static String notFound;
+static String chunk;
+static String page;
+static const char pageP[] PROGMEM =
+    "<html><head><title>Agrumino</title></head><body><form method='POST' action='/update' enctype='multipart/form-data'>"
+    "<input type='file' name='update'><input type='submit' value='Update'></form></body></html>";
+
+static size_t handlerAllocations;
+
+static void counted(std::function<void()> handler)
+{
+    allocations = 0;
+    counting = true;
+    handler();
+    counting = false;
+    handlerAllocations = allocations;
+}
+
+struct Result {
+    std::string md5;
+    size_t bytes;
+    uint32_t segments;
+    size_t allocations;
+};
+
+// Sends the request and reads the response until the server closes
+static Result exchange(ESP8266WebServer& server, const char* path)
+{
+    HostNetStats& net = hostNetStats();
+    memset(&net, 0, sizeof(net));
+    handlerAllocations = 0;
+
+    std::string response;
+    bool closed = false;
+    HostSocketPtr socket = hostConnect(80);
+    socket->onData = [&response](const std::string& data) { response += data; };
+    socket->onClose = [&closed](bool) { closed = true; };
+    socket->send(std::string("GET ") + path + " HTTP/1.1\r\nHost: 192.168.1.50\r\nUser-Agent: web_response_test\r\n\r\n");
+    uint64_t deadline = hostNow() + 5000000;
+    while(!closed && hostNow() < deadline) {
+        server.handleClient();
+        delay(1);
+    }
+
+    MD5Builder md5;
+    md5.begin();
+    md5.add((const uint8_t*) response.data(), response.size());
+    md5.calculate();
+    Result result = { md5.toString().c_str(), response.size(), net.segments, handlerAllocations };
+    return result;
+}
+
+// The lines of the build from before, by name
+static std::map<std::string, Result> readBefore(const char* path)
+{
+    std::map<std::string, Result> before;
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        return before;
+    }
+    char line[512], name[64], md5[33];
+    unsigned long bytes, segments, allocated;
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "{\"test\":\"response\",\"name\":\"%63[^\"]\",\"md5\":\"%32[0-9a-f]\",\"bytes\":%lu,\"segments\":%lu,"
+                        "\"allocations\":%lu", name, md5, &bytes, &segments, &allocated) == 5) {
+            Result result = { md5, bytes, (uint32_t) segments, allocated };
+            before[name] = result;
+        }
+    }
+    fclose(f);
+    return before;
+}
+
+static void run(ESP8266WebServer& server, const char* name, const char* path, const std::map<std::string, Result>& before, uint32_t segments)
+{
+    Result now = exchange(server, path);
+    check(now.bytes > 0, name, "no response");
+
+    auto it = before.find(name);
+    if(it == before.end()) {
+        printf("{\"test\":\"response\",\"name\":\"%s\",\"md5\":\"%s\",\"bytes\":%zu,\"segments\":%u,\"allocations\":%zu}\n",
+               name, now.md5.c_str(), now.bytes, now.segments, now.allocations);
+        return;
+    }
+    const Result& old = it->second;
+    check(now.md5 == old.md5, name, "different bytes on the wire");
+    check(now.segments <= old.segments, name, "more segments");
+    check(now.allocations <= old.allocations, name, "more allocations");
+    check(!segments || now.segments == segments, name, "unexpected segment count");
+    printf("{\"test\":\"response\",\"name\":\"%s\",\"md5\":\"%s\",\"bytes\":%zu,\"segments\":%u,\"allocations\":%zu,"
+           "\"segments_before\":%u,\"allocations_before\":%zu}\n",
+           name, now.md5.c_str(), now.bytes, now.segments, now.allocations, old.segments, old.allocations);
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, Result> before;
+    if(argc > 1) {
+        before = readBefore(argv[1]);
+        if(before.empty()) {
+            fprintf(stderr, "no results in %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    json = String("{\"temp\":21.50,\"lux\":319.3,\"soil\":53,\"battery\":3.92,\"usb\":false,\"charging\":false,\"button\":false}");
+    notFound = "Not found: /favicon.ico";
+    for(int i = 0; i < 200; ++i) {
+        chunk += (char) ('a' + i % 26);
+    }
+    for(int i = 0; i < 4000; ++i) {
+        page += (char) ('a' + i % 26);
+    }
+
+    hostBoot(REASON_DEFAULT_RST);
+    ESP8266WebServer server(80); // destroyed before the stand-ins of the core
+    server.on("/json", [&server]() {
+        counted([&server]() {
+            server.sendHeader("Cache-Control", "no-cache");
+            server.send(200, "application/json", json);
+        });
+    });
+    server.on("/chunked", [&server]() {
+        counted([&server]() {
+            server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+            server.send(200, "text/plain", "");
+            server.sendContent(chunk);
+            server.sendContent(chunk);
+            server.sendContent("");
+        });
+    });
+    server.on("/page", [&server]() { counted([&server]() { server.send(200, "text/html", page); }); });
+    server.on("/form", [&server]() { counted([&server]() { server.send_P(200, PSTR("text/html"), pageP); }); });
+    server.onNotFound([&server]() { counted([&server]() { server.send(404, "text/plain", notFound); }); });
+    server.begin();
+
+    // a small response fits one segment, send_P() writes the head and the flash content apart
+    run(server, "json", "/json", before, 1);
+    run(server, "not_found", "/favicon.ico", before, 1);
+    run(server, "chunked", "/chunked", before, 0);
+    run(server, "page", "/page", before, 0);
+    run(server, "form", "/form", before, 0);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/*
+  Host benchmark of the request dispatch of ESP8266WebServer.
+
+    g++ -O2 -std=c++11 -I libraries/ESP8266WebServer/src tools/web_route_bench.cpp -o web_route_bench
+    ./web_route_bench [lookups per table, default 200000]
+
+  Tables of 5, 50 and 200 routes like those of a status/config firmware
+  (on() paths with methods, a wildcard on() for /files/ and a static directory)
+  are searched for a mix of URIs: routes taken at random, the last route,
+  and URIs no route takes. The former dispatch walks the handler list and
+  calls canHandle() with a copy of the URI for every handler, RouteTable
+  only offers the candidates of the URI. Both must pick the same handler.
+
+  The result is a JSON line per table with the nanoseconds per lookup and
+  the canHandle() calls per lookup.
+*/
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "detail/RouteTable.h"
+
+enum Method { GET, POST };
+
+static unsigned long canHandleCalls;
+
+// FunctionRequestHandler and StaticRequestHandler as far as matching goes
+struct Handler {
+  std::string uri;
+  Method method;
+  RequestRoute kind;
+
+  __attribute__((noinline)) bool canHandle(Method requestMethod, std::string requestUri) {
+    canHandleCalls++;
+    if (kind != ROUTE_PREFIX && method != requestMethod)
+      return false;
+    if (kind == ROUTE_PREFIX)
+      return requestUri.compare(0, uri.size(), uri) == 0;
+    return requestUri == uri;
+  }
+};
+
+static std::vector<Handler> routes(size_t count) {
+  static const char* groups[] = {"/api/sensor/", "/api/config/", "/status/", "/update/", "/wifi/"};
+  std::vector<Handler> handlers;
+  handlers.push_back({"/update", GET, ROUTE_EXACT});
+  handlers.push_back({"/update", POST, ROUTE_EXACT});
+  handlers.push_back({"/files/", GET, ROUTE_PREFIX});
+  for (size_t i = 0; handlers.size() < count - 1; i++) {
+    std::string uri = std::string(groups[i % 5]) + "item" + std::to_string(i);
+    handlers.push_back({uri, i % 3 ? GET : POST, ROUTE_EXACT});
+  }
+  handlers.push_back({"/static/", GET, ROUTE_PREFIX});
+  return handlers;
+}
+
+int main(int argc, char** argv) {
+  size_t lookups = argc > 1 ? atoi(argv[1]) : 200000;
+  srand(1);
+  for (size_t count : {5, 50, 200}) {
+    std::vector<Handler> handlers = routes(count);
+    RouteTable<Handler> table;
+    for (Handler& handler : handlers)
+      table.add(&handler, handler.kind, handler.uri.c_str());
+
+    std::vector<std::pair<std::string, Method>> requests;
+    for (size_t i = 0; i < 1024; i++) {
+      switch (i % 4) {
+        case 0: requests.push_back({handlers[rand() % count].uri, GET}); break;
+        case 1: requests.push_back({handlers[count - 2].uri, handlers[count - 2].method}); break;
+        case 2: requests.push_back({"/static/css/style.css", GET}); break;
+        case 3: requests.push_back({"/api/sensor/missing" + std::to_string(i), GET}); break;
+      }
+    }
+
+    for (auto& request : requests) {
+      Handler* scanned = nullptr;
+      for (Handler& handler : handlers) {
+        if (handler.canHandle(request.second, request.first)) {
+          scanned = &handler;
+          break;
+        }
+      }
+      Handler* found = table.find(request.first.c_str(), [&](Handler* handler) {
+        return handler->canHandle(request.second, request.first);
+      });
+      if (scanned != found) {
+        fprintf(stderr, "%zu routes: %s dispatched differently\n", count, request.first.c_str());
+        return 1;
+      }
+    }
+
+    canHandleCalls = 0;
+    size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      auto& request = requests[i & 1023];
+      for (Handler& handler : handlers) {
+        if (handler.canHandle(request.second, request.first)) {
+          hits++;
+          break;
+        }
+      }
+    }
+    double scanNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+    double scanCalls = (double) canHandleCalls / lookups;
+
+    canHandleCalls = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      auto& request = requests[i & 1023];
+      if (table.find(request.first.c_str(), [&](Handler* handler) {
+            return handler->canHandle(request.second, request.first);
+          }))
+        hits++;
+    }
+    double tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+    double tableCalls = (double) canHandleCalls / lookups;
+
+    printf("{\"bench\":\"routes\",\"routes\":%zu,\"scan_ns\":%.0f,\"table_ns\":%.0f,\"speedup\":%.1f,"
+           "\"scan_calls\":%.1f,\"table_calls\":%.1f,\"hits\":%zu}\n",
+           count, scanNs, tableNs, scanNs / tableNs, scanCalls, tableCalls, hits);
+  }
+  return 0;
+}
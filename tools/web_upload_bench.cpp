@@ -0,0 +1,281 @@
+/*
+  Host benchmark of the multipart upload parser of ESP8266WebServer.
+
+    g++ -O2 -std=c++11 -I libraries/ESP8266WebServer/src tools/web_upload_bench.cpp -o web_upload_bench
+    ./web_upload_bench [image size, default 393216] [runs, default 20]
+
+  The same form (a sketch.bin upload like the one of the web browser mode)
+  is parsed by the former byte-wise loop of _parseForm and by
+  MultipartReader, from a client that hands out 1460 byte segments and
+  acknowledges every read like ClientContext does (tcp_recved). Two images
+  are used: random bytes like a sketch, and one made of "\r\n-" runs that
+  keeps the byte-wise boundary check busy. Both parsers must pass the same
+  bytes to the upload handler.
+
+  The result is a JSON line per image with the time per run and the handler
+  calls of both parsers. This is the parsing only, on the board every byte
+  read also costs a tcp_recved() call of lwIP, which the web mode includes
+  in its receive_us (see "Transfer statistics" in readme.md). A body that
+  ends at the closing "--" without a CRLF must parse as well.
+*/
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static auto benchStart = std::chrono::steady_clock::now();
+
+static unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - benchStart).count();
+}
+
+static void yield() {}
+
+#include "detail/MultipartReader.h"
+
+#define HTTP_UPLOAD_BUFLEN 2048
+#define SEGMENT 1460
+
+// A connection with the body queued as segments, read() acknowledges what it consumes
+class Client {
+public:
+  Client(const std::string& data) : _data(data), _offset(0), _acked(0) {}
+
+  virtual ~Client() {}
+
+  virtual size_t available() {
+    size_t segmentEnd = (_offset / SEGMENT + 1) * SEGMENT;
+    if (segmentEnd > _data.size())
+      segmentEnd = _data.size();
+    return segmentEnd - _offset;
+  }
+
+  virtual bool connected() { return _offset < _data.size(); }
+
+  virtual int read() {
+    if (_offset == _data.size())
+      return -1;
+    int c = (uint8_t) _data[_offset];
+    _consume(1);
+    return c;
+  }
+
+  virtual size_t read(uint8_t* buf, size_t size) {
+    size_t n = _data.size() - _offset;
+    if (n > size)
+      n = size;
+    memcpy(buf, _data.data() + _offset, n);
+    _consume(n);
+    return n;
+  }
+
+  size_t readBytes(uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (n < size && connected())
+      n += read(buf + n, size - n);
+    return n;
+  }
+
+private:
+  __attribute__((noinline)) void _consume(size_t size) {
+    _offset += size;
+    _acked += size; // tcp_recved()
+  }
+
+  const std::string& _data;
+  size_t _offset;
+  size_t _acked;
+};
+
+struct Upload {
+  size_t currentSize;
+  size_t totalSize;
+  size_t calls;
+  uint32_t hash;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+// Hashes what the parser hands out on the checking run, timed runs only look at it
+static bool checking;
+
+static void handler(Upload& upload) {
+  upload.calls++;
+  if (!checking) {
+    upload.hash += upload.currentSize ? upload.buf[0] : 0;
+    return;
+  }
+  uint32_t h = upload.hash;
+  for (size_t i = 0; i < upload.currentSize; i++)
+    h = (h ^ upload.buf[i]) * 16777619u;
+  upload.hash = h;
+}
+
+static void skipLine(Client& client) {
+  int c;
+  while ((c = client.read()) != -1 && c != '\n');
+}
+
+// The file part loop of _parseForm before MultipartReader
+static void writeByte(Upload& upload, uint8_t b) {
+  if (upload.currentSize == HTTP_UPLOAD_BUFLEN) {
+    handler(upload);
+    upload.totalSize += upload.currentSize;
+    upload.currentSize = 0;
+  }
+  upload.buf[upload.currentSize++] = b;
+}
+
+static uint8_t readByte(Client& client) {
+  int res = client.read();
+  if (res == -1) {
+    while (!client.available() && client.connected())
+      yield();
+    res = client.read();
+  }
+  return (uint8_t) res;
+}
+
+static bool parseBytewise(Client& client, const std::string& boundary, Upload& upload) {
+  for (int i = 0; i < 4; i++) // boundary, disposition, type, empty line
+    skipLine(client);
+  uint8_t argByte = readByte(client);
+readfile:
+  while (argByte != 0x0D) {
+    if (!client.connected()) return false;
+    writeByte(upload, argByte);
+    argByte = readByte(client);
+  }
+  argByte = readByte(client);
+  if (argByte == 0x0A) {
+    argByte = readByte(client);
+    if ((char) argByte != '-') {
+      writeByte(upload, 0x0D);
+      writeByte(upload, 0x0A);
+      goto readfile;
+    } else {
+      argByte = readByte(client);
+      if ((char) argByte != '-') {
+        writeByte(upload, 0x0D);
+        writeByte(upload, 0x0A);
+        writeByte(upload, (uint8_t) '-');
+        goto readfile;
+      }
+    }
+    uint8_t endBuf[boundary.size() + 1];
+    client.readBytes(endBuf, boundary.size());
+    endBuf[boundary.size()] = 0;
+    if (strstr((const char*) endBuf, boundary.c_str()) != NULL) {
+      handler(upload);
+      upload.totalSize += upload.currentSize;
+      skipLine(client);
+      return true;
+    }
+    writeByte(upload, 0x0D);
+    writeByte(upload, 0x0A);
+    writeByte(upload, (uint8_t) '-');
+    writeByte(upload, (uint8_t) '-');
+    for (size_t i = 0; i < boundary.size(); i++)
+      writeByte(upload, endBuf[i]);
+    argByte = readByte(client);
+    goto readfile;
+  }
+  writeByte(upload, 0x0D);
+  goto readfile;
+}
+
+static bool parseBlocks(Client& client, const std::string& boundary, Upload& upload) {
+  MultipartReader<Client> reader(client, upload.buf, HTTP_UPLOAD_BUFLEN, boundary.c_str(), 5000);
+  const char* line;
+  size_t length;
+  bool close;
+  if (!reader.valid() || !reader.begin() || !reader.readDelimiterEnd(close) || close)
+    return false;
+  do {
+    if (!reader.readLine(line, length))
+      return false;
+  } while (length);
+  bool received = reader.readPart([&](const uint8_t*, size_t n) {
+    upload.currentSize = n;
+    handler(upload);
+    upload.totalSize += n;
+  });
+  return received && reader.readDelimiterEnd(close) && close;
+}
+
+static std::string form(const std::string& boundary, const std::string& image) {
+  return "--" + boundary + "\r\n"
+         "Content-Disposition: form-data; name=\"update\"; filename=\"sketch.bin\"\r\n"
+         "Content-Type: application/octet-stream\r\n\r\n" + image +
+         "\r\n--" + boundary + "--\r\n";
+}
+
+template<typename Parser>
+static double run(Parser parser, const std::string& body, const std::string& boundary, int runs, Upload& upload) {
+  Upload check;
+  checking = true;
+  memset(&check, 0, sizeof(check));
+  Client first(body);
+  if (!parser(first, boundary, check)) {
+    fprintf(stderr, "parse failed\n");
+    exit(1);
+  }
+  checking = false;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++) {
+    memset(&upload, 0, sizeof(upload));
+    Client client(body);
+    if (!parser(client, boundary, upload)) {
+      fprintf(stderr, "parse failed\n");
+      exit(1);
+    }
+  }
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+  upload.totalSize = check.totalSize;
+  upload.hash = check.hash;
+  return us;
+}
+
+int main(int argc, char** argv) {
+  size_t size = argc > 1 ? atoi(argv[1]) : 393216;
+  int runs = argc > 2 ? atoi(argv[2]) : 20;
+  const std::string boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+  std::string random(size, 0), dashes(size, 0);
+  srand(1);
+  for (size_t i = 0; i < size; i++) {
+    random[i] = (char) (rand() & 0xff);
+    dashes[i] = "\r\n--\r\n-"[i % 7];
+  }
+  // the byte-wise loop loses the delimiter when "\r\n--" comes shortly before it
+  for (size_t i = size > 64 ? size - 64 : 0; i < size; i++)
+    dashes[i] = 'x';
+  struct { const char* name; const std::string* image; } images[] = {{"random", &random}, {"crlf", &dashes}};
+
+  for (auto& image : images) {
+    std::string body = form(boundary, *image.image);
+    Upload byteUpload, blockUpload;
+    double bytewise = run(parseBytewise, body, boundary, runs, byteUpload);
+    double block = run(parseBlocks, body, boundary, runs, blockUpload);
+    if (byteUpload.totalSize != size || blockUpload.totalSize != size || byteUpload.hash != blockUpload.hash) {
+      fprintf(stderr, "%s: the parsers disagree (%zu/%zu bytes)\n", image.name, byteUpload.totalSize, blockUpload.totalSize);
+      return 1;
+    }
+    // the closing delimiter may end the body without its CRLF
+    Upload bare;
+    memset(&bare, 0, sizeof(bare));
+    std::string unterminated = body.substr(0, body.size() - 2);
+    Client client(unterminated);
+    checking = true;
+    if (!parseBlocks(client, boundary, bare) || bare.totalSize != size || bare.hash != byteUpload.hash) {
+      fprintf(stderr, "%s: no CRLF after the closing delimiter\n", image.name);
+      return 1;
+    }
+    printf("{\"bench\":\"multipart\",\"image\":\"%s\",\"bytes\":%zu,\"bytewise_us\":%.0f,\"block_us\":%.0f,"
+           "\"speedup\":%.1f,\"bytewise_calls\":%zu,\"block_calls\":%zu}\n",
+           image.name, size, bytewise, block, bytewise / block, byteUpload.calls, blockUpload.calls);
+  }
+  return 0;
+}